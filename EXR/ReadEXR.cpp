@@ -764,6 +764,7 @@ mDeclareReaderPluginFactory(ReadEXRPluginFactory,; , false);
 void
 ReadEXRPluginFactory::unload()
 {
+    shutdownOCIOPrewarm();
     //Kill all threads
     IlmThread::ThreadPool::globalThreadPool().setNumThreads(0);
 }
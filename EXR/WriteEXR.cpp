@@ -22,6 +22,7 @@
  */
 
 #include <memory>
+#include <stdexcept>
 #include <ImfChannelList.h>
 #include <ImfArray.h>
 #include <ImfOutputFile.h>
@@ -147,7 +148,20 @@ private:
                         const int dstNCompsStartIndex,
                         const int dstNComps,
                         const int rowBytes) OVERRIDE FINAL;
+    virtual bool prepareEncode(void* user_data,
+                               const string& filename,
+                               OfxTime time,
+                               const string& viewName,
+                               const OfxRectI& bounds,
+                               float pixelAspectRatio,
+                               int pixelDataNComps,
+                               int dstNCompsStartIndex,
+                               int dstNComps) OVERRIDE FINAL;
+    virtual void encodePrepared(void* user_data, const float* pixelData, int rowBytes) OVERRIDE FINAL;
+    virtual void* allocateEncodePlanesUserData() OVERRIDE FINAL;
+    virtual void destroyEncodePlanesUserData(void* data) OVERRIDE FINAL;
     virtual bool isImageFile(const string& fileExtension) const OVERRIDE FINAL;
+    virtual void appendEncodeSettings(double time, std::stringstream& settings) const OVERRIDE FINAL;
     virtual PreMultiplicationEnum getExpectedInputPremultiplication() const OVERRIDE FINAL { return eImagePreMultiplied; }
 
     virtual void onOutputFileChanged(const string& newFile, bool setColorSpace) OVERRIDE FINAL;
@@ -174,17 +188,65 @@ WriteEXRPlugin::~WriteEXRPlugin()
 //}
 
 
+// what encodePrepared() needs, set by prepareEncode()
+struct WriteEXREncodeData
+{
+    string filename;
+    OfxRectI bounds;
+    float pixelAspectRatio;
+    int pixelDataNComps;
+    Imf_::Compression compression;
+    int depth;
+};
+
+void*
+WriteEXRPlugin::allocateEncodePlanesUserData()
+{
+    return new WriteEXREncodeData;
+}
+
+void
+WriteEXRPlugin::destroyEncodePlanesUserData(void* data)
+{
+    assert(data);
+    delete (WriteEXREncodeData*)data;
+}
+
 void
 WriteEXRPlugin::encode(const string& filename,
-                       const OfxTime /*time*/,
-                       const string& /*viewName*/,
+                       const OfxTime time,
+                       const string& viewName,
                        const float *pixelData,
                        const OfxRectI& bounds,
                        const float pixelAspectRatio,
                        const int pixelDataNComps,
-                       const int /*dstNCompsStartIndex*/,
-                       const int /*dstNComps*/,
+                       const int dstNCompsStartIndex,
+                       const int dstNComps,
                        const int rowBytes)
+{
+    EncodePlanesLocalData_RAII data(this);
+
+    if ( !prepareEncode(data.getData(), filename, time, viewName, bounds, pixelAspectRatio, pixelDataNComps, dstNCompsStartIndex, dstNComps) ) {
+        return;
+    }
+    try {
+        encodePrepared(data.getData(), pixelData, rowBytes);
+    } catch (const std::exception& e) {
+        setPersistentMessage( Message::eMessageError, "", e.what() );
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+}
+
+bool
+WriteEXRPlugin::prepareEncode(void* user_data,
+                              const string& filename,
+                              OfxTime /*time*/,
+                              const string& /*viewName*/,
+                              const OfxRectI& bounds,
+                              float pixelAspectRatio,
+                              int pixelDataNComps,
+                              int /*dstNCompsStartIndex*/,
+                              int /*dstNComps*/)
 {
     ///FIXME: WriteEXR should not disregard dstNComps
 
@@ -192,20 +254,42 @@ WriteEXRPlugin::encode(const string& filename,
         setPersistentMessage(Message::eMessageError, "", "EXR: can only write RGBA, RGB, or Alpha components images");
         throwSuiteStatusException(kOfxStatErrFormat);
 
-        return;
+        return false;
     }
 
-    assert(pixelDataNComps);
-    try {
-        int compressionIndex;
-        _compression->getValue(compressionIndex);
+    assert(user_data);
+    WriteEXREncodeData* data = (WriteEXREncodeData*)user_data;
+    data->filename = filename;
+    data->bounds = bounds;
+    data->pixelAspectRatio = pixelAspectRatio;
+    data->pixelDataNComps = pixelDataNComps;
+
+    int compressionIndex;
+    _compression->getValue(compressionIndex);
+    data->compression = Exr::stringToCompression(Exr::compressionNames[compressionIndex]);
 
-        Imf_::Compression compression( Exr::stringToCompression(Exr::compressionNames[compressionIndex]) );
+    int depthIndex;
+    _bitDepth->getValue(depthIndex);
+    data->depth = Exr::depthNameToInt(Exr::depthNames[depthIndex]);
 
-        int depthIndex;
-        _bitDepth->getValue(depthIndex);
+    return true;
+}
+
+void
+WriteEXRPlugin::encodePrepared(void* user_data,
+                               const float* pixelData,
+                               int rowBytes)
+{
+    assert(user_data);
+    const WriteEXREncodeData* data = (const WriteEXREncodeData*)user_data;
+    const string& filename = data->filename;
+    const OfxRectI& bounds = data->bounds;
+    const float pixelAspectRatio = data->pixelAspectRatio;
+    const int pixelDataNComps = data->pixelDataNComps;
+    const Imf_::Compression compression = data->compression;
+    const int depth = data->depth;
 
-        int depth = Exr::depthNameToInt(Exr::depthNames[depthIndex]);
+    try {
         Imath::Box2i exrDataW;
 
         exrDataW.min.x = bounds.x1;
@@ -270,12 +354,17 @@ WriteEXRPlugin::encode(const string& filename,
             outputFile.writePixels(1);
         }
     } catch (const std::exception& e) {
-        setPersistentMessage( Message::eMessageError, "", string("OpenEXR error") + ": " + e.what() );
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
+        throw std::runtime_error( string("OpenEXR error") + ": " + e.what() );
     }
-} // WriteEXRPlugin::encode
+} // WriteEXRPlugin::encodePrepared
+
+void
+WriteEXRPlugin::appendEncodeSettings(double time,
+                                     std::stringstream& settings) const
+{
+    GenericWriterPlugin::appendEncodeSettings(time, settings);
+    settings << ' ' << _compression->getValueAtTime(time) << ' ' << _bitDepth->getValueAtTime(time);
+}
 
 bool
 WriteEXRPlugin::isImageFile(const string& /*fileExtension*/) const
@@ -306,6 +395,7 @@ WriteEXRPluginFactory::load()
 void
 WriteEXRPluginFactory::unload()
 {
+    shutdownOCIOPrewarm();
     //Kill all threads
     IlmThread::ThreadPool::globalThreadPool().setNumThreads(0);
 }
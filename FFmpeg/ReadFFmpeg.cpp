@@ -514,6 +514,7 @@ public:
     virtual void load() OVERRIDE FINAL;
     virtual void unload() OVERRIDE FINAL
     {
+        shutdownOCIOPrewarm();
         _manager.reset(NULL);
         _extensions.clear();
     }
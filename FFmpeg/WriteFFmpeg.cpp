@@ -5168,7 +5168,7 @@ WriteFFmpegPlugin::freeFormat()
     _isOpen = false;
 }
 
-mDeclareWriterPluginFactory(WriteFFmpegPluginFactory, {}, true);
+mDeclareWriterPluginFactory(WriteFFmpegPluginFactory, {shutdownOCIOPrewarm();}, true);
 static
 std::list<string> &
 split(const string &s,
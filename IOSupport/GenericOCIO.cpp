@@ -41,19 +41,41 @@
 
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <cstdio> // sprintf, rename, remove
 #ifdef DEBUG
-#include <cstdio>
 #define DBG(x) x
 #else
 #define DBG(x) (void)0
 #endif
 #include <string>
+#include <map>
+#include <set>
+#include <fstream>
 #include <stdexcept>
+#include <ctime>
+#include <stdint.h> // uint64_t
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(WIN64)
+#define NOMINMAX 1
+#include <windows.h> // FindFirstFileA
+#include <direct.h> // _mkdir
+#include <process.h> // _getpid
+#include <sys/utime.h>
+#else
+#include <dirent.h> // opendir
+#include <unistd.h> // getpid
+#include <utime.h>
+#endif
 #include <ofxsParam.h>
 #include <ofxsImageEffect.h>
 #include <ofxsLog.h>
 #include <ofxNatron.h>
 #include "ofxsMacros.h"
+#include "ofxsMaskMix.h"
+#include "tinythread.h"
 
 #ifdef OFX_IO_USING_OCIO
 #include <OpenColorIO/OpenColorIO.h>
@@ -267,6 +289,10 @@ GenericOCIO::GenericOCIO(ImageEffect* parent)
     , _contextKey4(NULL)
     , _contextValue4(NULL)
     , _config()
+    , _procCache(kOCIOProcessorCacheSize)
+    , _contextCacheMutex()
+    , _contextCache()
+    , _identityCache()
 #endif
 {
 #ifdef OFX_IO_USING_OCIO
@@ -318,26 +344,22 @@ GenericOCIO::GenericOCIO(ImageEffect* parent)
     inputCheck(0.);
     outputCheck(0.);
     _created = true;
+#ifdef OFX_IO_USING_OCIO
+    // so that the processor is ready for the first render
+    prewarmProcessor(0.);
+#endif
 }
 
 #ifdef OFX_IO_USING_OCIO
-#ifdef OFX_OCIO_CHOICE
-
-// ChoiceParamType may be ChoiceParamDescriptor or ChoiceParam
-template <typename ChoiceParamType>
+// compute the colorspace menu of a config (slow with large configs: use getOCIOColorSpaceMenu())
 static void
-buildChoiceMenu(OCIO::ConstConfigRcPtr config,
-                ChoiceParamType* choice,
-                bool cascading,
-                const string& name = "")
+computeColorSpaceMenu(const OCIO::ConstConfigRcPtr& config,
+                      std::vector<OCIOColorSpaceMenuItem>* items)
 {
-    //DBG(std::printf("%p->resetOptions\n", (void*)choice));
-    choice->resetOptions();
-    assert(choice->getNOptions() == 0);
+    items->clear();
     if (!config) {
         return;
     }
-    int def = -1;
     int defaultcs = config->getIndexForColorSpace(OCIO::ROLE_DEFAULT);
     int referencecs = config->getIndexForColorSpace(OCIO::ROLE_REFERENCE);
     int datacs = config->getIndexForColorSpace(OCIO::ROLE_DATA);
@@ -347,19 +369,14 @@ buildChoiceMenu(OCIO::ConstConfigRcPtr config,
     int colortimingcs = config->getIndexForColorSpace(OCIO::ROLE_COLOR_TIMING);
     int texturepaintcs = config->getIndexForColorSpace(OCIO::ROLE_TEXTURE_PAINT);
     int mattepaintcs = config->getIndexForColorSpace(OCIO::ROLE_MATTE_PAINT);
+    items->resize( config->getNumColorSpaces() );
     for (int i = 0; i < config->getNumColorSpaces(); ++i) {
-        string csname = config->getColorSpaceNameByIndex(i);
+        OCIOColorSpaceMenuItem& item = (*items)[i];
+        item.name = config->getColorSpaceNameByIndex(i);
         string msg;
-        // set the default value, in case the GUI uses it
-        if ( !name.empty() && (csname == name) ) {
-            def = i;
-        }
-        OCIO::ConstColorSpaceRcPtr cs = config->getColorSpace( csname.c_str() );
-        if (cascading) {
-            string family = config->getColorSpace( csname.c_str() )->getFamily();
-            if ( !family.empty() ) {
-                csname = family + "/" + csname;
-            }
+        OCIO::ConstColorSpaceRcPtr cs = config->getColorSpace( item.name.c_str() );
+        if (cs) {
+            item.family = cs->getFamily();
         }
         string csdesc = cs ? cs->getDescription() : "(no colorspace)";
         csdesc = whitespacify( trim(csdesc) );
@@ -426,9 +443,42 @@ buildChoiceMenu(OCIO::ConstConfigRcPtr config,
         if (roles > 0) {
             msg += ')';
         }
-        //DBG(printf("%p->appendOption(\"%s\",\"%s\") (%d->%d options)\n", (void*)choice, csname.c_str(), msg.c_str(), i, i+1));
+        item.hint = msg;
+    }
+} // computeColorSpaceMenu
+
+#ifdef OFX_OCIO_CHOICE
+
+// ChoiceParamType may be ChoiceParamDescriptor or ChoiceParam
+template <typename ChoiceParamType>
+static void
+buildChoiceMenu(OCIO::ConstConfigRcPtr config,
+                ChoiceParamType* choice,
+                bool cascading,
+                const string& name = "")
+{
+    //DBG(std::printf("%p->resetOptions\n", (void*)choice));
+    choice->resetOptions();
+    assert(choice->getNOptions() == 0);
+    if (!config) {
+        return;
+    }
+    std::vector<OCIOColorSpaceMenuItem> items;
+    getOCIOColorSpaceMenu(config, &items);
+    int def = -1;
+    for (int i = 0; i < (int)items.size(); ++i) {
+        const OCIOColorSpaceMenuItem& item = items[i];
+        // set the default value, in case the GUI uses it
+        if ( !name.empty() && (item.name == name) ) {
+            def = i;
+        }
+        string csname = item.name;
+        if ( cascading && !item.family.empty() ) {
+            csname = item.family + "/" + csname;
+        }
+        //DBG(printf("%p->appendOption(\"%s\",\"%s\") (%d->%d options)\n", (void*)choice, csname.c_str(), item.hint.c_str(), i, i+1));
         assert(choice->getNOptions() == i);
-        choice->appendOption(csname, msg);
+        choice->appendOption(csname, item.hint);
         assert(choice->getNOptions() == i + 1);
     }
     if (def != -1) {
@@ -452,7 +502,7 @@ GenericOCIO::loadConfig()
     _config.reset();
     try {
         _ocioConfigFileName = filename;
-        _config = OCIO::Config::CreateFromFile( _ocioConfigFileName.c_str() );
+        _config = getSharedOCIOConfig(_ocioConfigFileName);
     } catch (OCIO::Exception &e) {
         _ocioConfigFileName.clear();
         if (_inputSpace) {
@@ -508,70 +558,65 @@ GenericOCIO::configIsDefault() const
 }
 
 #ifdef OFX_IO_USING_OCIO
+// Returns the config context with the context variables set.
+// The contexts are interned by content (the config context and the variables), so that the same context, with the
+// same cache ID, is returned for the same variables: the processors are not rebuilt on each render, and finding the
+// processor only costs a few lookups.
 OCIO::ConstContextRcPtr
 GenericOCIO::getLocalContext(double time) const
 {
     OCIO::ConstContextRcPtr context = _config->getCurrentContext();
-    OCIO::ContextRcPtr mutableContext;
-
-    if (_contextKey1) {
-        string contextKey1;
-        _contextKey1->getValueAtTime(time, contextKey1);
-        if ( !contextKey1.empty() ) {
-            string contextValue1;
-            _contextValue1->getValueAtTime(time, contextValue1);
-
-            if (!mutableContext) {
-                mutableContext = context->createEditableCopy();
+    StringParam* const keyParams[4] = { _contextKey1, _contextKey2, _contextKey3, _contextKey4 };
+    StringParam* const valueParams[4] = { _contextValue1, _contextValue2, _contextValue3, _contextValue4 };
+    string keys[4];
+    string values[4];
+    bool hasVars = false;
+
+    for (int i = 0; i < 4; ++i) {
+        if (keyParams[i]) {
+            keyParams[i]->getValueAtTime(time, keys[i]);
+            if ( !keys[i].empty() ) {
+                valueParams[i]->getValueAtTime(time, values[i]);
+                hasVars = true;
             }
-            mutableContext->setStringVar( contextKey1.c_str(), contextValue1.c_str() );
         }
     }
-    if (_contextKey2) {
-        string contextKey2;
-        _contextKey2->getValueAtTime(time, contextKey2);
-        if ( !contextKey2.empty() ) {
-            string contextValue2;
-            _contextValue2->getValueAtTime(time, contextValue2);
+    if (!hasVars) {
+        return context;
+    }
 
-            if (!mutableContext) {
-                mutableContext = context->createEditableCopy();
-            }
-            mutableContext->setStringVar( contextKey2.c_str(), contextValue2.c_str() );
+    // the config context cache ID covers the search path, the working directory and the environment
+    string contentKey = context->getCacheID();
+    for (int i = 0; i < 4; ++i) {
+        if ( !keys[i].empty() ) {
+            contentKey += '\0';
+            contentKey += keys[i];
+            contentKey += '\0';
+            contentKey += values[i];
         }
     }
-    if (_contextKey3) {
-        string contextKey3;
-        _contextKey3->getValueAtTime(time, contextKey3);
-        if ( !contextKey3.empty() ) {
-            string contextValue3;
-            _contextValue3->getValueAtTime(time, contextValue3);
-
-            if (!mutableContext) {
-                mutableContext = context->createEditableCopy();
-            }
-            mutableContext->setStringVar( contextKey3.c_str(), contextValue3.c_str() );
+    {
+        AutoMutex guard(_contextCacheMutex);
+        std::map<string, OCIO::ConstContextRcPtr>::const_iterator it = _contextCache.find(contentKey);
+        if ( it != _contextCache.end() ) {
+            return it->second;
         }
     }
-    if (_contextKey4) {
-        string contextKey4;
-        _contextKey4->getValueAtTime(time, contextKey4);
-        if ( !contextKey4.empty() ) {
-            string contextValue4;
-            _contextValue4->getValueAtTime(time, contextValue4);
 
-            if (!mutableContext) {
-                mutableContext = context->createEditableCopy();
-            }
-            mutableContext->setStringVar( contextKey4.c_str(), contextValue4.c_str() );
+    OCIO::ContextRcPtr mutableContext = context->createEditableCopy();
+    for (int i = 0; i < 4; ++i) {
+        if ( !keys[i].empty() ) {
+            mutableContext->setStringVar( keys[i].c_str(), values[i].c_str() );
         }
     }
 
-    if (mutableContext) {
-        context = mutableContext;
+    AutoMutex guard(_contextCacheMutex);
+    if (_contextCache.size() >= kOCIOContextCacheSize) {
+        _contextCache.clear();
     }
 
-    return context;
+    // if another thread created the same context meanwhile, use the first one
+    return _contextCache.insert( std::make_pair(contentKey, OCIO::ConstContextRcPtr(mutableContext) ) ).first->second;
 } // GenericOCIO::getLocalContext
 
 #endif // ifdef OFX_IO_USING_OCIO
@@ -599,9 +644,24 @@ GenericOCIO::isIdentity(double time) const
     try {
         // maybe the names are not the same, but it's still a no-op (e.g. "scene_linear" and "linear")
         OCIO::ConstContextRcPtr context = getLocalContext(time);//_config->getCurrentContext();
-        OCIO::ConstProcessorRcPtr proc = _config->getProcessor( context, inputSpace.c_str(), outputSpace.c_str() );
+        const string key = OCIOProcessorCache::getKey(_config, context, inputSpace, outputSpace);
+        {
+            AutoMutex guard(_contextCacheMutex);
+            std::map<string, bool>::const_iterator it = _identityCache.find(key);
+            if ( it != _identityCache.end() ) {
+                return it->second;
+            }
+        }
+        OCIO::ConstProcessorRcPtr proc = getCachedProcessor(context, inputSpace, outputSpace);
+        bool isNoOp = proc->isNoOp();
+
+        AutoMutex guard(_contextCacheMutex);
+        if (_identityCache.size() >= kOCIOIdentityCacheSize) {
+            _identityCache.clear();
+        }
+        _identityCache[key] = isNoOp;
 
-        return proc->isNoOp();
+        return isNoOp;
     } catch (const std::exception& e) {
         _parent->setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
@@ -725,12 +785,7 @@ GenericOCIO::apply(double time,
 {
     assert(_created);
 #ifdef OFX_IO_USING_OCIO
-    BitDepthEnum bitDepth = img->getPixelDepth();
-    if (bitDepth != eBitDepthFloat) {
-        throw std::runtime_error("OCIO: invalid pixel depth (only float is supported)");
-    }
-
-    apply( time, renderWindow, (float*)img->getPixelData(), img->getBounds(), img->getPixelComponents(), img->getPixelComponentCount(), img->getRowBytes() );
+    apply( time, renderWindow, img->getPixelData(), img->getBounds(), img->getPixelComponents(), img->getPixelComponentCount(), img->getPixelDepth(), img->getRowBytes() );
 #endif
 }
 
@@ -754,204 +809,2102 @@ GenericOCIO::setValues(const OCIO::ConstContextRcPtr &context,
                        const string& inputSpace,
                        const string& outputSpace)
 {
-    AutoMutex guard(_procMutex);
+    {
+        AutoMutex guard(_procMutex);
 
-    if ( !_proc ||
-         ( context != _procContext) ||
-         ( inputSpace != _procInputSpace) ||
-         ( outputSpace != _procOutputSpace) ) {
-        _procContext = context;
-        _procInputSpace = inputSpace;
-        _procOutputSpace = outputSpace;
-        _proc = _config->getProcessor( context, inputSpace.c_str(), outputSpace.c_str() );
+        if ( _proc &&
+             ( context == _procContext) &&
+             ( inputSpace == _procInputSpace) &&
+             ( outputSpace == _procOutputSpace) ) {
+            return;
+        }
     }
+    // the processor may have to be created: do not hold the lock meanwhile
+    OCIO::ConstProcessorRcPtr proc = getCachedProcessor(context, inputSpace, outputSpace);
+
+    AutoMutex guard(_procMutex);
+    _procContext = context;
+    _procInputSpace = inputSpace;
+    _procOutputSpace = outputSpace;
+    _proc = proc;
 }
 
-void
-OCIOProcessor::multiThreadProcessImages(OfxRectI renderWindow)
+// creates the processor of a colorspace conversion
+class ColorSpaceProcessorBuilder
+    : public OCIOProcessorBuilder
 {
-    assert(_dstBounds.x1 <= renderWindow.x1 && renderWindow.x1 <= renderWindow.x2 && renderWindow.x2 <= _dstBounds.x2);
-    assert(_dstBounds.y1 <= renderWindow.y1 && renderWindow.y1 <= renderWindow.y2 && renderWindow.y2 <= _dstBounds.y2);
-    // Ensure there are pixels to render otherwise OCIO::PackedImageDesc will throw an exception.
-    if ( (renderWindow.y2 <= renderWindow.y1) || (renderWindow.x2 <= renderWindow.x1) ) {
-        return;
+public:
+    ColorSpaceProcessorBuilder(const OCIO::ConstConfigRcPtr& config,
+                               const OCIO::ConstContextRcPtr& context,
+                               const string& inputSpace,
+                               const string& outputSpace)
+        : _config(config)
+        , _context(context)
+        , _inputSpace(inputSpace)
+        , _outputSpace(outputSpace)
+    {
     }
-#ifdef OFX_IO_USING_OCIO
-    if (!_proc) {
-        throw std::logic_error("OCIO configuration not loaded");
+
+    virtual OCIO::ConstProcessorRcPtr build() const OVERRIDE FINAL
+    {
+        return _config->getProcessor( _context, _inputSpace.c_str(), _outputSpace.c_str() );
     }
-    int numChannels;
-    int pixelBytes;
-    switch (_dstPixelComponents) {
-    case ePixelComponentRGBA:
-        numChannels = 4;
-        break;
-    case ePixelComponentRGB:
-        numChannels = 3;
-        break;
-    //case ePixelComponentAlpha: pixelBytes = 1; break;
-    default:
-        throwSuiteStatusException(kOfxStatErrFormat);
 
-        return;
+private:
+    OCIO::ConstConfigRcPtr _config;
+    OCIO::ConstContextRcPtr _context;
+    string _inputSpace;
+    string _outputSpace;
+};
+
+// get the processor from the instance cache, then from the shared cache, or create it
+// (or wait for it, if it is being created in the background)
+OCIO::ConstProcessorRcPtr
+GenericOCIO::getCachedProcessor(const OCIO::ConstContextRcPtr &context,
+                                const string& inputSpace,
+                                const string& outputSpace) const
+{
+    const string key = OCIOProcessorCache::getKey(_config, context, inputSpace, outputSpace);
+    OCIO::ConstProcessorRcPtr proc = _procCache.get(key);
+
+    if (proc) {
+        return proc;
     }
+#ifdef OFX_OCIO_SHARED_PROCESSOR_CACHE
+    proc = getSharedOCIOProcessorCache().get(key);
+    if (proc) {
+        _procCache.insert(key, proc);
 
-    pixelBytes = numChannels * sizeof(float);
-    size_t pixelDataOffset = (size_t)(renderWindow.y1 - _dstBounds.y1) * _dstRowBytes + (size_t)(renderWindow.x1 - _dstBounds.x1) * pixelBytes;
-    float *pix = (float *) ( ( (char *) _dstPixelData ) + pixelDataOffset ); // (char*)dstImg->getPixelAddress(renderWindow.x1, renderWindow.y1);
-    try {
-        if (_proc) {
-            OCIO::PackedImageDesc img(pix, renderWindow.x2 - renderWindow.x1, renderWindow.y2 - renderWindow.y1, numChannels, sizeof(float), pixelBytes, _dstRowBytes);
-            _proc->apply(img);
-        }
-    } catch (OCIO::Exception &e) {
-        _instance->setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
-        throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
+        return proc;
     }
 #endif
+    proc = getOCIOProcessor( key, ColorSpaceProcessorBuilder(_config, context, inputSpace, outputSpace) );
+    _procCache.insert(key, proc);
+#ifdef OFX_OCIO_SHARED_PROCESSOR_CACHE
+    getSharedOCIOProcessorCache().insert(key, proc);
+#endif
+
+    return proc;
 }
 
-#endif // OFX_IO_USING_OCIO
+OCIOProcessorCache::OCIOProcessorCache(std::size_t maxSize)
+    : _mutex()
+    , _entries()
+    , _maxSize(maxSize)
+{
+}
 
-#ifdef OFX_IO_USING_OCIO
 OCIO::ConstProcessorRcPtr
-GenericOCIO::getOrCreateProcessor(double time)
+OCIOProcessorCache::get(const string& key)
 {
-    if (!_config) {
-        return OCIO::ConstProcessorRcPtr();
+    AutoMutex guard(_mutex);
+
+    for (EntryList::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->first == key) {
+            // move it to the front
+            _entries.splice(_entries.begin(), _entries, it);
+
+            return _entries.front().second;
+        }
     }
-    string inputSpace;
-    getInputColorspaceAtTime(time, inputSpace);
-    string outputSpace;
-    getOutputColorspaceAtTime(time, outputSpace);
-    OCIO::ConstContextRcPtr context = getLocalContext(time);//_config->getCurrentContext();
-    setValues(context, inputSpace, outputSpace);
 
-    return getProcessor();
+    return OCIO::ConstProcessorRcPtr();
 }
 
-#endif // OFX_IO_USING_OCIO
-
 void
-GenericOCIO::apply(double time,
-                   const OfxRectI& renderWindow,
-                   float *pixelData,
-                   const OfxRectI& bounds,
-                   PixelComponentEnum pixelComponents,
-                   int pixelComponentCount,
-                   int rowBytes)
+OCIOProcessorCache::insert(const string& key,
+                           const OCIO::ConstProcessorRcPtr& proc)
 {
-    assert(_created);
-#ifdef OFX_IO_USING_OCIO
-
-    if (!_created) {
-        return;
-    }
+    AutoMutex guard(_mutex);
 
-    if ( isIdentity(time) ) {
-        return;
-    }
-    // are we in the image bounds
-    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
-         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
-        _parent->setPersistentMessage(Message::eMessageError, "", "OCIO: render window outside of image bounds");
-        throwSuiteStatusException(kOfxStatFailed);
+    for (EntryList::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->first == key) {
+            _entries.erase(it);
+            break;
+        }
     }
-    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
-        _parent->setPersistentMessage(Message::eMessageError, "", "OCIO: invalid components (only RGB and RGBA are supported)");
-        throwSuiteStatusException(kOfxStatFailed);
+    _entries.push_front( std::make_pair(key, proc) );
+    while (_entries.size() > _maxSize) {
+        _entries.pop_back();
     }
+}
 
-    OCIO::ConstProcessorRcPtr proc = getOrCreateProcessor(time);
-    if (!proc) {
-        _parent->setPersistentMessage( Message::eMessageError, "", "Cannot create OCIO processor" );
-        throwSuiteStatusException(kOfxStatFailed);
+void
+OCIOProcessorCache::clear()
+{
+    AutoMutex guard(_mutex);
 
-        return;
+    _entries.clear();
+}
+
+void
+OCIOProcessorCache::eraseFile(const string& filename)
+{
+    const string line = '\n' + filename + '\n';
+    AutoMutex guard(_mutex);
+
+    for (EntryList::iterator it = _entries.begin(); it != _entries.end();) {
+        if (it->first.find(line) != string::npos) {
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
     }
+}
 
-    OCIOProcessor processor(*_parent);
-    // set the images
-    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
+string
+OCIOProcessorCache::getKey(const OCIO::ConstConfigRcPtr& config,
+                           const OCIO::ConstContextRcPtr& context,
+                           const string& inputSpace,
+                           const string& outputSpace)
+{
+    // the config cache ID depends on the context variables used to resolve its files
+    string key = config->getCacheID(context);
 
-    processor.setProcessor(proc);
+    key += '\n';
+    key += context->getCacheID();
+    key += '\n';
+    key += inputSpace;
+    key += '\n';
+    key += outputSpace;
 
-    // set the render window
-    processor.setRenderWindow(renderWindow);
+    return key;
+}
 
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-#endif
+#ifdef OFX_OCIO_SHARED_PROCESSOR_CACHE
+static OCIOProcessorCache gSharedProcessorCache(kOCIOSharedProcessorCacheSize);
+
+OCIOProcessorCache&
+getSharedOCIOProcessorCache()
+{
+    return gSharedProcessorCache;
 }
 
-void
-GenericOCIO::changedParam(const InstanceChangedArgs &args,
-                          const string &paramName)
+#endif
+
+// Creates the processors requested by prewarmOCIOProcessor() on up to kOCIOPrewarmThreads threads.
+// The threads are started on demand and are joined by shutdown(), which the plugins call from their unload action:
+// they must not be left running plugin code once the binary is unloaded, and they cannot be joined safely from a
+// static destructor (on Windows, this runs under the loader lock, which exiting threads also need).
+class OCIOPrewarmPool
 {
-    assert(_created);
-#ifdef OFX_IO_USING_OCIO
-    if ( (paramName == kOCIOParamConfigFile) && (args.reason != eChangeTime) ) {
-        // must clear persistent message, or render() is not called by Nuke after an error
-        _parent->clearPersistentMessage();
-        // compute canonical inputSpace and outputSpace before changing the config,
-        // if different from inputSpace and outputSpace they must be set to the canonical value after changing ocio config
-        string inputSpace;
-        getInputColorspaceAtTime(args.time, inputSpace);
-        string inputSpaceCanonical = canonicalizeColorSpace(_config, inputSpace);
-        if (inputSpaceCanonical != inputSpace) {
-            _inputSpace->setValue(inputSpaceCanonical);
+public:
+    OCIOPrewarmPool()
+        : _mutex()
+        , _jobAdded()
+        , _jobDone()
+        , _jobs()
+        , _inFlight()
+        , _done(kOCIOPrewarmCacheSize)
+        , _threads()
+        , _nIdle(0)
+        , _shutdowns(0)
+    {
+    }
+
+    // a fallback for hosts which do not call the unload action: the threads are normally joined already
+    ~OCIOPrewarmPool()
+    {
+        shutdown();
+    }
+
+    void push(const string& key,
+              OCIOProcessorBuilder* builder)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        if ( (_shutdowns > 0) || isPending(key) || _done.get(key) ) {
+            delete builder;
+
+            return;
         }
-        if (_outputSpace) {
-            string outputSpace;
-            getOutputColorspaceAtTime(args.time, outputSpace);
-            string outputSpaceCanonical = canonicalizeColorSpace(_config, outputSpace);
-            if (outputSpaceCanonical != outputSpace) {
-                _outputSpace->setValue(outputSpaceCanonical);
+        _jobs.push_back( std::make_pair(key, builder) );
+        if (_nIdle > 0) {
+            _jobAdded.notify_one();
+        } else if ( (int)_threads.size() < kOCIOPrewarmThreads ) {
+            // it waits for the mutex before taking the job
+            _threads.push_back( new tthread::thread(&OCIOPrewarmPool::threadFunction, this) );
+        }
+        // else a running thread will take it
+    }
+
+    // pending jobs are discarded, the running ones are finished, and all threads are joined.
+    // Threads are started again by the next push().
+    void shutdown()
+    {
+        std::vector<tthread::thread*> threads;
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            for (JobList::iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+                delete it->second;
             }
+            _jobs.clear();
+            ++_shutdowns;
+            threads.swap(_threads);
+        }
+        _jobAdded.notify_all();
+        for (std::size_t i = 0; i < threads.size(); ++i) {
+            threads[i]->join();
+            delete threads[i];
         }
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            --_shutdowns;
+        }
+    }
 
-        loadConfig(); // re-load the new OCIO config
-        //if inputspace or outputspace are not valid in the new config, reset them to "default"
-        if (_config) {
-            string inputSpaceName;
-            getInputColorspaceAtTime(args.time, inputSpaceName);
-            int inputSpaceIndex = _config->getIndexForColorSpace( inputSpaceName.c_str() );
-            if (inputSpaceIndex < 0) {
-                OCIO::ConstColorSpaceRcPtr cs;
-                if (!cs) {
-                    cs = _config->getColorSpace(OCIO::ROLE_DEFAULT);
-                }
-                if (!cs) {
-                    // no default colorspace, fallback to the first one
-                    cs = _config->getColorSpace( _config->getColorSpaceNameByIndex(0) );
+    OCIO::ConstProcessorRcPtr get(const string& key,
+                                  const OCIOProcessorBuilder& builder)
+    {
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            // a job which has not started yet is run by the calling thread
+            for (JobList::iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+                if (it->first == key) {
+                    delete it->second;
+                    _jobs.erase(it);
+                    break;
                 }
-                inputSpaceName = cs ? cs->getName() : OCIO::ROLE_DEFAULT;
-                _inputSpace->setValue(inputSpaceName);
             }
+            while ( _inFlight.find(key) != _inFlight.end() ) {
+                _jobDone.wait(_mutex);
+            }
+            OCIO::ConstProcessorRcPtr proc = _done.get(key);
+            if (proc) {
+                return proc;
+            }
+            _inFlight.insert(key);
         }
-        inputCheck(args.time);
-        if (_config && _outputSpace) {
-            string outputSpaceName;
-            getOutputColorspaceAtTime(args.time, outputSpaceName);
-            int outputSpaceIndex = _config->getIndexForColorSpace( outputSpaceName.c_str() );
-            if (outputSpaceIndex < 0) {
-                OCIO::ConstColorSpaceRcPtr cs;
-                if (!cs) {
-                    cs = _config->getColorSpace(OCIO::ROLE_DEFAULT);
-                }
-                if (!cs) {
-                    // no default colorspace, fallback to the first one
-                    cs = _config->getColorSpace( _config->getColorSpaceNameByIndex(0) );
-                }
-                outputSpaceName = cs ? cs->getName() : OCIO::ROLE_DEFAULT;
-                _outputSpace->setValue(OCIO::ROLE_DEFAULT);
+        OCIO::ConstProcessorRcPtr proc;
+        try {
+            proc = builder.build();
+        } catch (...) {
+            {
+                tthread::lock_guard<tthread::mutex> guard(_mutex);
+                _inFlight.erase(key);
             }
+            _jobDone.notify_all();
+            throw;
         }
-        outputCheck(args.time);
+        finish(key, proc);
 
-        if ( !_config && (args.reason == eChangeUserEdit) ) {
-            string filename;
-            _ocioConfigFile->getValue(filename);
+        return proc;
+    }
+
+    void clear()
+    {
+        _done.clear();
+    }
+
+    void eraseFile(const string& filename)
+    {
+        _done.eraseFile(filename);
+    }
+
+private:
+    typedef std::list<std::pair<string, OCIOProcessorBuilder*> > JobList;
+
+    // must be called with _mutex locked
+    bool isPending(const string& key) const
+    {
+        if ( _inFlight.find(key) != _inFlight.end() ) {
+            return true;
+        }
+        for (JobList::const_iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+            if (it->first == key) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void finish(const string& key,
+                const OCIO::ConstProcessorRcPtr& proc)
+    {
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            if (proc) {
+                _done.insert(key, proc);
+            }
+            _inFlight.erase(key);
+        }
+        _jobDone.notify_all();
+    }
+
+    static void threadFunction(void* arg)
+    {
+        ( (OCIOPrewarmPool*)arg )->run();
+    }
+
+    void run()
+    {
+        for (;;) {
+            string key;
+            OCIOProcessorBuilder* builder = NULL;
+            {
+                tthread::lock_guard<tthread::mutex> guard(_mutex);
+                while ( _jobs.empty() && (_shutdowns == 0) ) {
+                    ++_nIdle;
+                    _jobAdded.wait(_mutex);
+                    --_nIdle;
+                }
+                if (_shutdowns > 0) {
+                    return;
+                }
+                key = _jobs.front().first;
+                builder = _jobs.front().second;
+                _jobs.pop_front();
+                _inFlight.insert(key);
+            }
+            OCIO::ConstProcessorRcPtr proc;
+            try {
+                DBG(std::clock_t start = std::clock());
+                proc = builder->build();
+                DBG( std::printf( "OCIOPrewarmPool: processor created in %gs\n", (double)(std::clock() - start) / CLOCKS_PER_SEC ) );
+            } catch (const std::exception& e) {
+                DBG( std::printf( "OCIOPrewarmPool: %s\n", e.what() ) );
+            } catch (...) {
+            }
+            delete builder;
+            finish(key, proc);
+        }
+    }
+
+    tthread::mutex _mutex; // protects everything below
+    tthread::condition_variable _jobAdded;
+    tthread::condition_variable _jobDone;
+    JobList _jobs;
+    std::set<string> _inFlight; // keys of the processors being created
+    OCIOProcessorCache _done; // the processors created recently
+    std::vector<tthread::thread*> _threads;
+    int _nIdle; // threads waiting for a job
+    int _shutdowns; // number of shutdown() calls in progress: no job is accepted or started meanwhile
+};
+
+static OCIOPrewarmPool gPrewarmPool;
+
+void
+prewarmOCIOProcessor(const string& key,
+                     OCIOProcessorBuilder* builder)
+{
+    gPrewarmPool.push(key, builder);
+}
+
+OCIO::ConstProcessorRcPtr
+getOCIOProcessor(const string& key,
+                 const OCIOProcessorBuilder& builder)
+{
+    return gPrewarmPool.get(key, builder);
+}
+
+void
+clearPrewarmedOCIOProcessors()
+{
+    gPrewarmPool.clear();
+}
+
+// the state of a file, used to detect changes
+struct OCIOFileState
+{
+    std::time_t mtime;
+    long size;
+    bool racy; // modified during the second it was read: a later edit in that second would keep the same state
+
+    OCIOFileState()
+        : mtime(0)
+        , size(0)
+        , racy(false)
+    {
+    }
+
+    // a racy state cannot prove that the file is unchanged
+    bool operator==(const OCIOFileState& other) const
+    {
+        return !racy && !other.racy && mtime == other.mtime && size == other.size;
+    }
+
+    bool operator!=(const OCIOFileState& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+static bool
+getOCIOFileState(const string& filename,
+                 OCIOFileState* state)
+{
+#if defined(_WIN32) || defined(WIN64)
+    struct _stat sb;
+    if (_stat(filename.c_str(), &sb) != 0) {
+        return false;
+    }
+#else
+    struct stat sb;
+    if (stat(filename.c_str(), &sb) != 0) {
+        return false;
+    }
+#endif
+    state->mtime = sb.st_mtime;
+    state->size = (long)sb.st_size;
+    state->racy = ( sb.st_mtime >= std::time(NULL) );
+
+    return true;
+}
+
+// a parsed config, with its colorspace menu
+struct OCIOConfigEntry
+{
+    OCIOFileState state;
+    OCIO::ConstConfigRcPtr config;
+    bool menuValid;
+    std::vector<OCIOColorSpaceMenuItem> menu;
+
+    OCIOConfigEntry()
+        : state()
+        , config()
+        , menuValid(false)
+        , menu()
+    {
+    }
+};
+
+typedef std::map<string, OCIOConfigEntry> OCIOConfigMap;
+typedef std::map<string, OCIOFileState> OCIOFileStateMap;
+
+typedef tthread::fast_mutex RegistryMutex;
+typedef OFX::MultiThread::AutoMutexT<tthread::fast_mutex> RegistryAutoMutex;
+
+static RegistryMutex gConfigRegistryMutex; // protects gConfigRegistry, gFileStates and gRacyStampCount
+static OCIOConfigMap gConfigRegistry;
+static OCIOFileStateMap gFileStates;
+static unsigned long gRacyStampCount = 0; // makes the stamps of racy file states unique
+
+OCIO::ConstConfigRcPtr
+getSharedOCIOConfig(const string& filename)
+{
+    OCIOFileState state;
+
+    if ( !getOCIOFileState(filename, &state) ) {
+        // let OCIO report the error, don't cache anything
+        return OCIO::Config::CreateFromFile( filename.c_str() );
+    }
+    {
+        RegistryAutoMutex guard(gConfigRegistryMutex);
+        OCIOConfigMap::const_iterator it = gConfigRegistry.find(filename);
+        if ( ( it != gConfigRegistry.end() ) && (it->second.state == state) ) {
+            return it->second.config;
+        }
+    }
+    // parsing may take a while: do it without holding the lock
+    DBG(std::printf("getSharedOCIOConfig: parsing %s\n", filename.c_str()));
+    OCIO::ConstConfigRcPtr config = OCIO::Config::CreateFromFile( filename.c_str() );
+    {
+        RegistryAutoMutex guard(gConfigRegistryMutex);
+        OCIOConfigMap::iterator it = gConfigRegistry.find(filename);
+        if ( ( it != gConfigRegistry.end() ) && (it->second.state == state) ) {
+            // another thread parsed the same file in the meantime
+            return it->second.config;
+        }
+        OCIOConfigEntry& entry = gConfigRegistry[filename];
+        entry.state = state;
+        entry.config = config;
+        entry.menuValid = false;
+        entry.menu.clear();
+    }
+
+    return config;
+}
+
+void
+getOCIOColorSpaceMenu(const OCIO::ConstConfigRcPtr& config,
+                      std::vector<OCIOColorSpaceMenuItem>* items)
+{
+    if (!config) {
+        items->clear();
+
+        return;
+    }
+    {
+        RegistryAutoMutex guard(gConfigRegistryMutex);
+        for (OCIOConfigMap::const_iterator it = gConfigRegistry.begin(); it != gConfigRegistry.end(); ++it) {
+            if ( (it->second.config == config) && it->second.menuValid ) {
+                *items = it->second.menu;
+
+                return;
+            }
+        }
+    }
+    computeColorSpaceMenu(config, items);
+    {
+        RegistryAutoMutex guard(gConfigRegistryMutex);
+        for (OCIOConfigMap::iterator it = gConfigRegistry.begin(); it != gConfigRegistry.end(); ++it) {
+            if (it->second.config == config) {
+                it->second.menu = *items;
+                it->second.menuValid = true;
+                break;
+            }
+        }
+    }
+}
+
+void
+setOCIOFileLoaded(const string& filename)
+{
+    OCIOFileState state;
+
+    if ( !getOCIOFileState(filename, &state) ) {
+        return;
+    }
+    RegistryAutoMutex guard(gConfigRegistryMutex);
+    // OCIO keeps the version it parsed first until its caches are cleared
+    gFileStates.insert( std::make_pair(filename, state) );
+}
+
+void
+clearOCIOFileCaches()
+{
+    OCIO::ClearAllCaches();
+    RegistryAutoMutex guard(gConfigRegistryMutex);
+    gFileStates.clear();
+}
+
+void
+clearOCIOFileCaches(const string& filename)
+{
+#ifdef OFX_OCIO_SHARED_PROCESSOR_CACHE
+    gSharedProcessorCache.eraseFile(filename);
+#endif
+    gPrewarmPool.eraseFile(filename);
+    bool parsed;
+    {
+        RegistryAutoMutex guard(gConfigRegistryMutex);
+        parsed = gFileStates.erase(filename) > 0;
+    }
+    // OCIO keeps the files it parsed keyed by path only, and cannot forget a single one: clearing all of them is the
+    // only way to make it read this file again. The processors which were already created keep their own data, only
+    // the other files are parsed again when they are next used.
+    if (parsed) {
+        clearOCIOFileCaches();
+    }
+}
+
+bool
+ocioFileOutdated(const string& filename)
+{
+    OCIOFileState state;
+    bool exists = getOCIOFileState(filename, &state);
+    RegistryAutoMutex guard(gConfigRegistryMutex);
+    OCIOFileStateMap::const_iterator it = gFileStates.find(filename);
+
+    return ( it != gFileStates.end() ) && ( !exists || (it->second != state) );
+}
+
+OCIOBakedLut::OCIOBakedLut()
+    : _log(false)
+    , _min(0.f)
+    , _max(1.f)
+    , _offset(0.f)
+    , _is3D(false)
+    , _size(0)
+    , _lut()
+    , _maxError(-1.)
+    , _speedup(-1.)
+{
+}
+
+inline float
+OCIOBakedLut::shape(float x) const
+{
+    float t;
+
+    if (_log) {
+        x += _offset;
+        if ( !(x > 0.f) ) {
+            return 0.f;
+        }
+        t = ( (float)(std::log(x) * 1.4426950408889634) /* log2(x) */ - _min ) / (_max - _min);
+    } else {
+        t = (x - _min) / (_max - _min);
+    }
+    // also catches NaNs
+    if ( !(t > 0.f) ) {
+        return 0.f;
+    }
+
+    return (t < 1.f) ? t : 1.f;
+}
+
+inline float
+OCIOBakedLut::unshape(float t) const
+{
+    float x = _min + t * (_max - _min);
+
+    if (_log) {
+        return (float)std::pow(2., (double)x) - _offset;
+    }
+
+    return x;
+}
+
+inline void
+OCIOBakedLut::applyPixel(const float* in,
+                         float* out) const
+{
+    const int last = _size - 1;
+
+    if (!_is3D) {
+        for (int c = 0; c < 3; ++c) {
+            float t = shape(in[c]) * last;
+            int i = (int)t;
+            if (i >= last) {
+                i = last - 1;
+            }
+            float f = t - i;
+            const float* v = &_lut[i * 3 + c];
+            out[c] = v[0] + f * (v[3] - v[0]);
+        }
+
+        return;
+    }
+
+    float tr = shape(in[0]) * last;
+    float tg = shape(in[1]) * last;
+    float tb = shape(in[2]) * last;
+    int ir = std::min( (int)tr, last - 1 );
+    int ig = std::min( (int)tg, last - 1 );
+    int ib = std::min( (int)tb, last - 1 );
+    float fr = tr - ir;
+    float fg = tg - ig;
+    float fb = tb - ib;
+    // offsets of the neighbouring nodes in each direction
+    const int dr = 3;
+    const int dg = 3 * _size;
+    const int db = 3 * _size * _size;
+    const float* c000 = &_lut[ib * db + ig * dg + ir * dr];
+    const float* c111 = c000 + dr + dg + db;
+    // tetrahedral interpolation: walk from c000 to c111 along the edges, in decreasing fraction order
+    const float* a;
+    const float* b;
+    float f1, f2, f3;
+    if (fr >= fg) {
+        if (fg >= fb) {
+            a = c000 + dr; b = a + dg; f1 = fr; f2 = fg; f3 = fb;
+        } else if (fr >= fb) {
+            a = c000 + dr; b = a + db; f1 = fr; f2 = fb; f3 = fg;
+        } else {
+            a = c000 + db; b = a + dr; f1 = fb; f2 = fr; f3 = fg;
+        }
+    } else {
+        if (fb >= fg) {
+            a = c000 + db; b = a + dg; f1 = fb; f2 = fg; f3 = fr;
+        } else if (fb >= fr) {
+            a = c000 + dg; b = a + db; f1 = fg; f2 = fb; f3 = fr;
+        } else {
+            a = c000 + dg; b = a + dr; f1 = fg; f2 = fr; f3 = fb;
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        out[c] = c000[c] + f1 * (a[c] - c000[c]) + f2 * (b[c] - a[c]) + f3 * (c111[c] - b[c]);
+    }
+} // OCIOBakedLut::applyPixel
+
+void
+OCIOBakedLut::apply(float* pixelData,
+                    int width,
+                    int height,
+                    int numChannels,
+                    std::size_t rowBytes) const
+{
+    assert(_size >= 2);
+    for (int y = 0; y < height; ++y) {
+        float* pix = (float*)( (char*)pixelData + y * rowBytes );
+        for (int x = 0; x < width; ++x, pix += numChannels) {
+            float rgb[3];
+            applyPixel(pix, rgb);
+            pix[0] = rgb[0];
+            pix[1] = rgb[1];
+            pix[2] = rgb[2];
+        }
+    }
+}
+
+void
+OCIOBakedLut::bakeLut(const OCIO::ConstProcessorRcPtr& proc,
+                      bool is3D,
+                      int size)
+{
+    _is3D = is3D;
+    _size = size;
+    int n = is3D ? size * size * size : size;
+    _lut.resize(3 * n);
+    std::vector<float> shaped(size);
+    for (int i = 0; i < size; ++i) {
+        shaped[i] = unshape( (float)i / (size - 1) );
+    }
+    float* p = &_lut[0];
+    if (is3D) {
+        for (int b = 0; b < size; ++b) {
+            for (int g = 0; g < size; ++g) {
+                for (int r = 0; r < size; ++r, p += 3) {
+                    p[0] = shaped[r];
+                    p[1] = shaped[g];
+                    p[2] = shaped[b];
+                }
+            }
+        }
+    } else {
+        for (int i = 0; i < size; ++i, p += 3) {
+            p[0] = p[1] = p[2] = shaped[i];
+        }
+    }
+    // one row per blue slice, to keep the image dimensions reasonable
+    OCIO::PackedImageDesc img(&_lut[0], is3D ? size * size : size, is3D ? size : 1, 3);
+    proc->apply(img);
+}
+
+// the largest error, relative to max(1,|value|), of the baked LUT on points which are not on the LUT nodes,
+// and on points outside of the shaper range, where the baked LUT clamps its input: if the processor does not
+// saturate there (e.g. HDR or negative values through a matrix or a log curve), the LUT must not be used.
+// Alpha varies across the points, so that processors which use or modify alpha are detected.
+// speedup is set to the time taken by the processor on these points over the time taken by the LUT.
+double
+OCIOBakedLut::getMaxError(const OCIO::ConstProcessorRcPtr& proc,
+                          double* speedup) const
+{
+    const int n = 16;
+    const float lo = unshape(0.f);
+    const float hi = unshape(1.f);
+    const float span = hi - lo;
+    // below and above the shaper range, near it and far from it
+    const float outside[] = {
+        lo - 0.01f * span - 0.01f, lo - span - 1.f,
+        hi + 0.01f * span + 0.01f, hi + span + 1.f, hi + 16.f * (span + 1.f)
+    };
+    const int nOutside = (int)( sizeof(outside) / sizeof(outside[0]) );
+    const float inside[] = { unshape(0.25f), unshape(0.75f) };
+    // each outside value on one channel, with the other channels inside, plus the neutral outside values
+    const int nOutsidePoints = nOutside * (3 * 2 * 2 + 1);
+    const int width = n * n;
+    const int height = n + (nOutsidePoints + width - 1) / width;
+    std::vector<float> exact(4 * width * height, 0.f);
+    float* p = &exact[0];
+
+    for (int b = 0; b < n; ++b) {
+        for (int g = 0; g < n; ++g) {
+            for (int r = 0; r < n; ++r, p += 4) {
+                p[0] = unshape( (r + 0.3183f) / n );
+                p[1] = unshape( (g + 0.3183f) / n );
+                p[2] = unshape( (b + 0.3183f) / n );
+                p[3] = ( (r + g + b) % 3 ) * 0.5f;
+            }
+        }
+    }
+    for (int i = 0; i < nOutside; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            for (int j = 0; j < 4; ++j, p += 4) {
+                p[c] = outside[i];
+                p[(c + 1) % 3] = inside[j & 1];
+                p[(c + 2) % 3] = inside[j >> 1];
+                p[3] = (j % 3) * 0.5f;
+            }
+        }
+        p[0] = p[1] = p[2] = outside[i];
+        p[3] = 1.f;
+        p += 4;
+    }
+    // the remaining pixels of the last row are black, and are checked too
+    std::vector<float> baked(exact);
+    std::clock_t start = std::clock();
+    OCIO::PackedImageDesc img(&exact[0], width, height, 4);
+    proc->apply(img);
+    std::clock_t exactEnd = std::clock();
+    apply(&baked[0], width, height, 4, width * 4 * sizeof(float));
+    std::clock_t bakedEnd = std::clock();
+    *speedup = (double)(exactEnd - start) / std::max( (double)(bakedEnd - exactEnd), 1. );
+    double maxError = 0.;
+    for (std::size_t i = 0; i < exact.size(); ++i) {
+        double e = std::fabs( (double)exact[i] - baked[i] ) / std::max( 1., std::fabs( (double)exact[i] ) );
+        // also catches NaNs
+        if ( !(e <= maxError) ) {
+            maxError = e;
+        }
+    }
+
+    return maxError;
+}
+
+bool
+OCIOBakedLut::bake(const OCIO::ConstProcessorRcPtr& proc,
+                   const OCIO::ConstConfigRcPtr& config,
+                   const string& inputSpace)
+{
+    _log = false;
+    _min = 0.f;
+    _max = 1.f;
+    _offset = 0.f;
+    if ( config && !inputSpace.empty() ) {
+        OCIO::ConstColorSpaceRcPtr cs = config->getColorSpace( inputSpace.c_str() );
+        if (cs) {
+            float vars[3] = { 0.f, 1.f, 0.f };
+            int nVars = std::min(cs->getAllocationNumVars(), 3);
+            if (nVars > 0) {
+                cs->getAllocationVars(vars);
+            }
+            _log = (cs->getAllocation() == OCIO::ALLOCATION_LG2);
+            if (nVars >= 2) {
+                _min = vars[0];
+                _max = vars[1];
+            } else if (_log) {
+                // the OCIO defaults for a log2 allocation
+                _min = -10.f;
+                _max = 6.f;
+            }
+            if (nVars >= 3) {
+                _offset = vars[2];
+            }
+        }
+    }
+    if ( !(_max > _min) ) {
+        return false;
+    }
+    if ( !proc->hasChannelCrosstalk() ) {
+        bakeLut(proc, false, kOCIOBakedLut1DSize);
+        _maxError = getMaxError(proc, &_speedup);
+        if (_maxError <= kOCIOBakedLutTolerance) {
+            return true;
+        }
+    }
+    bakeLut(proc, true, kOCIOBakedLut3DSizeMin);
+    _maxError = getMaxError(proc, &_speedup);
+    if (_maxError <= kOCIOBakedLutTolerance) {
+        return true;
+    }
+    bakeLut(proc, true, kOCIOBakedLut3DSizeMax);
+    _maxError = getMaxError(proc, &_speedup);
+    if (_maxError <= kOCIOBakedLutTolerance) {
+        return true;
+    }
+    _lut.clear();
+    _size = 0;
+
+    return false;
+} // OCIOBakedLut::bake
+
+string
+OCIOBakedLut::getDescription() const
+{
+    char buf[256];
+
+    if (_maxError < 0.) {
+        std::sprintf(buf, "%s LUT, %d points per channel, loaded from the disk cache", _is3D ? "3D" : "1D", _size);
+    } else {
+        std::sprintf(buf, "%s LUT, %d points per channel, max error %.2g, %.1fx faster than OpenColorIO", _is3D ? "3D" : "1D", _size, _maxError, _speedup);
+    }
+
+    return buf;
+}
+
+void
+OCIOBakedLut::write(string* data) const
+{
+    const int header[3] = { _log ? 1 : 0, _is3D ? 1 : 0, _size };
+    const float shaper[3] = { _min, _max, _offset };
+
+    data->append( (const char*)header, sizeof(header) );
+    data->append( (const char*)shaper, sizeof(shaper) );
+    if ( !_lut.empty() ) {
+        data->append( (const char*)&_lut[0], _lut.size() * sizeof(float) );
+    }
+}
+
+bool
+OCIOBakedLut::read(const string& data)
+{
+    int header[3];
+    float shaper[3];
+
+    if ( data.size() < sizeof(header) + sizeof(shaper) ) {
+        return false;
+    }
+    std::memcpy( header, data.data(), sizeof(header) );
+    std::memcpy( shaper, data.data() + sizeof(header), sizeof(shaper) );
+    const bool is3D = (header[1] != 0);
+    const int size = header[2];
+    if ( (size < 2) || ( size > (is3D ? kOCIOBakedLut3DSizeMax : kOCIOBakedLut1DSize) ) || !(shaper[1] > shaper[0]) ) {
+        return false;
+    }
+    const std::size_t lutSize = (std::size_t)size * (is3D ? size * size : 1) * 3;
+    if ( data.size() != sizeof(header) + sizeof(shaper) + lutSize * sizeof(float) ) {
+        return false;
+    }
+    _log = (header[0] != 0);
+    _is3D = is3D;
+    _size = size;
+    _min = shaper[0];
+    _max = shaper[1];
+    _offset = shaper[2];
+    _lut.resize(lutSize);
+    std::memcpy( &_lut[0], data.data() + sizeof(header) + sizeof(shaper), lutSize * sizeof(float) );
+
+    return true;
+}
+
+string
+getOCIOFileStamp(const string& filename)
+{
+    OCIOFileState state;
+
+    if ( !getOCIOFileState(filename, &state) ) {
+        return string();
+    }
+    char stamp[64];
+    if (state.racy) {
+        // the state may not change with the next edit: make the stamp unique
+        RegistryAutoMutex guard(gConfigRegistryMutex);
+        std::sprintf(stamp, "%.0f %ld racy %lu", (double)state.mtime, state.size, ++gRacyStampCount);
+    } else {
+        std::sprintf(stamp, "%.0f %ld", (double)state.mtime, state.size);
+    }
+
+    return stamp;
+}
+
+#define kOCIOBakedLutFileExtension ".ocio-lut"
+#define kOCIOBakedLutFileMagic "OFXOCIOLUT" // followed by the format version
+#define kOCIOBakedLutFileVersion 2 // version 1 files were not checked outside of the shaper range
+#define kOCIOBakedLutFileSizeMax (16 * 1024 * 1024) // larger than any valid file
+#define kOCIOBakedLutDiskCacheTrimFraction 8 // the directory is trimmed each time 1/8 of its maximum size was written
+
+// FNV-1a hash, to name the cache files and to check their contents
+static uint64_t
+hashOCIOData(const char* data,
+             std::size_t size,
+             uint64_t hash = ( (uint64_t)0xcbf29ce4 << 32 ) | 0x84222325)
+{
+    const uint64_t prime = ( (uint64_t)0x100 << 32 ) | 0x1b3;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= prime;
+    }
+
+    return hash;
+}
+
+// the files of a directory with the given extension
+static void
+listOCIOFiles(const string& dir,
+              const char* extension,
+              std::vector<string>* filenames)
+{
+#if defined(_WIN32) || defined(WIN64)
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA( (dir + "*" + extension).c_str(), &data );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        filenames->push_back(dir + data.cFileName);
+    } while ( FindNextFileA(handle, &data) );
+    FindClose(handle);
+#else
+    DIR* d = opendir( dir.c_str() );
+    if (!d) {
+        return;
+    }
+    const std::size_t extensionSize = std::strlen(extension);
+    while (struct dirent* entry = readdir(d)) {
+        const std::size_t nameSize = std::strlen(entry->d_name);
+        if ( (nameSize > extensionSize) && (std::strcmp(entry->d_name + nameSize - extensionSize, extension) == 0) ) {
+            filenames->push_back(dir + entry->d_name);
+        }
+    }
+    closedir(d);
+#endif
+}
+
+// creates a directory and its missing parents
+static void
+makeOCIODirectories(const string& path)
+{
+    for (std::size_t i = 1; i <= path.size(); ++i) {
+        if ( (i == path.size()) || (path[i] == '/') || (path[i] == '\\') ) {
+            // fails harmlessly on existing directories and on drive names
+            const string dir = path.substr(0, i);
+#if defined(_WIN32) || defined(WIN64)
+            _mkdir( dir.c_str() );
+#else
+            mkdir(dir.c_str(), 0777);
+#endif
+        }
+    }
+}
+
+/**
+ * The baked LUTs stored across sessions, in the directory given by kOCIOBakedLutDiskCachePathEnv.
+ *
+ * Each file holds one LUT (or the fact that the processor cannot be baked), named by the hash of its key.
+ * The full key and a hash of the contents are stored in the file, and checked when it is loaded, so that a hash
+ * collision, a truncated file or a file written by another version is never used.
+ * Files are written under a temporary name, then renamed, so that other processes never read a partial file.
+ * Only the LUTs used more than once are stored (see findBakedLut()), so that interactive changes, which bake a new LUT
+ * for each value, do not fill the directory.
+ * When the directory grows above its maximum size, the least recently used files are removed. This is checked when the
+ * first file is stored, then each time 1/kOCIOBakedLutDiskCacheTrimFraction of the maximum size was written.
+ **/
+class OCIOBakedLutDiskCache
+{
+public:
+    OCIOBakedLutDiskCache()
+        : _mutex()
+        , _path()
+        , _maxSize(0)
+        , _tmpCount(0)
+        , _trimmed(false)
+        , _sizeSinceTrim(0)
+    {
+        const char* path = std::getenv(kOCIOBakedLutDiskCachePathEnv);
+
+        if ( !path || !*path ) {
+            return;
+        }
+        _path = path;
+        if ( (_path[_path.size() - 1] != '/') && (_path[_path.size() - 1] != '\\') ) {
+            _path += '/';
+        }
+        double maxSizeMB = kOCIOBakedLutDiskCacheSize;
+        const char* maxSize = std::getenv(kOCIOBakedLutDiskCacheSizeEnv);
+        if (maxSize && *maxSize) {
+            maxSizeMB = std::max( 0., std::atof(maxSize) );
+        }
+        _maxSize = (uint64_t)(maxSizeMB * 1024. * 1024.);
+    }
+
+    // Returns true if key was found. *bakedLut is empty if the processor cannot be baked.
+    bool load(const string& key,
+              OCIO_SHARED_PTR<const OCIOBakedLut>* bakedLut) const
+    {
+        if ( _path.empty() ) {
+            return false;
+        }
+        const string filename = getFilename(key);
+        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+        if ( !file.is_open() ) {
+            return false;
+        }
+        // read the whole file at once: the LUT is copied anyway, so mapping the file would not save anything
+        file.seekg(0, std::ios::end);
+        const std::streamoff fileSize = file.tellg();
+        if ( (fileSize <= 0) || (fileSize > kOCIOBakedLutFileSizeMax) ) {
+            return false;
+        }
+        string contents( (std::size_t)fileSize, '\0' );
+        file.seekg(0, std::ios::beg);
+        if ( !file.read(&contents[0], fileSize) ) {
+            return false;
+        }
+        string payload;
+        if ( !parse(contents, getFullKey(key), &payload) ) {
+            DBG( std::printf( "OCIOBakedLutDiskCache: ignoring %s\n", filename.c_str() ) );
+
+            return false;
+        }
+        if ( payload.empty() ) {
+            bakedLut->reset();
+        } else {
+            OCIO_SHARED_PTR<OCIOBakedLut> lut(new OCIOBakedLut);
+            if ( !lut->read(payload) ) {
+                return false;
+            }
+            *bakedLut = lut;
+        }
+        // the modification time gives the last use
+#if defined(_WIN32) || defined(WIN64)
+        _utime(filename.c_str(), NULL);
+#else
+        utime(filename.c_str(), NULL);
+#endif
+
+        return true;
+    }
+
+    void store(const string& key,
+               const OCIO_SHARED_PTR<const OCIOBakedLut>& bakedLut)
+    {
+        if ( _path.empty() ) {
+            return;
+        }
+        const string fullKey = getFullKey(key);
+        string payload;
+        if (bakedLut) {
+            bakedLut->write(&payload);
+        }
+        string data = fullKey + payload;
+        const uint64_t hash = hashOCIOData( data.data(), data.size() );
+        const uint32_t header[4] = { kOCIOBakedLutFileVersion, 0x01020304, (uint32_t)fullKey.size(), (uint32_t)payload.size() };
+        data.insert( 0, (const char*)&hash, sizeof(hash) );
+        data.insert( 0, (const char*)header, sizeof(header) );
+        data.insert(0, kOCIOBakedLutFileMagic);
+
+        AutoMutex guard(_mutex);
+        const string filename = getFilename(key);
+        char tmpSuffix[64];
+#if defined(_WIN32) || defined(WIN64)
+        std::sprintf(tmpSuffix, ".%d.%u.tmp", (int)_getpid(), _tmpCount++);
+#else
+        std::sprintf(tmpSuffix, ".%d.%u.tmp", (int)getpid(), _tmpCount++);
+#endif
+        if (!_trimmed) {
+            makeOCIODirectories(_path);
+        }
+        const string tmpFilename = filename + tmpSuffix;
+        {
+            std::ofstream file(tmpFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            if ( !file.is_open() ) {
+                DBG( std::printf( "OCIOBakedLutDiskCache: cannot write %s\n", tmpFilename.c_str() ) );
+
+                return;
+            }
+            file.write( data.data(), data.size() );
+            if ( !file.good() ) {
+                file.close();
+                std::remove( tmpFilename.c_str() );
+
+                return;
+            }
+        }
+#if defined(_WIN32) || defined(WIN64)
+        // rename() does not replace existing files on Windows
+        const bool renamed = MoveFileExA(tmpFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        const bool renamed = std::rename( tmpFilename.c_str(), filename.c_str() ) == 0;
+#endif
+        if (!renamed) {
+            std::remove( tmpFilename.c_str() );
+
+            return;
+        }
+        // listing the directory is not cheap: only do it once enough data was written
+        _sizeSinceTrim += data.size();
+        if ( !_trimmed || (_sizeSinceTrim > _maxSize / kOCIOBakedLutDiskCacheTrimFraction) ) {
+            trim();
+            _trimmed = true;
+            _sizeSinceTrim = 0;
+        }
+    }
+
+private:
+    typedef tthread::fast_mutex Mutex;
+    typedef OFX::MultiThread::AutoMutexT<tthread::fast_mutex> AutoMutex;
+
+    // the key, and the settings the LUTs are baked with
+    static string getFullKey(const string& key)
+    {
+        char settings[128];
+
+        std::sprintf(settings, "%d %d %d %g\n", kOCIOBakedLut1DSize, kOCIOBakedLut3DSizeMin, kOCIOBakedLut3DSizeMax, kOCIOBakedLutTolerance);
+
+        return settings + key;
+    }
+
+    string getFilename(const string& key) const
+    {
+        const uint64_t hash = hashOCIOData( key.data(), key.size() );
+        char name[32];
+
+        std::sprintf(name, "%08x%08x", (unsigned int)(hash >> 32), (unsigned int)(hash & 0xffffffff) );
+
+        return _path + name + kOCIOBakedLutFileExtension;
+    }
+
+    // checks the file contents, and extracts the payload (empty if the processor cannot be baked)
+    static bool parse(const string& contents,
+                      const string& fullKey,
+                      string* payload)
+    {
+        const std::size_t magicSize = std::strlen(kOCIOBakedLutFileMagic);
+        uint32_t header[4];
+        uint64_t hash;
+
+        if ( (contents.size() < magicSize + sizeof(header) + sizeof(hash)) ||
+             (contents.compare(0, magicSize, kOCIOBakedLutFileMagic) != 0) ) {
+            return false;
+        }
+        std::memcpy( header, contents.data() + magicSize, sizeof(header) );
+        std::memcpy( &hash, contents.data() + magicSize + sizeof(header), sizeof(hash) );
+        const std::size_t dataOffset = magicSize + sizeof(header) + sizeof(hash);
+        if ( (header[0] != kOCIOBakedLutFileVersion) || (header[1] != 0x01020304) ||
+             ( contents.size() != dataOffset + (std::size_t)header[2] + header[3]) ) {
+            return false;
+        }
+        if ( hashOCIOData(contents.data() + dataOffset, contents.size() - dataOffset) != hash ) {
+            return false;
+        }
+        if (contents.compare(dataOffset, header[2], fullKey) != 0) {
+            // another key with the same hash
+            return false;
+        }
+        payload->assign(contents, dataOffset + header[2], header[3]);
+
+        return true;
+    }
+
+    // removes the least recently used files until the directory is below its maximum size
+    // must be called with _mutex locked
+    void trim()
+    {
+        std::vector<string> filenames;
+
+        listOCIOFiles(_path, kOCIOBakedLutFileExtension, &filenames);
+        std::vector<std::pair<std::time_t, std::pair<long, string> > > files;
+        uint64_t totalSize = 0;
+        for (std::size_t i = 0; i < filenames.size(); ++i) {
+            OCIOFileState state;
+            if ( getOCIOFileState(filenames[i], &state) ) {
+                files.push_back( std::make_pair( state.mtime, std::make_pair(state.size, filenames[i]) ) );
+                totalSize += state.size;
+            }
+        }
+        if (totalSize <= _maxSize) {
+            return;
+        }
+        // oldest first
+        std::sort( files.begin(), files.end() );
+        for (std::size_t i = 0; i < files.size() && totalSize > _maxSize; ++i) {
+            if (std::remove( files[i].second.second.c_str() ) == 0) {
+                totalSize -= files[i].second.first;
+            }
+        }
+    }
+
+    Mutex _mutex; // protects _tmpCount, trim() and the trim state
+    string _path; // empty if the cache is disabled
+    uint64_t _maxSize; // in bytes
+    unsigned int _tmpCount;
+    bool _trimmed; // trim() was called in this session
+    uint64_t _sizeSinceTrim; // bytes written since the last trim()
+};
+
+static OCIOBakedLutDiskCache gBakedLutDiskCache;
+
+// a baked LUT shared by all instances. An empty bakedLut means the processor cannot be baked.
+struct OCIOBakedLutEntry
+{
+    OCIO::ConstProcessorRcPtr proc; // empty if the LUT was loaded from the disk cache
+    string inputSpace;
+    string key; // see getOCIOBakedLut()
+    OCIO_SHARED_PTR<const OCIOBakedLut> bakedLut;
+    bool stored; // in the disk cache, or does not need to be
+};
+
+typedef std::list<OCIOBakedLutEntry> BakedLutList;
+
+static RegistryMutex gBakedLutsMutex;
+static BakedLutList gBakedLuts; // most recently used first
+
+// must be called with gBakedLutsMutex locked
+static void
+insertBakedLut(const OCIO::ConstProcessorRcPtr& proc,
+               const string& inputSpace,
+               const string& key,
+               const OCIO_SHARED_PTR<const OCIOBakedLut>& bakedLut,
+               bool stored)
+{
+    OCIOBakedLutEntry entry;
+
+    entry.proc = proc;
+    entry.inputSpace = inputSpace;
+    entry.key = key;
+    entry.bakedLut = bakedLut;
+    entry.stored = stored || key.empty();
+    gBakedLuts.push_front(entry);
+    while (gBakedLuts.size() > kOCIOBakedLutCacheSize) {
+        gBakedLuts.pop_back();
+    }
+}
+
+// looks for the baked LUT in memory, then in the disk cache. Returns true if it was found.
+// A LUT baked in this session is written to the disk cache the second time it is used.
+static bool
+findBakedLut(const string& key,
+             OCIO_SHARED_PTR<const OCIOBakedLut>* bakedLut)
+{
+    bool found = false;
+    bool store = false;
+    {
+        RegistryAutoMutex guard(gBakedLutsMutex);
+        BakedLutList::iterator it = gBakedLuts.begin();
+        while ( (it != gBakedLuts.end()) && (it->key != key) ) {
+            ++it;
+        }
+        if ( it != gBakedLuts.end() ) {
+            found = true;
+            gBakedLuts.splice(gBakedLuts.begin(), gBakedLuts, it);
+            *bakedLut = gBakedLuts.front().bakedLut;
+            store = !gBakedLuts.front().stored;
+            gBakedLuts.front().stored = true;
+        }
+    }
+    if (found) {
+        if (store) {
+            gBakedLutDiskCache.store(key, *bakedLut);
+        }
+
+        return true;
+    }
+    if ( !gBakedLutDiskCache.load(key, bakedLut) ) {
+        return false;
+    }
+    RegistryAutoMutex guard(gBakedLutsMutex);
+    insertBakedLut(OCIO::ConstProcessorRcPtr(), string(), key, *bakedLut, true);
+
+    return true;
+}
+
+OCIO_SHARED_PTR<const OCIOBakedLut>
+findOCIOBakedLut(const string& key)
+{
+    OCIO_SHARED_PTR<const OCIOBakedLut> bakedLut;
+
+    if ( !key.empty() ) {
+        findBakedLut(key, &bakedLut);
+    }
+
+    return bakedLut;
+}
+
+string
+getOCIOBakedLutsDescription()
+{
+    string desc;
+    RegistryAutoMutex guard(gBakedLutsMutex);
+
+    for (BakedLutList::const_iterator it = gBakedLuts.begin(); it != gBakedLuts.end(); ++it) {
+        if (it->bakedLut) {
+            desc += "- ";
+            desc += it->bakedLut->getDescription();
+            desc += '\n';
+        }
+    }
+
+    return desc;
+}
+
+OCIO_SHARED_PTR<const OCIOBakedLut>
+getOCIOBakedLut(const OCIO::ConstProcessorRcPtr& proc,
+                const OCIO::ConstConfigRcPtr& config,
+                const string& inputSpace,
+                const string& key)
+{
+    OCIO_SHARED_PTR<const OCIOBakedLut> result;
+
+    if (!proc) {
+        return result;
+    }
+    if ( !key.empty() ) {
+        if ( findBakedLut(key, &result) ) {
+            return result;
+        }
+    } else {
+        RegistryAutoMutex guard(gBakedLutsMutex);
+        for (BakedLutList::iterator it = gBakedLuts.begin(); it != gBakedLuts.end(); ++it) {
+            if ( (it->proc == proc) && (it->inputSpace == inputSpace) ) {
+                gBakedLuts.splice(gBakedLuts.begin(), gBakedLuts, it);
+
+                return gBakedLuts.front().bakedLut;
+            }
+        }
+    }
+    // baking may take a while: do it without holding the lock
+    OCIO_SHARED_PTR<OCIOBakedLut> bakedLut(new OCIOBakedLut);
+    try {
+        if ( bakedLut->bake(proc, config, inputSpace) ) {
+            result = bakedLut;
+        }
+    } catch (const OCIO::Exception &e) {
+        DBG( std::printf( "OCIOBakedLut: %s\n", e.what() ) );
+    }
+    {
+        RegistryAutoMutex guard(gBakedLutsMutex);
+        // stored in the disk cache if it is used again (see findBakedLut())
+        insertBakedLut(proc, inputSpace, key, result, false);
+    }
+
+    return result;
+} // getOCIOBakedLut
+
+// IEEE 754 half float, as stored in eBitDepthHalf images
+struct OCIOHalf
+{
+    unsigned short bits;
+};
+
+// half <-> float conversions, rounding to nearest even (see F. Giesen, "Half to float done quick")
+static inline float
+halfToFloat(unsigned short h)
+{
+    const unsigned int shiftedExp = 0x7c00u << 13; // exponent mask after the shift
+    unsigned int u = (h & 0x7fffu) << 13; // exponent and mantissa
+    const unsigned int exp = u & shiftedExp;
+    float f;
+
+    u += (127u - 15u) << 23; // rebias the exponent
+    if (exp == shiftedExp) {
+        u += (128u - 16u) << 23; // Inf or NaN
+    } else if (exp == 0) {
+        // zero or denormal: renormalize
+        u += 1u << 23;
+        std::memcpy( &f, &u, sizeof(f) );
+        f -= 6.103515625e-05f; // 2^-14
+        std::memcpy( &u, &f, sizeof(u) );
+    }
+    u |= (h & 0x8000u) << 16; // sign
+    std::memcpy( &f, &u, sizeof(f) );
+
+    return f;
+}
+
+static inline unsigned short
+floatToHalf(float f)
+{
+    unsigned int u;
+
+    std::memcpy( &u, &f, sizeof(u) );
+    const unsigned int sign = (u >> 16) & 0x8000u;
+    u &= 0x7fffffffu;
+    unsigned int h;
+    if (u >= 0x47800000u) {
+        // too large for a half: Inf, or NaN
+        h = (u > 0x7f800000u) ? 0x7e00u : 0x7c00u;
+    } else if (u < 0x38800000u) {
+        // denormal or zero: let the FPU round the mantissa, by adding 0.5
+        float v;
+        std::memcpy( &v, &u, sizeof(v) );
+        v += 0.5f;
+        std::memcpy( &u, &v, sizeof(u) );
+        h = u - 0x3f000000u;
+    } else {
+        const unsigned int mantissaOdd = (u >> 13) & 1u;
+        u += ( (unsigned int)(15 - 127) << 23 ) + 0xfffu; // rebias the exponent and round
+        u += mantissaOdd;
+        h = u >> 13;
+    }
+
+    return (unsigned short)(h | sign);
+}
+
+// conversions between the stored pixel values and the float values processed by OCIO:
+// integer values are normalized to [0,1], then clamped and rounded back
+template <class PIX, int maxValue>
+struct OCIOPixelTraits
+{
+    static float toFloat(PIX v)
+    {
+        return v * (1.f / maxValue);
+    }
+
+    static PIX fromFloat(float v)
+    {
+        // NaN gives 0
+        if ( !(v > 0.f) ) {
+            return 0;
+        }
+        if ( !(v < 1.f) ) {
+            return maxValue;
+        }
+
+        return (PIX)(v * maxValue + 0.5f);
+    }
+};
+
+template <>
+struct OCIOPixelTraits<float, 1>
+{
+    static float toFloat(float v) { return v; }
+
+    static float fromFloat(float v) { return v; }
+};
+
+template <>
+struct OCIOPixelTraits<OCIOHalf, 1>
+{
+    static float toFloat(OCIOHalf v) { return halfToFloat(v.bits); }
+
+    static OCIOHalf fromFloat(float v)
+    {
+        OCIOHalf h;
+
+        h.bits = floatToHalf(v);
+
+        return h;
+    }
+};
+
+template <class PIX, int maxValue>
+void
+OCIOProcessor::processBlocks(const OfxRectI& procWindow,
+                             int numChannels)
+{
+    float block[kOCIOBlockSize * 4];
+
+    for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+        PIX* row = (PIX*)( (char*)_dstPixelData + (size_t)(y - _dstBounds.y1) * _dstRowBytes ) + (size_t)(procWindow.x1 - _dstBounds.x1) * numChannels;
+        for (int x1 = procWindow.x1; x1 < procWindow.x2; x1 += kOCIOBlockSize) {
+            const int n = std::min(kOCIOBlockSize, procWindow.x2 - x1);
+            PIX* pix = row + (size_t)(x1 - procWindow.x1) * numChannels;
+            for (int i = 0; i < n * numChannels; ++i) {
+                block[i] = OCIOPixelTraits<PIX, maxValue>::toFloat(pix[i]);
+            }
+            if (_bakedLut) {
+                _bakedLut->transformBlock(block, n, numChannels);
+            } else {
+                OCIO::PackedImageDesc img(block, n, 1, numChannels);
+                _proc->apply(img);
+            }
+            for (int i = 0; i < n * numChannels; ++i) {
+                pix[i] = OCIOPixelTraits<PIX, maxValue>::fromFloat(block[i]);
+            }
+        }
+    }
+}
+
+void
+OCIOProcessor::multiThreadProcessImages(OfxRectI renderWindow)
+{
+    assert(_dstBounds.x1 <= renderWindow.x1 && renderWindow.x1 <= renderWindow.x2 && renderWindow.x2 <= _dstBounds.x2);
+    assert(_dstBounds.y1 <= renderWindow.y1 && renderWindow.y1 <= renderWindow.y2 && renderWindow.y2 <= _dstBounds.y2);
+    // Ensure there are pixels to render otherwise OCIO::PackedImageDesc will throw an exception.
+    if ( (renderWindow.y2 <= renderWindow.y1) || (renderWindow.x2 <= renderWindow.x1) ) {
+        return;
+    }
+#ifdef OFX_IO_USING_OCIO
+    if (!_proc) {
+        throw std::logic_error("OCIO configuration not loaded");
+    }
+    int numChannels;
+    int pixelBytes;
+    switch (_dstPixelComponents) {
+    case ePixelComponentRGBA:
+        numChannels = 4;
+        break;
+    case ePixelComponentRGB:
+        numChannels = 3;
+        break;
+    //case ePixelComponentAlpha: pixelBytes = 1; break;
+    default:
+        throwSuiteStatusException(kOfxStatErrFormat);
+
+        return;
+    }
+
+    if (_dstBitDepth != eBitDepthFloat) {
+        try {
+            switch (_dstBitDepth) {
+            case eBitDepthUByte:
+                processBlocks<unsigned char, 255>(renderWindow, numChannels);
+                break;
+            case eBitDepthUShort:
+                processBlocks<unsigned short, 65535>(renderWindow, numChannels);
+                break;
+            case eBitDepthHalf:
+                processBlocks<OCIOHalf, 1>(renderWindow, numChannels);
+                break;
+            default:
+                throwSuiteStatusException(kOfxStatErrFormat);
+                break;
+            }
+        } catch (OCIO::Exception &e) {
+            _instance->setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
+            throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
+        }
+
+        return;
+    }
+
+    pixelBytes = numChannels * sizeof(float);
+    size_t pixelDataOffset = (size_t)(renderWindow.y1 - _dstBounds.y1) * _dstRowBytes + (size_t)(renderWindow.x1 - _dstBounds.x1) * pixelBytes;
+    float *pix = (float *) ( ( (char *) _dstPixelData ) + pixelDataOffset ); // (char*)dstImg->getPixelAddress(renderWindow.x1, renderWindow.y1);
+    try {
+        if (_bakedLut) {
+            _bakedLut->apply(pix, renderWindow.x2 - renderWindow.x1, renderWindow.y2 - renderWindow.y1, numChannels, _dstRowBytes);
+        } else if (_proc) {
+            OCIO::PackedImageDesc img(pix, renderWindow.x2 - renderWindow.x1, renderWindow.y2 - renderWindow.y1, numChannels, sizeof(float), pixelBytes, _dstRowBytes);
+            _proc->apply(img);
+        }
+    } catch (OCIO::Exception &e) {
+        _instance->setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
+        throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
+    }
+#endif
+}
+
+// the processor used by applyOCIOBlocks()
+class OCIOBlockProcessorBase
+    : public ImageProcessor
+{
+protected:
+    const Image* _srcImg;
+    const Image* _maskImg;
+    OCIO::ConstProcessorRcPtr _proc;
+    const OCIOBlockTransform* _transform;
+    bool _premult;
+    int _premultChannel;
+    bool _doMasking;
+    double _mix;
+    bool _maskInvert;
+
+public:
+    OCIOBlockProcessorBase(ImageEffect &instance)
+        : ImageProcessor(instance)
+        , _srcImg(NULL)
+        , _maskImg(NULL)
+        , _proc()
+        , _transform(NULL)
+        , _premult(false)
+        , _premultChannel(3)
+        , _doMasking(false)
+        , _mix(1.)
+        , _maskInvert(false)
+    {
+    }
+
+    void setSrcImg(const Image* v) { _srcImg = v; }
+
+    void setMaskImg(const Image* v,
+                    bool maskInvert)
+    {
+        _maskImg = v;
+        _maskInvert = maskInvert;
+        _doMasking = (v != NULL);
+    }
+
+    void setProcessor(const OCIO::ConstProcessorRcPtr& proc,
+                      const OCIOBlockTransform* transform)
+    {
+        _proc = proc;
+        _transform = transform;
+    }
+
+    void setValues(bool premult,
+                   int premultChannel,
+                   double mix)
+    {
+        _premult = premult;
+        _premultChannel = premultChannel;
+        _mix = mix;
+    }
+};
+
+template <class PIX, int maxValue, int nComponents, bool masked>
+class OCIOBlockProcessor
+    : public OCIOBlockProcessorBase
+{
+public:
+    OCIOBlockProcessor(ImageEffect &instance)
+        : OCIOBlockProcessorBase(instance)
+    {
+    }
+
+private:
+    void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        try {
+            processBlocks(procWindow);
+        } catch (OCIO::Exception &e) {
+            _effect.setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
+            throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
+        }
+    }
+
+    // returns the source pixel at (x,y) converted to float, or NULL if it is outside of the source
+    const float* getSrcPix(const PIX* srcPix,
+                           float srcPixF[4]) const
+    {
+        if (!srcPix) {
+            return NULL;
+        }
+        for (int c = 0; c < nComponents; ++c) {
+            srcPixF[c] = OCIOPixelTraits<PIX, maxValue>::toFloat(srcPix[c]);
+        }
+
+        return srcPixF;
+    }
+
+    // the mix factor at (x,y), including the mask (same as ofxsMaskMixPix())
+    float getMix(int x,
+                 int y) const
+    {
+        if (!_doMasking) {
+            return (float)_mix;
+        }
+        const PIX* maskPix = (const PIX*)_maskImg->getPixelAddress(x, y);
+        float maskScale;
+        if (!maskPix) {
+            maskScale = _maskInvert ? 1.f : 0.f;
+        } else {
+            maskScale = OCIOPixelTraits<PIX, maxValue>::toFloat(*maskPix);
+            if (_maskInvert) {
+                maskScale = 1.f - maskScale;
+            }
+        }
+
+        return maskScale * (float)_mix;
+    }
+
+    void processBlocks(const OfxRectI& procWindow)
+    {
+        float block[kOCIOBlockSize * nComponents];
+        const OfxRectI srcBounds = _srcImg ? _srcImg->getBounds() : procWindow;
+
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            for (int x1 = procWindow.x1; x1 < procWindow.x2; x1 += kOCIOBlockSize) {
+                const int n = std::min(kOCIOBlockSize, procWindow.x2 - x1);
+                // if the block is inside the source, its pixels are contiguous
+                const bool srcInside = ( _srcImg && (srcBounds.y1 <= y) && (y < srcBounds.y2) &&
+                                         (srcBounds.x1 <= x1) && (x1 + n <= srcBounds.x2) );
+                const PIX* srcRow = srcInside ? (const PIX*)_srcImg->getPixelAddress(x1, y) : NULL;
+
+                // convert to float and unpremultiply
+                float srcPixF[4];
+                float unpPix[4];
+                for (int i = 0; i < n; ++i) {
+                    const PIX* srcPix = srcInside ? srcRow + i * nComponents : (const PIX*)( _srcImg ? _srcImg->getPixelAddress(x1 + i, y) : NULL );
+                    ofxsUnPremult<float, nComponents, 1>(getSrcPix(srcPix, srcPixF), unpPix, _premult, _premultChannel);
+                    for (int c = 0; c < nComponents; ++c) {
+                        block[i * nComponents + c] = unpPix[c];
+                    }
+                }
+
+                // transform
+                if (_transform) {
+                    _transform->transformBlock(block, n, nComponents);
+                } else if (_proc) {
+                    OCIO::PackedImageDesc img(block, n, 1, nComponents);
+                    _proc->apply(img);
+                }
+
+                // premultiply, mask and mix with the source, and convert back
+                PIX* dstPix = (PIX*)getDstPixelAddress(x1, y);
+                assert(dstPix);
+                for (int i = 0; i < n; ++i, dstPix += nComponents) {
+                    const PIX* srcPix = srcInside ? srcRow + i * nComponents : (const PIX*)( _srcImg ? _srcImg->getPixelAddress(x1 + i, y) : NULL );
+                    float tmpPix[4] = { 0.f, 0.f, 0.f, 1.f };
+                    for (int c = 0; c < nComponents; ++c) {
+                        tmpPix[c] = block[i * nComponents + c];
+                    }
+                    float dstPixF[4];
+                    ofxsPremultMaskMixPix<float, nComponents, 1, masked>(tmpPix, _premult, _premultChannel, x1 + i, y, getSrcPix(srcPix, srcPixF),
+                                                                         false, NULL, masked ? getMix(x1 + i, y) : 1.f, false, dstPixF);
+                    for (int c = 0; c < nComponents; ++c) {
+                        dstPix[c] = OCIOPixelTraits<PIX, maxValue>::fromFloat(dstPixF[c]);
+                    }
+                }
+            }
+        }
+    } // processBlocks
+};
+
+template <class PIX, int maxValue, int nComponents, bool masked>
+static void
+applyOCIOBlocksForComponents(ImageEffect& instance,
+                             const OfxRectI& renderWindow,
+                             const Image* srcImg,
+                             Image* dstImg,
+                             const OCIO::ConstProcessorRcPtr& proc,
+                             const OCIOBlockTransform* transform,
+                             bool premult,
+                             int premultChannel,
+                             double mix,
+                             const Image* maskImg,
+                             bool maskInvert)
+{
+    OCIOBlockProcessor<PIX, maxValue, nComponents, masked> processor(instance);
+
+    processor.setDstImg(dstImg);
+    processor.setSrcImg(srcImg);
+    processor.setMaskImg(maskImg, maskInvert);
+    processor.setProcessor(proc, transform);
+    processor.setValues(premult, premultChannel, mix);
+    processor.setRenderWindow(renderWindow);
+    processor.process();
+}
+
+template <class PIX, int maxValue>
+static void
+applyOCIOBlocksForDepth(ImageEffect& instance,
+                        const OfxRectI& renderWindow,
+                        const Image* srcImg,
+                        Image* dstImg,
+                        const OCIO::ConstProcessorRcPtr& proc,
+                        const OCIOBlockTransform* transform,
+                        bool premult,
+                        int premultChannel,
+                        double mix,
+                        const Image* maskImg,
+                        bool maskInvert)
+{
+    // the mask/mix code is only needed if there is a mask or if the result is mixed with the source
+    bool masked = (maskImg != NULL) || (mix != 1.);
+
+    switch ( dstImg->getPixelComponents() ) {
+    case ePixelComponentRGBA:
+        if (masked) {
+            applyOCIOBlocksForComponents<PIX, maxValue, 4, true>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        } else {
+            applyOCIOBlocksForComponents<PIX, maxValue, 4, false>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        }
+        break;
+    case ePixelComponentRGB:
+        if (masked) {
+            applyOCIOBlocksForComponents<PIX, maxValue, 3, true>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        } else {
+            applyOCIOBlocksForComponents<PIX, maxValue, 3, false>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        }
+        break;
+    default:
+        instance.setPersistentMessage(Message::eMessageError, "", "OCIO: invalid components (only RGB and RGBA are supported)");
+        throwSuiteStatusException(kOfxStatErrFormat);
+        break;
+    }
+}
+
+void
+applyOCIOBlocks(ImageEffect& instance,
+                const OfxRectI& renderWindow,
+                const Image* srcImg,
+                Image* dstImg,
+                const OCIO::ConstProcessorRcPtr& proc,
+                const OCIOBlockTransform* transform,
+                bool premult,
+                int premultChannel,
+                double mix,
+                const Image* maskImg,
+                bool maskInvert)
+{
+    assert(dstImg);
+    const BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
+    if ( ( srcImg && ( (srcImg->getPixelDepth() != dstBitDepth) || (srcImg->getPixelComponents() != dstImg->getPixelComponents()) ) ) ||
+         ( maskImg && (maskImg->getPixelDepth() != dstBitDepth) ) ) {
+        throwSuiteStatusException(kOfxStatErrFormat);
+
+        return;
+    }
+    switch (dstBitDepth) {
+    case eBitDepthUByte:
+        applyOCIOBlocksForDepth<unsigned char, 255>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        break;
+    case eBitDepthUShort:
+        applyOCIOBlocksForDepth<unsigned short, 65535>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        break;
+    case eBitDepthHalf:
+        applyOCIOBlocksForDepth<OCIOHalf, 1>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        break;
+    case eBitDepthFloat:
+        applyOCIOBlocksForDepth<float, 1>(instance, renderWindow, srcImg, dstImg, proc, transform, premult, premultChannel, mix, maskImg, maskInvert);
+        break;
+    default:
+        throwSuiteStatusException(kOfxStatErrFormat);
+        break;
+    }
+} // applyOCIOBlocks
+
+#endif // OFX_IO_USING_OCIO
+
+void
+shutdownOCIOPrewarm()
+{
+#ifdef OFX_IO_USING_OCIO
+    gPrewarmPool.shutdown();
+#endif
+}
+
+#ifdef OFX_IO_USING_OCIO
+OCIO::ConstProcessorRcPtr
+GenericOCIO::getOrCreateProcessor(double time)
+{
+    if (!_config) {
+        return OCIO::ConstProcessorRcPtr();
+    }
+    string inputSpace;
+    getInputColorspaceAtTime(time, inputSpace);
+    string outputSpace;
+    getOutputColorspaceAtTime(time, outputSpace);
+    OCIO::ConstContextRcPtr context = getLocalContext(time);//_config->getCurrentContext();
+    setValues(context, inputSpace, outputSpace);
+
+    return getProcessor();
+}
+
+void
+GenericOCIO::prewarmProcessor(double time)
+{
+    if (!_config || !_inputSpace || !_outputSpace) {
+        return;
+    }
+    string inputSpace;
+    getInputColorspaceAtTime(time, inputSpace);
+    string outputSpace;
+    getOutputColorspaceAtTime(time, outputSpace);
+    if (inputSpace == outputSpace) {
+        return;
+    }
+    try {
+        OCIO::ConstContextRcPtr context = getLocalContext(time);
+        const string key = OCIOProcessorCache::getKey(_config, context, inputSpace, outputSpace);
+        if ( _procCache.get(key) ) {
+            return;
+        }
+#ifdef OFX_OCIO_SHARED_PROCESSOR_CACHE
+        if ( getSharedOCIOProcessorCache().get(key) ) {
+            return;
+        }
+#endif
+        prewarmOCIOProcessor( key, new ColorSpaceProcessorBuilder(_config, context, inputSpace, outputSpace) );
+    } catch (const OCIO::Exception &e) {
+        // the error is reported by render
+        DBG( std::printf( "GenericOCIO::prewarmProcessor: %s\n", e.what() ) );
+    }
+}
+
+#endif // OFX_IO_USING_OCIO
+
+void
+GenericOCIO::apply(double time,
+                   const OfxRectI& renderWindow,
+                   float *pixelData,
+                   const OfxRectI& bounds,
+                   PixelComponentEnum pixelComponents,
+                   int pixelComponentCount,
+                   int rowBytes)
+{
+    apply(time, renderWindow, (void*)pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
+}
+
+void
+GenericOCIO::apply(double time,
+                   const OfxRectI& renderWindow,
+                   void *pixelData,
+                   const OfxRectI& bounds,
+                   PixelComponentEnum pixelComponents,
+                   int pixelComponentCount,
+                   BitDepthEnum bitDepth,
+                   int rowBytes)
+{
+    assert(_created);
+#ifdef OFX_IO_USING_OCIO
+
+    if (!_created) {
+        return;
+    }
+
+    if ( isIdentity(time) ) {
+        return;
+    }
+    // are we in the image bounds
+    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
+         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
+        _parent->setPersistentMessage(Message::eMessageError, "", "OCIO: render window outside of image bounds");
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
+        _parent->setPersistentMessage(Message::eMessageError, "", "OCIO: invalid components (only RGB and RGBA are supported)");
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    OCIO::ConstProcessorRcPtr proc = getOrCreateProcessor(time);
+    if (!proc) {
+        _parent->setPersistentMessage( Message::eMessageError, "", "Cannot create OCIO processor" );
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+
+    OCIOProcessor processor(*_parent);
+    // set the images
+    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, rowBytes);
+
+    processor.setProcessor(proc);
+
+    // set the render window
+    processor.setRenderWindow(renderWindow);
+
+    // Call the base class process member, this will call the derived templated process code
+    processor.process();
+#endif
+}
+
+void
+GenericOCIO::changedParam(const InstanceChangedArgs &args,
+                          const string &paramName)
+{
+    assert(_created);
+#ifdef OFX_IO_USING_OCIO
+    if ( (paramName == kOCIOParamConfigFile) && (args.reason != eChangeTime) ) {
+        // must clear persistent message, or render() is not called by Nuke after an error
+        _parent->clearPersistentMessage();
+        // compute canonical inputSpace and outputSpace before changing the config,
+        // if different from inputSpace and outputSpace they must be set to the canonical value after changing ocio config
+        string inputSpace;
+        getInputColorspaceAtTime(args.time, inputSpace);
+        string inputSpaceCanonical = canonicalizeColorSpace(_config, inputSpace);
+        if (inputSpaceCanonical != inputSpace) {
+            _inputSpace->setValue(inputSpaceCanonical);
+        }
+        if (_outputSpace) {
+            string outputSpace;
+            getOutputColorspaceAtTime(args.time, outputSpace);
+            string outputSpaceCanonical = canonicalizeColorSpace(_config, outputSpace);
+            if (outputSpaceCanonical != outputSpace) {
+                _outputSpace->setValue(outputSpaceCanonical);
+            }
+        }
+
+        loadConfig(); // re-load the new OCIO config
+        //if inputspace or outputspace are not valid in the new config, reset them to "default"
+        if (_config) {
+            string inputSpaceName;
+            getInputColorspaceAtTime(args.time, inputSpaceName);
+            int inputSpaceIndex = _config->getIndexForColorSpace( inputSpaceName.c_str() );
+            if (inputSpaceIndex < 0) {
+                OCIO::ConstColorSpaceRcPtr cs;
+                if (!cs) {
+                    cs = _config->getColorSpace(OCIO::ROLE_DEFAULT);
+                }
+                if (!cs) {
+                    // no default colorspace, fallback to the first one
+                    cs = _config->getColorSpace( _config->getColorSpaceNameByIndex(0) );
+                }
+                inputSpaceName = cs ? cs->getName() : OCIO::ROLE_DEFAULT;
+                _inputSpace->setValue(inputSpaceName);
+            }
+        }
+        inputCheck(args.time);
+        if (_config && _outputSpace) {
+            string outputSpaceName;
+            getOutputColorspaceAtTime(args.time, outputSpaceName);
+            int outputSpaceIndex = _config->getIndexForColorSpace( outputSpaceName.c_str() );
+            if (outputSpaceIndex < 0) {
+                OCIO::ConstColorSpaceRcPtr cs;
+                if (!cs) {
+                    cs = _config->getColorSpace(OCIO::ROLE_DEFAULT);
+                }
+                if (!cs) {
+                    // no default colorspace, fallback to the first one
+                    cs = _config->getColorSpace( _config->getColorSpaceNameByIndex(0) );
+                }
+                outputSpaceName = cs ? cs->getName() : OCIO::ROLE_DEFAULT;
+                _outputSpace->setValue(OCIO::ROLE_DEFAULT);
+            }
+        }
+        outputCheck(args.time);
+
+        if ( !_config && (args.reason == eChangeUserEdit) ) {
+            string filename;
+            _ocioConfigFile->getValue(filename);
             _parent->sendMessage(Message::eMessageError, "", string("Cannot load OCIO config file \"") + filename + '"');
         }
     } else if ( (paramName == kOCIOHelpButton) || (paramName == kOCIOHelpLooksButton) || (paramName == kOCIOHelpDisplaysButton) ) {
@@ -1102,6 +3055,11 @@ GenericOCIO::changedParam(const InstanceChangedArgs &args,
                 }
             }
         }
+        string bakedLuts = getOCIOBakedLutsDescription();
+        if ( !bakedLuts.empty() ) {
+            msg += "\nBaked LUTs in use (see \"" kOCIOParamBakeLUTLabel "\"), most recent first:\n";
+            msg += bakedLuts;
+        }
         _parent->sendMessage(Message::eMessageMessage, "", msg);
     } else if (!_config) {
         // the other parameters assume there is a valid config
@@ -1201,6 +3159,16 @@ GenericOCIO::changedParam(const InstanceChangedArgs &args,
     }
 #endif // OFX_OCIO_CHOICE
 
+    if ( (args.reason != eChangeTime) &&
+         ( (paramName == kOCIOParamConfigFile) ||
+           ( paramName == kOCIOParamInputSpace) ||
+           ( paramName == kOCIOParamOutputSpace) ||
+           ( paramName == kOCIOParamContextKey1) || ( paramName == kOCIOParamContextValue1) ||
+           ( paramName == kOCIOParamContextKey2) || ( paramName == kOCIOParamContextValue2) ||
+           ( paramName == kOCIOParamContextKey3) || ( paramName == kOCIOParamContextValue3) ||
+           ( paramName == kOCIOParamContextKey4) || ( paramName == kOCIOParamContextValue4) ) ) {
+        prewarmProcessor(args.time);
+    }
 
 #endif // ifdef OFX_IO_USING_OCIO
 } // GenericOCIO::changedParam
@@ -1287,7 +3255,14 @@ void
 GenericOCIO::purgeCaches()
 {
 #ifdef OFX_IO_USING_OCIO
-    OCIO::ClearAllCaches();
+    _procCache.clear();
+    {
+        AutoMutex guard(_contextCacheMutex);
+        _contextCache.clear();
+        _identityCache.clear();
+    }
+    clearPrewarmedOCIOProcessors();
+    clearOCIOFileCaches();
 #endif
 }
 
@@ -1306,7 +3281,7 @@ GenericOCIO::describeInContextInput(ImageEffectDescriptor &desc,
     if (file != NULL) {
         //Add choices
         try {
-            config = OCIO::Config::CreateFromFile(file);
+            config = getSharedOCIOConfig(file);
             gWasOCIOEnvVarFound = true;
         } catch (OCIO::Exception &e) {
         }
@@ -1395,7 +3370,7 @@ GenericOCIO::describeInContextOutput(ImageEffectDescriptor &desc,
     if (file != NULL) {
         //Add choices
         try {
-            config = OCIO::Config::CreateFromFile(file);
+            config = getSharedOCIOConfig(file);
             gWasOCIOEnvVarFound = true;
         } catch (OCIO::Exception &e) {
         }
@@ -26,24 +26,47 @@
 
 #include <string>
 #include <vector>
+#include <list>
+#include <map>
+#include <utility>
 
 #include "ofxsImageEffect.h"
 #include "ofxsPixelProcessor.h"
 #include "ofxsMultiThread.h"
-#ifndef OFX_USE_MULTITHREAD_MUTEX
+#include "ofxsMacros.h"
 // some OFX hosts do not have mutex handling in the MT-Suite (e.g. Sony Catalyst Edit)
 // prefer using the fast mutex by Marcus Geelnard http://tinythreadpp.bitsnbites.eu/
+// (it is also used by the processor caches, which may be static objects)
 #include "fast_mutex.h"
-#endif
 
 // define OFX_OCIO_CHOICE to enable the colorspace choice popup menu
 #define OFX_OCIO_CHOICE
 
+// define OFX_OCIO_SHARED_PROCESSOR_CACHE to share the OCIO processors between all instances
+#define OFX_OCIO_SHARED_PROCESSOR_CACHE
+
+#define kOCIOProcessorCacheSize 8 // number of processors kept by each instance
+#define kOCIOSharedProcessorCacheSize 64 // number of processors shared by all instances
+#define kOCIOPrewarmThreads 2 // number of threads creating processors in the background
+#define kOCIOPrewarmCacheSize 16 // number of processors created in the background that are kept until used
+#define kOCIOContextCacheSize 32 // number of local contexts (sets of context variables) kept by each instance
+#define kOCIOIdentityCacheSize 64 // number of isIdentity() results kept by each instance
+
+#define kOCIOBakedLut1DSize 4096 // size of the 1D LUTs, for processors without channel crosstalk
+#define kOCIOBakedLut3DSizeMin 33 // first 3D LUT size tried
+#define kOCIOBakedLut3DSizeMax 65 // 3D LUT size used if the first one is not accurate enough
+#define kOCIOBakedLutTolerance 1e-3 // maximum error of a baked LUT, relative to max(1,|value|)
+#define kOCIOBakedLutCacheSize 8 // number of baked LUTs shared by all instances
+#define kOCIOBakedLutDiskCachePathEnv "OFX_OCIO_LUT_CACHE_PATH" // directory where baked LUTs are stored across sessions (disabled if not set)
+#define kOCIOBakedLutDiskCacheSizeEnv "OFX_OCIO_LUT_CACHE_SIZE" // maximum size of that directory, in megabytes
+#define kOCIOBakedLutDiskCacheSize 256 // default maximum size of the baked LUT directory, in megabytes
+
 #ifdef OFX_IO_USING_OCIO
 #include <OpenColorIO/OpenColorIO.h>
 #endif
 
 #include "IOUtility.h"
+#include "OCIOBlockTransform.h"
 
 NAMESPACE_OFX_ENTER
     NAMESPACE_OFX_IO_ENTER
@@ -62,6 +85,15 @@ NAMESPACE_OFX_ENTER
 #define kOCIOParamInputSpaceChoice "ocioInputSpaceIndex"
 #define kOCIOParamOutputSpaceChoice "ocioOutputSpaceIndex"
 #endif
+#define kOCIOParamBakeLUT "bakeLUT"
+#define kOCIOParamBakeLUTLabel "Use Baked LUT"
+#define kOCIOParamBakeLUTHint \
+    "Bake the transform into a shaper and a LUT, which is faster to apply on the CPU.\n" \
+    "Transforms without channel crosstalk are baked into a 1D LUT per channel, others into a 3D LUT with tetrahedral interpolation.\n" \
+    "The shaper covers the allocation range of the input colorspace, as with the GPU render, and the LUT clamps values outside of it.\n" \
+    "The baked LUT is checked against the exact transform, inside and outside of that range, and the exact transform is used if the LUT is not accurate enough.\n" \
+    "If the " kOCIOBakedLutDiskCachePathEnv " environment variable is set, baked LUTs are also stored in that directory, " \
+    "so that the next sessions neither bake them nor create the transform again (" kOCIOBakedLutDiskCacheSizeEnv " gives the maximum size of the directory in megabytes, 256 by default)."
 #define kOCIOHelpButton "ocioHelp"
 #define kOCIOHelpLooksButton "ocioHelpLooks"
 #define kOCIOHelpDisplaysButton "ocioHelpDisplays"
@@ -106,6 +138,220 @@ public:
 };
 
 
+#ifdef OFX_IO_USING_OCIO
+/**
+ * @brief A small LRU cache of OCIO processors, keyed by the config, the context and the transform.
+ *
+ * The lock is only held while looking up or inserting, never while creating a processor:
+ * two threads may create the same processor, and the last one inserted wins.
+ **/
+class OCIOProcessorCache
+{
+public:
+    explicit OCIOProcessorCache(std::size_t maxSize);
+
+    OCIO_NAMESPACE::ConstProcessorRcPtr get(const std::string& key);
+    void insert(const std::string& key, const OCIO_NAMESPACE::ConstProcessorRcPtr& proc);
+    void clear();
+
+    // forget the processors whose key contains filename as a whole line, i.e. which were built from that file
+    void eraseFile(const std::string& filename);
+
+    // the key for a colorspace conversion: the config and context cache IDs, and the colorspace names
+    static std::string getKey(const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+                              const OCIO_NAMESPACE::ConstContextRcPtr& context,
+                              const std::string& inputSpace,
+                              const std::string& outputSpace);
+
+private:
+    typedef tthread::fast_mutex Mutex;
+    typedef OFX::MultiThread::AutoMutexT<tthread::fast_mutex> AutoMutex;
+    typedef std::list<std::pair<std::string, OCIO_NAMESPACE::ConstProcessorRcPtr> > EntryList;
+
+    Mutex _mutex;
+    EntryList _entries; // most recently used first
+    std::size_t _maxSize;
+};
+
+#ifdef OFX_OCIO_SHARED_PROCESSOR_CACHE
+// the processors shared by all instances
+OCIOProcessorCache& getSharedOCIOProcessorCache();
+#endif
+
+/**
+ * @brief Creates an OCIO processor, possibly on a background thread (see prewarmOCIOProcessor()).
+ * It must only hold data it owns (config, context, names...), since it may outlive the instance which requested it.
+ **/
+class OCIOProcessorBuilder
+{
+public:
+    virtual ~OCIOProcessorBuilder() {}
+
+    // throws OCIO::Exception, as OCIO::Config::getProcessor()
+    virtual OCIO_NAMESPACE::ConstProcessorRcPtr build() const = 0;
+};
+
+/**
+ * @brief Starts creating a processor on a small pool of background threads, so that it is ready when the first
+ * render needs it. Takes ownership of builder.
+ * Does nothing if the processor for this key is already being created, or was created recently.
+ * Errors are ignored: they are reported when getOCIOProcessor() creates the processor again.
+ **/
+void prewarmOCIOProcessor(const std::string& key, OCIOProcessorBuilder* builder);
+
+/**
+ * @brief Returns the processor for key, created in the background by prewarmOCIOProcessor(). Waits only if it is still
+ * being created. If it was not requested (or failed), builder creates it in the calling thread, and other threads asking
+ * for the same key wait for it.
+ * Throws OCIO::Exception, as OCIOProcessorBuilder::build().
+ **/
+OCIO_NAMESPACE::ConstProcessorRcPtr getOCIOProcessor(const std::string& key, const OCIOProcessorBuilder& builder);
+
+// forget the processors created by getOCIOProcessor() and prewarmOCIOProcessor(), e.g. after OCIO::ClearAllCaches()
+void clearPrewarmedOCIOProcessors();
+
+// an entry of the colorspace choice menu
+struct OCIOColorSpaceMenuItem
+{
+    std::string name;
+    std::string family;
+    std::string hint; //< the colorspace description and its roles
+};
+
+/**
+ * @brief Returns the config parsed from the given file, shared by all instances.
+ * The file is parsed again only if its modification time or size changed since it was last parsed.
+ * Throws OCIO::Exception, as OCIO::Config::CreateFromFile().
+ **/
+OCIO_NAMESPACE::ConstConfigRcPtr getSharedOCIOConfig(const std::string& filename);
+
+/**
+ * @brief Gets the colorspace menu of a config. It is only computed once for the configs returned by getSharedOCIOConfig().
+ **/
+void getOCIOColorSpaceMenu(const OCIO_NAMESPACE::ConstConfigRcPtr& config, std::vector<OCIOColorSpaceMenuItem>* items);
+
+/**
+ * @brief Remembers the modification time and size of a file used by an OCIO transform (LUT, CDL...), once OCIO has read it.
+ * Only the first call after clearOCIOFileCaches() counts, since OCIO keeps the version it parsed first.
+ **/
+void setOCIOFileLoaded(const std::string& filename);
+
+/**
+ * @brief Returns true if setOCIOFileLoaded() was called for the file and it changed (or vanished) since,
+ * i.e. if the version in the OCIO file caches is stale.
+ **/
+bool ocioFileOutdated(const std::string& filename);
+
+/**
+ * @brief Clears the OCIO file caches, which are shared by all instances, and forgets the states remembered by setOCIOFileLoaded().
+ **/
+void clearOCIOFileCaches();
+
+/**
+ * @brief Forgets a file which changed: the processors built from it are removed from the shared and prewarmed
+ * processor caches, and the OCIO file caches are cleared only if OCIO parsed it (see setOCIOFileLoaded()).
+ **/
+void clearOCIOFileCaches(const std::string& filename);
+
+/**
+ * @brief A processor baked into a shaper and a 1D or 3D LUT, for a faster CPU render.
+ *
+ * The shaper maps each input channel to [0,1] using the allocation of the input colorspace,
+ * as the OCIO GPU path does. Processors without channel crosstalk are baked into one 1D LUT
+ * per channel, the others into a 3D LUT applied with tetrahedral interpolation.
+ * Alpha is left unchanged.
+ **/
+class OCIOBakedLut
+    : public OCIOBlockTransform
+{
+public:
+    OCIOBakedLut();
+
+    /**
+     * @brief Bakes the processor, and checks the result against it.
+     * The shaper is given by the allocation of inputSpace, or is the identity on [0,1] if inputSpace is empty.
+     * Returns false if the processor cannot be baked accurately, including on values outside of the shaper range,
+     * which the baked LUT clamps.
+     **/
+    bool bake(const OCIO_NAMESPACE::ConstProcessorRcPtr& proc,
+              const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+              const std::string& inputSpace);
+
+    // apply to packed RGB or RGBA float pixels
+    void apply(float* pixelData, int width, int height, int numChannels, std::size_t rowBytes) const;
+
+    // serialization, for the disk cache. read() returns false if the data is not a valid baked LUT
+    void write(std::string* data) const;
+    bool read(const std::string& data);
+
+    virtual void transformBlock(float* pixelData, int n, int numChannels) const OVERRIDE FINAL
+    {
+        apply(pixelData, n, 1, numChannels, n * numChannels * sizeof(float));
+    }
+
+    // the LUT type and size, and the error and speedup measured when it was baked (not known if it was read from the disk cache)
+    std::string getDescription() const;
+
+private:
+    float shape(float x) const;
+    float unshape(float t) const;
+    void applyPixel(const float* in, float* out) const;
+    void bakeLut(const OCIO_NAMESPACE::ConstProcessorRcPtr& proc, bool is3D, int size);
+    double getMaxError(const OCIO_NAMESPACE::ConstProcessorRcPtr& proc, double* speedup) const;
+
+    bool _log; // shaper is log2(x + offset), else x
+    float _min; // shaped values in [min,max] are mapped to [0,1]
+    float _max;
+    float _offset;
+    bool _is3D;
+    int _size;
+    std::vector<float> _lut; // RGB triplets, red varies fastest
+    double _maxError; // measured by bake(), -1 if unknown
+    double _speedup; // time taken by the processor over time taken by the LUT, measured by bake(), -1 if unknown
+};
+
+/**
+ * @brief Returns the baked LUT for a processor, or an empty pointer if it cannot be baked accurately.
+ * Baked LUTs are shared by all instances, and the processor is only baked once.
+ * key, if not empty, identifies the processor and the shaper across sessions: the config cache ID (which covers the
+ * files it references), the transform description and the state of any other file read by the transform.
+ * The result is then also stored in the disk cache, if it is enabled (see kOCIOBakedLutDiskCachePathEnv), as soon as
+ * it is used again (so that interactive changes do not fill the cache).
+ **/
+OCIO_SHARED_PTR<const OCIOBakedLut> getOCIOBakedLut(const OCIO_NAMESPACE::ConstProcessorRcPtr& proc,
+                                                    const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+                                                    const std::string& inputSpace,
+                                                    const std::string& key = std::string());
+
+/**
+ * @brief Returns the baked LUT stored under key by getOCIOBakedLut(), in memory or in the disk cache, so that the
+ * processor does not have to be created.
+ * Returns an empty pointer if there is none, or if the processor cannot be baked: the processor must then be
+ * created and passed to getOCIOBakedLut().
+ **/
+OCIO_SHARED_PTR<const OCIOBakedLut> findOCIOBakedLut(const std::string& key);
+
+/**
+ * @brief Describes the baked LUTs shared by all instances (see OCIOBakedLut::getDescription()), one per line,
+ * most recently used first. Displayed by the OCIO help button.
+ **/
+std::string getOCIOBakedLutsDescription();
+
+/**
+ * @brief Returns a string which changes whenever the file is modified, to be used in baked LUT keys,
+ * or an empty string if the file cannot be found.
+ **/
+std::string getOCIOFileStamp(const std::string& filename);
+#endif
+
+/**
+ * @brief Stops the threads creating processors in the background (see prewarmOCIOProcessor()): pending requests are
+ * discarded, and the running ones are waited for. Every plugin using GenericOCIO or prewarmOCIOProcessor() must call
+ * it from its unload action, so that no thread runs plugin code once the binary is unloaded.
+ * Does nothing if OCIO is not used.
+ **/
+void shutdownOCIOPrewarm();
+
 class GenericOCIO
 {
     friend class OCIOProcessor;
@@ -152,6 +398,8 @@ public:
 
     void apply(double time, const OfxRectI& renderWindow, OFX::Image* dstImg);
     void apply(double time, const OfxRectI& renderWindow, float *pixelData, const OfxRectI& bounds, OFX::PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
+    // pixelData may be of any bit depth: integer values are normalized to [0,1] before the conversion
+    void apply(double time, const OfxRectI& renderWindow, void *pixelData, const OfxRectI& bounds, OFX::PixelComponentEnum pixelComponents, int pixelComponentCount, OFX::BitDepthEnum bitDepth, int rowBytes);
     void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName);
     void purgeCaches();
     void getInputColorspaceDefault(std::string &v) const;
@@ -168,6 +416,8 @@ public:
     OCIO_NAMESPACE::ConstConfigRcPtr getConfig() const { return _config; };
     OCIO_NAMESPACE::ConstProcessorRcPtr getProcessor() const;
     OCIO_NAMESPACE::ConstProcessorRcPtr getOrCreateProcessor(double time);
+    // start creating the processor for the colorspace conversion at the given time in the background
+    void prewarmProcessor(double time);
 
 #endif
     bool configIsDefault() const;
@@ -200,6 +450,9 @@ public:
 
 private:
     void loadConfig();
+#ifdef OFX_IO_USING_OCIO
+    OCIO_NAMESPACE::ConstProcessorRcPtr getCachedProcessor(const OCIO_NAMESPACE::ConstContextRcPtr &context, const std::string& inputSpace, const std::string& outputSpace) const;
+#endif
     void inputCheck(double time);
     void outputCheck(double time);
 
@@ -233,6 +486,10 @@ private:
     std::string _procInputSpace;
     std::string _procOutputSpace;
     //OCIO_NAMESPACE::ConstTransformRcPtr _procTransform;
+    mutable OCIOProcessorCache _procCache; //< the processors recently used by this instance
+    mutable Mutex _contextCacheMutex; //< protects _contextCache and _identityCache
+    mutable std::map<std::string, OCIO_NAMESPACE::ConstContextRcPtr> _contextCache; //< local contexts, by content (see getLocalContext())
+    mutable std::map<std::string, bool> _identityCache; //< isIdentity() results, by processor key
 #endif
 };
 
@@ -245,6 +502,7 @@ public:
     OCIOProcessor(OFX::ImageEffect &instance)
         : OFX::PixelProcessor(instance)
         , _proc()
+        , _bakedLut(NULL)
         , _instance(&instance)
     {}
 
@@ -256,11 +514,43 @@ public:
         _proc = proc;
     }
 
+    // if set, the baked LUT is applied instead of the processor
+    void setBakedLut(const OCIOBakedLut* bakedLut)
+    {
+        _bakedLut = bakedLut;
+    }
+
 private:
+    // process integer or half pixels, converted to float kOCIOBlockSize pixels at a time
+    template <class PIX, int maxValue>
+    void processBlocks(const OfxRectI& procWindow, int numChannels);
+
     OCIO_NAMESPACE::ConstProcessorRcPtr _proc;
+    const OCIOBakedLut* _bakedLut;
     OFX::ImageEffect* _instance;
 };
 
+/**
+ * @brief Applies an OCIO processor (or a block transform, if not NULL) from srcImg to dstImg in a single pass.
+ *
+ * Each block of kOCIOBlockSize pixels is unpremultiplied, transformed, premultiplied,
+ * masked and mixed with the source while it is in the cache, so that no temporary image is needed.
+ * If proc is empty and transform is NULL, the color is not transformed.
+ * RGB and RGBA images of any bit depth are supported (the source, destination and mask must have the same depth):
+ * integer and half values are converted to float when the block is loaded, and back when it is stored.
+ **/
+void applyOCIOBlocks(OFX::ImageEffect& instance,
+                     const OfxRectI& renderWindow,
+                     const OFX::Image* srcImg,
+                     OFX::Image* dstImg,
+                     const OCIO_NAMESPACE::ConstProcessorRcPtr& proc,
+                     const OCIOBlockTransform* transform,
+                     bool premult,
+                     int premultChannel,
+                     double mix,
+                     const OFX::Image* maskImg,
+                     bool maskInvert);
+
 #endif
 
 NAMESPACE_OFX_IO_EXIT
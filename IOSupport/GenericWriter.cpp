@@ -24,14 +24,25 @@
 #include "GenericWriter.h"
 
 #include <cfloat> // DBL_MAX
-#include <cstring> // memset
+#include <cstddef> // ptrdiff_t
+#include <cstdio> // fopen, printf
+#include <cstring> // memset, memcpy
 #include <locale>
 #include <sstream>
+#include <iomanip>
 #include <algorithm>
+#include <list>
+#include <set>
+#include <ctime>
+#include <stdint.h> // uint64_t
 
 #include "ofxsLog.h"
 #include "ofxsCopier.h"
 #include "ofxsCoords.h"
+#include "ofxsMultiThread.h"
+#include "ofxsFileOpen.h"
+#include "tinythread.h"
+#include "OutputFile.h"
 
 #include "ofxsMultiPlane.h"
 
@@ -128,7 +139,7 @@ enum FormatTypeEnum
 
 #define kParamClipInfo "clipInfo"
 #define kParamClipInfoLabel "Clip Info..."
-#define kParamClipInfoHint "Display information about the inputs"
+#define kParamClipInfoHint "Display information about the inputs, and how many planes the last render could give to the encoder without copying them"
 
 #define kParamOutputSpaceLabel "File Colorspace"
 
@@ -145,6 +156,55 @@ enum FormatTypeEnum
 #define kParamOutputComponentsLabel "Output Components"
 #define kParamOutputComponentsHint "Map the input layer to this type of components before writing it to the output file."
 
+#define kParamWriteBehind "writeBehind"
+#define kParamWriteBehindLabel "Write Behind"
+#define kParamWriteBehindHint "When checked, each rendered frame is handed over to background threads which compress and write the file, " \
+    "so that rendering the next frames does not have to wait for the disk. Write errors are reported at the end of the render.\n" \
+    "This is only available when writing image files, and only applies to sequence renders."
+
+#define kParamEncodeByStrips "encodeByStrips"
+#define kParamEncodeByStripsLabel "Write by Strips"
+#define kParamEncodeByStripsHint "When checked, the input image is fetched, converted and written by horizontal strips (or rows of tiles for tiled files), " \
+    "from top to bottom, instead of all at once. This bounds the memory used for very large images, provided the host can render the input by regions.\n" \
+    "Frames written by strips do not use write behind. This is only available for formats that can be written incrementally."
+
+#define kParamSkipUnchanged "skipUnchanged"
+#define kParamSkipUnchangedLabel "Skip Unchanged Frames"
+#define kParamSkipUnchangedHint "When checked, a hash of each frame is compared with the one stored by the previous render in a hidden file next to the images " \
+    "(named after the output file, with the .hashes extension). Frames which did not change and whose file is still there are not rewritten, " \
+    "and the number of skipped frames is reported at the end of the render.\n" \
+    "This is only available when writing image files, and only applies to sequence renders of a single layer and view, not written by strips."
+
+#define kParamClaimFrames "claimFrames"
+#define kParamClaimFramesLabel "Claim Frames"
+#define kParamClaimFramesHint "When checked, several processes (e.g. render farm nodes) may render the same sequence at the same time without " \
+    "writing the same frame twice. Before rendering a frame, its lock file (named after the output file, with the .lock extension) is created " \
+    "on the shared filesystem. Frames whose file already exists, or which are locked by another process, are skipped. " \
+    "Since image files are written under a temporary name and renamed when complete, an existing file is always a complete frame.\n" \
+    "The lock files are updated every " kFrameClaimsHeartbeatString " seconds while the frame is being rendered, and a lock file which was not updated " \
+    "for " kFrameClaimsStaleAgeString " seconds (because the process that created it died) is taken over, so the clocks of the render nodes must be synchronized. " \
+    "To render a frame again, delete its file.\n" \
+    "This is only available when writing image files, only applies to sequence renders, and disables write behind."
+
+#define kParamFileSync "fileSync"
+#define kParamFileSyncLabel "Sync To Disk"
+#define kParamFileSyncHint "Image files are written to a hidden temporary file, which is renamed when complete, so that other programs never read " \
+    "a partially written file. This controls when the written files are flushed to disk, which guarantees that they survive a power failure, " \
+    "but is slow."
+#define kParamFileSyncOptionNone "None", "Leave it to the operating system.", "none"
+#define kParamFileSyncOptionFrame "Each Frame", "Flush each file to disk before renaming it. This is the safest, and the slowest.", "frame"
+#define kParamFileSyncOptionSequence "End of Sequence", "Flush all the files of a sequence together at the end of the render. " \
+    "A power failure during the render may leave incomplete files.", "sequence"
+
+#define kFrameClaimsHeartbeat 10 // seconds between two updates of the lock files held by this process
+#define kFrameClaimsHeartbeatString "10"
+#define kFrameClaimsStaleAge 120 // seconds after which a lock file that was not updated is considered abandoned
+#define kFrameClaimsStaleAgeString "120"
+#define kFrameClaimsLockExtension ".lock"
+
+#define kWriteBehindMaxThreads 4 // maximum number of frames being compressed and written at the same time
+#define kWriteBehindMaxPendingPerThread 2 // number of frames that may be waiting per thread before render() blocks
+
 #define kParamGuessedParams "ParamExistingInstance" // was guessParamsFromFilename already successfully called once on this instance
 
 #ifdef OFX_IO_USING_OCIO
@@ -160,6 +220,605 @@ template<typename T>
 static inline void
 unused(const T&) {}
 
+/**
+ * @brief A bounded queue of frames waiting to be encoded, served by a small pool of threads.
+ * render() reads the encoder parameters with prepareEncode(), pushes a private copy of the converted frame
+ * and returns, and encodePrepared() is called from one of the worker threads, which never use the host suites.
+ * Two frames with the same filename are never written at the same time.
+ * The first error is kept and reported by the next call to render() or by wait().
+ **/
+class GenericWriterPlugin::WriteBehindQueue
+{
+public:
+
+    struct Job
+    {
+        string filename;
+        OutputFile* output; // if not NULL, the frame is written to its temporary file
+        OutputFileSyncEnum sync;
+        EncodePlanesLocalData_RAII* encodeData; // filled by prepareEncode()
+        RamBuffer* mem;
+        int rowBytes;
+        bool recordHash; // record frameHash in the manifest once the file is committed
+        uint64_t frameHash;
+
+        Job()
+            : filename()
+            , output(NULL)
+            , sync(eOutputFileSyncNone)
+            , encodeData(NULL)
+            , mem(NULL)
+            , rowBytes(0)
+            , recordHash(false)
+            , frameHash(0)
+        {
+        }
+
+        ~Job()
+        {
+            delete encodeData;
+            delete mem;
+            delete output;
+        }
+    };
+
+    WriteBehindQueue(GenericWriterPlugin* effect,
+                     unsigned int nThreads)
+        : _effect(effect)
+        , _mutex()
+        , _jobAvailable()
+        , _jobDone()
+        , _jobs()
+        , _inFlight()
+        , _maxPendingJobs(nThreads * kWriteBehindMaxPendingPerThread)
+        , _quit(false)
+        , _error()
+        , _threads()
+    {
+        for (unsigned int i = 0; i < nThreads; ++i) {
+            _threads.push_back( new tthread::thread(&WriteBehindQueue::threadFunction, this) );
+        }
+    }
+
+    // Pending jobs are discarded: wait() must be called first to write them
+    ~WriteBehindQueue()
+    {
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            _quit = true;
+            for (std::list<Job*>::iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+                delete *it;
+            }
+            _jobs.clear();
+        }
+        _jobAvailable.notify_all();
+        for (vector<tthread::thread*>::iterator it = _threads.begin(); it != _threads.end(); ++it) {
+            (*it)->join();
+            delete *it;
+        }
+    }
+
+    // Takes ownership of job. Blocks while the queue is full, or while the same file is being written.
+    void push(Job* job)
+    {
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            while ( _jobs.size() >= _maxPendingJobs || isBusyWith(job->filename) ) {
+                _jobDone.wait(_mutex);
+            }
+            _jobs.push_back(job);
+        }
+        _jobAvailable.notify_one();
+    }
+
+    // Returns true and sets error if a previous job failed
+    bool getError(string* error)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        *error = _error;
+
+        return !_error.empty();
+    }
+
+    // Blocks until all jobs are written. Returns false and sets error if any of them failed
+    bool wait(string* error)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        while ( !_jobs.empty() || !_inFlight.empty() ) {
+            _jobDone.wait(_mutex);
+        }
+        *error = _error;
+
+        return _error.empty();
+    }
+
+private:
+
+    // must be called with _mutex locked
+    bool isBusyWith(const string& filename) const
+    {
+        if ( _inFlight.find(filename) != _inFlight.end() ) {
+            return true;
+        }
+        for (std::list<Job*>::const_iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+            if ( (*it)->filename == filename ) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void threadFunction(void* arg)
+    {
+        ( (WriteBehindQueue*)arg )->run();
+    }
+
+    void run()
+    {
+        for (;;) {
+            Job* job = NULL;
+            {
+                tthread::lock_guard<tthread::mutex> guard(_mutex);
+                while ( !_quit && _jobs.empty() ) {
+                    _jobAvailable.wait(_mutex);
+                }
+                if (_quit) {
+                    return;
+                }
+                job = _jobs.front();
+                _jobs.pop_front();
+                _inFlight.insert(job->filename);
+            }
+
+            // no host suite may be used from this thread: errors are only reported through _error
+            string error;
+            try {
+                _effect->encodePrepared(job->encodeData->getData(), (const float*)job->mem->getData(), job->rowBytes);
+                if ( job->output && !_effect->commitOutputFile(job->output, job->sync) ) {
+                    error = string("Cannot finish writing \"") + job->filename + '"';
+                } else if ( job->recordHash && _effect->_frameHashes.get() ) {
+                    _effect->_frameHashes->setWritten(job->filename, job->frameHash);
+                }
+            } catch (const std::exception& e) {
+                error = string("Error while writing \"") + job->filename + "\": " + e.what();
+            } catch (...) {
+                error = string("Unknown error while writing \"") + job->filename + '"';
+            }
+
+            {
+                tthread::lock_guard<tthread::mutex> guard(_mutex);
+                _inFlight.erase(_inFlight.find(job->filename));
+                if ( !error.empty() && _error.empty() ) {
+                    _error = error;
+                }
+            }
+            delete job;
+            _jobDone.notify_all();
+        }
+    }
+
+    GenericWriterPlugin* _effect;
+    tthread::mutex _mutex; // protects everything below
+    tthread::condition_variable _jobAvailable;
+    tthread::condition_variable _jobDone;
+    std::list<Job*> _jobs;
+    std::multiset<string> _inFlight; // filenames being written
+    size_t _maxPendingJobs;
+    bool _quit;
+    string _error; // the first error
+    vector<tthread::thread*> _threads;
+};
+
+/**
+ * @brief Counts the planes that were given to the encoder directly from the host image, and the bytes
+ * that had to be copied otherwise (conversion, packing, interleaving, write-behind).
+ * The counters cover the last sequence render and are displayed by the Clip Info button.
+ **/
+class GenericWriterPlugin::EncodeStats
+{
+public:
+
+    EncodeStats()
+        : _mutex()
+        , _zeroCopyPlanes(0)
+        , _copiedPlanes(0)
+        , _copiedBytes(0)
+        , _interleavedBytes(0)
+    {
+    }
+
+    void reset()
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        _zeroCopyPlanes = 0;
+        _copiedPlanes = 0;
+        _copiedBytes = 0;
+        _interleavedBytes = 0;
+    }
+
+    void addPlane(size_t copiedBytes)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        if (copiedBytes == 0) {
+            ++_zeroCopyPlanes;
+        } else {
+            ++_copiedPlanes;
+            _copiedBytes += copiedBytes;
+        }
+    }
+
+    void addInterleaved(size_t bytes)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        _interleavedBytes += bytes;
+    }
+
+    string getSummary()
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+        stringstream ss;
+
+        ss << _zeroCopyPlanes << " plane(s) passed through, " << _copiedPlanes << " plane(s) copied (" << _copiedBytes << " bytes), "
+           << _interleavedBytes << " bytes interleaved";
+
+        return ss.str();
+    }
+
+private:
+    tthread::mutex _mutex; // protects everything below
+    size_t _zeroCopyPlanes;
+    size_t _copiedPlanes;
+    size_t _copiedBytes;
+    size_t _interleavedBytes;
+};
+
+
+static inline uint64_t
+hashCombine(uint64_t h,
+            uint64_t k)
+{
+    // from MurmurHash64A
+    const uint64_t m = ( (uint64_t)0xc6a4a793 << 32 ) | 0x5bd1e995;
+
+    k *= m;
+    k ^= k >> 47;
+    k *= m;
+    h ^= k;
+    h *= m;
+
+    return h;
+}
+
+static uint64_t
+hashBytes(uint64_t h,
+          const void* data,
+          size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t k;
+        std::memcpy( &k, p, sizeof(uint64_t) );
+        h = hashCombine(h, k);
+    }
+    if (len > 0) {
+        uint64_t k = 0;
+        std::memcpy(&k, p, len);
+        h = hashCombine(h, k);
+    }
+
+    return h;
+}
+
+// Hash of the pixels of an encoder-ready buffer, and of the settings used to encode it
+static uint64_t
+hashFrame(const float* pixelData,
+          const OfxRectI& bounds,
+          int pixelDataNComps,
+          int rowBytes,
+          const string& settings)
+{
+    uint64_t h = hashBytes( 0, settings.data(), settings.size() );
+    // the same pixels at another position are another image
+    h = hashBytes( h, &bounds, sizeof(bounds) );
+    const size_t usedRowBytes = (size_t)(bounds.x2 - bounds.x1) * pixelDataNComps * sizeof(float);
+
+    for (int y = bounds.y1; y < bounds.y2; ++y) {
+        h = hashBytes(h, (const char*)pixelData + (std::ptrdiff_t)(y - bounds.y1) * rowBytes, usedRowBytes);
+    }
+    h ^= h >> 47;
+
+    return h;
+}
+
+/**
+ * @brief The hashes of the frames written by the previous renders of a sequence, stored in a hidden file
+ * next to the images. A frame is unchanged if its hash is the same and its file still has the same size.
+ * When saved, the file is read again and merged with the frames written since it was loaded, so that
+ * several processes writing parts of the same sequence keep each other's entries.
+ **/
+class GenericWriterPlugin::FrameHashManifest
+{
+public:
+
+    FrameHashManifest(const string& path)
+        : _path(path)
+        , _mutex()
+        , _entries()
+        , _written()
+        , _skipped(0)
+    {
+        load(_path, &_entries);
+    }
+
+    // Returns true if filename already contains the frame with the given hash
+    bool isUnchanged(const string& filename,
+                     uint64_t hash)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+        map<string, Entry>::const_iterator found = _entries.find(filename);
+        uint64_t size;
+
+        if ( ( found == _entries.end() ) || (found->second.hash != hash) ||
+             !getFileSize(filename, &size) || (size != found->second.size) ) {
+            return false;
+        }
+        ++_skipped;
+
+        return true;
+    }
+
+    // Must only be called once the frame was encoded and its file committed. The file size is read by save().
+    void setWritten(const string& filename,
+                    uint64_t hash)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        _written[filename] = hash;
+    }
+
+    int getSkippedCount()
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        return _skipped;
+    }
+
+    // Must be called once all frames are written
+    bool save()
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        if ( _written.empty() ) {
+            return true;
+        }
+        map<string, Entry> entries;
+        load(_path, &entries);
+        for (map<string, uint64_t>::const_iterator it = _written.begin(); it != _written.end(); ++it) {
+            Entry e;
+            e.hash = it->second;
+            if ( getFileSize(it->first, &e.size) ) {
+                entries[it->first] = e;
+            } else {
+                entries.erase(it->first);
+            }
+        }
+
+        stringstream tmpPath;
+        tmpPath << _path << '.' << (size_t)this << ".tmp";
+        std::FILE* file = fopen_utf8(tmpPath.str().c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        bool ok = true;
+        for (map<string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            stringstream line;
+            line << std::hex << std::setw(16) << std::setfill('0') << it->second.hash << std::dec << ' ' << it->second.size << ' ' << it->first << '\n';
+            const string& l = line.str();
+            ok = ok && std::fwrite(l.data(), 1, l.size(), file) == l.size();
+        }
+        ok = (std::fclose(file) == 0) && ok;
+        if ( !ok || !renameFile(tmpPath.str(), _path) ) {
+            removeFile( tmpPath.str() );
+
+            return false;
+        }
+        _written.clear();
+
+        return true;
+    }
+
+private:
+
+    struct Entry
+    {
+        uint64_t hash;
+        uint64_t size;
+    };
+
+    static void load(const string& path,
+                     map<string, Entry>* entries)
+    {
+        std::FILE* file = fopen_utf8(path.c_str(), "rb");
+
+        if (!file) {
+            return;
+        }
+        char buf[4096];
+        // each line is: hash size filename
+        while ( std::fgets(buf, sizeof(buf), file) ) {
+            std::istringstream line(buf);
+            Entry e;
+            string filename;
+            if ( line >> std::hex >> e.hash >> std::dec >> e.size && line.get() == ' ' && std::getline(line, filename) && !filename.empty() ) {
+                if (filename[filename.size() - 1] == '\r') {
+                    filename.erase(filename.size() - 1);
+                }
+                (*entries)[filename] = e;
+            }
+        }
+        std::fclose(file);
+    }
+
+    string _path;
+    tthread::mutex _mutex; // protects everything below
+    map<string, Entry> _entries; // as loaded when the sequence render began
+    map<string, uint64_t> _written; // frames written since then
+    int _skipped;
+};
+
+/**
+ * @brief Lets several processes render the same sequence on a shared filesystem, each frame being written by only one of them.
+ * A frame is claimed by creating its lock file exclusively. A background thread updates the modification time of the lock files
+ * held by this process every kFrameClaimsHeartbeat seconds, so that a lock file which is older than kFrameClaimsStaleAge seconds
+ * can be taken over: the process that held it died.
+ **/
+class GenericWriterPlugin::FrameClaims
+{
+public:
+
+    // A frame claimed by this process. The claim is released when it is deleted.
+    class Claim
+    {
+public:
+
+        Claim(FrameClaims* claims,
+              const string& filename)
+            : _claims(claims)
+            , _filename(filename)
+        {
+        }
+
+        ~Claim()
+        {
+            _claims->release(_filename);
+        }
+
+private:
+
+        FrameClaims* _claims;
+        string _filename;
+    };
+
+    FrameClaims()
+        : _mutex()
+        , _locks()
+        , _quit(false)
+        , _thread(NULL)
+    {
+        _thread = new tthread::thread(&FrameClaims::threadFunction, this);
+    }
+
+    // All claims must have been deleted
+    ~FrameClaims()
+    {
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            assert( _locks.empty() );
+            _quit = true;
+        }
+        _thread->join();
+        delete _thread;
+    }
+
+    // Returns NULL if the frame was already written, or is being written by another process
+    Claim* claim(const string& filename)
+    {
+        uint64_t size;
+
+        if ( getFileSize(filename, &size) ) {
+            return NULL;
+        }
+        const string lockPath = filename + kFrameClaimsLockExtension;
+        stringstream contents;
+        contents << "pid " << getProcessId() << '\n';
+        if ( !createFileExclusive( lockPath, contents.str() ) &&
+             ( !takeOverStaleLock(lockPath) || !createFileExclusive( lockPath, contents.str() ) ) ) {
+            return NULL;
+        }
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            _locks.insert(lockPath);
+        }
+        auto_ptr<Claim> c( new Claim(this, filename) );
+        // the frame may have been completed by the process we took the lock from
+        if ( getFileSize(filename, &size) ) {
+            return NULL;
+        }
+
+        return c.release();
+    }
+
+    // Called by ~Claim()
+    void release(const string& filename)
+    {
+        const string lockPath = filename + kFrameClaimsLockExtension;
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        _locks.erase(lockPath);
+        removeFile(lockPath);
+    }
+
+private:
+
+    // Removes the lock file if it is abandoned. Only one of the processes trying to do this at the same time succeeds.
+    static bool takeOverStaleLock(const string& lockPath)
+    {
+        if (getFileAge(lockPath) < kFrameClaimsStaleAge) {
+            return false;
+        }
+        // rename() is atomic: if several processes find the same stale lock, only the first one moves it away
+        stringstream stalePath;
+        stalePath << lockPath << '.' << getProcessId() << ".stale";
+        if ( std::rename( lockPath.c_str(), stalePath.str().c_str() ) != 0 ) {
+            return false;
+        }
+        const bool taken = getFileAge( stalePath.str() ) >= kFrameClaimsStaleAge;
+        // Another process may have taken it over in the meantime. Renaming it back could replace a claim made
+        // since then, so it is removed: its owner creates it again at its next heartbeat.
+        removeFile( stalePath.str() );
+
+        return taken;
+    }
+
+    static void threadFunction(void* arg)
+    {
+        ( (FrameClaims*)arg )->run();
+    }
+
+    void run()
+    {
+        for (int ticks = 1;; ++ticks) {
+            tthread::this_thread::sleep_for( tthread::chrono::milliseconds(100) );
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            if (_quit) {
+                return;
+            }
+            if (ticks >= kFrameClaimsHeartbeat * 10) {
+                for (std::set<string>::const_iterator it = _locks.begin(); it != _locks.end(); ++it) {
+                    // the lock file may have been removed by a process which took it over at the same time as us
+                    if ( !touchFile(*it) ) {
+                        stringstream contents;
+                        contents << "pid " << getProcessId() << '\n';
+                        createFileExclusive( *it, contents.str() );
+                    }
+                }
+                ticks = 0;
+            }
+        }
+    }
+
+    tthread::mutex _mutex; // protects everything below
+    std::set<string> _locks; // lock files held by this process
+    bool _quit;
+    tthread::thread* _thread;
+};
 
 GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
                                          const vector<string>& extensions,
@@ -194,6 +853,16 @@ GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
     , _supportsXY(supportsXY)
     , _supportsAlpha(supportsAlpha)
     , _outputComponentsTable()
+    , _writeBehind(NULL)
+    , _writeBehindQueue()
+    , _encodeStats(new EncodeStats)
+    , _encodeByStrips(NULL)
+    , _skipUnchanged(NULL)
+    , _frameHashes()
+    , _claimFrames(NULL)
+    , _frameClaims()
+    , _fileSync(NULL)
+    , _outputFileSync()
 {
     _inputClip = fetchClip(kOfxImageEffectSimpleSourceClipName);
     _outputClip = fetchClip(kOfxImageEffectOutputClipName);
@@ -229,6 +898,16 @@ GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
     assert(_processChannels[0] && _processChannels[1] && _processChannels[2] && _processChannels[3] && _outputComponents);
 
     _guessedParams = fetchBooleanParam(kParamGuessedParams);
+    _writeBehind = fetchBooleanParam(kParamWriteBehind);
+    assert(_writeBehind);
+    _encodeByStrips = fetchBooleanParam(kParamEncodeByStrips);
+    assert(_encodeByStrips);
+    _skipUnchanged = fetchBooleanParam(kParamSkipUnchanged);
+    assert(_skipUnchanged);
+    _claimFrames = fetchBooleanParam(kParamClaimFrames);
+    assert(_claimFrames);
+    _fileSync = fetchChoiceParam(kParamFileSync);
+    assert(_fileSync);
 
 #ifdef OFX_IO_USING_OCIO
     _outputSpaceSet = fetchBooleanParam(kParamOutputSpaceSet);
@@ -361,20 +1040,279 @@ getPixelsComponentsCount(const string& rawComponents,
         *mappedComponents = ePixelComponentAlpha;
         break;
     case 2:
-        *mappedComponents = ePixelComponentXY;
+        *mappedComponents = ePixelComponentXY;
+        break;
+    case 3:
+        *mappedComponents = ePixelComponentRGB;
+        break;
+    case 4:
+        *mappedComponents = ePixelComponentRGBA;
+        break;
+    default:
+        assert(false);
+        break;
+    }
+
+    return (int)plane.getNumComponents();
+}
+
+static PixelComponentEnum
+pixelComponentsFromCount(int nComps)
+{
+    switch (nComps) {
+    case 1:
+        return ePixelComponentAlpha;
+    case 2:
+        return ePixelComponentXY;
+    case 3:
+        return ePixelComponentRGB;
+    case 4:
+        return ePixelComponentRGBA;
+    default:
+        assert(false);
+
+        return ePixelComponentNone;
+    }
+}
+
+#define kConvertAndPackChunkSize 1024 // number of pixels converted at once, the scratch buffer should fit in the L1/L2 cache
+
+/**
+ * @brief Converts the source image to the layout expected by the encoder in a single pass:
+ * force opaque or unpremultiply, apply the OCIO processor, premultiply and pack the channels.
+ * Each row is processed by chunks of kConvertAndPackChunkSize pixels in a small scratch buffer,
+ * so that the source image is read once and the destination buffer is written once.
+ * Pixels of the destination that are outside of the source bounds are black and transparent,
+ * and are not color-converted.
+ **/
+class ConvertAndPackProcessorBase
+    : public PixelProcessorFilterBase
+{
+protected:
+    bool _opaque;
+    bool _unpremult;
+    bool _premult;
+#ifdef OFX_IO_USING_OCIO
+    OCIO::ConstProcessorRcPtr _proc;
+#endif
+    vector<int> _mapping; // maps dst channels to src channels, empty if no packing is required
+
+public:
+    ConvertAndPackProcessorBase(ImageEffect& instance)
+        : PixelProcessorFilterBase(instance)
+        , _opaque(false)
+        , _unpremult(false)
+        , _premult(false)
+#ifdef OFX_IO_USING_OCIO
+        , _proc()
+#endif
+        , _mapping()
+    {
+    }
+
+    void setValues(bool opaque,
+                   bool unpremult,
+                   bool premult,
+                   const vector<int>& mapping)
+    {
+        _opaque = opaque;
+        _unpremult = unpremult;
+        _premult = premult;
+        _mapping = mapping;
+    }
+
+#ifdef OFX_IO_USING_OCIO
+    void setProcessor(const OCIO::ConstProcessorRcPtr& proc)
+    {
+        _proc = proc;
+    }
+
+#endif
+};
+
+template <int srcNComps>
+class ConvertAndPackProcessor
+    : public ConvertAndPackProcessorBase
+{
+public:
+    ConvertAndPackProcessor(ImageEffect& instance)
+        : ConvertAndPackProcessorBase(instance)
+    {
+    }
+
+private:
+    // write n pixels from the scratch buffer (in the source layout) to dstPix
+    void writePixels(const float* buf,
+                     int n,
+                     float* dstPix) const
+    {
+        if ( _mapping.empty() ) {
+            assert(_dstPixelComponentCount == srcNComps);
+            std::memcpy( dstPix, buf, n * srcNComps * sizeof(float) );
+
+            return;
+        }
+        // same as PackPixelsProcessor
+        for (int i = 0; i < n; ++i, buf += srcNComps, dstPix += _dstPixelComponentCount) {
+            for (int c = 0; c < _dstPixelComponentCount; ++c) {
+                int srcCol = _mapping[c];
+                if (srcCol == -1) {
+                    dstPix[c] = c != 3 ? 0. : 1.;
+                } else if (srcCol < srcNComps) {
+                    dstPix[c] = buf[srcCol];
+                } else if (srcNComps == 1) {
+                    dstPix[c] = *buf;
+                } else {
+                    dstPix[c] = c != 3 ? 0. : 1.;
+                }
+            }
+        }
+    }
+
+    // convert n pixels in place
+    void convertPixels(float* buf,
+                       int n) const
+    {
+        if ( _opaque && ( (srcNComps == 4) || (srcNComps == 1) ) ) {
+            for (int i = 0; i < n; ++i) {
+                buf[i * srcNComps + srcNComps - 1] = 1.;
+            }
+        }
+        if (srcNComps == 4) {
+            if (_unpremult) {
+                // same as PixelCopierUnPremult
+                for (int i = 0; i < n; ++i) {
+                    float* p = buf + i * 4;
+                    if (p[3] > FLT_EPSILON) {
+                        p[0] /= p[3];
+                        p[1] /= p[3];
+                        p[2] /= p[3];
+                    }
+                }
+            }
+        }
+#ifdef OFX_IO_USING_OCIO
+        if ( _proc && ( (srcNComps == 3) || (srcNComps == 4) ) ) {
+            try {
+                OCIO::PackedImageDesc img(buf, n, 1, srcNComps);
+                _proc->apply(img);
+            } catch (OCIO::Exception &e) {
+                _effect.setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
+                throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
+            }
+        }
+#endif
+        if (srcNComps == 4) {
+            if (_premult) {
+                for (int i = 0; i < n; ++i) {
+                    float* p = buf + i * 4;
+                    p[0] *= p[3];
+                    p[1] *= p[3];
+                    p[2] *= p[3];
+                }
+            }
+        }
+    }
+
+    virtual void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        assert( _mapping.empty() || (int)_mapping.size() == _dstPixelComponentCount );
+        float buf[kConvertAndPackChunkSize * srcNComps];
+        float zero[kConvertAndPackChunkSize * srcNComps];
+        std::memset( zero, 0, sizeof(zero) );
+
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( (y % 10 == 0) && _effect.abort() ) {
+                //check for abort only every 10 lines
+                break;
+            }
+            float* dstPix = (float*)getDstPixelAddress(procWindow.x1, y);
+            assert(dstPix);
+            const bool rowInSrc = (_srcBounds.y1 <= y && y < _srcBounds.y2);
+            int x = procWindow.x1;
+            while (x < procWindow.x2) {
+                int xEnd;
+                if ( !rowInSrc || (x < _srcBounds.x1) || (_srcBounds.x2 <= x) ) {
+                    // outside of the source image
+                    xEnd = std::min(procWindow.x2, x + kConvertAndPackChunkSize);
+                    if ( rowInSrc && (x < _srcBounds.x1) ) {
+                        xEnd = std::min(xEnd, _srcBounds.x1);
+                    }
+                    writePixels(zero, xEnd - x, dstPix);
+                } else {
+                    xEnd = std::min( std::min(procWindow.x2, _srcBounds.x2), x + kConvertAndPackChunkSize );
+                    const int n = xEnd - x;
+                    const float* srcPix = (const float*)getSrcPixelAddress(x, y);
+                    assert(srcPix);
+                    std::memcpy( buf, srcPix, n * srcNComps * sizeof(float) );
+                    convertPixels(buf, n);
+                    writePixels(buf, n, dstPix);
+                }
+                dstPix += (xEnd - x) * _dstPixelComponentCount;
+                x = xEnd;
+            }
+        }
+    }
+};
+
+void
+GenericWriterPlugin::convertAndPackPixelBuffer(const OfxRectI& renderWindow,
+                                               const void *srcPixelData,
+                                               const OfxRectI& srcBounds,
+                                               PixelComponentEnum srcPixelComponents,
+                                               int srcPixelComponentCount,
+                                               int srcRowBytes,
+                                               bool opaque,
+                                               bool unpremult,
+                                               bool applyOCIO,
+                                               bool premult,
+                                               double time,
+                                               const vector<int>& channelsMapping,
+                                               int dstPixelComponentCount,
+                                               int dstRowBytes,
+                                               void* dstPixelData)
+{
+    auto_ptr<ConvertAndPackProcessorBase> p;
+    switch (srcPixelComponentCount) {
+    case 1:
+        p.reset( new ConvertAndPackProcessor<1>(*this) );
+        break;
+    case 2:
+        p.reset( new ConvertAndPackProcessor<2>(*this) );
         break;
     case 3:
-        *mappedComponents = ePixelComponentRGB;
+        p.reset( new ConvertAndPackProcessor<3>(*this) );
         break;
     case 4:
-        *mappedComponents = ePixelComponentRGBA;
+        p.reset( new ConvertAndPackProcessor<4>(*this) );
         break;
     default:
-        assert(false);
-        break;
+        //Unsupported components
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
     }
+#ifdef OFX_IO_USING_OCIO
+    if (applyOCIO) {
+        OCIO::ConstProcessorRcPtr proc = _ocio->getOrCreateProcessor(time);
+        if (!proc) {
+            setPersistentMessage( Message::eMessageError, "", "Cannot create OCIO processor" );
+            throwSuiteStatusException(kOfxStatFailed);
 
-    return (int)plane.getNumComponents();
+            return;
+        }
+        p->setProcessor(proc);
+    }
+#else
+    unused(applyOCIO);
+    unused(time);
+#endif
+    p->setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, eBitDepthFloat, srcRowBytes, 0);
+    p->setDstImg(dstPixelData, renderWindow, pixelComponentsFromCount(dstPixelComponentCount), dstPixelComponentCount, eBitDepthFloat, dstRowBytes);
+    p->setRenderWindow(renderWindow);
+    p->setValues(opaque, unpremult, premult, channelsMapping);
+
+    p->process();
 }
 
 void
@@ -465,6 +1403,9 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
     *mappedComponentsCount = srcMappedComponentsCount;
     assert(srcMappedComponentsCount != 0 && srcMappedComponents != ePixelComponentNone);
 
+    // packing is required if channels are not contiguous, or if some channels are not written
+    const bool needPacking = doAnyPacking && ( !packingContiguous || ( (int)packingMapping.size() != srcMappedComponentsCount ) );
+
     bool renderWindowIsBounds = renderWindow.x1 == bounds->x1 &&
                                 renderWindow.y1 == bounds->y1 &&
                                 renderWindow.x2 == bounds->x2 &&
@@ -479,6 +1420,9 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
 
         *tmpMemPtr = (float*)srcPixelData;
         *rowBytes = srcRowBytes;
+        if (!needPacking) {
+            _encodeStats->addPlane(0);
+        }
 
         // copy to dstImg if necessary
         if ( (renderRequestedView == view) && _outputClip && _outputClip->isConnected() ) {
@@ -516,9 +1460,12 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
         }
     } else {
         // generic case: some conversions are needed.
+        // They are all done in a single pass, which also packs the channels if needed.
+
+        const int dstNComps = needPacking ? (int)packingMapping.size() : srcMappedComponentsCount;
 
         // allocate
-        int pixelBytes = srcMappedComponentsCount * getComponentBytes(bitDepth);
+        int pixelBytes = dstNComps * getComponentBytes(bitDepth);
         int tmpRowBytes = (renderWindow.x2 - renderWindow.x1) * pixelBytes;
         *rowBytes = tmpRowBytes;
         size_t memSize = (size_t)(renderWindow.y2 - renderWindow.y1) * (size_t)tmpRowBytes;
@@ -530,82 +1477,44 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
 
             return;
         }
+        _encodeStats->addPlane(memSize);
 
-        float* tmpPixelData = *tmpMemPtr;
+        // Opaque: force the alpha channel to 1
+        const bool opaque = (userPremult == eImageOpaque) && ( (srcMappedComponents == ePixelComponentRGBA) ||
+                                                               ( srcMappedComponents == ePixelComponentAlpha) );
+        bool unpremult;
+        bool premult;
+        if (isOCIOIdentity) {
+            // bypass OCIO
+            unpremult = !noPremult && (userPremult == eImagePreMultiplied) && (pluginExpectedPremult == eImageUnPreMultiplied);
+            premult = !noPremult && (userPremult == eImageUnPreMultiplied) && (pluginExpectedPremult == eImagePreMultiplied);
+        } else {
+            // OCIO expects unpremultiplied input
+            unpremult = !noPremult && (userPremult == eImagePreMultiplied);
+            ///If needed, re-premult the image for the plugin to work correctly
+            premult = (pluginExpectedPremult == eImagePreMultiplied) && (srcMappedComponents == ePixelComponentRGBA);
+        }
+        const bool applyOCIO = !isOCIOIdentity && ( (srcMappedComponents == ePixelComponentRGB) || (srcMappedComponents == ePixelComponentRGBA) );
 
-        // Set to black and transparant so that outside the portion defined by the image there's nothing.
-        if (!renderWindowIsBounds) {
-            std::memset(tmpPixelData, 0, memSize);
+        // Pixels outside of the source bounds are set to black and transparent.
+        convertAndPackPixelBuffer(renderWindow, srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount, srcRowBytes,
+                                  opaque, unpremult, applyOCIO, premult, time,
+                                  needPacking ? packingMapping : vector<int>(),
+                                  dstNComps, tmpRowBytes, *tmpMemPtr);
+        if (needPacking) {
+            *mappedComponentsCount = dstNComps;
+            *mappedComponents = pixelComponentsFromCount(dstNComps);
         }
 
         // Clip the render window to the bounds of the source image.
         OfxRectI renderWindowClipped;
         if ( !intersect(renderWindow, *bounds, &renderWindowClipped) ) {
-            // Nothing to do, exit
+            // Nothing to copy, exit
+            *bounds = renderWindow;
+
             return;
         }
 
-        if (isOCIOIdentity) {
-            // bypass OCIO
-
-            if ( noPremult || (userPremult == pluginExpectedPremult) ) {
-                if ( (userPremult == eImageOpaque) && ( (srcMappedComponents == ePixelComponentRGBA) ||
-                                                        ( srcMappedComponents == ePixelComponentAlpha) ) ) {
-                    // Opaque: force the alpha channel to 1
-                    copyPixelsOpaque(*this, renderWindowClipped,
-                                     srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount, bitDepth, srcRowBytes,
-                                     tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-                } else {
-                    // copy the whole raw src image
-                    copyPixels(*this, renderWindowClipped,
-                               srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount, bitDepth, srcRowBytes,
-                               tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-                }
-            } else if (userPremult == eImagePreMultiplied) {
-                assert(pluginExpectedPremult == eImageUnPreMultiplied);
-                unPremultPixelData(renderWindow, srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount
-                                   , bitDepth, srcRowBytes, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-            } else {
-                assert(userPremult == eImageUnPreMultiplied);
-                assert(pluginExpectedPremult == eImagePreMultiplied);
-                premultPixelData(renderWindow, srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount
-                                 , bitDepth, srcRowBytes, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-            }
-        } else {
-            assert(!isOCIOIdentity);
-            // OCIO expects unpremultiplied input
-            if ( noPremult || (userPremult == eImageUnPreMultiplied) ) {
-                if ( (userPremult == eImageOpaque) && ( (srcMappedComponents == ePixelComponentRGBA) ||
-                                                        ( srcMappedComponents == ePixelComponentAlpha) ) ) {
-                    // Opaque: force the alpha channel to 1
-                    copyPixelsOpaque(*this, renderWindowClipped,
-                                     srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount, bitDepth, srcRowBytes,
-                                     tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-                } else {
-                    // copy the whole raw src image
-                    copyPixels(*this, renderWindowClipped,
-                               srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount, bitDepth, srcRowBytes,
-                               tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-                }
-            } else {
-                assert(userPremult == eImagePreMultiplied);
-                unPremultPixelData(renderWindow, srcPixelData, *bounds, srcMappedComponents, srcMappedComponentsCount
-                                   , bitDepth, srcRowBytes, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-            }
-#         ifdef OFX_IO_USING_OCIO
-            // do the color-space conversion
-            if ( (srcMappedComponents == ePixelComponentRGB) || (srcMappedComponents == ePixelComponentRGBA) ) {
-                _ocio->apply(time, renderWindowClipped, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, tmpRowBytes);
-            }
-#         endif
-
-            ///If needed, re-premult the image for the plugin to work correctly
-            if ( (pluginExpectedPremult == eImagePreMultiplied) && (srcMappedComponents == ePixelComponentRGBA) ) {
-                premultPixelData(renderWindow, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount
-                                 , bitDepth, tmpRowBytes, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, bitDepth, tmpRowBytes);
-            }
-        } // if (isOCIOIdentity) {
-
         // copy to dstImg if necessary
         if ( (renderRequestedView == view) && _outputClip && _outputClip->isConnected() ) {
             auto_ptr<Image> dstImg( _outputClip->fetchImagePlane( time, renderRequestedView, plane.c_str() ) );
@@ -663,7 +1572,8 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
     } // if (renderWindowIsBounds && isOCIOIdentity && (noPremult || userPremult == pluginExpectedPremult))
 
 
-    if ( doAnyPacking && ( !packingContiguous || ( (int)packingMapping.size() != srcMappedComponentsCount ) ) ) {
+    if (needPacking && !*tmpMem) {
+        // pass-through case: only packing is needed
         int pixelBytes = packingMapping.size() * getComponentBytes(bitDepth);
         int tmpRowBytes = (renderWindow.x2 - renderWindow.x1) * pixelBytes;
         size_t memSize = (size_t)(renderWindow.y2 - renderWindow.y1) * (size_t)tmpRowBytes;
@@ -677,28 +1587,13 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
         }
 
         packPixelBuffer(renderWindow, *tmpMemPtr, *bounds, bitDepth, *rowBytes, srcMappedComponents, packingMapping, tmpRowBytes, packingBufferData);
+        _encodeStats->addPlane(memSize);
 
         *tmpMemPtr = packingBufferData;
         *rowBytes = tmpRowBytes;
         *bounds = renderWindow;
         *mappedComponentsCount = packingMapping.size();
-        switch ( packingMapping.size() ) {
-        case 1:
-            *mappedComponents = ePixelComponentAlpha;
-            break;
-        case 2:
-            *mappedComponents = ePixelComponentXY;
-            break;
-        case 3:
-            *mappedComponents = ePixelComponentRGB;
-            break;
-        case 4:
-            *mappedComponents = ePixelComponentRGBA;
-            break;
-        default:
-            assert(false);
-            break;
-        }
+        *mappedComponents = pixelComponentsFromCount( packingMapping.size() );
     }
 } // GenericWriterPlugin::fetchPlaneConvertAndCopy
 
@@ -711,6 +1606,23 @@ struct ImageData
     int pixelComponentsCount;
 };
 
+static EncodePartPlane
+makeEncodePartPlane(const ImageData& data,
+                    bool doAnyPacking,
+                    const vector<int>& packingMapping)
+{
+    EncodePartPlane p;
+
+    p.pixelData = data.srcPixelData;
+    p.bounds = data.bounds;
+    p.pixelDataNComps = data.pixelComponentsCount;
+    p.srcNCompsStartIndex = doAnyPacking ? packingMapping[0] : 0;
+    p.nComps = doAnyPacking ? (int)packingMapping.size() : data.pixelComponentsCount;
+    p.rowBytes = data.rowBytes;
+
+    return p;
+}
+
 void
 GenericWriterPlugin::getPackingOptions(bool *allCheckboxHidden,
                                        vector<int>* packingMapping) const
@@ -930,10 +1842,39 @@ GenericWriterPlugin::render(const RenderArguments &args)
     }
     assert( !viewNames.empty() );
 
+    auto_ptr<FrameClaims::Claim> claim;
+    if ( _frameClaims.get() ) {
+        claim.reset( _frameClaims->claim(filename) );
+        if ( !claim.get() ) {
+            // the frame was written, or is being written, by another process
+            clearPersistentMessage();
+
+            return;
+        }
+    }
+
+    // The hash of the frame is only recorded once its file is complete
+    bool recordHash = false;
+    uint64_t frameHash = 0;
+
+    // Image files are written to a temporary file, which is renamed once complete
+    string encodeFilename = filename;
+    auto_ptr<OutputFile> output;
+    OutputFileSyncEnum sync = (OutputFileSyncEnum)_fileSync->getValue();
+    if ( isImageFile( extension(filename) ) ) {
+        output.reset( new OutputFile(filename) );
+        encodeFilename = output->getTemporaryFilename();
+    }
+
     //This controls how we split into parts
     LayerViewsPartsEnum partsSplit = getPartsSplittingPreference();
 
-    if ( (viewNames.size() == 1) && (args.planes.size() == 1) ) {
+    if ( (viewNames.size() == 1) && (args.planes.size() == 1) &&
+         _encodeByStrips->getValue() && supportsEncodeStrips(filename) ) {
+        // Very large images: never hold the whole frame
+        encodeByStrips(encodeFilename, args.planes.front(), viewNames.begin()->first, viewNames.begin()->second, args, time, pixelAspectRatio,
+                       pluginExpectedPremult, userPremult, isOCIOIdentity, doAnyPacking, packingContiguous, packingMapping);
+    } else if ( (viewNames.size() == 1) && (args.planes.size() == 1) ) {
         //Regular case, just do a simple part
         int viewIndex = viewNames.begin()->first;
         InputImagesHolder dataHolder; // owns srcImg and tmpMem
@@ -946,7 +1887,70 @@ GenericWriterPlugin::render(const RenderArguments &args)
         int dstNComps = doAnyPacking ? packingMapping.size() : data.pixelComponentsCount;
         int dstNCompsStartIndex = doAnyPacking ? packingMapping[0] : 0;
 
-        encode(filename, time, viewNames[0], data.srcPixelData, args.renderWindow, pixelAspectRatio, data.pixelComponentsCount, dstNCompsStartIndex, dstNComps, data.rowBytes);
+        if ( _frameHashes.get() && data.srcPixelData ) {
+            stringstream settings;
+            appendEncodeSettings(time, settings);
+            settings << ' ' << viewNames.begin()->second << ' ' << pixelAspectRatio << ' ' << dstNCompsStartIndex << ' ' << dstNComps;
+            frameHash = hashFrame(data.srcPixelData, args.renderWindow, data.pixelComponentsCount, data.rowBytes, settings.str());
+            if ( _frameHashes->isUnchanged(filename, frameHash) ) {
+                // the file already holds this image
+                clearPersistentMessage();
+
+                return;
+            }
+            recordHash = true;
+        }
+
+        auto_ptr<EncodePlanesLocalData_RAII> encodeData;
+        if ( _writeBehindQueue.get() ) {
+            string error;
+            if ( _writeBehindQueue->getError(&error) ) {
+                setPersistentMessage(Message::eMessageError, "", error);
+                throwSuiteStatusException(kOfxStatFailed);
+            }
+            if (!data.srcPixelData) {
+                // no input image: there is nothing to copy for the writer threads
+                clearPersistentMessage();
+
+                return;
+            }
+            // the writer threads must not read the parameters: the encoder reads them now
+            encodeData.reset( new EncodePlanesLocalData_RAII(this) );
+            if ( !prepareEncode(encodeData->getData(), encodeFilename, time, viewNames[0], args.renderWindow, pixelAspectRatio, data.pixelComponentsCount, dstNCompsStartIndex, dstNComps) ) {
+                // this encoder does not support write-behind
+                encodeData.reset();
+            }
+        }
+        if ( encodeData.get() ) {
+            // the source image and the temporary buffers are released when this function returns:
+            // give the writer threads their own copy of the frame.
+            auto_ptr<WriteBehindQueue::Job> job(new WriteBehindQueue::Job);
+            const int width = args.renderWindow.x2 - args.renderWindow.x1;
+            const int height = args.renderWindow.y2 - args.renderWindow.y1;
+            const size_t jobRowBytes = (size_t)width * data.pixelComponentsCount * sizeof(float);
+            job->mem = new RamBuffer(jobRowBytes * height);
+            unsigned char* jobData = job->mem->getData();
+            if (!jobData) {
+                throwSuiteStatusException(kOfxStatErrMemory);
+
+                return;
+            }
+            for (int y = 0; y < height; ++y) {
+                std::memcpy(jobData + y * jobRowBytes, (const char*)data.srcPixelData + (std::ptrdiff_t)y * data.rowBytes, jobRowBytes);
+            }
+            job->filename = filename;
+            job->output = output.release();
+            job->sync = sync;
+            job->encodeData = encodeData.release();
+            job->rowBytes = (int)jobRowBytes;
+            job->recordHash = recordHash;
+            job->frameHash = frameHash;
+            _writeBehindQueue->push( job.release() );
+            // the writer thread records the hash once the file is committed
+            recordHash = false;
+        } else {
+            encode(encodeFilename, time, viewNames[0], data.srcPixelData, args.renderWindow, pixelAspectRatio, data.pixelComponentsCount, dstNCompsStartIndex, dstNComps, data.rowBytes);
+        }
     } else {
         /*
            Use the beginEncodeParts/encodePart/endEncodeParts API when there are multiple views/planes to render
@@ -970,7 +1974,7 @@ GenericWriterPlugin::render(const RenderArguments &args)
              */
             int nChannels = 0;
             InputImagesHolder dataHolder;     // owns all tmpMem and srcImg
-            std::list<ImageData> planesData;
+            vector<EncodePartPlane> planesData;
 
             // The list of actual planes that could be fetched
             std::list<string> actualPlanes;
@@ -999,9 +2003,8 @@ GenericWriterPlugin::render(const RenderArguments &args)
 
                     assert(data.pixelComponentsCount != 0 && data.pixelComponents != ePixelComponentNone);
 
-                    planesData.push_back(data);
-                    int dstNComps = doAnyPacking ? packingMapping.size() : data.pixelComponentsCount;
-                    nChannels += dstNComps;
+                    planesData.push_back( makeEncodePartPlane(data, doAnyPacking, packingMapping) );
+                    nChannels += planesData.back().nComps;
                 }    // for each plane
             }     // for each view
             if (nChannels == 0) {
@@ -1010,50 +2013,8 @@ GenericWriterPlugin::render(const RenderArguments &args)
 
                 return;
             }
-            int pixelBytes = nChannels * getComponentBytes(eBitDepthFloat);
-            int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-            size_t memSize = (size_t)(args.renderWindow.y2 - args.renderWindow.y1) * (size_t)tmpRowBytes;
-            ImageMemory interleavedMem(memSize, this);
-            float* tmpMemPtr = (float*)interleavedMem.lock();
-            if (!tmpMemPtr) {
-                throwSuiteStatusException(kOfxStatErrMemory);
-
-                return;
-            }
-
-            ///Set to 0 everywhere since the render window might be bigger than the src img bounds
-            std::memset(tmpMemPtr, 0, memSize);
-
-            int interleaveIndex = 0;
-            for (std::list<ImageData>::iterator it = planesData.begin(); it != planesData.end(); ++it) {
-                assert(interleaveIndex < nChannels);
-
-                int dstNComps = doAnyPacking ? packingMapping.size() : it->pixelComponentsCount;
-                int dstNCompsStartIndex = doAnyPacking ? packingMapping[0] : 0;
-                OfxRectI intersection;
-                if ( Coords::rectIntersection(args.renderWindow, it->bounds, &intersection) ) {
-                    assert( (/*dstPixelComponentStartIndex=*/ interleaveIndex + /*desiredSrcNComps=*/ dstNComps) <= /*dstPixelComponentCount=*/ nChannels );
-                    interleavePixelBuffers(intersection,
-                                           it->srcPixelData,
-                                           it->bounds,
-                                           it->pixelComponents,
-                                           it->pixelComponentsCount,
-                                           dstNCompsStartIndex,     // srcNCompsStartIndex
-                                           dstNComps,     // desiredSrcNComps
-                                           eBitDepthFloat,
-                                           it->rowBytes,
-                                           args.renderWindow,     // dstBounds
-                                           ePixelComponentNone,     // dstPixelComponents
-                                           interleaveIndex,     // dstPixelComponentStartIndex
-                                           nChannels,     // dstPixelComponentCount
-                                           tmpRowBytes,     // dstRowBytes
-                                           tmpMemPtr);     // dstPixelData
-                }
-                interleaveIndex += dstNComps;
-            }
-
-            beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
-            encodePart(encodeData.getData(), filename, tmpMemPtr, nChannels, 0, tmpRowBytes);
+            beginEncodeParts(encodeData.getData(), encodeFilename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+            encodePartPlanes(encodeData.getData(), encodeFilename, planesData, args.renderWindow, 0);
 
             break;
         }
@@ -1078,7 +2039,7 @@ GenericWriterPlugin::render(const RenderArguments &args)
                 int nChannels = 0;
                 InputImagesHolder dataHolder;     // owns all tmpMem and srcImg
 
-                std::list<ImageData> planesData;
+                vector<EncodePartPlane> planesData;
                 for (std::list<string>::const_iterator plane = planesToFetch->begin(); plane != planesToFetch->end(); ++plane) {
                     ImageMemory *tmpMem;     // owned by dataHolder, no need to delete
                     const Image* srcImg;     // owned by dataHolder, no need to delete
@@ -1094,10 +2055,8 @@ GenericWriterPlugin::render(const RenderArguments &args)
 
                     assert(data.pixelComponentsCount != 0 && data.pixelComponents != ePixelComponentNone);
 
-                    planesData.push_back(data);
-
-                    int dstNComps = doAnyPacking ? packingMapping.size() : data.pixelComponentsCount;
-                    nChannels += dstNComps;
+                    planesData.push_back( makeEncodePartPlane(data, doAnyPacking, packingMapping) );
+                    nChannels += planesData.back().nComps;
                 }
                 if (nChannels == 0) {
                     setPersistentMessage(Message::eMessageError, "", "Failed to fetch input layers");
@@ -1105,53 +2064,11 @@ GenericWriterPlugin::render(const RenderArguments &args)
 
                     return;
                 }
-                int pixelBytes = nChannels * getComponentBytes(eBitDepthFloat);
-                int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-                size_t memSize = (size_t)(args.renderWindow.y2 - args.renderWindow.y1) * (size_t)tmpRowBytes;
-                ImageMemory interleavedMem(memSize, this);
-                float* tmpMemPtr = (float*)interleavedMem.lock();
-                if (!tmpMemPtr) {
-                    throwSuiteStatusException(kOfxStatErrMemory);
-
-                    return;
-                }
-
-                ///Set to 0 everywhere since the render window might be bigger than the src img bounds
-                std::memset(tmpMemPtr, 0, memSize);
-
-                int interleaveIndex = 0;
-                for (std::list<ImageData>::iterator it = planesData.begin(); it != planesData.end(); ++it) {
-                    assert(interleaveIndex < nChannels);
-
-                    OfxRectI intersection;
-                    int dstNComps = doAnyPacking ? packingMapping.size() : it->pixelComponentsCount;
-                    int dstNCompsStartIndex = doAnyPacking ? packingMapping[0] : 0;
-                    if ( Coords::rectIntersection(args.renderWindow, it->bounds, &intersection) ) {
-                        assert( (/*dstPixelComponentStartIndex=*/ interleaveIndex + /*desiredSrcNComps=*/ dstNComps) <= /*dstPixelComponentCount=*/ nChannels );
-                        interleavePixelBuffers(intersection,
-                                               it->srcPixelData,
-                                               it->bounds,
-                                               it->pixelComponents,
-                                               it->pixelComponentsCount,
-                                               dstNCompsStartIndex,     // srcNCompsStartIndex
-                                               dstNComps,     // desiredSrcNComps
-                                               eBitDepthFloat,
-                                               it->rowBytes,
-                                               args.renderWindow,
-                                               ePixelComponentNone,     // dstPixelComponents
-                                               interleaveIndex,     // dstPixelComponentStartIndex
-                                               nChannels,     // dstPixelComponentCount
-                                               tmpRowBytes,
-                                               tmpMemPtr);
-                    }
-                    interleaveIndex += dstNComps;
-                }
-
                 if ( view == viewNames.begin() ) {
-                    beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                    beginEncodeParts(encodeData.getData(), encodeFilename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
                 }
 
-                encodePart(encodeData.getData(), filename, tmpMemPtr, nChannels, partIndex, tmpRowBytes);
+                encodePartPlanes(encodeData.getData(), encodeFilename, planesData, args.renderWindow, partIndex);
 
                 ++partIndex;
             }     // for each view
@@ -1193,10 +2110,10 @@ GenericWriterPlugin::render(const RenderArguments &args)
                 }     // for each plane
 
                 if ( view == viewNames.begin() ) {
-                    beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                    beginEncodeParts(encodeData.getData(), encodeFilename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
                 }
                 for (vector<ImageData>::iterator it = datas.begin(); it != datas.end(); ++it) {
-                    encodePart(encodeData.getData(), filename, it->srcPixelData, it->pixelComponentsCount, partIndex, it->rowBytes);
+                    encodePart(encodeData.getData(), encodeFilename, it->srcPixelData, it->pixelComponentsCount, partIndex, it->rowBytes);
                     ++partIndex;
                 }
             }     // for each view
@@ -1209,9 +2126,110 @@ GenericWriterPlugin::render(const RenderArguments &args)
         endEncodeParts( encodeData.getData() );
     }
 
+    if ( output.get() && abort() ) {
+        // the file may be incomplete: leave the previous one, and remove the temporary file
+        return;
+    }
+    if ( output.get() && !commitOutputFile(output.get(), sync) ) {
+        setPersistentMessage(Message::eMessageError, "", string("Cannot finish writing \"") + filename + '"');
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+    if ( recordHash && !abort() ) {
+        _frameHashes->setWritten(filename, frameHash);
+    }
+
     clearPersistentMessage();
 } // GenericWriterPlugin::render
 
+bool
+GenericWriterPlugin::commitOutputFile(OutputFile* file,
+                                      OutputFileSyncEnum sync)
+{
+    if ( (sync == eOutputFileSyncSequence) && _outputFileSync.get() ) {
+        if ( !file->commit(false) ) {
+            return false;
+        }
+        _outputFileSync->add( file->getFilename() );
+
+        return true;
+    }
+
+    // outside of a sequence render, "End of Sequence" flushes each frame
+    return file->commit(sync != eOutputFileSyncNone);
+}
+
+void
+GenericWriterPlugin::encodeByStrips(const string& filename,
+                                    const string& plane,
+                                    int view,
+                                    const string& viewName,
+                                    const RenderArguments &args,
+                                    double time,
+                                    float pixelAspectRatio,
+                                    PreMultiplicationEnum pluginExpectedPremult,
+                                    PreMultiplicationEnum userPremult,
+                                    const bool isOCIOIdentity,
+                                    const bool doAnyPacking,
+                                    const bool packingContiguous,
+                                    const vector<int>& packingMapping)
+{
+    // The encoder must be opened before the first strip is fetched: compute the number of components
+    // the same way as fetchPlaneConvertAndCopy() does.
+    int srcMappedComponentsCount;
+    if (plane == kFnOfxImagePlaneColour) {
+        PixelComponentEnum srcMappedComponents;
+        srcMappedComponentsCount = getPixelsComponentsCount(_inputClip->getPixelComponentsProperty(), &srcMappedComponents);
+    } else {
+        srcMappedComponentsCount = (int)MultiPlane::ImagePlaneDesc::mapOFXPlaneStringToPlane(plane).getNumComponents();
+    }
+    if (srcMappedComponentsCount == 0) {
+        setPersistentMessage(Message::eMessageError, "", "Failed to fetch input layer");
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+    const bool needPacking = doAnyPacking && ( !packingContiguous || ( (int)packingMapping.size() != srcMappedComponentsCount ) );
+    const int pixelDataNComps = needPacking ? (int)packingMapping.size() : srcMappedComponentsCount;
+    const int dstNComps = doAnyPacking ? (int)packingMapping.size() : pixelDataNComps;
+    const int dstNCompsStartIndex = doAnyPacking ? packingMapping[0] : 0;
+
+    EncodePlanesLocalData_RAII encodeData(this);
+    const int stripHeight = beginEncodeStrips(encodeData.getData(), filename, time, viewName, args.renderWindow, pixelAspectRatio,
+                                              pixelDataNComps, dstNCompsStartIndex, dstNComps);
+    if (stripHeight <= 0) {
+        setPersistentMessage(Message::eMessageError, "", "This file cannot be written by strips");
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+
+    for (int y2 = args.renderWindow.y2; y2 > args.renderWindow.y1; y2 -= stripHeight) {
+        if ( abort() ) {
+            return;
+        }
+        OfxRectI strip = args.renderWindow;
+        strip.y1 = std::max(args.renderWindow.y1, y2 - stripHeight);
+        strip.y2 = y2;
+
+        // the source image and the converted strip are released at the end of each iteration
+        InputImagesHolder dataHolder;
+        const Image* srcImg; // owned by dataHolder, no need to delete
+        ImageMemory *tmpMem; // owned by dataHolder, no need to delete
+        ImageData data;
+        fetchPlaneConvertAndCopy(plane, /*failIfNoSrcImg=*/ true, view, args.renderView, time, strip, args.renderScale, args.fieldToRender, pluginExpectedPremult, userPremult, isOCIOIdentity, doAnyPacking, packingContiguous, packingMapping, &dataHolder, &data.bounds, &tmpMem, &srcImg, &data.srcPixelData, &data.rowBytes, &data.pixelComponents, &data.pixelComponentsCount);
+        if (data.pixelComponentsCount != pixelDataNComps) {
+            setPersistentMessage(Message::eMessageError, "", "OFX Host gave image with wrong components");
+            throwSuiteStatusException(kOfxStatFailed);
+
+            return;
+        }
+        assert(data.bounds.x1 == strip.x1 && data.bounds.x2 == strip.x2 && data.bounds.y1 == strip.y1 && data.bounds.y2 == strip.y2);
+        encodeStrip(encodeData.getData(), data.srcPixelData, strip, data.rowBytes);
+    }
+
+    endEncodeStrips( encodeData.getData() );
+} // GenericWriterPlugin::encodeByStrips
+
 class PackPixelsProcessorBase
     : public PixelProcessorFilterBase
 {
@@ -1568,128 +2586,77 @@ GenericWriterPlugin::beginSequenceRender(const BeginSequenceRenderArguments &arg
     OfxRectI rodPixel;
     Coords::toPixelEnclosing(rod, args.renderScale, par, &rodPixel);
 
-    beginEncode(filename, rodPixel, par, args);
-}
+    _encodeStats->reset();
 
-void
-GenericWriterPlugin::endSequenceRender(const EndSequenceRenderArguments &args)
-{
-    if ( !kSupportsRenderScale && ( (args.renderScale.x != 1.) || (args.renderScale.y != 1.) ) ) {
-        throwSuiteStatusException(kOfxStatFailed);
+    beginEncode(filename, rodPixel, par, args);
 
-        return;
+    if ( !_frameHashes.get() && _skipUnchanged->getValue() && isImageFile( extension(filename) ) ) {
+        // one manifest per sequence: use the filename pattern, not the name of a frame
+        string pattern;
+        _fileParam->getValue(pattern);
+        string name = basename(pattern);
+        string path = (name == pattern) ? ('.' + name) : ( dirname(pattern) + "/." + name );
+        _frameHashes.reset( new FrameHashManifest(path + ".hashes") );
     }
 
-    endEncode(args);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/** @brief render for the filter */
-
-////////////////////////////////////////////////////////////////////////////////
-// basic plugin render function, just a skelington to instantiate templates from
-
-static void
-setupAndProcess(PixelProcessorFilterBase & processor,
-                int premultChannel,
-                const OfxRectI &renderWindow,
-                const void *srcPixelData,
-                const OfxRectI& srcBounds,
-                PixelComponentEnum srcPixelComponents,
-                int srcPixelComponentCount,
-                BitDepthEnum srcPixelDepth,
-                int srcRowBytes,
-                void *dstPixelData,
-                const OfxRectI& dstBounds,
-                PixelComponentEnum dstPixelComponents,
-                int dstPixelComponentCount,
-                BitDepthEnum dstPixelDepth,
-                int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
+    if ( !_frameClaims.get() && _claimFrames->getValue() && isImageFile( extension(filename) ) ) {
+        _frameClaims.reset(new FrameClaims);
     }
 
-    // set the images
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    processor.setPremultMaskMix(true, premultChannel, 1.);
+    if ( !_outputFileSync.get() && (_fileSync->getValue() == (int)eOutputFileSyncSequence) && isImageFile( extension(filename) ) ) {
+        _outputFileSync.reset(new OutputFileSyncGroup);
+    }
 
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
+    // a claimed frame must be written before its claim is released
+    if ( !_writeBehindQueue.get() && !_frameClaims.get() && _writeBehind->getValue() && isImageFile( extension(filename) ) ) {
+        unsigned int nThreads = std::max( 1u, std::min( MultiThread::getNumCPUs(), (unsigned int)kWriteBehindMaxThreads ) );
+        _writeBehindQueue.reset( new WriteBehindQueue(this, nThreads) );
+    }
 }
 
 void
-GenericWriterPlugin::unPremultPixelData(const OfxRectI &renderWindow,
-                                        const void *srcPixelData,
-                                        const OfxRectI& srcBounds,
-                                        PixelComponentEnum srcPixelComponents,
-                                        int srcPixelComponentCount,
-                                        BitDepthEnum srcPixelDepth,
-                                        int srcRowBytes,
-                                        void *dstPixelData,
-                                        const OfxRectI& dstBounds,
-                                        PixelComponentEnum dstPixelComponents,
-                                        int dstPixelComponentCount,
-                                        BitDepthEnum dstBitDepth,
-                                        int dstRowBytes)
+GenericWriterPlugin::endSequenceRender(const EndSequenceRenderArguments &args)
 {
-    assert(srcPixelData && dstPixelData);
-
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
+    if ( !kSupportsRenderScale && ( (args.renderScale.x != 1.) || (args.renderScale.y != 1.) ) ) {
+        throwSuiteStatusException(kOfxStatFailed);
 
         return;
     }
-    if (dstPixelComponents == ePixelComponentRGBA) {
-        PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-        setupAndProcess(fred, 3, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else {
-        ///other pixel components means you want to copy only...
-        assert(false);
+
+    // wait until all frames are written
+    string error;
+    bool writeOk = true;
+    if ( _writeBehindQueue.get() ) {
+        writeOk = _writeBehindQueue->wait(&error);
+        _writeBehindQueue.reset();
     }
-}
 
-void
-GenericWriterPlugin::premultPixelData(const OfxRectI &renderWindow,
-                                      const void *srcPixelData,
-                                      const OfxRectI& srcBounds,
-                                      PixelComponentEnum srcPixelComponents,
-                                      int srcPixelComponentCount,
-                                      BitDepthEnum srcPixelDepth,
-                                      int srcRowBytes,
-                                      void *dstPixelData,
-                                      const OfxRectI& dstBounds,
-                                      PixelComponentEnum dstPixelComponents,
-                                      int dstPixelComponentCount,
-                                      BitDepthEnum dstBitDepth,
-                                      int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
+    endEncode(args);
 
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
+    if ( _outputFileSync.get() ) {
+        if ( !_outputFileSync->sync() && writeOk ) {
+            writeOk = false;
+            error = "Some of the written files could not be flushed to disk";
+        }
+        _outputFileSync.reset();
+    }
 
-        return;
+    int skipped = 0;
+    if ( _frameHashes.get() ) {
+        // only the frames that were written successfully are recorded: the others will be written again next time
+        _frameHashes->save();
+        skipped = _frameHashes->getSkippedCount();
+        _frameHashes.reset();
     }
+    _frameClaims.reset();
 
-    if (dstPixelComponents == ePixelComponentRGBA) {
-        PixelCopierPremult<float, 4, 1, float, 4, 1> fred(*this);
-        setupAndProcess(fred, 3, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else {
-        ///other pixel components means you want to copy only...
-        assert(false);
+    if (!writeOk) {
+        setPersistentMessage(Message::eMessageError, "", error);
+        throwSuiteStatusException(kOfxStatFailed);
+    } else if (skipped > 0) {
+        stringstream ss;
+        ss << skipped << " unchanged frame(s) were not written again";
+        setPersistentMessage( Message::eMessageMessage, "", ss.str() );
     }
 }
 
@@ -1824,6 +2791,101 @@ GenericWriterPlugin::encodePart(void* /*user_data*/,
     /// Does nothing
 }
 
+void
+GenericWriterPlugin::appendEncodeSettings(double time,
+                                          stringstream& settings) const
+{
+    settings << _outputFormatType->getValueAtTime(time) << ' ' << _outputFormat->getValueAtTime(time);
+    if (_clipToRoD) {
+        settings << ' ' << _clipToRoD->getValueAtTime(time);
+    }
+#ifdef OFX_IO_USING_OCIO
+    string outputSpace;
+    _ocio->getOutputColorspaceAtTime(time, outputSpace);
+    settings << ' ' << outputSpace;
+#endif
+}
+
+int
+GenericWriterPlugin::beginEncodeStrips(void* /*user_data*/,
+                                       const string& /*filename*/,
+                                       OfxTime /*time*/,
+                                       const string& /*viewName*/,
+                                       const OfxRectI& /*bounds*/,
+                                       float /*pixelAspectRatio*/,
+                                       int /*pixelDataNComps*/,
+                                       int /*dstNCompsStartIndex*/,
+                                       int /*dstNComps*/)
+{
+    /// Does nothing
+    return 0;
+}
+
+void
+GenericWriterPlugin::encodeStrip(void* /*user_data*/,
+                                 const float */*pixelData*/,
+                                 const OfxRectI& /*stripBounds*/,
+                                 int /*rowBytes*/)
+{
+    /// Does nothing
+}
+
+void
+GenericWriterPlugin::encodePartPlanes(void* user_data,
+                                      const string& filename,
+                                      const vector<EncodePartPlane>& planes,
+                                      const OfxRectI& bounds,
+                                      int partIndex)
+{
+    int nChannels = 0;
+
+    for (vector<EncodePartPlane>::const_iterator it = planes.begin(); it != planes.end(); ++it) {
+        nChannels += it->nComps;
+    }
+    int pixelBytes = nChannels * getComponentBytes(eBitDepthFloat);
+    int tmpRowBytes = (bounds.x2 - bounds.x1) * pixelBytes;
+    size_t memSize = (size_t)(bounds.y2 - bounds.y1) * (size_t)tmpRowBytes;
+    ImageMemory interleavedMem(memSize, this);
+    float* tmpMemPtr = (float*)interleavedMem.lock();
+    if (!tmpMemPtr) {
+        throwSuiteStatusException(kOfxStatErrMemory);
+
+        return;
+    }
+    _encodeStats->addInterleaved(memSize);
+
+    ///Set to 0 everywhere since the render window might be bigger than the src img bounds
+    std::memset(tmpMemPtr, 0, memSize);
+
+    int interleaveIndex = 0;
+    for (vector<EncodePartPlane>::const_iterator it = planes.begin(); it != planes.end(); ++it) {
+        assert(interleaveIndex < nChannels);
+
+        OfxRectI intersection;
+        if ( Coords::rectIntersection(bounds, it->bounds, &intersection) ) {
+            assert( (/*dstPixelComponentStartIndex=*/ interleaveIndex + /*desiredSrcNComps=*/ it->nComps) <= /*dstPixelComponentCount=*/ nChannels );
+            interleavePixelBuffers(intersection,
+                                   it->pixelData,
+                                   it->bounds,
+                                   pixelComponentsFromCount(it->pixelDataNComps),
+                                   it->pixelDataNComps,
+                                   it->srcNCompsStartIndex,
+                                   it->nComps,     // desiredSrcNComps
+                                   eBitDepthFloat,
+                                   it->rowBytes,
+                                   bounds,     // dstBounds
+                                   ePixelComponentNone,     // dstPixelComponents
+                                   interleaveIndex,     // dstPixelComponentStartIndex
+                                   nChannels,     // dstPixelComponentCount
+                                   tmpRowBytes,     // dstRowBytes
+                                   tmpMemPtr);     // dstPixelData
+        }
+        interleaveIndex += it->nComps;
+    }
+
+    encodePart(user_data, filename, tmpMemPtr, nChannels, partIndex, tmpRowBytes);
+}
+
 bool
 GenericWriterPlugin::getTimeDomain(OfxRangeD &range)
 {
@@ -2023,6 +3085,11 @@ GenericWriterPlugin::outputFileChanged(InstanceChangeReason reason,
     if (_clipToRoD) {
         _clipToRoD->setIsSecretAndDisabled( !displayWindowSupportedByFormat(filename) );
     }
+    _writeBehind->setIsSecretAndDisabled( !isImageFile( extension(filename) ) );
+    _encodeByStrips->setIsSecretAndDisabled( !supportsEncodeStrips(filename) );
+    _skipUnchanged->setIsSecretAndDisabled( !isImageFile( extension(filename) ) );
+    _claimFrames->setIsSecretAndDisabled( !isImageFile( extension(filename) ) );
+    _fileSync->setIsSecretAndDisabled( !isImageFile( extension(filename) ) );
 
 
     if (reason == eChangeUserEdit) {
@@ -2106,6 +3173,9 @@ GenericWriterPlugin::changedParam(const InstanceChangedArgs &args,
             msg += premultString( _outputClip->getPreMultiplication() );
         }
         msg += "\n";
+        msg += "Last render: ";
+        msg += _encodeStats->getSummary();
+        msg += "\n";
         sendMessage(Message::eMessageMessage, "", msg);
 #ifdef OFX_IO_USING_OCIO
     } else if ( ( (paramName == kOCIOParamOutputSpace) || (paramName == kOCIOParamOutputSpaceChoice) ) &&
@@ -2688,6 +3758,77 @@ GenericWriterDescribeInContextBegin(ImageEffectDescriptor &desc,
         }
     }
 
+    ////////////Sync to disk
+    {
+        ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamFileSync);
+        param->setLabel(kParamFileSyncLabel);
+        param->setHint(kParamFileSyncHint);
+        assert(param->getNOptions() == (int)eOutputFileSyncNone);
+        param->appendOption(kParamFileSyncOptionNone);
+        assert(param->getNOptions() == (int)eOutputFileSyncFrame);
+        param->appendOption(kParamFileSyncOptionFrame);
+        assert(param->getNOptions() == (int)eOutputFileSyncSequence);
+        param->appendOption(kParamFileSyncOptionSequence);
+        param->setDefault((int)eOutputFileSyncNone);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    ////////////Write behind
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamWriteBehind);
+        param->setLabel(kParamWriteBehindLabel);
+        param->setHint(kParamWriteBehindHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    ////////////Skip unchanged frames
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamSkipUnchanged);
+        param->setLabel(kParamSkipUnchangedLabel);
+        param->setHint(kParamSkipUnchangedHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    ////////////Claim frames
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamClaimFrames);
+        param->setLabel(kParamClaimFramesLabel);
+        param->setHint(kParamClaimFramesHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    ////////////Write by strips
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamEncodeByStrips);
+        param->setLabel(kParamEncodeByStripsLabel);
+        param->setHint(kParamEncodeByStripsHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     // sublabel
     if (gHostIsNatron) {
         StringParamDescriptor* param = desc.defineStringParam(kNatronOfxParamStringSublabelName);
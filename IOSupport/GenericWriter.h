@@ -25,9 +25,11 @@
 #define Io_GenericWriter_h
 
 #include <memory>
+#include <sstream>
 #include <ofxsImageEffect.h>
 #include <ofxsMultiPlane.h>
 #include "IOUtility.h"
+#include "OutputFile.h"
 #include "ofxsMacros.h"
 #include "ofxsPixelProcessor.h" // for getImageData
 #include "ofxsCopier.h" // for copyPixels
@@ -50,6 +52,20 @@ enum LayerViewsPartsEnum
 #define kGenericWriterViewDefault -2 // Indicates that we want to render what the host request via the render action (the default)
 #define kGenericWriterViewAll -1 // the write will write all views when rendering view 0
 
+/**
+ * @brief A plane of a part passed to encodePartPlanes().
+ * The channels [srcNCompsStartIndex, srcNCompsStartIndex + nComps) of pixelData are written.
+ **/
+struct EncodePartPlane
+{
+    const float* pixelData;
+    OfxRectI bounds;
+    int pixelDataNComps;
+    int srcNCompsStartIndex;
+    int nComps;
+    int rowBytes;
+};
+
 /**
  * @brief A generic writer plugin, derive this to create a new writer for a specific file format.
  * This class propose to handle the common stuff among writers:
@@ -190,6 +206,29 @@ protected:
                         const int dstNCompsStartIndex,
                         const int dstNComps,
                         const int rowBytes);
+
+    /**
+     * @brief Write-behind (see the Write Behind parameter) splits encode() in two.
+     * prepareEncode() is called from the render action: it reads the parameters, and stores in user_data
+     * (allocated by allocateEncodePlanesUserData()) everything the encoder needs.
+     * encodePrepared() is called later from a background thread, which must not use the host suites
+     * (no parameter, clip, message or status exception): it reports errors by throwing std::exception.
+     * Overload both to support write-behind. The default prepareEncode() returns false, and the frame is then
+     * given to encode() from the render action.
+     * The arguments have the same meaning as in encode().
+     **/
+    virtual bool prepareEncode(void* /*user_data*/,
+                               const std::string& /*filename*/,
+                               OfxTime /*time*/,
+                               const std::string& /*viewName*/,
+                               const OfxRectI& /*bounds*/,
+                               float /*pixelAspectRatio*/,
+                               int /*pixelDataNComps*/,
+                               int /*dstNCompsStartIndex*/,
+                               int /*dstNComps*/) { return false; }
+
+    virtual void encodePrepared(void* /*user_data*/, const float* /*pixelData*/, int /*rowBytes*/) {}
+
     virtual void beginEncode(const std::string& /*filename*/,
                              const OfxRectI& /*rodPixel*/,
                              float /*pixelAspectRatio*/,
@@ -220,6 +259,54 @@ protected:
 
     virtual void encodePart(void* user_data, const std::string& filename, const float *pixelData, int pixelDataNComps, int planeIndex, int rowBytes);
 
+    /**
+     * @brief Encode several planes into the part partIndex, their channels being written in the given order.
+     * The default implementation interleaves them into a temporary buffer covering bounds and calls encodePart().
+     * Overload it if the encoder can read the planes from separate buffers, to avoid that copy.
+     **/
+    virtual void encodePartPlanes(void* user_data,
+                                  const std::string& filename,
+                                  const std::vector<EncodePartPlane>& planes,
+                                  const OfxRectI& bounds,
+                                  int partIndex);
+
+    /**
+     * @brief Overload to return true if the given file can be written incrementally by horizontal strips,
+     * from top to bottom, with beginEncodeStrips()/encodeStrip()/endEncodeStrips().
+     * The source image is then fetched, converted and encoded one strip at a time, so that only a few strips
+     * have to be in memory when the host can render the input by regions.
+     **/
+    virtual bool supportsEncodeStrips(const std::string& /*filename*/) const { return false; }
+
+    /**
+     * @brief Open the file for writing by strips, and return the height of the strips (e.g. the tile height).
+     * user_data was allocated by allocateEncodePlanesUserData().
+     * The arguments have the same meaning as in encode().
+     **/
+    virtual int beginEncodeStrips(void* user_data,
+                                  const std::string& filename,
+                                  OfxTime time,
+                                  const std::string& viewName,
+                                  const OfxRectI& bounds,
+                                  float pixelAspectRatio,
+                                  int pixelDataNComps,
+                                  int dstNCompsStartIndex,
+                                  int dstNComps);
+
+    /**
+     * @brief Write the given strip. Strips are given from top to bottom, and all strips have the height
+     * returned by beginEncodeStrips(), except the last one which may be smaller.
+     **/
+    virtual void encodeStrip(void* user_data, const float *pixelData, const OfxRectI& stripBounds, int rowBytes);
+    virtual void endEncodeStrips(void* /*user_data*/) {}
+
+    /**
+     * @brief Overload to append the values of the parameters that change the encoded file for a given image
+     * (compression, bit depth...), so that frames are not considered unchanged when one of them changes.
+     * Derived implementations must call the base class implementation first.
+     **/
+    virtual void appendEncodeSettings(double time, std::stringstream& settings) const;
+
     /**
      * @brief Should return the view index needed to render.
      * Possible return values:
@@ -284,6 +371,46 @@ protected:
 
 private:
 
+    class WriteBehindQueue;
+
+    OFX::BooleanParam* _writeBehind; //< encode and write frames from background threads (image files only)
+    auto_ptr<WriteBehindQueue> _writeBehindQueue; //< only set between beginSequenceRender and endSequenceRender
+
+    class EncodeStats;
+
+    auto_ptr<EncodeStats> _encodeStats; //< counts the planes given to the encoder with and without an intermediate copy
+
+    OFX::BooleanParam* _encodeByStrips; //< fetch, convert and write the image by strips (formats that support it)
+
+    class FrameHashManifest;
+
+    OFX::BooleanParam* _skipUnchanged; //< do not rewrite frames which are identical to the previous write
+    auto_ptr<FrameHashManifest> _frameHashes; //< only set between beginSequenceRender and endSequenceRender
+
+    class FrameClaims;
+
+    OFX::BooleanParam* _claimFrames; //< coordinate several processes writing the same sequence with lock files
+    auto_ptr<FrameClaims> _frameClaims; //< only set between beginSequenceRender and endSequenceRender
+
+    OFX::ChoiceParam* _fileSync; //< when to flush the written image files to disk
+    auto_ptr<OutputFileSyncGroup> _outputFileSync; //< files to flush at the end of the sequence, only set between beginSequenceRender and endSequenceRender
+
+    // Renames the temporary file to its final name, and flushes it to disk according to sync. Thread-safe.
+    bool commitOutputFile(OutputFile* file, OutputFileSyncEnum sync);
+
+    void encodeByStrips(const std::string& filename,
+                        const std::string& plane,
+                        int view,
+                        const std::string& viewName,
+                        const OFX::RenderArguments &args,
+                        double time,
+                        float pixelAspectRatio,
+                        OFX::PreMultiplicationEnum pluginExpectedPremult,
+                        OFX::PreMultiplicationEnum userPremult,
+                        const bool isOCIOIdentity,
+                        const bool doAnyPacking,
+                        const bool packingContiguous,
+                        const std::vector<int>& packingMapping);
 
     class InputImagesHolder
     {
@@ -446,6 +573,27 @@ private:
                          int dstRowBytes,
                          void* dstPixelData);
 
+    /**
+     * @brief Converts float pixels from srcPixelData to the layout expected by encode() in a single pass:
+     * opaque or unpremult, OCIO, premult, then channel packing (if channelsMapping is not empty).
+     * dstPixelData covers renderWindow, pixels outside of srcBounds are set to black and transparent.
+     **/
+    void convertAndPackPixelBuffer(const OfxRectI& renderWindow,
+                                   const void *srcPixelData,
+                                   const OfxRectI& srcBounds,
+                                   OFX::PixelComponentEnum srcPixelComponents,
+                                   int srcPixelComponentCount,
+                                   int srcRowBytes,
+                                   bool opaque,
+                                   bool unpremult,
+                                   bool applyOCIO,
+                                   bool premult,
+                                   double time,
+                                   const std::vector<int>& channelsMapping, //maps dst channels to input channels
+                                   int dstPixelComponentCount,
+                                   int dstRowBytes,
+                                   void* dstPixelData);
+
     void interleavePixelBuffers(const OfxRectI& renderWindow,
                                 const void *srcPixelData,
                                 const OfxRectI& bounds,
@@ -462,34 +610,6 @@ private:
                                 const int dstRowBytes,
                                 void* dstPixelData);
 
-    void unPremultPixelData(const OfxRectI &renderWindow,
-                            const void *srcPixelData,
-                            const OfxRectI& srcBounds,
-                            OFX::PixelComponentEnum srcPixelComponents,
-                            int srcPixelComponentCount,
-                            OFX::BitDepthEnum srcPixelDepth,
-                            int srcRowBytes,
-                            void *dstPixelData,
-                            const OfxRectI& dstBounds,
-                            OFX::PixelComponentEnum dstPixelComponents,
-                            int dstPixelComponentCount,
-                            OFX::BitDepthEnum dstBitDepth,
-                            int dstRowBytes);
-
-    void premultPixelData(const OfxRectI &renderWindow,
-                          const void *srcPixelData,
-                          const OfxRectI& srcBounds,
-                          OFX::PixelComponentEnum srcPixelComponents,
-                          int srcPixelComponentCount,
-                          OFX::BitDepthEnum srcPixelDepth,
-                          int srcRowBytes,
-                          void *dstPixelData,
-                          const OfxRectI& dstBounds,
-                          OFX::PixelComponentEnum dstPixelComponents,
-                          int dstPixelComponentCount,
-                          OFX::BitDepthEnum dstBitDepth,
-                          int dstRowBytes);
-
     void getPackingOptions(bool *allCheckboxHidden, std::vector<int>* packingMapping) const;
 
     void outputFileChanged(OFX::InstanceChangeReason reason, bool restoreExistingWriter, bool throwErrors);
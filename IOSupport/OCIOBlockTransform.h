@@ -0,0 +1,45 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * A color transform which can replace an OCIO processor.
+ * Does not depend on OpenFX, so that the transforms can be checked against OCIO by the tests (see Tests/).
+ */
+
+#ifndef IO_OCIOBlockTransform_h
+#define IO_OCIOBlockTransform_h
+
+#define kOCIOBlockSize 1024 // number of pixels processed at once by applyOCIOBlocks(), small enough to stay in the cache
+
+namespace OFX {
+namespace IO {
+/**
+ * @brief A color transform which can be applied by applyOCIOBlocks() instead of an OCIO processor.
+ **/
+class OCIOBlockTransform
+{
+public:
+    virtual ~OCIOBlockTransform() {}
+
+    // transform n packed RGB or RGBA float pixels
+    virtual void transformBlock(float* pixelData, int n, int numChannels) const = 0;
+};
+} // namespace IO
+} // namespace OFX
+
+#endif // ifndef IO_OCIOBlockTransform_h
@@ -0,0 +1,321 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Output files written under a temporary name and renamed once complete,
+ * so that other processes never see a partially written file.
+ */
+
+#include "OutputFile.h"
+
+#include <sstream>
+#include <algorithm>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(WIN64)
+#include <windows.h> // MoveFileExW, MultiByteToWideChar
+#include <io.h> // _wopen, _commit
+#include <fcntl.h>
+#include <process.h> // _getpid
+#include <stdio.h> // _wremove
+#include <sys/utime.h> // _wutime
+#else
+#include <fcntl.h> // open, posix_fallocate
+#include <unistd.h> // fsync, getpid
+#include <utime.h>
+#endif
+
+using std::string;
+using std::stringstream;
+
+NAMESPACE_OFX_ENTER
+NAMESPACE_OFX_IO_ENTER
+
+#if defined(_WIN32) || defined(WIN64)
+// file names are UTF-8, the narrow Windows API uses the ANSI code page
+static std::wstring
+utf8ToUtf16(const string& str)
+{
+    std::wstring native;
+
+    native.resize( MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, NULL, 0) );
+    if ( !native.empty() ) {
+        MultiByteToWideChar( CP_UTF8, 0, str.c_str(), -1, &native[0], (int)native.size() );
+    }
+
+    return native;
+}
+
+#endif
+
+OutputFile::OutputFile(const string& filename)
+    : _filename(filename)
+    , _temporaryFilename()
+    , _committed(false)
+{
+    // hidden, and with the same extension, which may be used by the encoder to pick a format
+    string name = basename(filename);
+    string dir = (name == filename) ? string() : ( dirname(filename) + '/' );
+    std::size_t dot = name.find_last_of('.');
+    stringstream ss;
+
+    ss << dir << '.' << name.substr(0, dot) << '.' << getProcessId() << '-' << std::hex << (std::size_t)this << std::dec << ".tmp";
+    if (dot != string::npos) {
+        ss << name.substr(dot);
+    }
+    _temporaryFilename = ss.str();
+}
+
+OutputFile::~OutputFile()
+{
+    if (!_committed) {
+        removeFile(_temporaryFilename);
+    }
+}
+
+bool
+OutputFile::commit(bool sync)
+{
+    if ( sync && !syncFile(_temporaryFilename) ) {
+        return false;
+    }
+    if ( !renameFile(_temporaryFilename, _filename) ) {
+        return false;
+    }
+    _committed = true;
+    if (sync) {
+        // make the rename itself durable
+        string name = basename(_filename);
+        syncFile( (name == _filename) ? string(".") : dirname(_filename) );
+    }
+
+    return true;
+}
+
+OutputFileSyncGroup::OutputFileSyncGroup()
+    : _mutex()
+    , _filenames()
+{
+}
+
+void
+OutputFileSyncGroup::add(const string& filename)
+{
+    tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+    _filenames.insert(filename);
+}
+
+bool
+OutputFileSyncGroup::sync()
+{
+    tthread::lock_guard<tthread::mutex> guard(_mutex);
+    std::set<string> dirs;
+    bool ok = true;
+
+    for (std::set<string>::const_iterator it = _filenames.begin(); it != _filenames.end(); ++it) {
+        ok = syncFile(*it) && ok;
+        string name = basename(*it);
+        dirs.insert( (name == *it) ? string(".") : dirname(*it) );
+    }
+    for (std::set<string>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+        syncFile(*it);
+    }
+    _filenames.clear();
+
+    return ok;
+}
+
+bool
+syncFile(const string& filename)
+{
+#if defined(_WIN32) || defined(WIN64)
+    // directories cannot be opened, but renames are journaled by NTFS anyway
+    int fd = _wopen(utf8ToUtf16(filename).c_str(), _O_WRONLY | _O_BINARY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+#  ifdef F_FULLFSYNC
+    // on OS X, fsync() does not flush the disk cache
+    bool ok = (fcntl(fd, F_FULLFSYNC) == 0) || (fsync(fd) == 0);
+#  else
+    bool ok = fsync(fd) == 0;
+#  endif
+    close(fd);
+#endif
+
+    return ok;
+}
+
+bool
+preallocateFile(std::FILE* file,
+                std::size_t size)
+{
+#if defined(__linux__)
+    return posix_fallocate(fileno(file), 0, (off_t)size) == 0;
+#elif defined(__APPLE__)
+    fstore_t store;
+    store.fst_flags = F_ALLOCATECONTIG;
+    store.fst_posmode = F_PEOFPOSMODE;
+    store.fst_offset = 0;
+    store.fst_length = (off_t)size;
+    store.fst_bytesalloc = 0;
+    if (fcntl(fileno(file), F_PREALLOCATE, &store) == -1) {
+        // contiguous space may not be available
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fileno(file), F_PREALLOCATE, &store) == -1) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    (void)file;
+    (void)size;
+
+    return false;
+#endif
+}
+
+bool
+renameFile(const string& from,
+           const string& to)
+{
+#if defined(_WIN32) || defined(WIN64)
+    // rename() does not replace an existing file on Windows, and removing it first would leave a window
+    // where the destination does not exist. MoveFileExW replaces it in one operation.
+    return MoveFileExW(utf8ToUtf16(from).c_str(), utf8ToUtf16(to).c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+
+    return std::rename( from.c_str(), to.c_str() ) == 0;
+#endif
+}
+
+bool
+removeFile(const string& filename)
+{
+#if defined(_WIN32) || defined(WIN64)
+
+    return _wremove( utf8ToUtf16(filename).c_str() ) == 0;
+#else
+
+    return std::remove( filename.c_str() ) == 0;
+#endif
+}
+
+bool
+createFileExclusive(const string& filename,
+                    const string& contents)
+{
+#if defined(_WIN32) || defined(WIN64)
+    int fd = _wopen(utf8ToUtf16(filename).c_str(), _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(filename.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+#endif
+
+    if (fd < 0) {
+        return false;
+    }
+    // the contents are only informative
+#if defined(_WIN32) || defined(WIN64)
+    (void)_write( fd, contents.data(), (unsigned int)contents.size() );
+    _close(fd);
+#else
+    ssize_t written = write( fd, contents.data(), contents.size() );
+    (void)written;
+    close(fd);
+#endif
+
+    return true;
+}
+
+bool
+getFileSize(const string& filename,
+            uint64_t* size)
+{
+    // ftell() returns a 32-bit long on Windows
+#if defined(_WIN32) || defined(WIN64)
+    struct _stat64 st;
+    if (_wstat64(utf8ToUtf16(filename).c_str(), &st) != 0) {
+        return false;
+    }
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+#endif
+    if ( (st.st_mode & S_IFMT) != S_IFREG ) {
+        return false;
+    }
+    *size = (uint64_t)st.st_size;
+
+    return true;
+}
+
+double
+getFileAge(const string& filename)
+{
+#if defined(_WIN32) || defined(WIN64)
+    struct _stat64 st;
+    if (_wstat64(utf8ToUtf16(filename).c_str(), &st) != 0) {
+        return -1.;
+    }
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return -1.;
+    }
+#endif
+
+    return std::max( 0., std::difftime(std::time(NULL), st.st_mtime) );
+}
+
+bool
+touchFile(const string& filename)
+{
+#if defined(_WIN32) || defined(WIN64)
+
+    return _wutime(utf8ToUtf16(filename).c_str(), NULL) == 0;
+#else
+
+    return utime(filename.c_str(), NULL) == 0;
+#endif
+}
+
+int
+getProcessId()
+{
+#if defined(_WIN32) || defined(WIN64)
+    return _getpid();
+#else
+    return (int)getpid();
+#endif
+}
+
+NAMESPACE_OFX_IO_EXIT
+NAMESPACE_OFX_EXIT
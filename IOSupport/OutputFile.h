@@ -0,0 +1,133 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Output files written under a temporary name and renamed once complete,
+ * so that other processes never see a partially written file.
+ */
+
+#ifndef Io_OutputFile_h
+#define Io_OutputFile_h
+
+#include <cstddef>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <stdint.h> // uint64_t
+
+#include "IOUtility.h"
+#include "tinythread.h"
+
+NAMESPACE_OFX_ENTER
+NAMESPACE_OFX_IO_ENTER
+
+enum OutputFileSyncEnum
+{
+    eOutputFileSyncNone = 0, // leave it to the operating system
+    eOutputFileSyncFrame, // flush each file to disk before renaming it
+    eOutputFileSyncSequence // flush all files to disk together, with OutputFileSyncGroup::sync()
+};
+
+/**
+ * @brief A file written under a hidden temporary name, in the same directory and with the same extension,
+ * and renamed to its final name by commit(). The temporary file is removed if it was not committed.
+ **/
+class OutputFile
+{
+public:
+
+    explicit OutputFile(const std::string& filename);
+
+    ~OutputFile();
+
+    const std::string& getFilename() const
+    {
+        return _filename;
+    }
+
+    // The file the encoder must write to. It must be closed before commit() is called.
+    const std::string& getTemporaryFilename() const
+    {
+        return _temporaryFilename;
+    }
+
+    // Flushes the temporary file to disk if sync is true, then renames it to the final name
+    bool commit(bool sync);
+
+private:
+
+    std::string _filename;
+    std::string _temporaryFilename;
+    bool _committed;
+};
+
+/**
+ * @brief Files that were committed without being flushed to disk, which are flushed together at the end of a sequence.
+ * Files may be added from several threads.
+ **/
+class OutputFileSyncGroup
+{
+public:
+
+    OutputFileSyncGroup();
+
+    void add(const std::string& filename);
+
+    // Flushes the files and their directories to disk. Returns false if any of them could not be flushed.
+    bool sync();
+
+private:
+
+    tthread::mutex _mutex; // protects _filenames
+    std::set<std::string> _filenames;
+};
+
+// Flushes the contents of a closed file to disk
+bool syncFile(const std::string& filename);
+
+/**
+ * @brief Reserves the disk space of a file which was just opened for writing, when its final size is known,
+ * which reduces fragmentation and reports a full disk before anything is written.
+ * The file size may be changed to size. Returns false if the space could not be reserved.
+ **/
+bool preallocateFile(std::FILE* file, std::size_t size);
+
+// Renames a file, replacing the destination file if it exists
+bool renameFile(const std::string& from, const std::string& to);
+
+// Removes a file
+bool removeFile(const std::string& filename);
+
+// Creates the file, unless it already exists. This is atomic, even on network filesystems.
+bool createFileExclusive(const std::string& filename, const std::string& contents);
+
+// Returns false if the file does not exist or is not a regular file
+bool getFileSize(const std::string& filename, uint64_t* size);
+
+// Returns the number of seconds since the file was last modified, or -1 if it does not exist
+double getFileAge(const std::string& filename);
+
+// Sets the modification time of a file to the current time. Returns false if the file does not exist.
+bool touchFile(const std::string& filename);
+
+int getProcessId();
+
+NAMESPACE_OFX_IO_EXIT
+NAMESPACE_OFX_EXIT
+
+#endif // ifndef Io_OutputFile_h
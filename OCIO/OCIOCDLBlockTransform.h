@@ -0,0 +1,208 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * The ASC CDL, used by OCIOCDLTransform instead of the OCIO processor.
+ * Only depends on ofxsMacros.h, so that it can be checked against OCIO by the tests (see Tests/).
+ */
+
+#ifndef IO_OCIOCDLBlockTransform_h
+#define IO_OCIOCDLBlockTransform_h
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "ofxsMacros.h"
+#include "OCIOBlockTransform.h"
+
+namespace OFX {
+namespace IO {
+
+// the saturation coefficients of OCIO::CDLTransform
+#define kCDLLumaR 0.2126f
+#define kCDLLumaG 0.7152f
+#define kCDLLumaB 0.0722f
+
+/**
+ * @brief The CDL, evaluated without building an OCIO processor.
+ *
+ * It gives the same results as the ops built by OCIO for a CDLTransform:
+ * - forward: in * slope + offset, then clamp to 0 and power (both skipped if all powers are 1, alpha is clamped too), then saturation;
+ * - inverse: the inverse of each step, in reverse order.
+ **/
+class CDLBlockTransform
+    : public OCIOBlockTransform
+{
+public:
+    CDLBlockTransform(const double slope[3],
+                      const double offset[3],
+                      const double power[3],
+                      double saturation,
+                      bool inverse)
+        : _inverse(inverse)
+        , _doPower(false)
+        , _doSat(saturation != 1.)
+        , _sat( (float)saturation )
+        , _valid(true)
+    {
+        for (int c = 0; c < 3; ++c) {
+            _slope[c] = (float)slope[c];
+            _offset[c] = (float)offset[c];
+            _power[c] = (float)power[c];
+            if (_power[c] != 1.f) {
+                _doPower = true;
+            }
+        }
+        if (inverse) {
+            // OCIO fails to invert a null slope, power or saturation: let it report the error
+            for (int c = 0; c < 3; ++c) {
+                if ( (_slope[c] == 0.f) || (_doPower && (_power[c] == 0.f)) ) {
+                    _valid = false;
+
+                    return;
+                }
+                _slope[c] = 1.f / _slope[c];
+                if (_doPower) {
+                    _power[c] = 1.f / _power[c];
+                }
+            }
+            if ( _doSat && (_sat == 0.f) ) {
+                _valid = false;
+
+                return;
+            }
+            // the luma coefficients sum to 1, so the inverse of the saturation matrix is the saturation matrix of 1/sat
+            _sat = 1.f / _sat;
+        }
+    }
+
+    // false if the CDL cannot be evaluated natively
+    bool isValid() const { return _valid; }
+
+    virtual void transformBlock(float* pixelData,
+                                int n,
+                                int numChannels) const OVERRIDE FINAL
+    {
+        assert(_valid);
+        if (numChannels == 4) {
+            transform<4>(pixelData, n);
+        } else {
+            assert(numChannels == 3);
+            transform<3>(pixelData, n);
+        }
+    }
+
+private:
+    template <int nComponents>
+    void transform(float* pixelData,
+                   int n) const
+    {
+        if (!_inverse) {
+            slopeOffset<nComponents>(pixelData, n);
+            if (_doPower) {
+                clampPower<nComponents>(pixelData, n);
+            }
+            if (_doSat) {
+                saturate<nComponents>(pixelData, n);
+            }
+        } else {
+            if (_doSat) {
+                saturate<nComponents>(pixelData, n);
+            }
+            if (_doPower) {
+                clampPower<nComponents>(pixelData, n);
+            }
+            offsetSlope<nComponents>(pixelData, n);
+        }
+    }
+
+    // each step is a separate loop over the block, simple enough to be vectorized by the compiler
+    template <int nComponents>
+    void slopeOffset(float* pix,
+                     int n) const
+    {
+        const float sr = _slope[0], sg = _slope[1], sb = _slope[2];
+        const float ofr = _offset[0], ofg = _offset[1], ofb = _offset[2];
+
+        for (int i = 0; i < n; ++i, pix += nComponents) {
+            pix[0] = pix[0] * sr + ofr;
+            pix[1] = pix[1] * sg + ofg;
+            pix[2] = pix[2] * sb + ofb;
+        }
+    }
+
+    // the inverse of slopeOffset(), _slope contains the inverse slope
+    template <int nComponents>
+    void offsetSlope(float* pix,
+                     int n) const
+    {
+        const float sr = _slope[0], sg = _slope[1], sb = _slope[2];
+        const float ofr = _offset[0], ofg = _offset[1], ofb = _offset[2];
+
+        for (int i = 0; i < n; ++i, pix += nComponents) {
+            pix[0] = (pix[0] - ofr) * sr;
+            pix[1] = (pix[1] - ofg) * sg;
+            pix[2] = (pix[2] - ofb) * sb;
+        }
+    }
+
+    template <int nComponents>
+    void clampPower(float* pix,
+                    int n) const
+    {
+        const float pr = _power[0], pg = _power[1], pb = _power[2];
+
+        for (int i = 0; i < n; ++i, pix += nComponents) {
+            pix[0] = std::pow(std::max(0.f, pix[0]), pr);
+            pix[1] = std::pow(std::max(0.f, pix[1]), pg);
+            pix[2] = std::pow(std::max(0.f, pix[2]), pb);
+            if (nComponents == 4) {
+                // the OCIO exponent op also clamps alpha
+                pix[3] = std::max(0.f, pix[3]);
+            }
+        }
+    }
+
+    template <int nComponents>
+    void saturate(float* pix,
+                  int n) const
+    {
+        const float sat = _sat;
+
+        for (int i = 0; i < n; ++i, pix += nComponents) {
+            const float luma = kCDLLumaR * pix[0] + kCDLLumaG * pix[1] + kCDLLumaB * pix[2];
+            pix[0] = luma + sat * (pix[0] - luma);
+            pix[1] = luma + sat * (pix[1] - luma);
+            pix[2] = luma + sat * (pix[2] - luma);
+        }
+    }
+
+    bool _inverse;
+    bool _doPower;
+    bool _doSat;
+    float _slope[3];
+    float _offset[3];
+    float _power[3];
+    float _sat;
+    bool _valid;
+};
+} // namespace IO
+} // namespace OFX
+
+#endif // ifndef IO_OCIOCDLBlockTransform_h
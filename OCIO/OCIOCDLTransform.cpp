@@ -24,16 +24,19 @@
 #ifdef OFX_IO_USING_OCIO
 
 #include <cstdio> // fopen...
+#include <cmath>
+#include <algorithm>
 
 #include "ofxsProcessing.H"
 #include "ofxsThreadSuite.h"
-#include "ofxsCopier.h"
+#include "ofxsMaskMix.h"
 #include "IOUtility.h"
 #include "ofxNatron.h"
 #include "ofxsCoords.h"
 #include "ofxsMacros.h"
 
 #include "GenericOCIO.h"
+#include "OCIOCDLBlockTransform.h"
 
 
 namespace OCIO = OCIO_NAMESPACE;
@@ -60,7 +63,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 #define kPluginIdentifier "fr.inria.openfx.OCIOCDLTransform"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -181,140 +184,14 @@ private:
 
     OCIO::ConstProcessorRcPtr getProcessor(OfxTime time);
 
+    void checkFirstLoad();
+
     void updateCCCId();
 
     void refreshKnobEnabledState(bool readFromFile);
 
     void loadCDLFromFile();
 
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       Image* dstImg)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcBitDepth,
-                       int srcRowBytes,
-                       Image* dstImg)
-    {
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcPixelDepth,
-                       int srcRowBytes,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes);
-
-    void apply(double time, const OfxRectI& renderWindow, float *pixelData, const OfxRectI& bounds, PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
-
-    void setupAndCopy(PixelProcessorFilterBase & processor,
-                      double time,
-                      const OfxRectI &renderWindow,
-                      const void *srcPixelData,
-                      const OfxRectI& srcBounds,
-                      PixelComponentEnum srcPixelComponents,
-                      int srcPixelComponentCount,
-                      BitDepthEnum srcPixelDepth,
-                      int srcRowBytes,
-                      void *dstPixelData,
-                      const OfxRectI& dstBounds,
-                      PixelComponentEnum dstPixelComponents,
-                      int dstPixelComponentCount,
-                      BitDepthEnum dstPixelDepth,
-                      int dstRowBytes);
-
 private:
     // do not need to delete these, the ImageEffect is managing them for us
     Clip *_dstClip;
@@ -328,6 +205,7 @@ private:
     ChoiceParam *_direction;
     BooleanParam* _readFromFile;
     StringParam *_file;
+    string _fileStamp; // the state of the file when the CDL values were last read from it
     IntParam *_version;
     StringParam *_cccid;
     StringParam *_export;
@@ -370,6 +248,7 @@ OCIOCDLTransformPlugin::OCIOCDLTransformPlugin(OfxImageEffectHandle handle)
     , _direction(NULL)
     , _readFromFile(NULL)
     , _file(NULL)
+    , _fileStamp()
     , _version(NULL)
     , _cccid(NULL)
     , _export(NULL)
@@ -444,154 +323,9 @@ OCIOCDLTransformPlugin::~OCIOCDLTransformPlugin()
 {
 }
 
-/* set up and run a copy processor */
-void
-OCIOCDLTransformPlugin::setupAndCopy(PixelProcessorFilterBase & processor,
-                                     double time,
-                                     const OfxRectI &renderWindow,
-                                     const void *srcPixelData,
-                                     const OfxRectI& srcBounds,
-                                     PixelComponentEnum srcPixelComponents,
-                                     int srcPixelComponentCount,
-                                     BitDepthEnum srcPixelDepth,
-                                     int srcRowBytes,
-                                     void *dstPixelData,
-                                     const OfxRectI& dstBounds,
-                                     PixelComponentEnum dstPixelComponents,
-                                     int dstPixelComponentCount,
-                                     BitDepthEnum dstPixelDepth,
-                                     int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-
-    auto_ptr<const Image> orig( ( _srcClip && _srcClip->isConnected() ) ?
-                                     _srcClip->fetchImage(time) : 0 );
-
-    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(time) ) && _maskClip && _maskClip->isConnected() );
-    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(time) : 0);
-    if (doMasking) {
-        bool maskInvert;
-        _maskInvert->getValueAtTime(time, maskInvert);
-        processor.doMasking(true);
-        processor.setMaskImg(mask.get(), maskInvert);
-    }
-
-    // set the images
-    assert(orig.get() && dstPixelData && srcPixelData);
-    processor.setOrigImg( orig.get() );
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    bool premult;
-    int premultChannel;
-    _premult->getValueAtTime(time, premult);
-    _premultChannel->getValueAtTime(time, premultChannel);
-    double mix;
-    _mix->getValueAtTime(time, mix);
-    processor.setPremultMaskMix(premult, premultChannel, mix);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
+// load the CDL file, if this was not done yet
 void
-OCIOCDLTransformPlugin::copyPixelData(bool unpremult,
-                                      bool premult,
-                                      bool maskmix,
-                                      double time,
-                                      const OfxRectI& renderWindow,
-                                      const void *srcPixelData,
-                                      const OfxRectI& srcBounds,
-                                      PixelComponentEnum srcPixelComponents,
-                                      int srcPixelComponentCount,
-                                      BitDepthEnum srcBitDepth,
-                                      int srcRowBytes,
-                                      void *dstPixelData,
-                                      const OfxRectI& dstBounds,
-                                      PixelComponentEnum dstPixelComponents,
-                                      int dstPixelComponentCount,
-                                      BitDepthEnum dstBitDepth,
-                                      int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-    if (!unpremult && !premult && !maskmix) {
-        copyPixels(*this, renderWindow,
-                   srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                   dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else if (unpremult && !premult && !maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierUnPremult<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierUnPremult<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && !premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierMaskMix<float, 4, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierMaskMix<float, 3, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierMaskMix<float, 1, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierPremultMaskMix<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierPremultMaskMix<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierPremultMaskMix<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else {
-        assert(false); // should never happen
-    }
-} // OCIOCDLTransformPlugin::copyPixelData
-
-OCIO::ConstProcessorRcPtr
-OCIOCDLTransformPlugin::getProcessor(OfxTime time)
+OCIOCDLTransformPlugin::checkFirstLoad()
 {
     if (_firstLoad) {
         _firstLoad = false;
@@ -601,6 +335,12 @@ OCIOCDLTransformPlugin::getProcessor(OfxTime time)
             loadCDLFromFile();
         }
     }
+}
+
+OCIO::ConstProcessorRcPtr
+OCIOCDLTransformPlugin::getProcessor(OfxTime time)
+{
+    checkFirstLoad();
 
     float sop[9];
     double slope_r, slope_g, slope_b;
@@ -668,37 +408,6 @@ OCIOCDLTransformPlugin::getProcessor(OfxTime time)
     return _proc;
 } // getProecssor
 
-void
-OCIOCDLTransformPlugin::apply(double time,
-                              const OfxRectI& renderWindow,
-                              float *pixelData,
-                              const OfxRectI& bounds,
-                              PixelComponentEnum pixelComponents,
-                              int pixelComponentCount,
-                              int rowBytes)
-{
-    // are we in the image bounds
-    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
-         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
-        throw std::runtime_error("OCIO: render window outside of image bounds");
-    }
-    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
-        throw std::runtime_error("OCIO: invalid components (only RGB and RGBA are supported)");
-    }
-
-    OCIOProcessor processor(*this);
-    // set the images
-    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
-
-    processor.setProcessor( getProcessor(time) );
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
 
 /*
@@ -921,7 +630,7 @@ OCIOCDLTransformPlugin::render(const RenderArguments &args)
     }
 
     BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
-    if ( (dstBitDepth != eBitDepthFloat) || (dstBitDepth != srcBitDepth) ) {
+    if (dstBitDepth != srcBitDepth) {
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -945,31 +654,35 @@ OCIOCDLTransformPlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    const void* srcPixelData = NULL;
-    OfxRectI bounds;
-    PixelComponentEnum pixelComponents;
-    BitDepthEnum bitDepth;
-    int srcRowBytes;
-    getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
-    int pixelComponentCount = srcImg->getPixelComponentCount();
-
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
     bool premult;
+    int premultChannel;
     _premult->getValueAtTime(args.time, premult);
+    _premultChannel->getValueAtTime(args.time, premultChannel);
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(args.time) : 0);
+    bool maskInvert = false;
+    if (doMasking) {
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+    }
 
-    // copy renderWindow to the temporary image
-    copyPixelData(premult, false, false, args.time, args.renderWindow, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
-
-    ///do the color-space conversion
-    apply(args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, tmpRowBytes);
+    // the CDL is evaluated natively, without building an OCIO processor
+    checkFirstLoad();
+    double slope[3], offset[3], power[3];
+    _slope->getValueAtTime(args.time, slope[0], slope[1], slope[2]);
+    _offset->getValueAtTime(args.time, offset[0], offset[1], offset[2]);
+    _power->getValueAtTime(args.time, power[0], power[1], power[2]);
+    double saturation = _saturation->getValueAtTime(args.time);
+    int directioni = _direction->getValueAtTime(args.time);
+    CDLBlockTransform cdl(slope, offset, power, saturation, directioni != 0);
+    OCIO::ConstProcessorRcPtr proc;
+    if ( !cdl.isValid() ) {
+        proc = getProcessor(args.time);
+    }
 
-    // copy the color-converted window
-    copyPixelData( false, premult, true, args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes, dstImg.get() );
+    // unpremultiply, apply the CDL, premultiply and mix, block by block
+    applyOCIOBlocks(*this, args.renderWindow, srcImg.get(), dstImg.get(), proc, cdl.isValid() ? &cdl : NULL, premult, premultChannel, mix, mask.get(), maskInvert);
 } // OCIOCDLTransformPlugin::render
 
 bool
@@ -1111,7 +824,11 @@ OCIOCDLTransformPlugin::loadCDLFromFile()
         _file->getValue(file);
         string cccid;
         _cccid->getValue(cccid);
+        // read the state first, so that an edit made while reading is seen by the next Reload
+        string stamp = getOCIOFileStamp(file);
         transform = OCIO::CDLTransform::CreateFromFile( file.c_str(), cccid.c_str() );
+        setOCIOFileLoaded(file);
+        _fileStamp = stamp;
     } catch (const OCIO::Exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
@@ -1170,7 +887,19 @@ OCIOCDLTransformPlugin::changedParam(const InstanceChangedArgs &args,
         updateCCCId();
     } else if (paramName == kParamReload) {
         _version->setValue(_version->getValue() + 1); // invalidate the node cache
-        OCIO::ClearAllCaches();
+        string file;
+        _file->getValue(file);
+        // the OCIO caches are shared by all instances: only clear them if the file changed since this instance
+        // read it, or since OCIO parsed it
+        const string stamp = getOCIOFileStamp(file);
+        if ( stamp.empty() || (stamp != _fileStamp) || ocioFileOutdated(file) ) {
+            clearOCIOFileCaches(file);
+        }
+        bool readFromFile;
+        _readFromFile->getValue(readFromFile);
+        if (readFromFile) {
+            loadCDLFromFile();
+        }
     } else if ( (paramName == kParamExport) && (args.reason == eChangeUserEdit) ) {
         string exportName;
         _export->getValueAtTime(args.time, exportName);
@@ -1271,7 +1000,7 @@ OCIOCDLTransformPlugin::changedClip(const InstanceChangedArgs &args,
     }
 }
 
-mDeclarePluginFactory(OCIOCDLTransformPluginFactory, {ofxsThreadSuiteCheck();}, {});
+mDeclarePluginFactory(OCIOCDLTransformPluginFactory, {ofxsThreadSuiteCheck();}, {shutdownOCIOPrewarm();});
 
 /** @brief The basic describe function, passed a plugin descriptor */
 void
@@ -1288,6 +1017,9 @@ OCIOCDLTransformPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedContext(eContextPaint);
 
     // add supported pixel depths
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
     desc.setSupportsTiles(kSupportsTiles);
@@ -33,7 +33,7 @@
 
 #include "ofxsProcessing.H"
 #include "ofxsThreadSuite.h"
-#include "ofxsCopier.h"
+#include "ofxsMaskMix.h"
 #include "ofxsCoords.h"
 #include "ofxsMacros.h"
 #include "IOUtility.h"
@@ -52,7 +52,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginDescription "ColorSpace transformation using OpenColorIO configuration file."
 #define kPluginIdentifier "fr.inria.openfx.OCIOColorSpace"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -109,146 +109,6 @@ private:
     void renderGPU(const RenderArguments &args);
 #endif
 
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       bool maskmix,
-                       double mix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       Image* dstImg)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      premultChannel,
-                      maskmix,
-                      mix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       bool maskmix,
-                       double mix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcBitDepth,
-                       int srcRowBytes,
-                       Image* dstImg)
-    {
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      premultChannel,
-                      maskmix,
-                      mix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       bool maskmix,
-                       double mix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      premultChannel,
-                      maskmix,
-                      mix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       bool maskmix,
-                       double mix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcPixelDepth,
-                       int srcRowBytes,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes);
-
-    void setupAndCopy(PixelProcessorFilterBase & processor,
-                      double time,
-                      const OfxRectI &renderWindow,
-                      const void *srcPixelData,
-                      const OfxRectI& srcBounds,
-                      PixelComponentEnum srcPixelComponents,
-                      int srcPixelComponentCount,
-                      BitDepthEnum srcPixelDepth,
-                      int srcRowBytes,
-                      void *dstPixelData,
-                      const OfxRectI& dstBounds,
-                      PixelComponentEnum dstPixelComponents,
-                      int dstPixelComponentCount,
-                      BitDepthEnum dstPixelDepth,
-                      int dstRowBytes);
-
     // do not need to delete these, the ImageEffect is managing them for us
     Clip *_dstClip;
     Clip *_srcClip;
@@ -314,166 +174,6 @@ OCIOColorSpacePlugin::~OCIOColorSpacePlugin()
 {
 }
 
-/* set up and run a copy processor */
-void
-OCIOColorSpacePlugin::setupAndCopy(PixelProcessorFilterBase & processor,
-                                   double time,
-                                   const OfxRectI &renderWindow,
-                                   const void *srcPixelData,
-                                   const OfxRectI& srcBounds,
-                                   PixelComponentEnum srcPixelComponents,
-                                   int srcPixelComponentCount,
-                                   BitDepthEnum srcPixelDepth,
-                                   int srcRowBytes,
-                                   void *dstPixelData,
-                                   const OfxRectI& dstBounds,
-                                   PixelComponentEnum dstPixelComponents,
-                                   int dstPixelComponentCount,
-                                   BitDepthEnum dstPixelDepth,
-                                   int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-
-    auto_ptr<const Image> orig( _srcClip->fetchImage(time) );
-
-    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(time) ) && _maskClip && _maskClip->isConnected() );
-    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(time) : 0);
-    if (doMasking) {
-        bool maskInvert;
-        _maskInvert->getValueAtTime(time, maskInvert);
-        processor.doMasking(true);
-        processor.setMaskImg(mask.get(), maskInvert);
-    }
-
-    // set the images
-    assert(orig.get() && dstPixelData && srcPixelData);
-    processor.setOrigImg( orig.get() );
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    bool premult;
-    int premultChannel;
-    _premult->getValueAtTime(time, premult);
-    _premultChannel->getValueAtTime(time, premultChannel);
-    double mix;
-    _mix->getValueAtTime(time, mix);
-    processor.setPremultMaskMix(premult, premultChannel, mix);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
-void
-OCIOColorSpacePlugin::copyPixelData(bool unpremult,
-                                    bool premult,
-                                    int premultChannel,
-                                    bool maskmix,
-                                    double mix,
-                                    double time,
-                                    const OfxRectI& renderWindow,
-                                    const void *srcPixelData,
-                                    const OfxRectI& srcBounds,
-                                    PixelComponentEnum srcPixelComponents,
-                                    int srcPixelComponentCount,
-                                    BitDepthEnum srcBitDepth,
-                                    int srcRowBytes,
-                                    void *dstPixelData,
-                                    const OfxRectI& dstBounds,
-                                    PixelComponentEnum dstPixelComponents,
-                                    int dstPixelComponentCount,
-                                    BitDepthEnum dstBitDepth,
-                                    int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-    if ( ( (!unpremult && !premult) || (unpremult && premult) ) && !maskmix ) {
-        copyPixels(*this, renderWindow,
-                   srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                   dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else if (unpremult && !premult && !maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, 1.);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierUnPremult<float, 3, 1, float, 3, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, 1.);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierUnPremult<float, 1, 1, float, 1, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, 1.);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && !premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierMaskMix<float, 4, 1, true> fred(*this);
-            fred.setPremultMaskMix(false, premultChannel, mix);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierMaskMix<float, 3, 1, true> fred(*this);
-            fred.setPremultMaskMix(false, premultChannel, mix);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierMaskMix<float, 1, 1, true> fred(*this);
-            fred.setPremultMaskMix(false, premultChannel, mix);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierPremultMaskMix<float, 4, 1, float, 4, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, mix);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierPremultMaskMix<float, 3, 1, float, 3, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, mix);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierPremultMaskMix<float, 1, 1, float, 1, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, mix);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else {
-        // not handled: (should never happen in OCIOColorSpace)
-        // !unpremult && premult && !maskmix
-        // unpremult && !premult && maskmix
-        // unpremult && premult && maskmix
-        assert(false); // should never happen
-    }
-} // OCIOColorSpacePlugin::copyPixelData
-
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
 
 /*
@@ -702,7 +402,7 @@ OCIOColorSpacePlugin::render(const RenderArguments &args)
     }
 
     BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
-    if ( (dstBitDepth != eBitDepthFloat) || (dstBitDepth != srcBitDepth) ) {
+    if (dstBitDepth != srcBitDepth) {
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -726,35 +426,32 @@ OCIOColorSpacePlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    const void* srcPixelData = NULL;
-    OfxRectI bounds;
-    PixelComponentEnum pixelComponents;
-    BitDepthEnum bitDepth;
-    int srcRowBytes;
-    getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
-    int pixelComponentCount = srcImg->getPixelComponentCount();
-
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
     bool premult;
-    _premult->getValueAtTime(args.time, premult);
     int premultChannel;
+    _premult->getValueAtTime(args.time, premult);
     _premultChannel->getValueAtTime(args.time, premultChannel);
     double mix;
     _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(args.time) : 0);
+    bool maskInvert = false;
+    if (doMasking) {
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+    }
 
-    // copy renderWindow to the temporary image
-    copyPixelData(premult, false, premultChannel, false, 1., args.time, args.renderWindow, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
+    OCIO::ConstProcessorRcPtr proc;
+    if ( !_ocio->isIdentity(args.time) ) {
+        proc = _ocio->getOrCreateProcessor(args.time);
+        if (!proc) {
+            setPersistentMessage( Message::eMessageError, "", "Cannot create OCIO processor" );
+            throwSuiteStatusException(kOfxStatFailed);
 
-    ///do the color-space conversion
-    _ocio->apply(args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, tmpRowBytes);
+            return;
+        }
+    }
 
-    // copy the color-converted window and apply masking
-    copyPixelData( false, premult, premultChannel, true, mix, args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes, dstImg.get() );
+    // unpremultiply, do the color-space conversion, premultiply and mix, block by block
+    applyOCIOBlocks(*this, args.renderWindow, srcImg.get(), dstImg.get(), proc, NULL, premult, premultChannel, mix, mask.get(), maskInvert);
 } // OCIOColorSpacePlugin::render
 
 bool
@@ -839,7 +536,7 @@ OCIOColorSpacePlugin::changedClip(const InstanceChangedArgs &args,
     }
 }
 
-mDeclarePluginFactory(OCIOColorSpacePluginFactory, {ofxsThreadSuiteCheck();}, {});
+mDeclarePluginFactory(OCIOColorSpacePluginFactory, {ofxsThreadSuiteCheck();}, {shutdownOCIOPrewarm();});
 
 /** @brief The basic describe function, passed a plugin descriptor */
 void
@@ -856,6 +553,9 @@ OCIOColorSpacePluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedContext(eContextPaint);
 
     // add supported pixel depths
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
     desc.setSupportsTiles(kSupportsTiles);
@@ -25,13 +25,11 @@
 //#include <iostream>
 #include <memory>
 #include <algorithm>
-#ifdef DEBUG
-#include <cstdio> // printf
-#endif
+#include <cstdio> // sprintf, printf
 
 #include "ofxsProcessing.H"
 #include "ofxsThreadSuite.h"
-#include "ofxsCopier.h"
+#include "ofxsMaskMix.h"
 #include "ofxsCoords.h"
 #include "ofxsMacros.h"
 #include "IOUtility.h"
@@ -49,7 +47,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginDescription "Uses the OpenColorIO library to apply a colorspace conversion to an image sequence, so that it can be accurately represented on a specific display device."
 #define kPluginIdentifier "fr.inria.openfx.OCIODisplay"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -153,6 +151,142 @@ buildViewMenu(OCIO::ConstConfigRcPtr config,
     }
 }
 
+// creates the processor of a display transform, possibly in the background (see prewarmOCIOProcessor())
+class DisplayProcessorBuilder
+    : public OCIOProcessorBuilder
+{
+public:
+    DisplayProcessorBuilder(const OCIO::ConstConfigRcPtr& config,
+                            const OCIO::ConstContextRcPtr& context,
+                            const string& inputSpace,
+                            ChannelSelectorEnum channel,
+                            const string& display,
+                            const string& view,
+                            double gain,
+                            double gamma)
+        : _config(config)
+        , _context(context)
+        , _inputSpace(inputSpace)
+        , _channel(channel)
+        , _display(display)
+        , _view(view)
+        , _gain(gain)
+        , _gamma(gamma)
+    {
+    }
+
+    // identifies the processor: the config, the context and the transform parameters
+    string getKey() const
+    {
+        char values[128];
+        std::sprintf(values, "\n%d\n%.17g\n%.17g", (int)_channel, _gain, _gamma);
+        string key = _config->getCacheID(_context);
+        key += '\n';
+        key += _context->getCacheID();
+        key += "\ndisplay\n";
+        key += _inputSpace;
+        key += '\n';
+        key += _display;
+        key += '\n';
+        key += _view;
+        key += values;
+
+        return key;
+    }
+
+    virtual OCIO::ConstProcessorRcPtr build() const OVERRIDE FINAL
+    {
+        OCIO::DisplayTransformRcPtr transform = OCIO::DisplayTransform::Create();
+        transform->setInputColorSpaceName( _inputSpace.c_str() );
+
+        transform->setDisplay( _display.c_str() );
+
+        transform->setView( _view.c_str() );
+
+        // Specify an (optional) linear color correction
+        {
+            float m44[16];
+            float offset4[4];
+            const float slope4f[] = { (float)_gain, (float)_gain, (float)_gain, (float)_gain };
+            OCIO::MatrixTransform::Scale(m44, offset4, slope4f);
+
+            OCIO::MatrixTransformRcPtr mtx =  OCIO::MatrixTransform::Create();
+            mtx->setValue(m44, offset4);
+
+            transform->setLinearCC(mtx);
+        }
+
+        // Specify an (optional) post-display transform.
+        {
+            float exponent = 1.0f / std::max(1e-6f, (float)_gamma);
+            const float exponent4f[] = { exponent, exponent, exponent, exponent };
+            OCIO::ExponentTransformRcPtr cc =  OCIO::ExponentTransform::Create();
+            cc->setValue(exponent4f);
+            transform->setDisplayCC(cc);
+        }
+
+        // Add Channel swizzling
+        {
+            int channelHot[4] = { 0, 0, 0, 0};
+
+            switch (_channel) {
+            case eChannelSelectorLuminance:     // Luma
+                channelHot[0] = 1;
+                channelHot[1] = 1;
+                channelHot[2] = 1;
+                break;
+            //case eChannelSelectorMatteOverlay: //  Channel overlay mode. Do rgb, and then swizzle later
+            //    channelHot[0] = 1;
+            //    channelHot[1] = 1;
+            //    channelHot[2] = 1;
+            //    channelHot[3] = 1;
+            //    break;
+            case eChannelSelectorRGB:     // RGB
+                channelHot[0] = 1;
+                channelHot[1] = 1;
+                channelHot[2] = 1;
+                channelHot[3] = 1;
+                break;
+            case eChannelSelectorR:     // R
+                channelHot[0] = 1;
+                break;
+            case eChannelSelectorG:     // G
+                channelHot[1] = 1;
+                break;
+            case eChannelSelectorB:     // B
+                channelHot[2] = 1;
+                break;
+            case eChannelSelectorA:     // A
+                channelHot[3] = 1;
+                break;
+            default:
+                break;
+            }
+
+            float lumacoef[3];
+            _config->getDefaultLumaCoefs(lumacoef);
+            float m44[16];
+            float offset[4];
+            OCIO::MatrixTransform::View(m44, offset, channelHot, lumacoef);
+            OCIO::MatrixTransformRcPtr swizzle = OCIO::MatrixTransform::Create();
+            swizzle->setValue(m44, offset);
+            transform->setChannelView(swizzle);
+        }
+
+        return _config->getProcessor(_context, transform, OCIO::TRANSFORM_DIR_FORWARD);
+    }
+
+private:
+    OCIO::ConstConfigRcPtr _config;
+    OCIO::ConstContextRcPtr _context;
+    string _inputSpace;
+    ChannelSelectorEnum _channel;
+    string _display;
+    string _view;
+    double _gain;
+    double _gamma;
+};
+
 class OCIODisplayPlugin
     : public ImageEffect
 {
@@ -204,135 +338,9 @@ private:
     void displayCheck(double time);
     void viewCheck(double time, bool setDefaultIfInvalid = false);
 
-    void apply(double time, const OfxRectI& renderWindow, float *pixelData, const OfxRectI& bounds, PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
-
+    DisplayProcessorBuilder getProcessorBuilder(OfxTime time, const OCIO::ConstConfigRcPtr& config);
     OCIO::ConstProcessorRcPtr getProcessor(OfxTime time);
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       Image* dstImg)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      premultChannel,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcBitDepth,
-                       int srcRowBytes,
-                       Image* dstImg)
-    {
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      premultChannel,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      premultChannel,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       int premultChannel,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcPixelDepth,
-                       int srcRowBytes,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes);
-
-    void setupAndCopy(PixelProcessorFilterBase & processor,
-                      double time,
-                      const OfxRectI &renderWindow,
-                      const void *srcPixelData,
-                      const OfxRectI& srcBounds,
-                      PixelComponentEnum srcPixelComponents,
-                      int srcPixelComponentCount,
-                      BitDepthEnum srcPixelDepth,
-                      int srcRowBytes,
-                      void *dstPixelData,
-                      const OfxRectI& dstBounds,
-                      PixelComponentEnum dstPixelComponents,
-                      int dstPixelComponentCount,
-                      BitDepthEnum dstPixelDepth,
-                      int dstRowBytes);
+    void prewarmProcessor(double time);
 
     // do not need to delete these, the ImageEffect is managing them for us
     Clip *_dstClip;
@@ -351,12 +359,9 @@ private:
 
     GenericOCIO::Mutex _procMutex;
     OCIO::ConstProcessorRcPtr _proc;
-    string _procInputSpace;
-    ChannelSelectorEnum _procChannel;
-    string _procDisplay;
-    string _procView;
-    double _procGain;
-    double _procGamma;
+    string _procKey; // see DisplayProcessorBuilder::getKey()
+
+    BooleanParam* _bakeLut;
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     BooleanParam* _enableGPU;
@@ -376,9 +381,8 @@ OCIODisplayPlugin::OCIODisplayPlugin(OfxImageEffectHandle handle)
     , _gamma(NULL)
     , _channel(NULL)
     , _ocio( new GenericOCIO(this) )
-    , _procChannel(eChannelSelectorRGB)
-    , _procGain(-1)
-    , _procGamma(-1)
+    , _procKey()
+    , _bakeLut(NULL)
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     , _enableGPU(NULL)
     , _openGLContextData(NULL)
@@ -404,6 +408,8 @@ OCIODisplayPlugin::OCIODisplayPlugin(OfxImageEffectHandle handle)
     _display = fetchStringParam(kParamDisplay);
     _view = fetchStringParam(kParamView);
 
+    _bakeLut = fetchBooleanParam(kOCIOParamBakeLUT);
+    assert(_bakeLut);
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     _enableGPU = fetchBooleanParam(kParamEnableGPU);
     assert(_enableGPU);
@@ -430,6 +436,7 @@ OCIODisplayPlugin::OCIODisplayPlugin(OfxImageEffectHandle handle)
     }
     displayCheck(0.);
     viewCheck(0.);
+    prewarmProcessor(0.);
 }
 
 OCIODisplayPlugin::~OCIODisplayPlugin()
@@ -514,110 +521,9 @@ OCIODisplayPlugin::viewCheck(double time,
     }
 }
 
-/* set up and run a copy processor */
-void
-OCIODisplayPlugin::setupAndCopy(PixelProcessorFilterBase & processor,
-                                double time,
-                                const OfxRectI &renderWindow,
-                                const void *srcPixelData,
-                                const OfxRectI& srcBounds,
-                                PixelComponentEnum srcPixelComponents,
-                                int srcPixelComponentCount,
-                                BitDepthEnum srcPixelDepth,
-                                int srcRowBytes,
-                                void *dstPixelData,
-                                const OfxRectI& dstBounds,
-                                PixelComponentEnum dstPixelComponents,
-                                int dstPixelComponentCount,
-                                BitDepthEnum dstPixelDepth,
-                                int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-
-    // set the images
-    assert(dstPixelData && srcPixelData);
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    bool premult;
-    int premultChannel;
-    _premult->getValueAtTime(time, premult);
-    _premultChannel->getValueAtTime(time, premultChannel);
-    processor.setPremultMaskMix(premult, premultChannel, 1.);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
-void
-OCIODisplayPlugin::copyPixelData(bool unpremult,
-                                 bool premult,
-                                 int premultChannel,
-                                 double time,
-                                 const OfxRectI& renderWindow,
-                                 const void *srcPixelData,
-                                 const OfxRectI& srcBounds,
-                                 PixelComponentEnum srcPixelComponents,
-                                 int srcPixelComponentCount,
-                                 BitDepthEnum srcBitDepth,
-                                 int srcRowBytes,
-                                 void *dstPixelData,
-                                 const OfxRectI& dstBounds,
-                                 PixelComponentEnum dstPixelComponents,
-                                 int dstPixelComponentCount,
-                                 BitDepthEnum dstBitDepth,
-                                 int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-    if ( ( (!unpremult && !premult) || (unpremult && premult) ) ) {
-        copyPixels(*this, renderWindow,
-                   srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                   dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else if (unpremult && !premult) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, 1.);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierUnPremult<float, 3, 1, float, 3, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, 1.);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierUnPremult<float, 1, 1, float, 1, 1> fred(*this);
-            fred.setPremultMaskMix(true, premultChannel, 1.);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else {
-        // not handled: (should never happen in OCIODisplay)
-        // !unpremult && premult
-        assert(false); // should never happen
-    }
-}
-
-OCIO::ConstProcessorRcPtr
-OCIODisplayPlugin::getProcessor(OfxTime time)
+DisplayProcessorBuilder
+OCIODisplayPlugin::getProcessorBuilder(OfxTime time,
+                                       const OCIO::ConstConfigRcPtr& config)
 {
     string inputSpace;
 
@@ -630,151 +536,63 @@ OCIODisplayPlugin::getProcessor(OfxTime time)
     double gain = _gain->getValueAtTime(time);
     double gamma = _gamma->getValueAtTime(time);
 
+    return DisplayProcessorBuilder(config, _ocio->getLocalContext(time), inputSpace, channel, display, view, gain, gamma);
+}
+
+OCIO::ConstProcessorRcPtr
+OCIODisplayPlugin::getProcessor(OfxTime time)
+{
     try {
         OCIO::ConstConfigRcPtr config = _ocio->getConfig();
         if (!config) {
             throw std::runtime_error("OCIO: no current config");
         }
-        GenericOCIO::AutoMutex guard(_procMutex);
-        if ( !_proc ||
-             ( _procInputSpace != inputSpace) ||
-             ( _procChannel != channel) ||
-             ( _procDisplay != display) ||
-             ( _procView != view) ||
-             ( _procGain != gain) ||
-             ( _procGamma != gamma) ) {
-            OCIO::DisplayTransformRcPtr transform = OCIO::DisplayTransform::Create();
-            transform->setInputColorSpaceName( inputSpace.c_str() );
-
-            transform->setDisplay( display.c_str() );
-
-            transform->setView( view.c_str() );
-
-            // Specify an (optional) linear color correction
-            {
-                float m44[16];
-                float offset4[4];
-                const float slope4f[] = { (float)gain, (float)gain, (float)gain, (float)gain };
-                OCIO::MatrixTransform::Scale(m44, offset4, slope4f);
-
-                OCIO::MatrixTransformRcPtr mtx =  OCIO::MatrixTransform::Create();
-                mtx->setValue(m44, offset4);
-
-                transform->setLinearCC(mtx);
+        DisplayProcessorBuilder builder = getProcessorBuilder(time, config);
+        const string key = builder.getKey();
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            if ( _proc && (_procKey == key) ) {
+                return _proc;
             }
-
-            // Specify an (optional) post-display transform.
-            {
-                float exponent = 1.0f / std::max(1e-6f, (float)gamma);
-                const float exponent4f[] = { exponent, exponent, exponent, exponent };
-                OCIO::ExponentTransformRcPtr cc =  OCIO::ExponentTransform::Create();
-                cc->setValue(exponent4f);
-                transform->setDisplayCC(cc);
-            }
-
-            // Add Channel swizzling
-            {
-                int channelHot[4] = { 0, 0, 0, 0};
-
-                switch (channel) {
-                case eChannelSelectorLuminance:     // Luma
-                    channelHot[0] = 1;
-                    channelHot[1] = 1;
-                    channelHot[2] = 1;
-                    break;
-                //case eChannelSelectorMatteOverlay: //  Channel overlay mode. Do rgb, and then swizzle later
-                //    channelHot[0] = 1;
-                //    channelHot[1] = 1;
-                //    channelHot[2] = 1;
-                //    channelHot[3] = 1;
-                //    break;
-                case eChannelSelectorRGB:     // RGB
-                    channelHot[0] = 1;
-                    channelHot[1] = 1;
-                    channelHot[2] = 1;
-                    channelHot[3] = 1;
-                    break;
-                case eChannelSelectorR:     // R
-                    channelHot[0] = 1;
-                    break;
-                case eChannelSelectorG:     // G
-                    channelHot[1] = 1;
-                    break;
-                case eChannelSelectorB:     // B
-                    channelHot[2] = 1;
-                    break;
-                case eChannelSelectorA:     // A
-                    channelHot[3] = 1;
-                    break;
-                default:
-                    break;
-                }
-
-                float lumacoef[3];
-                config->getDefaultLumaCoefs(lumacoef);
-                float m44[16];
-                float offset[4];
-                OCIO::MatrixTransform::View(m44, offset, channelHot, lumacoef);
-                OCIO::MatrixTransformRcPtr swizzle = OCIO::MatrixTransform::Create();
-                swizzle->setValue(m44, offset);
-                transform->setChannelView(swizzle);
-            }
-
-            OCIO::ConstContextRcPtr context = _ocio->getLocalContext(time);
-            _proc = config->getProcessor(context, transform, OCIO::TRANSFORM_DIR_FORWARD);
-            _procInputSpace = inputSpace;
-            _procChannel = channel;
-            _procDisplay = display;
-            _procView = view;
-            _procGain = gain;
-            _procGamma = gamma;
         }
+        // the processor may be built right now, or may already be building in the background:
+        // do not hold the lock meanwhile
+        OCIO::ConstProcessorRcPtr proc = getOCIOProcessor(key, builder);
+        GenericOCIO::AutoMutex guard(_procMutex);
+        _proc = proc;
+        _procKey = key;
+
+        return proc;
     } catch (const OCIO::Exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
     }
 
-    return _proc;
+    return OCIO::ConstProcessorRcPtr();
 } // OCIODisplayPlugin::getProcessor
 
+// start building the processor in the background, so that it is ready for the next render
 void
-OCIODisplayPlugin::apply(double time,
-                         const OfxRectI& renderWindow,
-                         float *pixelData,
-                         const OfxRectI& bounds,
-                         PixelComponentEnum pixelComponents,
-                         int pixelComponentCount,
-                         int rowBytes)
+OCIODisplayPlugin::prewarmProcessor(double time)
 {
-    // are we in the image bounds
-    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
-         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
-        throw std::runtime_error("OCIO: render window outside of image bounds");
+    OCIO::ConstConfigRcPtr config = _ocio->getConfig();
+
+    if (!config) {
+        return;
     }
-    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
-        throw std::runtime_error("OCIO: invalid components (only RGB and RGBA are supported)");
+    try {
+        DisplayProcessorBuilder builder = getProcessorBuilder(time, config);
+        const string key = builder.getKey();
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            if ( _proc && (_procKey == key) ) {
+                return;
+            }
+        }
+        prewarmOCIOProcessor( key, new DisplayProcessorBuilder(builder) );
+    } catch (const OCIO::Exception &) {
+        // the error will be reported by render()
     }
-
-    OCIOProcessor processor(*this);
-    // set the images
-    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
-
-    processor.setProcessor( getProcessor(time) );
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-
-    // Hack to emulate Channel overlay mode
-    //if (channel == eChannelSelectorMatteOverlay) {
-    //    for (int i = 0; i < rowWidth; ++i) {
-    //        rOut[i] = rOut[i] + (1.0f - rOut[i]) * (0.5f * aOut[i]);
-    //        gOut[i] = gOut[i] - gOut[i] * (0.5f * aOut[i]);
-    //        bOut[i] = bOut[i] - bOut[i] * (0.5f * aOut[i]);
-    //    }
-    //}
 }
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
@@ -993,7 +811,7 @@ OCIODisplayPlugin::render(const RenderArguments &args)
     }
 
     BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
-    if ( (dstBitDepth != eBitDepthFloat) || (dstBitDepth != srcBitDepth) ) {
+    if (dstBitDepth != srcBitDepth) {
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -1017,33 +835,39 @@ OCIODisplayPlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    const void* srcPixelData = NULL;
-    OfxRectI bounds;
-    PixelComponentEnum pixelComponents;
-    BitDepthEnum bitDepth;
-    int srcRowBytes;
-    getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
-    int pixelComponentCount = srcImg->getPixelComponentCount();
-
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
     bool premult;
-    _premult->getValueAtTime(args.time, premult);
     int premultChannel;
+    _premult->getValueAtTime(args.time, premult);
     _premultChannel->getValueAtTime(args.time, premultChannel);
 
-    // copy renderWindow to the temporary image
-    copyPixelData(premult, false, premultChannel, args.time, args.renderWindow, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
+    OCIO::ConstProcessorRcPtr proc;
 
-    ///do the color-space conversion
-    apply(args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, tmpRowBytes);
+    // keep a reference to the baked LUT until processing is done
+    OCIO_SHARED_PTR<const OCIOBakedLut> bakedLut;
+    OCIO::ConstConfigRcPtr config = _ocio->getConfig();
+    if ( config && _bakeLut->getValueAtTime(args.time) ) {
+        string inputSpace;
+        _ocio->getInputColorspaceAtTime(args.time, inputSpace);
+        string key;
+        try {
+            // the config cache ID covers the LUT files used by the config
+            key = getProcessorBuilder(args.time, config).getKey();
+        } catch (const OCIO::Exception &) {
+            // reported by getProcessor()
+        }
+        // if the LUT was baked in a previous session, the processor is not even needed
+        bakedLut = findOCIOBakedLut(key);
+        if (!bakedLut) {
+            proc = getProcessor(args.time);
+            bakedLut = getOCIOBakedLut(proc, config, inputSpace, key);
+        }
+    }
+    if (!bakedLut && !proc) {
+        proc = getProcessor(args.time);
+    }
 
-    // copy the color-converted window and apply masking
-    copyPixelData( false, premult, premultChannel, args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes, dstImg.get() );
+    // unpremultiply, do the color-space conversion and premultiply, block by block
+    applyOCIOBlocks(*this, args.renderWindow, srcImg.get(), dstImg.get(), proc, bakedLut.get(), premult, premultChannel, 1., NULL, false);
 } // OCIODisplayPlugin::render
 
 void
@@ -1056,10 +880,9 @@ OCIODisplayPlugin::changedParam(const InstanceChangedArgs &args,
     OCIO::ConstConfigRcPtr config = _ocio->getConfig();
 
     if (!config) {
-        return _ocio->changedParam(args, paramName);
-    }
-    // the other parameters assume there is a valid config
-    if (paramName == kParamDisplay) {
+        // the other parameters assume there is a valid config
+        _ocio->changedParam(args, paramName);
+    } else if (paramName == kParamDisplay) {
         assert(_display);
         displayCheck(args.time);
         if (_viewChoice) {
@@ -1104,7 +927,21 @@ OCIODisplayPlugin::changedParam(const InstanceChangedArgs &args,
         setSupportsTiles(!supportsGL);
 #endif
     } else {
-        return _ocio->changedParam(args, paramName);
+        _ocio->changedParam(args, paramName);
+    }
+
+    // gain and gamma are left out: they are usually dragged interactively
+    if ( (args.reason != eChangeTime) &&
+         ( ( paramName == kOCIOParamConfigFile) ||
+           ( paramName == kOCIOParamInputSpace) ||
+           ( paramName == kParamDisplay) ||
+           ( paramName == kParamView) ||
+           ( paramName == kParamChannelSelector) ||
+           ( paramName == kOCIOParamContextKey1) || ( paramName == kOCIOParamContextValue1) ||
+           ( paramName == kOCIOParamContextKey2) || ( paramName == kOCIOParamContextValue2) ||
+           ( paramName == kOCIOParamContextKey3) || ( paramName == kOCIOParamContextValue3) ||
+           ( paramName == kOCIOParamContextKey4) || ( paramName == kOCIOParamContextValue4) ) ) {
+        prewarmProcessor(args.time);
     }
 } // OCIODisplayPlugin::changedParam
 
@@ -1131,7 +968,7 @@ OCIODisplayPlugin::changedClip(const InstanceChangedArgs &args,
     }
 }
 
-mDeclarePluginFactory(OCIODisplayPluginFactory, {ofxsThreadSuiteCheck();}, {});
+mDeclarePluginFactory(OCIODisplayPluginFactory, {ofxsThreadSuiteCheck();}, {shutdownOCIOPrewarm();});
 
 /** @brief The basic describe function, passed a plugin descriptor */
 void
@@ -1148,6 +985,9 @@ OCIODisplayPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedContext(eContextPaint);
 
     // add supported pixel depths
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
     desc.setSupportsTiles(kSupportsTiles);
@@ -1299,6 +1139,17 @@ OCIODisplayPluginFactory::describeInContext(ImageEffectDescriptor &desc,
         }
     }
 
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kOCIOParamBakeLUT);
+        param->setLabel(kOCIOParamBakeLUTLabel);
+        param->setHint(kOCIOParamBakeLUTHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kParamEnableGPU);
@@ -31,13 +31,11 @@
 #  endif
 #endif // defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 
-#ifdef DEBUG
-#include <cstdio>
-#endif
+#include <cstdio> // sprintf
 
 #include "ofxsProcessing.H"
 #include "ofxsThreadSuite.h"
-#include "ofxsCopier.h"
+#include "ofxsMaskMix.h"
 #include "IOUtility.h"
 #include "ofxNatron.h"
 #include "ofxsMacros.h"
@@ -66,7 +64,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 #define kPluginIdentifier "fr.inria.openfx.OCIOFileTransform"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -114,6 +112,101 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 static bool gHostIsNatron = false; // TODO: generate a CCCId choice param kParamCCCIDChoice from available IDs
 
+// creates the processor of a LUT file, possibly in the background (see prewarmOCIOProcessor()).
+// The processors are shared by all instances using the same file.
+class FileProcessorBuilder
+    : public OCIOProcessorBuilder
+{
+public:
+    // stamp is the state of the file, given by getOCIOFileStamp()
+    FileProcessorBuilder(const OCIO::ConstConfigRcPtr& config,
+                         const string& file,
+                         const string& stamp,
+                         const string& cccid,
+                         int direction,
+                         int interpolation)
+        : _config(config)
+        , _file(file)
+        , _stamp(stamp)
+        , _cccid(cccid)
+        , _direction(direction)
+        , _interpolation(interpolation)
+    {
+    }
+
+    // identifies the processor: the config, the file and its state, and the transform parameters.
+    // Returns an empty string if the file does not exist.
+    string getKey() const
+    {
+        if ( _stamp.empty() ) {
+            return string();
+        }
+        char settings[64];
+        std::sprintf(settings, "\n%d %d", _direction, _interpolation);
+        string key = _config->getCacheID();
+        key += "\nfile\n";
+        key += _file;
+        key += '\n';
+        key += _stamp;
+        key += '\n';
+        key += _cccid;
+        key += settings;
+
+        return key;
+    }
+
+    virtual OCIO::ConstProcessorRcPtr build() const OVERRIDE FINAL
+    {
+        OCIO::FileTransformRcPtr transform = OCIO::FileTransform::Create();
+        transform->setSrc( _file.c_str() );
+        transform->setCCCId( _cccid.c_str() );
+
+        if (_direction == 0) {
+            transform->setDirection(OCIO::TRANSFORM_DIR_FORWARD);
+        } else {
+            transform->setDirection(OCIO::TRANSFORM_DIR_INVERSE);
+        }
+
+        if (_interpolation == 0) {
+            transform->setInterpolation(OCIO::INTERP_NEAREST);
+        } else if (_interpolation == 1) {
+            transform->setInterpolation(OCIO::INTERP_LINEAR);
+        } else if (_interpolation == 2) {
+            transform->setInterpolation(OCIO::INTERP_TETRAHEDRAL);
+        } else if (_interpolation == 3) {
+            transform->setInterpolation(OCIO::INTERP_BEST);
+        } else {
+            // Should never happen
+            throw OCIO::Exception("OCIO Interpolation value out of bounds");
+        }
+
+        // the OCIO caches must have been cleared by the caller if the file changed (see clearCachesIfOutdated()):
+        // this may run on a background thread, while other threads use these caches
+        OCIO::ConstProcessorRcPtr proc = _config->getProcessor(transform, OCIO::TRANSFORM_DIR_FORWARD);
+        setOCIOFileLoaded(_file);
+
+        return proc;
+    }
+
+    // OCIO caches the parsed files by path only: if this file changed since it was parsed, the cached version
+    // is stale. The processors created for the other files hold their own data, and remain valid.
+    // Must be called before the processor is requested, on the calling thread.
+    void clearCachesIfOutdated() const
+    {
+        if ( ocioFileOutdated(_file) ) {
+            clearOCIOFileCaches(_file);
+        }
+    }
+
+private:
+    OCIO::ConstConfigRcPtr _config;
+    string _file;
+    string _stamp;
+    string _cccid;
+    int _direction;
+    int _interpolation;
+};
+
 class OCIOFileTransformPlugin
     : public ImageEffect
 {
@@ -154,138 +247,13 @@ private:
     void renderGPU(const RenderArguments &args);
 #endif
 
+    FileProcessorBuilder getProcessorBuilder(OfxTime time);
+    string getFileStamp(const string& file, bool refresh);
     OCIO::ConstProcessorRcPtr getProcessor(OfxTime time);
+    void prewarmProcessor(double time);
 
     void updateCCCId();
 
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       Image* dstImg)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcBitDepth,
-                       int srcRowBytes,
-                       Image* dstImg)
-    {
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcPixelDepth,
-                       int srcRowBytes,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes);
-
-    void apply(double time, const OfxRectI& renderWindow, float *pixelData, const OfxRectI& bounds, PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
-
-    void setupAndCopy(PixelProcessorFilterBase & processor,
-                      double time,
-                      const OfxRectI &renderWindow,
-                      const void *srcPixelData,
-                      const OfxRectI& srcBounds,
-                      PixelComponentEnum srcPixelComponents,
-                      int srcPixelComponentCount,
-                      BitDepthEnum srcPixelDepth,
-                      int srcRowBytes,
-                      void *dstPixelData,
-                      const OfxRectI& dstBounds,
-                      PixelComponentEnum dstPixelComponents,
-                      int dstPixelComponentCount,
-                      BitDepthEnum dstPixelDepth,
-                      int dstRowBytes);
-
 private:
     // do not need to delete these, the ImageEffect is managing them for us
     Clip *_dstClip;
@@ -304,10 +272,11 @@ private:
 
     GenericOCIO::Mutex _procMutex;
     OCIO::ConstProcessorRcPtr _proc;
-    string _procFile;
-    string _procCCCId;
-    int _procDirection;
-    int _procInterpolation;
+    string _procKey; // see FileProcessorBuilder::getKey()
+    string _stampedFile; // the file whose state is _fileStamp
+    string _fileStamp; // only refreshed by Reload or when the file changes, so that render() does not stat the file
+
+    BooleanParam* _bakeLut;
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     BooleanParam* _enableGPU;
@@ -330,8 +299,7 @@ OCIOFileTransformPlugin::OCIOFileTransformPlugin(OfxImageEffectHandle handle)
     , _mix(NULL)
     , _maskApply(NULL)
     , _maskInvert(NULL)
-    , _procDirection(-1)
-    , _procInterpolation(-1)
+    , _bakeLut(NULL)
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     , _enableGPU(NULL)
     , _openGLContextData(NULL)
@@ -359,6 +327,8 @@ OCIOFileTransformPlugin::OCIOFileTransformPlugin(OfxImageEffectHandle handle)
     _maskApply = paramExists(kParamMaskApply) ? fetchBooleanParam(kParamMaskApply) : 0;
     _maskInvert = fetchBooleanParam(kParamMaskInvert);
     assert(_mix && _maskInvert);
+    _bakeLut = fetchBooleanParam(kOCIOParamBakeLUT);
+    assert(_bakeLut);
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     _enableGPU = fetchBooleanParam(kParamEnableGPU);
     assert(_enableGPU);
@@ -370,249 +340,103 @@ OCIOFileTransformPlugin::OCIOFileTransformPlugin(OfxImageEffectHandle handle)
 #endif
 
     updateCCCId();
+    prewarmProcessor(0.);
 }
 
 OCIOFileTransformPlugin::~OCIOFileTransformPlugin()
 {
 }
 
-/* set up and run a copy processor */
-void
-OCIOFileTransformPlugin::setupAndCopy(PixelProcessorFilterBase & processor,
-                                      double time,
-                                      const OfxRectI &renderWindow,
-                                      const void *srcPixelData,
-                                      const OfxRectI& srcBounds,
-                                      PixelComponentEnum srcPixelComponents,
-                                      int srcPixelComponentCount,
-                                      BitDepthEnum srcPixelDepth,
-                                      int srcRowBytes,
-                                      void *dstPixelData,
-                                      const OfxRectI& dstBounds,
-                                      PixelComponentEnum dstPixelComponents,
-                                      int dstPixelComponentCount,
-                                      BitDepthEnum dstPixelDepth,
-                                      int dstRowBytes)
+FileProcessorBuilder
+OCIOFileTransformPlugin::getProcessorBuilder(OfxTime time)
 {
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-
-    auto_ptr<const Image> orig( ( _srcClip && _srcClip->isConnected() ) ?
-                                     _srcClip->fetchImage(time) : 0 );
+    string file;
 
-    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(time) ) && _maskClip && _maskClip->isConnected() );
-    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(time) : 0);
-    if (doMasking) {
-        bool maskInvert;
-        _maskInvert->getValueAtTime(time, maskInvert);
-        processor.doMasking(true);
-        processor.setMaskImg(mask.get(), maskInvert);
+    _file->getValueAtTime(time, file);
+    string cccid;
+    _cccid->getValueAtTime(time, cccid);
+    int directioni = _direction->getValueAtTime(time);
+    int interpolationi = _interpolation->getValueAtTime(time);
+    OCIO::ConstConfigRcPtr config = OCIO::GetCurrentConfig();
+    if (!config) {
+        throw std::runtime_error("OCIO: No current config");
     }
 
-    // set the images
-    assert(orig.get() && dstPixelData && srcPixelData);
-    processor.setOrigImg( orig.get() );
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    bool premult;
-    int premultChannel;
-    _premult->getValueAtTime(time, premult);
-    _premultChannel->getValueAtTime(time, premultChannel);
-    double mix;
-    _mix->getValueAtTime(time, mix);
-    processor.setPremultMaskMix(premult, premultChannel, mix);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
+    return FileProcessorBuilder(config, file, getFileStamp(file, false), cccid, directioni, interpolationi);
 }
 
-void
-OCIOFileTransformPlugin::copyPixelData(bool unpremult,
-                                       bool premult,
-                                       bool maskmix,
-                                       double time,
-                                       const OfxRectI& renderWindow,
-                                       const void *srcPixelData,
-                                       const OfxRectI& srcBounds,
-                                       PixelComponentEnum srcPixelComponents,
-                                       int srcPixelComponentCount,
-                                       BitDepthEnum srcBitDepth,
-                                       int srcRowBytes,
-                                       void *dstPixelData,
-                                       const OfxRectI& dstBounds,
-                                       PixelComponentEnum dstPixelComponents,
-                                       int dstPixelComponentCount,
-                                       BitDepthEnum dstBitDepth,
-                                       int dstRowBytes)
+string
+OCIOFileTransformPlugin::getFileStamp(const string& file,
+                                      bool refresh)
 {
-    assert(srcPixelData && dstPixelData);
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-    if (!unpremult && !premult && !maskmix) {
-        copyPixels(*this, renderWindow,
-                   srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                   dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else if (unpremult && !premult && !maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierUnPremult<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierUnPremult<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && !premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierMaskMix<float, 4, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierMaskMix<float, 3, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierMaskMix<float, 1, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierPremultMaskMix<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierPremultMaskMix<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierPremultMaskMix<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else {
-        assert(false); // should never happen
+    {
+        GenericOCIO::AutoMutex guard(_procMutex);
+        if ( !refresh && (file == _stampedFile) ) {
+            return _fileStamp;
+        }
     }
-} // OCIOFileTransformPlugin::copyPixelData
+    string stamp = getOCIOFileStamp(file);
+    GenericOCIO::AutoMutex guard(_procMutex);
+    _stampedFile = file;
+    _fileStamp = stamp;
+
+    return stamp;
+}
 
 OCIO::ConstProcessorRcPtr
 OCIOFileTransformPlugin::getProcessor(OfxTime time)
 {
-    string file;
-
-    _file->getValueAtTime(time, file);
-    string cccid;
-    _cccid->getValueAtTime(time, cccid);
-    int directioni = _direction->getValueAtTime(time);
-    int interpolationi = _interpolation->getValueAtTime(time);
-
     try {
-        OCIO::ConstConfigRcPtr config = OCIO::GetCurrentConfig();
-        if (!config) {
-            throw std::runtime_error("OCIO: No current config");
+        FileProcessorBuilder builder = getProcessorBuilder(time);
+        const string key = builder.getKey();
+        if ( key.empty() ) {
+            // the file does not exist: let OCIO report the error
+            return builder.build();
         }
-        GenericOCIO::AutoMutex guard(_procMutex);
-        if ( !_proc ||
-             ( _procFile != file) ||
-             ( _procCCCId != cccid) ||
-             ( _procDirection != directioni) ||
-             ( _procInterpolation != interpolationi) ) {
-            OCIO::FileTransformRcPtr transform = OCIO::FileTransform::Create();
-            transform->setSrc( file.c_str() );
-            transform->setCCCId( cccid.c_str() );
-
-            if (directioni == 0) {
-                transform->setDirection(OCIO::TRANSFORM_DIR_FORWARD);
-            } else {
-                transform->setDirection(OCIO::TRANSFORM_DIR_INVERSE);
-            }
-
-            if (interpolationi == 0) {
-                transform->setInterpolation(OCIO::INTERP_NEAREST);
-            } else if (interpolationi == 1) {
-                transform->setInterpolation(OCIO::INTERP_LINEAR);
-            } else if (interpolationi == 2) {
-                transform->setInterpolation(OCIO::INTERP_TETRAHEDRAL);
-            } else if (interpolationi == 3) {
-                transform->setInterpolation(OCIO::INTERP_BEST);
-            } else {
-                // Should never happen
-                setPersistentMessage(Message::eMessageError, "", "OCIO Interpolation value out of bounds");
-                throwSuiteStatusException(kOfxStatFailed);
-
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            if ( _proc && (_procKey == key) ) {
                 return _proc;
             }
-
-            _proc = config->getProcessor(transform, OCIO::TRANSFORM_DIR_FORWARD);
-            _procFile = file;
-            _procCCCId = cccid;
-            _procDirection = directioni;
-            _procInterpolation = interpolationi;
         }
+        builder.clearCachesIfOutdated();
+        // the file may be parsed right now, or may already be parsed in the background:
+        // do not hold the lock meanwhile
+        OCIO::ConstProcessorRcPtr proc = getOCIOProcessor(key, builder);
+        GenericOCIO::AutoMutex guard(_procMutex);
+        _proc = proc;
+        _procKey = key;
+
+        return proc;
     } catch (const std::exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
     }
 
-    return _proc;
+    return OCIO::ConstProcessorRcPtr();
 } // getProcessor
 
+// start parsing the file in the background, so that the processor is ready for the next render
 void
-OCIOFileTransformPlugin::apply(double time,
-                               const OfxRectI& renderWindow,
-                               float *pixelData,
-                               const OfxRectI& bounds,
-                               PixelComponentEnum pixelComponents,
-                               int pixelComponentCount,
-                               int rowBytes)
+OCIOFileTransformPlugin::prewarmProcessor(double time)
 {
-    // are we in the image bounds
-    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
-         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
-        throw std::runtime_error("OCIO: render window outside of image bounds");
-    }
-    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
-        throw std::runtime_error("OCIO: invalid components (only RGB and RGBA are supported)");
+    try {
+        FileProcessorBuilder builder = getProcessorBuilder(time);
+        const string key = builder.getKey();
+        if ( key.empty() ) {
+            return;
+        }
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            if ( _proc && (_procKey == key) ) {
+                return;
+            }
+        }
+        builder.clearCachesIfOutdated();
+        prewarmOCIOProcessor( key, new FileProcessorBuilder(builder) );
+    } catch (const std::exception &) {
+        // the error will be reported by render()
     }
-
-    OCIOProcessor processor(*this);
-    // set the images
-    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    processor.setProcessor( getProcessor(time) );
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
 }
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
@@ -837,7 +661,7 @@ OCIOFileTransformPlugin::render(const RenderArguments &args)
     }
 
     BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
-    if ( (dstBitDepth != eBitDepthFloat) || (dstBitDepth != srcBitDepth) ) {
+    if (dstBitDepth != srcBitDepth) {
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -861,31 +685,46 @@ OCIOFileTransformPlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    const void* srcPixelData = NULL;
-    OfxRectI bounds;
-    PixelComponentEnum pixelComponents;
-    BitDepthEnum bitDepth;
-    int srcRowBytes;
-    getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
-    int pixelComponentCount = srcImg->getPixelComponentCount();
-
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
     bool premult;
+    int premultChannel;
     _premult->getValueAtTime(args.time, premult);
+    _premultChannel->getValueAtTime(args.time, premultChannel);
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(args.time) : 0);
+    bool maskInvert = false;
+    if (doMasking) {
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+    }
 
-    // copy renderWindow to the temporary image
-    copyPixelData(premult, false, false, args.time, args.renderWindow, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
-
-    ///do the color-space conversion
-    apply(args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, tmpRowBytes);
+    OCIO::ConstProcessorRcPtr proc;
+
+    // keep a reference to the baked LUT until processing is done.
+    // The LUT file has no colorspace: the shaper covers [0,1], and the baked LUT is refused by getOCIOBakedLut()
+    // if the transform does not saturate outside of it.
+    OCIO_SHARED_PTR<const OCIOBakedLut> bakedLut;
+    if ( _bakeLut->getValueAtTime(args.time) ) {
+        string key;
+        try {
+            // the key contains the state of the LUT file
+            key = getProcessorBuilder(args.time).getKey();
+        } catch (const std::exception &) {
+            // reported by getProcessor()
+        }
+        // if the LUT was baked in a previous session, the LUT file is not even parsed
+        bakedLut = findOCIOBakedLut(key);
+        if (!bakedLut) {
+            proc = getProcessor(args.time);
+            bakedLut = getOCIOBakedLut( proc, OCIO::ConstConfigRcPtr(), string(), key );
+        }
+    }
+    if (!bakedLut && !proc) {
+        proc = getProcessor(args.time);
+    }
 
-    // copy the color-converted window
-    copyPixelData( false, premult, true, args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes, dstImg.get() );
+    // unpremultiply, do the color-space conversion, premultiply and mix, block by block
+    applyOCIOBlocks(*this, args.renderWindow, srcImg.get(), dstImg.get(), proc, bakedLut.get(), premult, premultChannel, mix, mask.get(), maskInvert);
 } // OCIOFileTransformPlugin::render
 
 bool
@@ -961,7 +800,12 @@ OCIOFileTransformPlugin::changedParam(const InstanceChangedArgs &args,
         updateCCCId();
     } else if ( (paramName == kParamReload) && (args.reason == eChangeUserEdit) ) {
         _version->setValue(_version->getValue() + 1); // invalidate the node cache
-        OCIO::ClearAllCaches();
+        // the processor key contains the state of the file: if it changed, the file is parsed again, and the
+        // OCIO caches are only cleared at that point (see FileProcessorBuilder::clearCachesIfOutdated())
+        string file;
+        _file->getValueAtTime(args.time, file);
+        getFileStamp(file, true);
+        prewarmProcessor(args.time);
 #ifdef OFX_SUPPORTS_OPENGLRENDER
     } else if (paramName == kParamEnableGPU) {
         bool supportsGL = _enableGPU->getValueAtTime(args.time);
@@ -969,6 +813,14 @@ OCIOFileTransformPlugin::changedParam(const InstanceChangedArgs &args,
         setSupportsTiles(!supportsGL);
 #endif
     }
+
+    if ( (args.reason != eChangeTime) &&
+         ( ( paramName == kParamFile) ||
+           ( paramName == kParamCCCID) ||
+           ( paramName == kParamDirection) ||
+           ( paramName == kParamInterpolation) ) ) {
+        prewarmProcessor(args.time);
+    }
 }
 
 void
@@ -994,7 +846,7 @@ OCIOFileTransformPlugin::changedClip(const InstanceChangedArgs &args,
     }
 }
 
-mDeclarePluginFactory(OCIOFileTransformPluginFactory, {ofxsThreadSuiteCheck();}, {});
+mDeclarePluginFactory(OCIOFileTransformPluginFactory, {ofxsThreadSuiteCheck();}, {shutdownOCIOPrewarm();});
 static string
 supportedFormats()
 {
@@ -1024,6 +876,9 @@ OCIOFileTransformPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedContext(eContextPaint);
 
     // add supported pixel depths
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
     desc.setSupportsTiles(kSupportsTiles);
@@ -1128,6 +983,17 @@ OCIOFileTransformPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     }
 
 
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kOCIOParamBakeLUT);
+        param->setLabel(kOCIOParamBakeLUTLabel);
+        param->setHint(kOCIOParamBakeLUTHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kParamEnableGPU);
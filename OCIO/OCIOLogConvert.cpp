@@ -24,17 +24,16 @@
 #ifdef OFX_IO_USING_OCIO
 
 #include <cstdlib>
-#ifdef DEBUG
-#include <cstdio> // printf
-#endif
+#include <cstdio> // printf, sprintf
 #include "ofxsProcessing.H"
 #include "ofxsThreadSuite.h"
-#include "ofxsCopier.h"
+#include "ofxsMaskMix.h"
 #include "IOUtility.h"
 #include "ofxNatron.h"
 #include "ofxsCoords.h"
 #include "ofxsMacros.h"
 #include "GenericOCIO.h"
+#include "OCIOLogCurve.h"
 
 namespace OCIO = OCIO_NAMESPACE;
 
@@ -47,11 +46,14 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 #define kPluginName "OCIOLogConvertOFX"
 #define kPluginGrouping "Color/OCIO"
-#define kPluginDescription  "Use OpenColorIO to convert from SCENE_LINEAR to COMPOSITING_LOG (or back)."
+#define kPluginDescription \
+    "Use OpenColorIO to convert from SCENE_LINEAR to COMPOSITING_LOG (or back).\n" \
+    "If the conversion matches the Cineon, ACEScct, ACEScc or ARRI LogC (EI 800) curve, that curve is computed directly, which is faster than OpenColorIO. " \
+    "The Help button shows which curve is used."
 
 #define kPluginIdentifier "fr.inria.openfx.OCIOLogConvert"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -115,135 +117,7 @@ private:
     void renderGPU(const RenderArguments &args);
 #endif
 
-    OCIO::ConstProcessorRcPtr getProcessor(OfxTime time);
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       Image* dstImg)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcBitDepth,
-                       int srcRowBytes,
-                       Image* dstImg)
-    {
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcPixelDepth,
-                       int srcRowBytes,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes);
-
-    void apply(double time, const OfxRectI& renderWindow, float *pixelData, const OfxRectI& bounds, PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
-
-    void setupAndCopy(PixelProcessorFilterBase & processor,
-                      double time,
-                      const OfxRectI &renderWindow,
-                      const void *srcPixelData,
-                      const OfxRectI& srcBounds,
-                      PixelComponentEnum srcPixelComponents,
-                      int srcPixelComponentCount,
-                      BitDepthEnum srcPixelDepth,
-                      int srcRowBytes,
-                      void *dstPixelData,
-                      const OfxRectI& dstBounds,
-                      PixelComponentEnum dstPixelComponents,
-                      int dstPixelComponentCount,
-                      BitDepthEnum dstPixelDepth,
-                      int dstRowBytes);
+    OCIO::ConstProcessorRcPtr getProcessor(OfxTime time, LogCurveBlockTransform* curve = NULL);
 
     void loadConfig(double time);
 
@@ -266,6 +140,7 @@ private:
     GenericOCIO::Mutex _procMutex;
     OCIO::ConstProcessorRcPtr _proc;
     int _procMode;
+    LogCurveBlockTransform _procCurve; // the analytic curve matching _proc, if any
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     BooleanParam* _enableGPU;
@@ -287,6 +162,7 @@ OCIOLogConvertPlugin::OCIOLogConvertPlugin(OfxImageEffectHandle handle)
     , _maskApply(NULL)
     , _maskInvert(NULL)
     , _procMode(-1)
+    , _procCurve()
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     , _enableGPU(NULL)
     , _openGLContextData(NULL)
@@ -342,9 +218,13 @@ OCIOLogConvertPlugin::loadConfig(double time)
     }
 
     _config.reset();
+    {
+        GenericOCIO::AutoMutex guard(_procMutex);
+        _proc.reset();
+    }
     try {
         _ocioConfigFileName = filename;
-        _config = OCIO::Config::CreateFromFile( _ocioConfigFileName.c_str() );
+        _config = getSharedOCIOConfig(_ocioConfigFileName);
         _mode->setEnabled(true);
         clearPersistentMessage();
     } catch (OCIO::Exception &e) {
@@ -355,154 +235,9 @@ OCIOLogConvertPlugin::loadConfig(double time)
     }
 }
 
-/* set up and run a copy processor */
-void
-OCIOLogConvertPlugin::setupAndCopy(PixelProcessorFilterBase & processor,
-                                   double time,
-                                   const OfxRectI &renderWindow,
-                                   const void *srcPixelData,
-                                   const OfxRectI& srcBounds,
-                                   PixelComponentEnum srcPixelComponents,
-                                   int srcPixelComponentCount,
-                                   BitDepthEnum srcPixelDepth,
-                                   int srcRowBytes,
-                                   void *dstPixelData,
-                                   const OfxRectI& dstBounds,
-                                   PixelComponentEnum dstPixelComponents,
-                                   int dstPixelComponentCount,
-                                   BitDepthEnum dstPixelDepth,
-                                   int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-
-    auto_ptr<const Image> orig( ( _srcClip && _srcClip->isConnected() ) ?
-                                     _srcClip->fetchImage(time) : 0 );
-
-    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(time) ) && _maskClip && _maskClip->isConnected() );
-    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(time) : 0);
-    if (doMasking) {
-        bool maskInvert;
-        _maskInvert->getValueAtTime(time, maskInvert);
-        processor.doMasking(true);
-        processor.setMaskImg(mask.get(), maskInvert);
-    }
-
-    // set the images
-    assert(orig.get() && dstPixelData && srcPixelData);
-    processor.setOrigImg( orig.get() );
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    bool premult;
-    int premultChannel;
-    _premult->getValueAtTime(time, premult);
-    _premultChannel->getValueAtTime(time, premultChannel);
-    double mix;
-    _mix->getValueAtTime(time, mix);
-    processor.setPremultMaskMix(premult, premultChannel, mix);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
-void
-OCIOLogConvertPlugin::copyPixelData(bool unpremult,
-                                    bool premult,
-                                    bool maskmix,
-                                    double time,
-                                    const OfxRectI& renderWindow,
-                                    const void *srcPixelData,
-                                    const OfxRectI& srcBounds,
-                                    PixelComponentEnum srcPixelComponents,
-                                    int srcPixelComponentCount,
-                                    BitDepthEnum srcBitDepth,
-                                    int srcRowBytes,
-                                    void *dstPixelData,
-                                    const OfxRectI& dstBounds,
-                                    PixelComponentEnum dstPixelComponents,
-                                    int dstPixelComponentCount,
-                                    BitDepthEnum dstBitDepth,
-                                    int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-    if (!unpremult && !premult && !maskmix) {
-        copyPixels(*this, renderWindow,
-                   srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                   dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else if (unpremult && !premult && !maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierUnPremult<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierUnPremult<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && !premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierMaskMix<float, 4, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierMaskMix<float, 3, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierMaskMix<float, 1, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierPremultMaskMix<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierPremultMaskMix<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierPremultMaskMix<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow,
-                         srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                         dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else {
-        assert(false); // should never happen
-    }
-} // OCIOLogConvertPlugin::copyPixelData
-
 OCIO::ConstProcessorRcPtr
-OCIOLogConvertPlugin::getProcessor(OfxTime time)
+OCIOLogConvertPlugin::getProcessor(OfxTime time,
+                                   LogCurveBlockTransform* curve)
 {
     int mode_i = _mode->getValueAtTime(time);
 
@@ -522,6 +257,11 @@ OCIOLogConvertPlugin::getProcessor(OfxTime time)
             }
 
             _proc = _config->getProcessor(src, dst);
+            _procMode = mode_i;
+            _procCurve = detectLogCurve(_proc, mode_i == 0);
+        }
+        if (curve) {
+            *curve = _procCurve;
         }
     } catch (const OCIO::Exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
@@ -531,37 +271,6 @@ OCIOLogConvertPlugin::getProcessor(OfxTime time)
     return _proc;
 } // getProcessor
 
-void
-OCIOLogConvertPlugin::apply(double time,
-                            const OfxRectI& renderWindow,
-                            float *pixelData,
-                            const OfxRectI& bounds,
-                            PixelComponentEnum pixelComponents,
-                            int pixelComponentCount,
-                            int rowBytes)
-{
-    // are we in the image bounds
-    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
-         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
-        throw std::runtime_error("OCIO: render window outside of image bounds");
-    }
-    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
-        throw std::runtime_error("OCIO: invalid components (only RGB and RGBA are supported)");
-    }
-
-    OCIOProcessor processor(*this);
-    // set the images
-    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
-
-    processor.setProcessor( getProcessor(time) );
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
 
 /*
@@ -790,7 +499,7 @@ OCIOLogConvertPlugin::render(const RenderArguments &args)
     }
 
     BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
-    if ( (dstBitDepth != eBitDepthFloat) || (dstBitDepth != srcBitDepth) ) {
+    if (dstBitDepth != srcBitDepth) {
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -814,31 +523,26 @@ OCIOLogConvertPlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    const void* srcPixelData = NULL;
-    OfxRectI bounds;
-    PixelComponentEnum pixelComponents;
-    BitDepthEnum bitDepth;
-    int srcRowBytes;
-    getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
-    int pixelComponentCount = srcImg->getPixelComponentCount();
-
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
     bool premult;
+    int premultChannel;
     _premult->getValueAtTime(args.time, premult);
+    _premultChannel->getValueAtTime(args.time, premultChannel);
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(args.time) : 0);
+    bool maskInvert = false;
+    if (doMasking) {
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+    }
 
-    // copy renderWindow to the temporary image
-    copyPixelData(premult, false, false, args.time, args.renderWindow, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
-
-    ///do the color-space conversion
-    apply(args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, tmpRowBytes);
+    LogCurveBlockTransform curve;
+    OCIO::ConstProcessorRcPtr proc = getProcessor(args.time, &curve);
 
-    // copy the color-converted window
-    copyPixelData( false, premult, true, args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes, dstImg.get() );
+    // unpremultiply, do the color-space conversion (using the analytic curve if the processor matches one),
+    // premultiply and mix, block by block
+    applyOCIOBlocks(*this, args.renderWindow, srcImg.get(), dstImg.get(), proc, (curve.getCurve() != eLogCurveNone) ? &curve : NULL,
+                    premult, premultChannel, mix, mask.get(), maskInvert);
 } // OCIOLogConvertPlugin::render
 
 bool
@@ -942,6 +646,26 @@ OCIOLogConvertPlugin::changedParam(const InstanceChangedArgs &args,
                     msg += '\n';
                 }
             }
+            msg += '\n';
+            {
+                LogCurveBlockTransform curve;
+                OCIO::ConstProcessorRcPtr proc = getProcessor(args.time, &curve);
+                try {
+                    double ocioThroughput;
+                    double curveThroughput;
+                    benchmarkLogCurve(proc, curve, &ocioThroughput, &curveThroughput);
+                    char buf[256];
+                    if (curve.getCurve() == eLogCurveNone) {
+                        std::sprintf(buf, "The conversion is done by OpenColorIO (%.1f Mpixel/s per thread).\n", ocioThroughput);
+                    } else {
+                        std::sprintf(buf, "The conversion matches the %s curve%s, which is evaluated natively (%.1f Mpixel/s per thread, OpenColorIO: %.1f Mpixel/s per thread).\n",
+                                     curve.getCurveName(), curve.isClamped() ? " (clamped to the log range [0,1])" : "", curveThroughput, ocioThroughput);
+                    }
+                    msg += buf;
+                } catch (const OCIO::Exception &e) {
+                    msg += string("OpenColorIO error: ") + e.what() + '\n';
+                }
+            }
         }
         sendMessage(Message::eMessageMessage, "", msg);
 #ifdef OFX_SUPPORTS_OPENGLRENDER
@@ -976,7 +700,7 @@ OCIOLogConvertPlugin::changedClip(const InstanceChangedArgs &args,
     }
 }
 
-mDeclarePluginFactory(OCIOLogConvertPluginFactory, {ofxsThreadSuiteCheck();}, {});
+mDeclarePluginFactory(OCIOLogConvertPluginFactory, {ofxsThreadSuiteCheck();}, {shutdownOCIOPrewarm();});
 
 /** @brief The basic describe function, passed a plugin descriptor */
 void
@@ -993,6 +717,9 @@ OCIOLogConvertPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedContext(eContextPaint);
 
     // add supported pixel depths
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
     desc.setSupportsTiles(kSupportsTiles);
@@ -1034,7 +761,7 @@ OCIOLogConvertPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     OCIO::ConstConfigRcPtr config;
     if (file != NULL) {
         try {
-            config = OCIO::Config::CreateFromFile(file);
+            config = getSharedOCIOConfig(file);
             gWasOCIOEnvVarFound = true;
         } catch (OCIO::Exception &e) {
         }
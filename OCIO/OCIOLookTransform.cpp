@@ -32,7 +32,7 @@
 #include <GenericOCIO.h>
 
 #include <ofxsProcessing.H>
-#include <ofxsCopier.h>
+#include <ofxsMaskMix.h>
 #include "ofxsCoords.h"
 #include <ofxsMacros.h>
 #include <ofxNatron.h>
@@ -63,7 +63,7 @@ using std::string;
 
 #define kPluginIdentifier "fr.inria.openfx.OCIOLookTransform"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -127,6 +127,71 @@ buildLookChoiceMenu(OCIO::ConstConfigRcPtr config,
     }
 }
 
+// creates the processor of a look transform, possibly in the background (see prewarmOCIOProcessor())
+class LookProcessorBuilder
+    : public OCIOProcessorBuilder
+{
+public:
+    LookProcessorBuilder(const OCIO::ConstConfigRcPtr& config,
+                         const string& look,
+                         const string& inputSpace,
+                         const string& outputSpace,
+                         int direction)
+        : _config(config)
+        , _look(look)
+        , _inputSpace(inputSpace)
+        , _outputSpace(outputSpace)
+        , _direction(direction)
+    {
+    }
+
+    // identifies the processor: the config, its current context and the transform parameters
+    string getKey() const
+    {
+        string key = _config->getCacheID();
+        key += "\nlook\n";
+        key += _look;
+        key += '\n';
+        key += _inputSpace;
+        key += '\n';
+        key += _outputSpace;
+        key += (_direction == 0) ? "\nforward" : "\ninverse";
+
+        return key;
+    }
+
+    virtual OCIO::ConstProcessorRcPtr build() const OVERRIDE FINAL
+    {
+        OCIO::TransformDirection direction = OCIO::TRANSFORM_DIR_UNKNOWN;
+        OCIO::LookTransformRcPtr transform = OCIO::LookTransform::Create();
+        transform->setLooks( _look.c_str() );
+
+        if (_direction == 0) {
+            transform->setSrc( _inputSpace.c_str() );
+            transform->setDst( _outputSpace.c_str() );
+            direction = OCIO::TRANSFORM_DIR_FORWARD;
+        } else {
+            // The TRANSFORM_DIR_INVERSE applies an inverse for the end-to-end transform,
+            // which would otherwise do dst->inv look -> src.
+            // This is an unintuitive result for the artist (who would expect in, out to
+            // remain unchanged), so we account for that here by flipping src/dst
+
+            transform->setSrc( _outputSpace.c_str() );
+            transform->setDst( _inputSpace.c_str() );
+            direction = OCIO::TRANSFORM_DIR_INVERSE;
+        }
+
+        return _config->getProcessor(transform, direction);
+    }
+
+private:
+    OCIO::ConstConfigRcPtr _config;
+    string _look;
+    string _inputSpace;
+    string _outputSpace;
+    int _direction;
+};
+
 class OCIOLookTransformPlugin
     : public ImageEffect
 {
@@ -167,135 +232,9 @@ private:
     void renderGPU(const RenderArguments &args);
 #endif
 
+    LookProcessorBuilder getProcessorBuilder(OfxTime time, const OCIO::ConstConfigRcPtr& config, bool singleLook, const string& lookCombination);
     OCIO::ConstProcessorRcPtr getProcessor(OfxTime time, bool singleLook, const string& lookCombination);
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       Image* dstImg)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcBitDepth,
-                       int srcRowBytes,
-                       Image* dstImg)
-    {
-        void* dstPixelData;
-        OfxRectI dstBounds;
-        PixelComponentEnum dstPixelComponents;
-        BitDepthEnum dstBitDepth;
-        int dstRowBytes;
-
-        getImageData(dstImg, &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
-        int dstPixelComponentCount = dstImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const Image* srcImg,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes)
-    {
-        const void* srcPixelData;
-        OfxRectI srcBounds;
-        PixelComponentEnum srcPixelComponents;
-        BitDepthEnum srcBitDepth;
-        int srcRowBytes;
-
-        getImageData(srcImg, &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
-        int srcPixelComponentCount = srcImg->getPixelComponentCount();
-        copyPixelData(unpremult,
-                      premult,
-                      maskmix,
-                      time,
-                      renderWindow,
-                      srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
-                      dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    }
-
-    void copyPixelData(bool unpremult,
-                       bool premult,
-                       bool maskmix,
-                       double time,
-                       const OfxRectI &renderWindow,
-                       const void *srcPixelData,
-                       const OfxRectI& srcBounds,
-                       PixelComponentEnum srcPixelComponents,
-                       int srcPixelComponentCount,
-                       BitDepthEnum srcPixelDepth,
-                       int srcRowBytes,
-                       void *dstPixelData,
-                       const OfxRectI& dstBounds,
-                       PixelComponentEnum dstPixelComponents,
-                       int dstPixelComponentCount,
-                       BitDepthEnum dstBitDepth,
-                       int dstRowBytes);
-
-    void setupAndCopy(PixelProcessorFilterBase & processor,
-                      double time,
-                      const OfxRectI &renderWindow,
-                      const void *srcPixelData,
-                      const OfxRectI& srcBounds,
-                      PixelComponentEnum srcPixelComponents,
-                      int srcPixelComponentCount,
-                      BitDepthEnum srcPixelDepth,
-                      int srcRowBytes,
-                      void *dstPixelData,
-                      const OfxRectI& dstBounds,
-                      PixelComponentEnum dstPixelComponents,
-                      int dstPixelComponentCount,
-                      BitDepthEnum dstPixelDepth,
-                      int dstRowBytes);
-
-    void apply(double time, const OfxRectI& renderWindow, float *pixelData, const OfxRectI& bounds, PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
+    void prewarmProcessor(double time);
 
     // do not need to delete these, the ImageEffect is managing them for us
     Clip *_dstClip;
@@ -311,16 +250,14 @@ private:
     DoubleParam* _mix;
     BooleanParam* _maskApply;
     BooleanParam* _maskInvert;
+    BooleanParam* _bakeLut;
     BooleanParam* _enableGPU;
 
     auto_ptr<GenericOCIO> _ocio;
 
     GenericOCIO::Mutex _procMutex;
     OCIO::ConstProcessorRcPtr _proc;
-    string _procLook;
-    string _procInputSpace;
-    string _procOutputSpace;
-    int _procDirection;
+    string _procKey; // see LookProcessorBuilder::getKey()
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     OCIOOpenGLContextData* _openGLContextData; // (OpenGL-only) - the single openGL context, in case the host does not support kNatronOfxImageEffectPropOpenGLContextData
@@ -342,9 +279,10 @@ OCIOLookTransformPlugin::OCIOLookTransformPlugin(OfxImageEffectHandle handle)
     , _mix(NULL)
     , _maskApply(NULL)
     , _maskInvert(NULL)
+    , _bakeLut(NULL)
     , _enableGPU(NULL)
     , _ocio( new GenericOCIO(this) )
-    , _procDirection(-1)
+    , _procKey()
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     , _openGLContextData(NULL)
 #endif
@@ -373,6 +311,8 @@ OCIOLookTransformPlugin::OCIOLookTransformPlugin(OfxImageEffectHandle handle)
     _maskInvert = fetchBooleanParam(kParamMaskInvert);
     assert(_mix && _maskInvert);
 
+    _bakeLut = fetchBooleanParam(kOCIOParamBakeLUT);
+    assert(_bakeLut);
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     _enableGPU = fetchBooleanParam(kParamEnableGPU);
     assert(_enableGPU);
@@ -408,137 +348,34 @@ OCIOLookTransformPlugin::OCIOLookTransformPlugin(OfxImageEffectHandle handle)
             _singleLook->setIsSecretAndDisabled(true);
         }
     }
+    prewarmProcessor(0.);
 }
 
 OCIOLookTransformPlugin::~OCIOLookTransformPlugin()
 {
 }
 
-/* set up and run a copy processor */
-void
-OCIOLookTransformPlugin::setupAndCopy(PixelProcessorFilterBase & processor,
-                                      double time,
-                                      const OfxRectI &renderWindow,
-                                      const void *srcPixelData,
-                                      const OfxRectI& srcBounds,
-                                      PixelComponentEnum srcPixelComponents,
-                                      int srcPixelComponentCount,
-                                      BitDepthEnum srcPixelDepth,
-                                      int srcRowBytes,
-                                      void *dstPixelData,
-                                      const OfxRectI& dstBounds,
-                                      PixelComponentEnum dstPixelComponents,
-                                      int dstPixelComponentCount,
-                                      BitDepthEnum dstPixelDepth,
-                                      int dstRowBytes)
-{
-    assert(srcPixelData && dstPixelData);
-
-    // make sure bit depths are sane
-    if ( (srcPixelDepth != dstPixelDepth) || (srcPixelComponents != dstPixelComponents) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
-
-        return;
-    }
-
-    auto_ptr<const Image> orig( ( _srcClip && _srcClip->isConnected() ) ?
-                                     _srcClip->fetchImage(time) : 0 );
-
-    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(time) ) && _maskClip && _maskClip->isConnected() );
-    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(time) : 0);
-    if (doMasking) {
-        bool maskInvert = _maskInvert->getValueAtTime(time);
-        processor.doMasking(true);
-        processor.setMaskImg(mask.get(), maskInvert);
-    }
-
-    if ( !orig.get() ) {
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
-    }
-    // set the images
-    assert(orig.get() && dstPixelData && srcPixelData);
-    processor.setOrigImg( orig.get() );
-    processor.setDstImg(dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstPixelDepth, dstRowBytes);
-    processor.setSrcImg(srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, 0);
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    bool premult = _premult->getValueAtTime(time);
-    int premultChannel = _premultChannel->getValueAtTime(time);
-    double mix = _mix->getValueAtTime(time);
-    processor.setPremultMaskMix(premult, premultChannel, mix);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-}
-
-void
-OCIOLookTransformPlugin::copyPixelData(bool unpremult,
-                                       bool premult,
-                                       bool maskmix,
-                                       double time,
-                                       const OfxRectI& renderWindow,
-                                       const void *srcPixelData,
-                                       const OfxRectI& srcBounds,
-                                       PixelComponentEnum srcPixelComponents,
-                                       int srcPixelComponentCount,
-                                       BitDepthEnum srcPixelDepth,
-                                       int srcRowBytes,
-                                       void *dstPixelData,
-                                       const OfxRectI& dstBounds,
-                                       PixelComponentEnum dstPixelComponents,
-                                       int dstPixelComponentCount,
-                                       BitDepthEnum dstBitDepth,
-                                       int dstRowBytes)
+LookProcessorBuilder
+OCIOLookTransformPlugin::getProcessorBuilder(OfxTime time,
+                                             const OCIO::ConstConfigRcPtr& config,
+                                             bool singleLook,
+                                             const string& lookCombination)
 {
-    assert(srcPixelData && dstPixelData);
-    // do the rendering
-    if ( (dstBitDepth != eBitDepthFloat) || ( (dstPixelComponents != ePixelComponentRGBA) && (dstPixelComponents != ePixelComponentRGB) && (dstPixelComponents != ePixelComponentAlpha) ) ) {
-        throwSuiteStatusException(kOfxStatErrFormat);
+    string inputSpace;
 
-        return;
-    }
-    if (!unpremult && !premult && !maskmix) {
-        copyPixels(*this, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-    } else if (unpremult && !premult && !maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierUnPremult<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierUnPremult<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierUnPremult<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && !premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierMaskMix<float, 4, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierMaskMix<float, 3, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierMaskMix<float, 1, 1, true> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
-    } else if (!unpremult && premult && maskmix) {
-        if (dstPixelComponents == ePixelComponentRGBA) {
-            PixelCopierPremultMaskMix<float, 4, 1, float, 4, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } else if (dstPixelComponents == ePixelComponentRGB) {
-            PixelCopierPremultMaskMix<float, 3, 1, float, 3, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        }  else if (dstPixelComponents == ePixelComponentAlpha) {
-            PixelCopierPremultMaskMix<float, 1, 1, float, 1, 1> fred(*this);
-            setupAndCopy(fred, time, renderWindow, srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcPixelDepth, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
-        } // switch
+    _ocio->getInputColorspaceAtTime(time, inputSpace);
+    string look;
+    if (singleLook) {
+        int lookChoice_i = _lookChoice->getValueAtTime(time);
+        look = config->getLookNameByIndex(lookChoice_i);
     } else {
-        assert(false); // should never happen
+        look = lookCombination;
     }
+    int directioni = _direction->getValueAtTime(time);
+    string outputSpace;
+    _ocio->getOutputColorspaceAtTime(time, outputSpace);
+
+    return LookProcessorBuilder(config, look, inputSpace, outputSpace, directioni);
 }
 
 OCIO::ConstProcessorRcPtr
@@ -554,47 +391,23 @@ OCIOLookTransformPlugin::getProcessor(OfxTime time,
         return _proc;
     }
 
-    string inputSpace;
-    _ocio->getInputColorspaceAtTime(time, inputSpace);
-    string look;
-    if (singleLook) {
-        int lookChoice_i = _lookChoice->getValueAtTime(time);
-        look = config->getLookNameByIndex(lookChoice_i);
-    } else {
-        look = lookCombination;
-    }
-    int directioni = _direction->getValueAtTime(time);
-    string outputSpace;
-    _ocio->getOutputColorspaceAtTime(time, outputSpace);
     try {
-        GenericOCIO::AutoMutex guard(_procMutex);
-        if ( !_proc ||
-             ( _procLook != look) ||
-             ( _procInputSpace != inputSpace) ||
-             ( _procOutputSpace != outputSpace) ||
-             ( _procDirection != directioni) ) {
-            OCIO::TransformDirection direction = OCIO::TRANSFORM_DIR_UNKNOWN;
-            OCIO::LookTransformRcPtr transform = OCIO::LookTransform::Create();
-            transform->setLooks( look.c_str() );
-
-            if (directioni == 0) {
-                transform->setSrc( inputSpace.c_str() );
-                transform->setDst( outputSpace.c_str() );
-                direction = OCIO::TRANSFORM_DIR_FORWARD;
-            } else {
-                // The TRANSFORM_DIR_INVERSE applies an inverse for the end-to-end transform,
-                // which would otherwise do dst->inv look -> src.
-                // This is an unintuitive result for the artist (who would expect in, out to
-                // remain unchanged), so we account for that here by flipping src/dst
-
-                transform->setSrc( outputSpace.c_str() );
-                transform->setDst( inputSpace.c_str() );
-                direction = OCIO::TRANSFORM_DIR_INVERSE;
+        LookProcessorBuilder builder = getProcessorBuilder(time, config, singleLook, lookCombination);
+        const string key = builder.getKey();
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            if ( _proc && (_procKey == key) ) {
+                return _proc;
             }
-            _proc = config->getProcessor(transform, direction);
         }
+        // the processor may be built right now, or may already be building in the background:
+        // do not hold the lock meanwhile
+        OCIO::ConstProcessorRcPtr proc = getOCIOProcessor(key, builder);
+        GenericOCIO::AutoMutex guard(_procMutex);
+        _proc = proc;
+        _procKey = key;
 
-        return _proc;
+        return proc;
     } catch (const OCIO::Exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
@@ -603,44 +416,34 @@ OCIOLookTransformPlugin::getProcessor(OfxTime time,
     }
 } // getProcessor
 
+// start building the processor in the background, so that it is ready for the next render
 void
-OCIOLookTransformPlugin::apply(double time,
-                               const OfxRectI& renderWindow,
-                               float *pixelData,
-                               const OfxRectI& bounds,
-                               PixelComponentEnum pixelComponents,
-                               int pixelComponentCount,
-                               int rowBytes)
+OCIOLookTransformPlugin::prewarmProcessor(double time)
 {
-    // are we in the image bounds
-    if ( (renderWindow.x1 < bounds.x1) || (renderWindow.x1 >= bounds.x2) || (renderWindow.y1 < bounds.y1) || (renderWindow.y1 >= bounds.y2) ||
-         ( renderWindow.x2 <= bounds.x1) || ( renderWindow.x2 > bounds.x2) || ( renderWindow.y2 <= bounds.y1) || ( renderWindow.y2 > bounds.y2) ) {
-        throw std::runtime_error("OCIO: render window outside of image bounds");
-    }
-    if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) ) {
-        throw std::runtime_error("OCIO: invalid components (only RGB and RGBA are supported)");
-    }
-
+    OCIO::ConstConfigRcPtr config = _ocio->getConfig();
 
-    OCIOProcessor processor(*this);
+    if (!config) {
+        return;
+    }
     bool singleLook = _singleLook->getValueAtTime(time);
     string lookCombination;
     _lookCombination->getValueAtTime(time, lookCombination);
     if ( _ocio->isIdentity(time) && !singleLook && lookCombination.empty() ) {
-        return; // isIdentity
+        return; // render() does not need a processor
+    }
+    try {
+        LookProcessorBuilder builder = getProcessorBuilder(time, config, singleLook, lookCombination);
+        const string key = builder.getKey();
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            if ( _proc && (_procKey == key) ) {
+                return;
+            }
+        }
+        prewarmOCIOProcessor( key, new LookProcessorBuilder(builder) );
+    } catch (const OCIO::Exception &) {
+        // the error will be reported by render()
     }
-
-    processor.setProcessor( getProcessor(time, singleLook, lookCombination) );
-
-    // set the images
-    processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
-
-
-    // set the render window
-    processor.setRenderWindow(renderWindow);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
 }
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
@@ -877,7 +680,7 @@ OCIOLookTransformPlugin::render(const RenderArguments &args)
     }
 
     BitDepthEnum dstBitDepth = dstImg->getPixelDepth();
-    if ( (dstBitDepth != eBitDepthFloat) || (dstBitDepth != srcBitDepth) ) {
+    if (dstBitDepth != srcBitDepth) {
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -901,31 +704,51 @@ OCIOLookTransformPlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    const void* srcPixelData = NULL;
-    OfxRectI bounds;
-    PixelComponentEnum pixelComponents;
-    BitDepthEnum bitDepth;
-    int srcRowBytes;
-    getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
-    int pixelComponentCount = srcImg->getPixelComponentCount();
-
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
     bool premult;
+    int premultChannel;
     _premult->getValueAtTime(args.time, premult);
+    _premultChannel->getValueAtTime(args.time, premultChannel);
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    auto_ptr<const Image> mask(doMasking ? _maskClip->fetchImage(args.time) : 0);
+    bool maskInvert = false;
+    if (doMasking) {
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+    }
 
-    // copy renderWindow to the temporary image
-    copyPixelData(premult, false, false, args.time, args.renderWindow, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
-
-    ///do the color-space conversion
-    apply(args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, tmpRowBytes);
+    bool singleLook = _singleLook->getValueAtTime(args.time);
+    string lookCombination;
+    _lookCombination->getValueAtTime(args.time, lookCombination);
+    OCIO::ConstProcessorRcPtr proc;
+    // keep a reference to the baked LUT until processing is done
+    OCIO_SHARED_PTR<const OCIOBakedLut> bakedLut;
+    if ( !_ocio->isIdentity(args.time) || singleLook || !lookCombination.empty() ) {
+        OCIO::ConstConfigRcPtr config = _ocio->getConfig();
+        const bool bake = config && _bakeLut->getValueAtTime(args.time);
+        string key;
+        if (bake) {
+            try {
+                // the config cache ID covers the LUT files used by the config
+                key = getProcessorBuilder(args.time, config, singleLook, lookCombination).getKey();
+            } catch (const OCIO::Exception &) {
+                // reported by getProcessor()
+            }
+            // if the LUT was baked in a previous session, the processor is not even needed
+            bakedLut = findOCIOBakedLut(key);
+        }
+        if (!bakedLut) {
+            proc = getProcessor(args.time, singleLook, lookCombination);
+            if (proc && bake) {
+                string inputSpace;
+                _ocio->getInputColorspaceAtTime(args.time, inputSpace);
+                bakedLut = getOCIOBakedLut(proc, config, inputSpace, key);
+            }
+        }
+    }
 
-    // copy the color-converted window and apply masking
-    copyPixelData( false, premult, true, args.time, args.renderWindow, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes, dstImg.get() );
+    // unpremultiply, do the color-space conversion, premultiply and mix, block by block
+    applyOCIOBlocks(*this, args.renderWindow, srcImg.get(), dstImg.get(), proc, bakedLut.get(), premult, premultChannel, mix, mask.get(), maskInvert);
 } // OCIOLookTransformPlugin::render
 
 bool
@@ -1030,6 +853,17 @@ OCIOLookTransformPlugin::changedParam(const InstanceChangedArgs &args,
             }
         }
     }
+
+    if ( (args.reason != eChangeTime) &&
+         ( ( paramName == kOCIOParamConfigFile) ||
+           ( paramName == kOCIOParamInputSpace) ||
+           ( paramName == kOCIOParamOutputSpace) ||
+           ( paramName == kParamLookChoice) ||
+           ( paramName == kParamSingleLook) ||
+           ( paramName == kParamLookCombination) ||
+           ( paramName == kParamDirection) ) ) {
+        prewarmProcessor(args.time);
+    }
 } // OCIOLookTransformPlugin::changedParam
 
 void
@@ -1055,7 +889,7 @@ OCIOLookTransformPlugin::changedClip(const InstanceChangedArgs &args,
     }
 }
 
-mDeclarePluginFactory(OCIOLookTransformPluginFactory, {ofxsThreadSuiteCheck();}, {});
+mDeclarePluginFactory(OCIOLookTransformPluginFactory, {ofxsThreadSuiteCheck();}, {shutdownOCIOPrewarm();});
 
 /** @brief The basic describe function, passed a plugin descriptor */
 void
@@ -1072,6 +906,9 @@ OCIOLookTransformPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedContext(eContextPaint);
 
     // add supported pixel depths
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
     desc.setSupportsTiles(kSupportsTiles);
@@ -1190,6 +1027,17 @@ OCIOLookTransformPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     }
 
 
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kOCIOParamBakeLUT);
+        param->setLabel(kOCIOParamBakeLUTLabel);
+        param->setHint(kOCIOParamBakeLUTHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kParamEnableGPU);
@@ -21,9 +21,12 @@
  * Resize images using OIIO.
  */
 
+#include <cmath>
 #include <cfloat> // DBL_MAX
 #include <limits>
 #include <algorithm>
+#include <list>
+#include <vector>
 
 #include "ofxsMacros.h"
 
@@ -48,10 +51,27 @@ GCC_DIAG_ON(unused-parameter)
 #include "ofxsCopier.h"
 #include "ofxsFormatResolution.h"
 #include "ofxsCoords.h"
+#include "ofxsMultiThread.h"
+#ifdef OFX_USE_MULTITHREAD_MUTEX
+namespace {
+typedef OFX::MultiThread::Mutex Mutex;
+typedef OFX::MultiThread::AutoMutex AutoMutex;
+}
+#else
+// some OFX hosts do not have mutex handling in the MT-Suite (e.g. Sony Catalyst Edit)
+// prefer using the fast mutex by Marcus Geelnard http://tinythreadpp.bitsnbites.eu/
+#include "fast_mutex.h"
+namespace {
+typedef tthread::fast_mutex Mutex;
+typedef OFX::MultiThread::AutoMutexT<tthread::fast_mutex> AutoMutex;
+}
+#endif
 
 #include "IOUtility.h"
+#include "OIIOResizeSeparable.h"
 
 using namespace OFX;
+using namespace IO;
 
 using std::string;
 
@@ -60,7 +80,6 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginName "ResizeOIIO"
 #define kPluginGrouping "Transform"
 #define kPluginDescription  "Resize input stream, using OpenImageIO.\n" \
-    "Note that only full images can be rendered, so it may be slower for interactive editing than the Reformat plugin.\n" \
     "However, the rendering algorithms are different between Reformat and Resize: Resize applies 1-dimensional filters in the horizontal and vertical directins, whereas Reformat resamples the image, so in some cases this plugin may give more visually pleasant results than Reformat.\n" \
     "This plugin does not concatenate transforms (as opposed to Reformat)."
 
@@ -68,10 +87,11 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 // History:
 // version 1.0: initial version
 // version 2.0: add the "default" filter, which is blackman-harris when increasing resolution, lanczos3 when decreasing resolution
+// version 2.1: support tiles, only the requested region of the source is fetched
 #define kPluginVersionMajor 2 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
-#define kSupportsTiles 0
+#define kSupportsTiles 1
 #define kSupportsMultiResolution 1
 #define kSupportsRenderScale 1
 #define kRenderThreadSafety eRenderFullySafe
@@ -118,6 +138,317 @@ enum ResizeTypeEnum
 
 OIIO_NAMESPACE_USING
 
+#define kResizeWeightsCacheSize 8 // number of axis weight tables kept by each instance
+
+// Keeps the most recently used axis weights, so that rendering the same resize again
+// (e.g. each frame of a sequence, or each tile of a frame) does not evaluate the filter.
+class ResizeWeightsCache
+{
+public:
+    ResizeWeightsCache()
+        : _mutex()
+        , _entries()
+    {
+    }
+
+    // returns false if the filter has no separable version
+    bool get(const string& filterName,
+             float filterWidth,
+             int srcStart,
+             int srcSize,
+             int dstStart,
+             int dstSize,
+             ResizeAxisWeights* w)
+    {
+        {
+            AutoMutex lock(_mutex);
+            for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+                if ( (it->filterName == filterName) && (it->filterWidth == filterWidth) &&
+                     (it->srcStart == srcStart) && (it->srcSize == srcSize) &&
+                     (it->dstStart == dstStart) && (it->dstSize == dstSize) ) {
+                    *w = it->weights;
+                    // move it to the front
+                    _entries.splice(_entries.begin(), _entries, it);
+
+                    return true;
+                }
+            }
+        }
+
+        auto_ptr<Filter1D> filter( Filter1D::create(filterName, filterWidth) );
+        if ( !filter.get() ) {
+            return false;
+        }
+        computeResizeAxisWeights(*filter, srcStart, srcSize, dstStart, dstSize, w);
+
+        AutoMutex lock(_mutex);
+        _entries.push_front( Entry() );
+        Entry& e = _entries.front();
+        e.filterName = filterName;
+        e.filterWidth = filterWidth;
+        e.srcStart = srcStart;
+        e.srcSize = srcSize;
+        e.dstStart = dstStart;
+        e.dstSize = dstSize;
+        e.weights = *w;
+        while (_entries.size() > kResizeWeightsCacheSize) {
+            _entries.pop_back();
+        }
+
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        string filterName;
+        float filterWidth;
+        int srcStart;
+        int srcSize;
+        int dstStart;
+        int dstSize;
+        ResizeAxisWeights weights;
+    };
+
+    Mutex _mutex;
+    std::list<Entry> _entries;
+};
+
+// First pass of the separable resize: filter the source rows horizontally into a float buffer
+// which covers the columns of the render window and the source rows needed by the second pass.
+// As in OIIO, source coordinates are clamped to the source format, and pixels outside of the source image are black.
+// There is no destination image, so the rows are split between threads by hand.
+// If TAPS is not zero, the weights are the same for all pixels and have TAPS taps.
+template <class PIX, int nComps, int TAPS>
+class ResizeHorizontalProcessor
+    : public MultiThread::Processor
+{
+public:
+    ResizeHorizontalProcessor(ImageEffect &instance,
+                              const Image* srcImg,
+                              const OfxRectI& srcFormat,
+                              const ResizeAxisWeights& xWeights,
+                              float* tmp,
+                              int tmpX1,
+                              int tmpX2,
+                              int tmpY1,
+                              int tmpY2)
+        : _effect(instance)
+        , _srcImg(srcImg)
+        , _srcBounds( srcImg->getBounds() )
+        , _srcFormatX1(srcFormat.x1)
+        , _srcFormatX2(srcFormat.x2)
+        , _xWeights(xWeights)
+        , _tmp(tmp)
+        , _tmpX1(tmpX1)
+        , _tmpX2(tmpX2)
+        , _tmpY1(tmpY1)
+        , _tmpY2(tmpY2)
+    {
+    }
+
+    void process()
+    {
+        if ( (_tmpX2 <= _tmpX1) || (_tmpY2 <= _tmpY1) ) {
+            return;
+        }
+        // at least 4096 pixels and one row per thread, as ImageProcessor does
+        unsigned int nThreads = ( std::min(_tmpX2 - _tmpX1, 4096) * (_tmpY2 - _tmpY1) ) / 4096;
+        nThreads = std::max( 1u, std::min( nThreads, MultiThread::getNumCPUs() ) );
+        multiThread(nThreads);
+    }
+
+private:
+    virtual void multiThreadFunction(unsigned int threadID,
+                                     unsigned int nThreads) OVERRIDE FINAL
+    {
+        const int rows = _tmpY2 - _tmpY1;
+        OfxRectI procWindow;
+
+        procWindow.x1 = _tmpX1;
+        procWindow.x2 = _tmpX2;
+        procWindow.y1 = _tmpY1 + (int)( (double)rows * threadID / nThreads );
+        procWindow.y2 = _tmpY1 + (int)( (double)rows * (threadID + 1) / nThreads );
+        multiThreadProcessImages(procWindow);
+    }
+
+    void multiThreadProcessImages(OfxRectI procWindow)
+    {
+        const std::size_t tmpRowSize = (std::size_t)(_tmpX2 - _tmpX1) * nComps;
+
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( (y % 10 == 0) && _effect.abort() ) {
+                //check for abort only every 10 lines
+                break;
+            }
+            float* tmpPix = _tmp + (y - _tmpY1) * tmpRowSize;
+            if ( (y < _srcBounds.y1) || (_srcBounds.y2 <= y) ) {
+                std::fill(tmpPix, tmpPix + tmpRowSize, 0.f);
+                continue;
+            }
+            const PIX* srcRow = (const PIX*)_srcImg->getPixelAddress(_srcBounds.x1, y);
+            resizeRowHorizontal<PIX, nComps, TAPS>(srcRow, _srcBounds.x1, _srcBounds.x2, _srcFormatX1, _srcFormatX2, _xWeights, _tmpX1, _tmpX2, tmpPix);
+        }
+    }
+
+    ImageEffect& _effect;
+    const Image* _srcImg;
+    const OfxRectI _srcBounds;
+    const int _srcFormatX1;
+    const int _srcFormatX2;
+    const ResizeAxisWeights& _xWeights;
+    float* _tmp;
+    const int _tmpX1;
+    const int _tmpX2;
+    const int _tmpY1;
+    const int _tmpY2;
+};
+
+// Second pass of the separable resize: filter the rows of the float buffer vertically into the destination.
+// As in OIIO, source rows are clamped to the source format. The buffer holds all the rows of the source image
+// needed by the render window, so the rows outside of it are black.
+// If TAPS is not zero, the weights are the same for all rows and have TAPS taps.
+template <class PIX, int nComps, int TAPS>
+class ResizeVerticalProcessor
+    : public ImageProcessor
+{
+public:
+    ResizeVerticalProcessor(ImageEffect &instance,
+                            Image* dstImg,
+                            const OfxRectI& srcFormat,
+                            const ResizeAxisWeights& yWeights,
+                            const float* tmp,
+                            int tmpX1,
+                            int tmpX2,
+                            int tmpY1,
+                            int tmpY2)
+        : ImageProcessor(instance)
+        , _yWeights(yWeights)
+        , _tmp(tmp)
+        , _tmpX1(tmpX1)
+        , _tmpX2(tmpX2)
+        , _tmpY1(tmpY1)
+        , _tmpY2(tmpY2)
+        , _srcFormatY1(srcFormat.y1)
+        , _srcFormatY2(srcFormat.y2)
+    {
+        setDstImg(dstImg);
+    }
+
+private:
+    virtual void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        assert(procWindow.x1 == _tmpX1 && procWindow.x2 == _tmpX2);
+        const std::size_t tmpRowSize = (std::size_t)(_tmpX2 - _tmpX1) * nComps;
+        std::vector<float> acc(tmpRowSize);
+
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( (y % 10 == 0) && _effect.abort() ) {
+                //check for abort only every 10 lines
+                break;
+            }
+            PIX* dstPix = (PIX*)getDstPixelAddress(procWindow.x1, y);
+            assert(dstPix);
+            resizeRowVertical<PIX, nComps, TAPS>(_yWeights, y, _tmp, tmpRowSize, _tmpY1, _tmpY2, _srcFormatY1, _srcFormatY2, &acc[0], dstPix);
+        }
+    }
+
+    const ResizeAxisWeights& _yWeights;
+    const float* _tmp;
+    const int _tmpX1;
+    const int _tmpX2;
+    const int _tmpY1;
+    const int _tmpY2;
+    const int _srcFormatY1;
+    const int _srcFormatY2;
+};
+
+template <class PIX, int nComps>
+class ResizeHorizontalPass
+{
+public:
+    ResizeHorizontalPass(ImageEffect &instance,
+                         const Image* srcImg,
+                         const OfxRectI& srcFormat,
+                         const ResizeAxisWeights& xWeights,
+                         float* tmp,
+                         int tmpX1,
+                         int tmpX2,
+                         int tmpY1,
+                         int tmpY2)
+        : _instance(instance)
+        , _srcImg(srcImg)
+        , _srcFormat(srcFormat)
+        , _xWeights(xWeights)
+        , _tmp(tmp)
+        , _tmpX1(tmpX1)
+        , _tmpX2(tmpX2)
+        , _tmpY1(tmpY1)
+        , _tmpY2(tmpY2)
+    {
+    }
+
+    template <int TAPS>
+    void run() const
+    {
+        ResizeHorizontalProcessor<PIX, nComps, TAPS> processor(_instance, _srcImg, _srcFormat, _xWeights, _tmp, _tmpX1, _tmpX2, _tmpY1, _tmpY2);
+        processor.process();
+    }
+
+private:
+    ImageEffect& _instance;
+    const Image* _srcImg;
+    const OfxRectI _srcFormat;
+    const ResizeAxisWeights& _xWeights;
+    float* _tmp;
+    const int _tmpX1;
+    const int _tmpX2;
+    const int _tmpY1;
+    const int _tmpY2;
+};
+
+template <class PIX, int nComps>
+class ResizeVerticalPass
+{
+public:
+    ResizeVerticalPass(ImageEffect &instance,
+                       Image* dstImg,
+                       const OfxRectI& srcFormat,
+                       const ResizeAxisWeights& yWeights,
+                       const float* tmp,
+                       const OfxRectI& renderWindow,
+                       int tmpY1,
+                       int tmpY2)
+        : _instance(instance)
+        , _dstImg(dstImg)
+        , _srcFormat(srcFormat)
+        , _yWeights(yWeights)
+        , _tmp(tmp)
+        , _renderWindow(renderWindow)
+        , _tmpY1(tmpY1)
+        , _tmpY2(tmpY2)
+    {
+    }
+
+    template <int TAPS>
+    void run() const
+    {
+        ResizeVerticalProcessor<PIX, nComps, TAPS> processor(_instance, _dstImg, _srcFormat, _yWeights, _tmp, _renderWindow.x1, _renderWindow.x2, _tmpY1, _tmpY2);
+        processor.setRenderWindow(_renderWindow);
+        processor.process();
+    }
+
+private:
+    ImageEffect& _instance;
+    Image* _dstImg;
+    const OfxRectI _srcFormat;
+    const ResizeAxisWeights& _yWeights;
+    const float* _tmp;
+    const OfxRectI _renderWindow;
+    const int _tmpY1;
+    const int _tmpY2;
+};
+
 class OIIOResizePlugin
     : public ImageEffect
 {
@@ -152,6 +483,15 @@ private:
     template <typename PIX, int nComps>
     void renderInternal(const RenderArguments &args, TypeDesc srcType, const Image* srcImg, TypeDesc dstType, Image* dstImg);
 
+    template <typename PIX, int nComps>
+    bool resizeSeparable(const Image* srcImg, Image* dstImg, const OfxRectI& srcFormat, const OfxRectI& dstFormat, const OfxRectI& renderWindow, const string& filterName, float fw, float fh);
+
+    bool getResizeFilter(float wratio, float hratio, FilterDesc* fd, float* fw, float* fh);
+
+    bool getResizeWindows(double time, const OfxPointD& renderScale, OfxRectI* srcFormat, OfxRectI* dstFormat);
+
+    double getResizePixelAspectRatio();
+
     void fillWithBlack(PixelProcessorFilterBase & processor,
                        const OfxRectI &renderWindow,
                        void *dstPixelData,
@@ -171,6 +511,7 @@ private:
     Double2DParam *_scale;
     BooleanParam *_preservePAR;
     BooleanParam* _srcClipChanged; // set to true the first time the user connects src
+    ResizeWeightsCache _weightsCache;
 };
 
 OIIOResizePlugin::OIIOResizePlugin(OfxImageEffectHandle handle)
@@ -184,6 +525,7 @@ OIIOResizePlugin::OIIOResizePlugin(OfxImageEffectHandle handle)
     , _scale(NULL)
     , _preservePAR(NULL)
     , _srcClipChanged(NULL)
+    , _weightsCache()
 {
     _dstClip = fetchClip(kOfxImageEffectOutputClipName);
     assert( _dstClip && (!_dstClip->isConnected() || _dstClip->getPixelComponents() == ePixelComponentRGBA ||
@@ -417,14 +759,151 @@ OIIOResizePlugin::render(const RenderArguments &args)
     }
 } // OIIOResizePlugin::render
 
+bool
+OIIOResizePlugin::getResizeFilter(float wratio,
+                                  float hratio,
+                                  FilterDesc* fd,
+                                  float* fw,
+                                  float* fh)
+{
+    int filter;
+
+    _filter->getValue(filter);
+    if (filter == 0) {
+        // impulse: nearest neighbour
+        return false;
+    }
+    const int num_filters = Filter2D::num_filters();
+    filter -= 1;
+    if (filter < num_filters) {
+        Filter2D::get_filterdesc(filter, fd);
+    } else {
+        string filtername;
+        // "default" filter
+        // No filter name supplied -- pick a good default
+        // see imgbufalgo_xform.cpp:477
+        if (wratio > 1.0f || hratio > 1.0f) {
+            filtername = "blackman-harris";
+        } else {
+            filtername = "lanczos3";
+        }
+        filter = 0;
+        Filter2D::get_filterdesc(filter, fd);
+        while (fd->name != filtername) {
+            ++filter;
+            Filter2D::get_filterdesc(filter, fd);
+        }
+    }
+    // older versions of OIIO 1.2 don't have ImageBufAlgo::resize(dstBuf, srcBuf, fd.name, fd.width)
+    // the filter width is expressed in destination pixels: widen it when downscaling
+    *fw = fd->width * std::max(1.0f, wratio);
+    *fh = fd->width * std::max(1.0f, hratio);
+
+    return true;
+}
+
+// Compute the source and destination formats, in pixel coordinates at the given render scale.
+// The resize maps the full window of the destination onto the full window of the source,
+// which is what makes rendering a single tile equivalent to rendering the full image.
+bool
+OIIOResizePlugin::getResizeWindows(double time,
+                                   const OfxPointD& renderScale,
+                                   OfxRectI* srcFormat,
+                                   OfxRectI* dstFormat)
+{
+    if ( !_srcClip || !_srcClip->isConnected() ) {
+        return false;
+    }
+    OfxRectD srcRoD = _srcClip->getRegionOfDefinition(time);
+    if ( Coords::rectIsEmpty(srcRoD) ) {
+        return false;
+    }
+    OfxRectD dstRoD;
+    RegionOfDefinitionArguments rodArgs;
+    rodArgs.time = time;
+    rodArgs.renderScale = renderScale;
+    if ( !getRegionOfDefinition(rodArgs, dstRoD) || Coords::rectIsEmpty(dstRoD) ) {
+        return false;
+    }
+    Coords::toPixelEnclosing(srcRoD, renderScale, _srcClip->getPixelAspectRatio(), srcFormat);
+    Coords::toPixelEnclosing(dstRoD, renderScale, getResizePixelAspectRatio(), dstFormat);
+
+    return !Coords::rectIsEmpty(*srcFormat) && !Coords::rectIsEmpty(*dstFormat);
+}
+
+// The pixel aspect ratio of the output, as set by getClipPreferences()
+double
+OIIOResizePlugin::getResizePixelAspectRatio()
+{
+    ResizeTypeEnum type = (ResizeTypeEnum)_type->getValue();
+
+    if (type == eResizeTypeFormat) {
+        int index;
+        _format->getValue(index);
+        double par = 1.;
+        int w = 0, h = 0;
+        getFormatResolution( (EParamFormat)index, &w, &h, &par );
+
+        return par;
+    }
+
+    return _srcClip->getPixelAspectRatio();
+}
+
+// Resize with a separable filter, in two passes: horizontally into a float buffer, then vertically.
+// The filter weights only depend on the source and destination formats, so they are cached.
+// Returns false if the filter is not separable.
+template <typename PIX, int nComps>
+bool
+OIIOResizePlugin::resizeSeparable(const Image* srcImg,
+                                  Image* dstImg,
+                                  const OfxRectI& srcFormat,
+                                  const OfxRectI& dstFormat,
+                                  const OfxRectI& renderWindow,
+                                  const string& filterName,
+                                  float fw,
+                                  float fh)
+{
+    ResizeAxisWeights xWeights, yWeights;
+
+    if ( !_weightsCache.get(filterName, fw, srcFormat.x1, srcFormat.x2 - srcFormat.x1, dstFormat.x1, dstFormat.x2 - dstFormat.x1, &xWeights) ||
+         !_weightsCache.get(filterName, fh, srcFormat.y1, srcFormat.y2 - srcFormat.y1, dstFormat.y1, dstFormat.y2 - dstFormat.y1, &yWeights) ) {
+        return false;
+    }
+
+    // the source rows needed by the render window, once clamped to the source format
+    const OfxRectI srcBounds = srcImg->getBounds();
+    int tmpY1, tmpY2;
+    getResizeSourceRows(yWeights, renderWindow.y1, renderWindow.y2, srcFormat.y1, srcFormat.y2, srcBounds.y1, srcBounds.y2, &tmpY1, &tmpY2);
+
+    std::vector<float> tmp( (std::size_t)(renderWindow.x2 - renderWindow.x1) * (tmpY2 - tmpY1) * nComps );
+    float* tmpData = tmp.empty() ? NULL : &tmp[0];
+    dispatchResizeTaps( xWeights, ResizeHorizontalPass<PIX, nComps>(*this, srcImg, srcFormat, xWeights, tmpData, renderWindow.x1, renderWindow.x2, tmpY1, tmpY2) );
+    if ( abort() ) {
+        return true;
+    }
+    dispatchResizeTaps( yWeights, ResizeVerticalPass<PIX, nComps>(*this, dstImg, srcFormat, yWeights, tmpData, renderWindow, tmpY1, tmpY2) );
+
+    return true;
+} // OIIOResizePlugin::resizeSeparable
+
 template <typename PIX, int nComps>
 void
-OIIOResizePlugin::renderInternal(const RenderArguments & /*args*/,
+OIIOResizePlugin::renderInternal(const RenderArguments &args,
                                  TypeDesc srcType,
                                  const Image* srcImg,
                                  TypeDesc dstType,
                                  Image* dstImg)
 {
+    OfxRectI srcFormat, dstFormat;
+
+    if ( !getResizeWindows(args.time, args.renderScale, &srcFormat, &dstFormat) ) {
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+
+    // the source image only covers the region of interest, but its full window is the whole source
     ImageSpec srcSpec(srcType);
     const OfxRectI srcBounds = srcImg->getBounds();
 
@@ -433,16 +912,15 @@ OIIOResizePlugin::renderInternal(const RenderArguments & /*args*/,
     srcSpec.width = srcBounds.x2 - srcBounds.x1;
     srcSpec.height = srcBounds.y2 - srcBounds.y1;
     srcSpec.nchannels = nComps;
-    srcSpec.full_x = srcSpec.x;
-    srcSpec.full_y = srcSpec.y;
-    srcSpec.full_width = srcSpec.width;
-    srcSpec.full_height = srcSpec.height;
+    srcSpec.full_x = srcFormat.x1;
+    srcSpec.full_y = srcFormat.y1;
+    srcSpec.full_width = srcFormat.x2 - srcFormat.x1;
+    srcSpec.full_height = srcFormat.y2 - srcFormat.y1;
     srcSpec.default_channel_names();
 
     const ImageBuf srcBuf( "src", srcSpec, const_cast<void*>( srcImg->getPixelAddress(srcBounds.x1, srcBounds.y1) ) );
 
-
-    ///This code assumes that the dstImg has the target size hence that we don't support tiles
+    // likewise, the destination image may be a tile of the output
     const OfxRectI dstBounds = dstImg->getBounds();
     ImageSpec dstSpec(dstType);
     dstSpec.x = dstBounds.x1;
@@ -450,54 +928,39 @@ OIIOResizePlugin::renderInternal(const RenderArguments & /*args*/,
     dstSpec.width = dstBounds.x2 - dstBounds.x1;
     dstSpec.height = dstBounds.y2 - dstBounds.y1;
     dstSpec.nchannels = nComps;
-    dstSpec.full_x = dstSpec.x;
-    dstSpec.full_y = dstSpec.y;
-    dstSpec.full_width = dstSpec.width;
-    dstSpec.full_height = dstSpec.height;
+    dstSpec.full_x = dstFormat.x1;
+    dstSpec.full_y = dstFormat.y1;
+    dstSpec.full_width = dstFormat.x2 - dstFormat.x1;
+    dstSpec.full_height = dstFormat.y2 - dstFormat.y1;
     dstSpec.default_channel_names();
 
     ImageBuf dstBuf( "dst", dstSpec, dstImg->getPixelAddress(dstBounds.x1, dstBounds.y1) );
-    int filter;
-    _filter->getValue(filter);
 
-    if (filter == 0) {
+    // only resize the requested render window
+    OfxRectI renderWindow;
+    if ( !Coords::rectIntersection(args.renderWindow, dstBounds, &renderWindow) ) {
+        return;
+    }
+    ROI roi(renderWindow.x1, renderWindow.x2, renderWindow.y1, renderWindow.y2, 0, 1, 0, nComps);
+
+    assert(srcSpec.full_width && srcSpec.full_height);
+    float wratio = float(dstSpec.full_width) / float(srcSpec.full_width);
+    float hratio = float(dstSpec.full_height) / float(srcSpec.full_height);
+    FilterDesc fd;
+    float fw, fh;
+    if ( !getResizeFilter(wratio, hratio, &fd, &fw, &fh) ) {
         ///Use nearest neighboor
-        if ( !ImageBufAlgo::resample( dstBuf, srcBuf, /*interpolate*/ false, ROI::All(), MultiThread::getNumCPUs() ) ) {
+        if ( !ImageBufAlgo::resample( dstBuf, srcBuf, /*interpolate*/ false, roi, MultiThread::getNumCPUs() ) ) {
             setPersistentMessage( Message::eMessageError, "", dstBuf.geterror() );
         }
-    } else {
-        assert(srcSpec.full_width && srcSpec.full_height);
-        float wratio = float(dstSpec.full_width) / float(srcSpec.full_width);
-        float hratio = float(dstSpec.full_height) / float(srcSpec.full_height);
-        const int num_filters = Filter2D::num_filters();
-        ///interpolate using the selected filter
-        FilterDesc fd;
-        filter -= 1;
-        if (filter < num_filters) {
-            Filter2D::get_filterdesc(filter, &fd);
-        } else {
-            string filtername;
-            // "default" filter
-            // No filter name supplied -- pick a good default
-            // see imgbufalgo_xform.cpp:477
-            if (wratio > 1.0f || hratio > 1.0f) {
-                filtername = "blackman-harris";
-            } else {
-                filtername = "lanczos3";
-            }
-            filter = 0;
-            Filter2D::get_filterdesc(filter, &fd);
-            while (fd.name != filtername) {
-                ++filter;
-                Filter2D::get_filterdesc(filter, &fd);
-            }
-        }
-        // older versions of OIIO 1.2 don't have ImageBufAlgo::resize(dstBuf, srcBuf, fd.name, fd.width)
-        float w = fd.width * std::max(1.0f, wratio);
-        float h = fd.width * std::max(1.0f, hratio);
-        auto_ptr<Filter2D> filter( Filter2D::create(fd.name, w, h) );
 
-        if ( !ImageBufAlgo::resize( dstBuf, srcBuf, filter.get(), ROI::All(), MultiThread::getNumCPUs() ) ) {
+        return;
+    }
+    if ( !resizeSeparable<PIX, nComps>(srcImg, dstImg, srcFormat, dstFormat, renderWindow, fd.name, fw, fh) ) {
+        ///interpolate using the selected filter (non-separable filters)
+        auto_ptr<Filter2D> filter( Filter2D::create(fd.name, fw, fh) );
+
+        if ( !ImageBufAlgo::resize( dstBuf, srcBuf, filter.get(), roi, MultiThread::getNumCPUs() ) ) {
             setPersistentMessage( Message::eMessageError, "", dstBuf.geterror() );
         }
     }
@@ -741,15 +1204,59 @@ void
 OIIOResizePlugin::getRegionsOfInterest(const RegionsOfInterestArguments &args,
                                        RegionOfInterestSetter &rois)
 {
-    if (!kSupportsTiles) {
+    if ( !_srcClip || !_srcClip->isConnected() ) {
+        return;
+    }
+    OfxRectD srcRoD = _srcClip->getRegionOfDefinition(args.time);
+    OfxRectI srcFormat, dstFormat;
+    if ( !kSupportsTiles || !getResizeWindows(args.time, args.renderScale, &srcFormat, &dstFormat) ) {
         // The effect requires full images to render any region
+        rois.setRegionOfInterest(*_srcClip, srcRoD);
 
-        if ( _srcClip && _srcClip->isConnected() ) {
-            OfxRectD srcRoD = _srcClip->getRegionOfDefinition(args.time);
-            rois.setRegionOfInterest(*_srcClip, srcRoD);
-        }
+        return;
     }
-}
+
+    // map the destination region to source pixels, the same way the resize does
+    const double srcPar = _srcClip->getPixelAspectRatio();
+    OfxRectI roiPixel;
+    Coords::toPixelEnclosing(args.regionOfInterest, args.renderScale, getResizePixelAspectRatio(), &roiPixel);
+    const double srcW = srcFormat.x2 - srcFormat.x1;
+    const double srcH = srcFormat.y2 - srcFormat.y1;
+    const double dstW = dstFormat.x2 - dstFormat.x1;
+    const double dstH = dstFormat.y2 - dstFormat.y1;
+    const double xscale = srcW / dstW;
+    const double yscale = srcH / dstH;
+    OfxRectD srcRoIPixel;
+    srcRoIPixel.x1 = srcFormat.x1 + (roiPixel.x1 - dstFormat.x1) * xscale;
+    srcRoIPixel.x2 = srcFormat.x1 + (roiPixel.x2 - dstFormat.x1) * xscale;
+    srcRoIPixel.y1 = srcFormat.y1 + (roiPixel.y1 - dstFormat.y1) * yscale;
+    srcRoIPixel.y2 = srcFormat.y1 + (roiPixel.y2 - dstFormat.y1) * yscale;
+
+    // add the filter support, which is expressed in destination pixels, plus one pixel for rounding
+    double xradius = 1.;
+    double yradius = 1.;
+    FilterDesc fd;
+    float fw, fh;
+    if ( getResizeFilter(float(dstW / srcW), float(dstH / srcH), &fd, &fw, &fh) ) {
+        xradius += std::ceil(0.5 * fw * xscale);
+        yradius += std::ceil(0.5 * fh * yscale);
+    }
+    srcRoIPixel.x1 = std::floor(srcRoIPixel.x1 - xradius);
+    srcRoIPixel.x2 = std::ceil(srcRoIPixel.x2 + xradius);
+    srcRoIPixel.y1 = std::floor(srcRoIPixel.y1 - yradius);
+    srcRoIPixel.y2 = std::ceil(srcRoIPixel.y2 + yradius);
+
+    // back to canonical coordinates
+    OfxRectD srcRoI;
+    srcRoI.x1 = srcRoIPixel.x1 * srcPar / args.renderScale.x;
+    srcRoI.x2 = srcRoIPixel.x2 * srcPar / args.renderScale.x;
+    srcRoI.y1 = srcRoIPixel.y1 / args.renderScale.y;
+    srcRoI.y2 = srcRoIPixel.y2 / args.renderScale.y;
+    if ( !Coords::rectIntersection(srcRoI, srcRoD, &srcRoI) ) {
+        return;
+    }
+    rois.setRegionOfInterest(*_srcClip, srcRoI);
+} // OIIOResizePlugin::getRegionsOfInterest
 
 void
 OIIOResizePlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences)
@@ -810,7 +1317,7 @@ OIIOResizePluginFactory<majorVersion>::describe(ImageEffectDescriptor &desc)
     desc.addSupportedBitDepth(eBitDepthUShort);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
-    ///We don't support tiles: we can only resize the whole RoD at once
+    ///Each tile is resized from the source region covered by the filter support
     desc.setSupportsTiles(kSupportsTiles);
 
     desc.setSupportsMultipleClipPARs(true); // plugin may setPixelAspectRatio on output clip
@@ -0,0 +1,333 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * The separable resize of OIIOResize: weights and row kernels.
+ * Only depends on OpenImageIO, so that it can be compared with ImageBufAlgo::resize by the benchmark (see Tests/).
+ */
+
+#ifndef IO_OIIOResizeSeparable_h
+#define IO_OIIOResizeSeparable_h
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+#include <vector>
+
+#include <OpenImageIO/filter.h>
+
+namespace OFX {
+namespace IO {
+
+// The weights of a separable filter along one axis, for every pixel of the destination format.
+// They are computed the same way as ImageBufAlgo::resize() computes them for separable filters.
+struct ResizeAxisWeights
+{
+    int dstStart; // first pixel of the destination format
+    int taps; // number of weights for each destination pixel
+    int step; // if not zero, all destination pixels have the same weights and srcStart increases by step
+    std::vector<int> srcStart; // first source pixel for each destination pixel
+    std::vector<float> weights; // normalized weights, taps per destination pixel
+
+    ResizeAxisWeights()
+        : dstStart(0)
+        , taps(0)
+        , step(0)
+        , srcStart()
+        , weights()
+    {
+    }
+};
+
+inline void
+computeResizeAxisWeights(const OIIO_NAMESPACE::Filter1D& filter,
+                         int srcStart,
+                         int srcSize,
+                         int dstStart,
+                         int dstSize,
+                         ResizeAxisWeights* w)
+{
+    const float ratio = float(dstSize) / float(srcSize);
+    const int rad = (int)std::ceil(filter.width() / 2.0f / ratio);
+    const int taps = 2 * rad + 1;
+
+    w->dstStart = dstStart;
+    w->taps = taps;
+    w->srcStart.resize(dstSize);
+    w->weights.resize( (std::size_t)dstSize * taps );
+    for (int i = 0; i < dstSize; ++i) {
+        // center of the destination pixel, in source coordinates
+        const float src_f = srcStart + (i + 0.5f) * srcSize / float(dstSize);
+        const float src_fl = std::floor(src_f);
+        const float src_frac = src_f - src_fl;
+        float* wi = &w->weights[(std::size_t)i * taps];
+        float total = 0.f;
+
+        w->srcStart[i] = (int)src_fl - rad;
+        for (int k = 0; k < taps; ++k) {
+            wi[k] = filter( ratio * (k - rad - (src_frac - 0.5f)) );
+            total += wi[k];
+        }
+        if (total != 0.f) {
+            for (int k = 0; k < taps; ++k) {
+                wi[k] /= total;
+            }
+        }
+    }
+
+    // drop the taps which are zero for all destination pixels (e.g. the last tap of box filters)
+    int kBegin = taps;
+    int kEnd = 0;
+    for (int i = 0; i < dstSize; ++i) {
+        const float* wi = &w->weights[(std::size_t)i * taps];
+        for (int k = 0; k < taps; ++k) {
+            if (wi[k] != 0.f) {
+                kBegin = std::min(kBegin, k);
+                kEnd = std::max(kEnd, k + 1);
+            }
+        }
+    }
+    if ( (kBegin < kEnd) && ( (kBegin > 0) || (kEnd < taps) ) ) {
+        const int trimmedTaps = kEnd - kBegin;
+        for (int i = 0; i < dstSize; ++i) {
+            for (int k = 0; k < trimmedTaps; ++k) {
+                w->weights[(std::size_t)i * trimmedTaps + k] = w->weights[(std::size_t)i * taps + kBegin + k];
+            }
+            w->srcStart[i] += kBegin;
+        }
+        w->taps = trimmedTaps;
+        w->weights.resize( (std::size_t)dstSize * trimmedTaps );
+    }
+
+    // integer reductions (2x, 4x...) with aligned formats have the same weights for every pixel
+    if ( (srcSize % dstSize == 0) && (srcSize > dstSize) ) {
+        const int step = srcSize / dstSize;
+        bool uniform = true;
+        for (int i = 1; i < dstSize && uniform; ++i) {
+            uniform = ( w->srcStart[i] == w->srcStart[0] + i * step &&
+                        std::equal(&w->weights[0], &w->weights[0] + w->taps, &w->weights[(std::size_t)i * w->taps]) );
+        }
+        if (uniform) {
+            w->step = step;
+        }
+    }
+}
+
+template <class PIX>
+inline PIX
+resizedValue(float v)
+{
+    // round and clamp, as the conversion from float done by OIIO
+    return (PIX)( std::max( 0.f, std::min(v, (float)std::numeric_limits<PIX>::max()) ) + 0.5f );
+}
+
+template <>
+inline float
+resizedValue<float>(float v)
+{
+    return v;
+}
+
+// First pass of the separable resize, for one source row: filter it horizontally into the columns [x1,x2) of tmpPix.
+// As in OIIO, source coordinates are clamped to the source format [srcFormatX1,srcFormatX2), and pixels outside of the
+// source row [srcBoundsX1,srcBoundsX2) are black.
+// If TAPS is not zero, the weights are the same for all pixels and have TAPS taps.
+template <class PIX, int nComps, int TAPS>
+inline void
+resizeRowHorizontal(const PIX* srcRow,
+                    int srcBoundsX1,
+                    int srcBoundsX2,
+                    int srcFormatX1,
+                    int srcFormatX2,
+                    const ResizeAxisWeights& xWeights,
+                    int x1,
+                    int x2,
+                    float* tmpPix)
+{
+    assert(!TAPS || (xWeights.step && xWeights.taps == TAPS));
+    const int taps = TAPS ? TAPS : xWeights.taps;
+    const int dstCount = (int)xWeights.srcStart.size();
+    // the columns inside both the source format and the source row
+    const int insideX1 = std::max(srcFormatX1, srcBoundsX1);
+    const int insideX2 = std::min(srcFormatX2, srcBoundsX2);
+
+    for (int x = x1; x < x2; ++x, tmpPix += nComps) {
+        float acc[nComps];
+        for (int c = 0; c < nComps; ++c) {
+            acc[c] = 0.f;
+        }
+        const int i = x - xWeights.dstStart;
+        if ( (0 <= i) && (i < dstCount) ) {
+            const float* w = &xWeights.weights[TAPS ? 0 : (std::size_t)i * taps];
+            const int sx = xWeights.srcStart[i];
+            if ( (insideX1 <= sx) && (sx + taps <= insideX2) ) {
+                // all taps are inside the source format and image (the loop is unrolled if TAPS is not zero)
+                const PIX* srcPix = srcRow + (sx - srcBoundsX1) * nComps;
+                for (int k = 0; k < taps; ++k) {
+                    for (int c = 0; c < nComps; ++c) {
+                        acc[c] += w[k] * srcPix[k * nComps + c];
+                    }
+                }
+            } else {
+                for (int k = 0; k < taps; ++k) {
+                    const int sxk = std::max( srcFormatX1, std::min(sx + k, srcFormatX2 - 1) );
+                    if ( (sxk < srcBoundsX1) || (srcBoundsX2 <= sxk) ) {
+                        continue;
+                    }
+                    const PIX* srcPix = srcRow + (sxk - srcBoundsX1) * nComps;
+                    for (int c = 0; c < nComps; ++c) {
+                        acc[c] += w[k] * srcPix[c];
+                    }
+                }
+            }
+        }
+        for (int c = 0; c < nComps; ++c) {
+            tmpPix[c] = acc[c];
+        }
+    }
+} // resizeRowHorizontal
+
+// Second pass of the separable resize, for one destination row y: filter the rows of the float buffer tmp vertically
+// into dstPix. tmp holds the source rows [tmpY1,tmpY2), with tmpRowSize values each, and acc must hold tmpRowSize
+// values. As in OIIO, source rows are clamped to the source format [srcFormatY1,srcFormatY2), and the rows outside of
+// tmp are black.
+// If TAPS is not zero, the weights are the same for all rows and have TAPS taps.
+template <class PIX, int nComps, int TAPS>
+inline void
+resizeRowVertical(const ResizeAxisWeights& yWeights,
+                  int y,
+                  const float* tmp,
+                  std::size_t tmpRowSize,
+                  int tmpY1,
+                  int tmpY2,
+                  int srcFormatY1,
+                  int srcFormatY2,
+                  float* acc,
+                  PIX* dstPix)
+{
+    assert(!TAPS || (yWeights.step && yWeights.taps == TAPS));
+    const int taps = TAPS ? TAPS : yWeights.taps;
+    const int dstCount = (int)yWeights.srcStart.size();
+    // the rows inside both the source format and the buffer
+    const int insideY1 = std::max(srcFormatY1, tmpY1);
+    const int insideY2 = std::min(srcFormatY2, tmpY2);
+
+    std::fill(acc, acc + tmpRowSize, 0.f);
+    const int i = y - yWeights.dstStart;
+    if ( (0 <= i) && (i < dstCount) ) {
+        const float* w = &yWeights.weights[TAPS ? 0 : (std::size_t)i * taps];
+        const int sy = yWeights.srcStart[i];
+        const bool inside = (insideY1 <= sy) && (sy + taps <= insideY2);
+        if (TAPS && inside) {
+            // fixed kernel: compute each destination value in a single pass over the rows
+            const float* rows[TAPS ? TAPS : 1];
+            for (int k = 0; k < TAPS; ++k) {
+                rows[k] = tmp + (sy + k - tmpY1) * tmpRowSize;
+            }
+            for (std::size_t j = 0; j < tmpRowSize; ++j) {
+                float a = 0.f;
+                for (int k = 0; k < TAPS; ++k) {
+                    a += w[k] * rows[k][j];
+                }
+                dstPix[j] = resizedValue<PIX>(a);
+            }
+
+            return;
+        }
+        for (int k = 0; k < taps; ++k) {
+            const int syk = inside ? (sy + k) : std::max( srcFormatY1, std::min(sy + k, srcFormatY2 - 1) );
+            if ( (syk < tmpY1) || (tmpY2 <= syk) ) {
+                continue;
+            }
+            const float wk = w[k];
+            const float* tmpPix = tmp + (syk - tmpY1) * tmpRowSize;
+            for (std::size_t j = 0; j < tmpRowSize; ++j) {
+                acc[j] += wk * tmpPix[j];
+            }
+        }
+    }
+    for (std::size_t j = 0; j < tmpRowSize; ++j) {
+        dstPix[j] = resizedValue<PIX>(acc[j]);
+    }
+} // resizeRowVertical
+
+// The source rows [*tmpY1,*tmpY2) needed by the destination rows [y1,y2), once clamped to the source format
+// [srcFormatY1,srcFormatY2) and to the source image [srcBoundsY1,srcBoundsY2).
+inline void
+getResizeSourceRows(const ResizeAxisWeights& yWeights,
+                    int y1,
+                    int y2,
+                    int srcFormatY1,
+                    int srcFormatY2,
+                    int srcBoundsY1,
+                    int srcBoundsY2,
+                    int* tmpY1,
+                    int* tmpY2)
+{
+    *tmpY1 = std::numeric_limits<int>::max();
+    *tmpY2 = std::numeric_limits<int>::min();
+    for (int y = y1; y < y2; ++y) {
+        const int i = y - yWeights.dstStart;
+        if ( (0 <= i) && ( i < (int)yWeights.srcStart.size() ) ) {
+            *tmpY1 = std::min( *tmpY1, std::max( srcFormatY1, std::min(yWeights.srcStart[i], srcFormatY2 - 1) ) );
+            *tmpY2 = std::max( *tmpY2, std::max( srcFormatY1, std::min(yWeights.srcStart[i] + yWeights.taps - 1, srcFormatY2 - 1) ) + 1 );
+        }
+    }
+    *tmpY1 = std::max(*tmpY1, srcBoundsY1);
+    *tmpY2 = std::max( *tmpY1, std::min(*tmpY2, srcBoundsY2) );
+}
+
+// Calls pass.run<TAPS>(). Integer reductions have the same weights for every pixel: TAPS is then their number of taps
+// for the common cases (box, triangle, blackman-harris and lanczos3 at 2x and 4x), so that the kernel is unrolled.
+// Otherwise, TAPS is zero.
+template <class PASS>
+inline void
+dispatchResizeTaps(const ResizeAxisWeights& weights,
+                   const PASS& pass)
+{
+    switch (weights.step ? weights.taps : 0) {
+    case 2:
+        pass.template run<2>();
+        break;
+    case 4:
+        pass.template run<4>();
+        break;
+    case 6:
+        pass.template run<6>();
+        break;
+    case 8:
+        pass.template run<8>();
+        break;
+    case 12:
+        pass.template run<12>();
+        break;
+    case 24:
+        pass.template run<24>();
+        break;
+    default:
+        pass.template run<0>();
+        break;
+    }
+}
+
+} // namespace IO
+} // namespace OFX
+
+#endif // ifndef IO_OIIOResizeSeparable_h
@@ -22,6 +22,9 @@
  */
 
 #include <cfloat> // DBL_MAX
+#include <list>
+#include <vector>
+#include <algorithm>
 
 #include "ofxsMacros.h"
 
@@ -45,6 +48,22 @@ GCC_DIAG_ON(unused-parameter)
 #include "ofxsThreadSuite.h"
 #include "ofxsCopier.h"
 #include "ofxsPositionInteract.h"
+#include "ofxsCoords.h"
+#include "ofxsMultiThread.h"
+#ifdef OFX_USE_MULTITHREAD_MUTEX
+namespace {
+typedef OFX::MultiThread::Mutex Mutex;
+typedef OFX::MultiThread::AutoMutex AutoMutex;
+}
+#else
+// some OFX hosts do not have mutex handling in the MT-Suite (e.g. Sony Catalyst Edit)
+// prefer using the fast mutex by Marcus Geelnard http://tinythreadpp.bitsnbites.eu/
+#include "fast_mutex.h"
+namespace {
+typedef tthread::fast_mutex Mutex;
+typedef OFX::MultiThread::AutoMutexT<tthread::fast_mutex> AutoMutex;
+}
+#endif
 
 #include "IOUtility.h"
 #include "ofxNatron.h"
@@ -61,15 +80,9 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 #define kPluginIdentifier "fr.inria.openfx.OIIOText"
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
-#ifdef DEBUG
 #define kSupportsTiles 1
-#pragma message WARN("TextOIIO: tiles support is buggy - enabled in DEBUG mode")
-#else
-#define kSupportsTiles 0
-#pragma message WARN("TextOIIO: tiles support is buggy - disabled in  RELEASE mode")
-#endif
 #define kSupportsMultiResolution 1
 #define kSupportsRenderScale 1
 #define kRenderThreadSafety eRenderFullySafe
@@ -111,6 +124,176 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 static bool gHostSupportsDefaultCoordinateSystem = true; // for kParamDefaultsNormalised
 
+#define kTextCoverageCacheSize 16 // number of rasterized texts kept by each instance
+
+// The coverage of a rasterized text, in OIIO coordinates (y down) relative to the start of the baseline.
+struct TextCoverage
+{
+    int x1, y1, x2, y2; // bounding box of the drawn pixels
+    std::vector<float> pixels; // (x2-x1)*(y2-y1) coverage values, top row first
+
+    TextCoverage()
+        : x1(0), y1(0), x2(0), y2(0)
+        , pixels()
+    {
+    }
+};
+
+// Rasterize the text in white over black: OIIO composites each glyph over the image using its
+// coverage, so the result is the coverage of the whole text.
+static bool
+rasterizeText(const string& text,
+              int fontSize,
+              const string& fontName,
+              TextCoverage* coverage,
+              string* error)
+{
+    OIIO::ROI box;
+#if OIIO_VERSION >= 10800
+    box = OIIO::ImageBufAlgo::text_size(text, fontSize, fontName);
+    if ( !box.defined() ) {
+        *error = "Cannot compute the size of the text";
+
+        return false;
+    }
+    // some glyphs (e.g. italics) may be drawn outside of the text box
+    const int margin = fontSize / 4 + 1;
+    box = OIIO::ROI(box.xbegin - margin, box.xend + margin, box.ybegin - margin, box.yend + margin);
+#else
+    // no text_size(): use a generous estimate, the box is cropped to the drawn pixels below
+    int lines = 1;
+    int lineLength = 0;
+    int maxLineLength = 0;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+            ++lines;
+            lineLength = 0;
+        } else {
+            maxLineLength = std::max(maxLineLength, ++lineLength);
+        }
+    }
+    box = OIIO::ROI(-fontSize, (maxLineLength + 1) * fontSize, -2 * fontSize, 2 * lines * fontSize);
+#endif
+    OIIO::ImageSpec spec(box.width(), box.height(), 1, OIIO::TypeDesc::FLOAT);
+    spec.x = spec.full_x = box.xbegin;
+    spec.y = spec.full_y = box.ybegin;
+    std::vector<float> pixels( (std::size_t)box.width() * box.height(), 0.f );
+    OIIO::ImageBuf buf("coverage", spec, &pixels[0]);
+    const float white[4] = { 1.f, 1.f, 1.f, 1.f };
+    if ( !OIIO::ImageBufAlgo::render_text(buf, 0, 0, text, fontSize, fontName, white) ) {
+        *error = buf.geterror();
+
+        return false;
+    }
+
+    // crop to the drawn pixels
+    int x1 = box.xend, y1 = box.yend, x2 = box.xbegin, y2 = box.ybegin;
+    for (int y = box.ybegin; y < box.yend; ++y) {
+        const float* row = &pixels[(std::size_t)(y - box.ybegin) * box.width()];
+        for (int x = box.xbegin; x < box.xend; ++x) {
+            if (row[x - box.xbegin] != 0.f) {
+                x1 = std::min(x1, x);
+                x2 = std::max(x2, x + 1);
+                y1 = std::min(y1, y);
+                y2 = std::max(y2, y + 1);
+            }
+        }
+    }
+    if ( (x2 <= x1) || (y2 <= y1) ) {
+        x1 = y1 = x2 = y2 = 0;
+    }
+    coverage->x1 = x1;
+    coverage->y1 = y1;
+    coverage->x2 = x2;
+    coverage->y2 = y2;
+    coverage->pixels.resize( (std::size_t)(x2 - x1) * (y2 - y1) );
+    for (int y = y1; y < y2; ++y) {
+        const float* row = &pixels[(std::size_t)(y - box.ybegin) * box.width() + (x1 - box.xbegin)];
+        std::copy( row, row + (x2 - x1), &coverage->pixels[(std::size_t)(y - y1) * (x2 - x1)] );
+    }
+
+    return true;
+} // rasterizeText
+
+// Keeps the most recently rasterized texts, so that rendering the same text again
+// (on each frame of a burn-in, or on each tile of a frame) does not run FreeType.
+// The font size is in pixels, so it also accounts for the render scale.
+class TextCoverageCache
+{
+public:
+    TextCoverageCache()
+        : _mutex()
+        , _entries()
+    {
+    }
+
+    bool get(const string& text,
+             int fontSize,
+             const string& fontName,
+             TextCoverage* coverage,
+             string* error)
+    {
+        {
+            AutoMutex lock(_mutex);
+            if ( find(text, fontSize, fontName, coverage) ) {
+                return true;
+            }
+        }
+
+        // OIIO may not be able to rasterize several texts at once (the FreeType library is shared)
+        AutoMutex lock(_mutex);
+        // another render may have rasterized the same text meanwhile: do not add it twice
+        if ( find(text, fontSize, fontName, coverage) ) {
+            return true;
+        }
+        if ( !rasterizeText(text, fontSize, fontName, coverage, error) ) {
+            return false;
+        }
+        _entries.push_front( Entry() );
+        Entry& e = _entries.front();
+        e.text = text;
+        e.fontSize = fontSize;
+        e.fontName = fontName;
+        e.coverage = *coverage;
+        while (_entries.size() > kTextCoverageCacheSize) {
+            _entries.pop_back();
+        }
+
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        string text;
+        int fontSize;
+        string fontName;
+        TextCoverage coverage;
+    };
+
+    // must be called with _mutex locked
+    bool find(const string& text,
+              int fontSize,
+              const string& fontName,
+              TextCoverage* coverage)
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if ( (it->fontSize == fontSize) && (it->text == text) && (it->fontName == fontName) ) {
+                *coverage = it->coverage;
+                // move it to the front
+                _entries.splice(_entries.begin(), _entries, it);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    Mutex _mutex;
+    std::list<Entry> _entries;
+};
+
 class OIIOTextPlugin
     : public ImageEffect
 {
@@ -149,12 +332,14 @@ private:
     IntParam *_fontSize;
     StringParam *_fontName;
     RGBAParam *_textColor;
+    TextCoverageCache _coverageCache;
 };
 
 OIIOTextPlugin::OIIOTextPlugin(OfxImageEffectHandle handle)
     : ImageEffect(handle)
     , _dstClip(NULL)
     , _srcClip(NULL)
+    , _coverageCache()
 {
     _dstClip = fetchClip(kOfxImageEffectOutputClipName);
     assert( _dstClip && (!_dstClip->isConnected() || _dstClip->getPixelComponents() == ePixelComponentRGBA ||
@@ -198,62 +383,6 @@ OIIOTextPlugin::~OIIOTextPlugin()
 {
 }
 
-static OIIO::ImageSpec
-imageSpecFromOFXImage(const OfxRectI &rod,
-                      const OfxRectI &bounds,
-                      PixelComponentEnum pixelComponents,
-                      BitDepthEnum bitDepth)
-{
-    OIIO::TypeDesc format;
-    switch (bitDepth) {
-    case eBitDepthUByte:
-        format = OIIO::TypeDesc::UINT8;
-        break;
-    case eBitDepthUShort:
-        format = OIIO::TypeDesc::UINT16;
-        break;
-    case eBitDepthHalf:
-        format = OIIO::TypeDesc::HALF;
-        break;
-    case eBitDepthFloat:
-        format = OIIO::TypeDesc::FLOAT;
-        break;
-    default:
-        throwSuiteStatusException(kOfxStatErrFormat);
-        break;
-    }
-    int nchannels = 0, alpha_channel = -1;
-    switch (pixelComponents) {
-    case ePixelComponentAlpha:
-        nchannels = 1;
-        alpha_channel = 0;
-        break;
-    case ePixelComponentRGB:
-        nchannels = 3;
-        break;
-    case ePixelComponentRGBA:
-        nchannels = 4;
-        alpha_channel = 3;
-        break;
-    default:
-        throwSuiteStatusException(kOfxStatErrFormat);
-        break;
-    }
-    OIIO::ImageSpec spec (format);
-    spec.x = bounds.x1;
-    spec.y = rod.y2 - bounds.y2;
-    spec.width = bounds.x2 - bounds.x1;
-    spec.height = bounds.y2 - bounds.y1;
-    spec.full_x = rod.x1;
-    spec.full_y = 0;
-    spec.full_width = rod.x2 - rod.x1;
-    spec.full_height = rod.y2 - rod.y1;
-    spec.nchannels = nchannels;
-    spec.alpha_channel = alpha_channel;
-
-    return spec;
-} // imageSpecFromOFXImage
-
 /* Override the render */
 void
 OIIOTextPlugin::render(const RenderArguments &args)
@@ -322,54 +451,30 @@ OIIOTextPlugin::render(const RenderArguments &args)
         //throw std::runtime_error("render window outside of image bounds");
     }
 
-    OfxRectI srcRod;
-    OfxRectI srcBounds;
-    PixelComponentEnum pixelComponents = ePixelComponentNone;
-    int pixelComponentCount = 0;
-    BitDepthEnum bitDepth = eBitDepthNone;
-    OIIO::ImageSpec srcSpec;
-    auto_ptr<const OIIO::ImageBuf> srcBuf;
-    OfxRectI dstRod = dstImg->getRegionOfDefinition();
     if ( !srcImg.get() ) {
         setPersistentMessage(Message::eMessageError, "", "Source needs to be connected");
         throwSuiteStatusException(kOfxStatFailed);
 
         return;
-    } else {
-        srcRod = srcImg->getRegionOfDefinition();
-        srcBounds = srcImg->getBounds();
-        pixelComponents = srcImg->getPixelComponents();
-        pixelComponentCount = srcImg->getPixelComponentCount();
-        bitDepth = srcImg->getPixelDepth();
-        srcSpec = imageSpecFromOFXImage(srcRod, srcBounds, pixelComponents, bitDepth);
-        srcBuf.reset( new OIIO::ImageBuf( "src", srcSpec, const_cast<void*>( srcImg->getPixelData() ) ) );
-
-        if (!kSupportsTiles) {
-            // http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#kOfxImageEffectPropSupportsTiles
-            //  If a clip or plugin does not support tiled images, then the host should supply full RoD images to the effect whenever it fetches one.
-            assert(srcRod.x1 == srcBounds.x1);
-            assert(srcRod.x2 == srcBounds.x2);
-            assert(srcRod.y1 == srcBounds.y1);
-            assert(srcRod.y2 == srcBounds.y2); // crashes on Natron if kSupportsTiles=0 & kSupportsMultiResolution=1
-            assert(dstRod.x1 == dstBounds.x1);
-            assert(dstRod.x2 == dstBounds.x2);
-            assert(dstRod.y1 == dstBounds.y1);
-            assert(dstRod.y2 == dstBounds.y2); // crashes on Natron if kSupportsTiles=0 & kSupportsMultiResolution=1
-        }
-        if (!kSupportsMultiResolution) {
-            // http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#kOfxImageEffectPropSupportsMultiResolution
-            //   Multiple resolution images mean...
-            //    input and output images can be of any size
-            //    input and output images can be offset from the origin
-            assert(srcRod.x1 == 0);
-            assert(srcRod.y1 == 0);
-            assert(srcRod.x1 == dstRod.x1);
-            assert(srcRod.x2 == dstRod.x2);
-            assert(srcRod.y1 == dstRod.y1);
-            assert(srcRod.y2 == dstRod.y2); // crashes on Natron if kSupportsMultiResolution=0
-        }
     }
 
+    // copy the source, the text is then composited over the pixels it covers
+    const void* srcPixelData;
+    OfxRectI srcBounds;
+    PixelComponentEnum srcPixelComponents;
+    BitDepthEnum srcBitDepth;
+    int srcRowBytes;
+    getImageData(srcImg.get(), &srcPixelData, &srcBounds, &srcPixelComponents, &srcBitDepth, &srcRowBytes);
+    int srcPixelComponentCount = srcImg->getPixelComponentCount();
+    void* dstPixelData;
+    PixelComponentEnum dstPixelComponents;
+    int dstRowBytes;
+    getImageData(dstImg.get(), &dstPixelData, &dstBounds, &dstPixelComponents, &dstBitDepth, &dstRowBytes);
+    int dstPixelComponentCount = dstImg->getPixelComponentCount();
+    copyPixels(*this, args.renderWindow,
+               srcPixelData, srcBounds, srcPixelComponents, srcPixelComponentCount, srcBitDepth, srcRowBytes,
+               dstPixelData, dstBounds, dstPixelComponents, dstPixelComponentCount, dstBitDepth, dstRowBytes);
+
     double x, y;
     _position->getValueAtTime(args.time, x, y);
     string text;
@@ -386,89 +491,46 @@ OIIOTextPlugin::render(const RenderArguments &args)
     textColor[2] = (float)b;
     textColor[3] = (float)a;
 
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(bitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
-    const bool flipit = true;
-    OIIO::ImageSpec tmpSpec = imageSpecFromOFXImage(srcImg.get() ? srcRod : args.renderWindow, args.renderWindow, pixelComponents, bitDepth);
-    assert(tmpSpec.width == args.renderWindow.x2 - args.renderWindow.x1);
-    assert(tmpSpec.width == args.renderWindow.x2 - args.renderWindow.x1);
-    assert(tmpSpec.height == args.renderWindow.y2 - args.renderWindow.y1);
-    OIIO::ROI srcRoi(tmpSpec.x, tmpSpec.x + tmpSpec.width, tmpSpec.y, tmpSpec.y + tmpSpec.height);
-    int ytext = int(y * args.renderScale.y);
-    if (flipit) {
-        // from the OIIO 1.5 release notes:
-        // Fixes, minor enhancements, and performance improvements:
-        // * ImageBufAlgo:
-        //   * flip(), flop(), flipflop() have been rewritten to work more
-        //     sensibly for cropped images. In particular, the transformation now
-        //     happens with respect to the display (full) window, rather than
-        //     simply flipping or flopping within the data window. (1.5.2)
-#if OIIO_VERSION >= 10502
-        // the transformation happens with respect to the display (full) window
-        tmpSpec.y = ( (tmpSpec.full_y + tmpSpec.full_height - 1) - tmpSpec.y ) - (tmpSpec.height - 1);
-        tmpSpec.full_y = 0;
-        ytext = (tmpSpec.full_y + tmpSpec.full_height - 1) - ytext;
-#else
-        // only the data window is flipped
-        ytext = tmpSpec.y + ( (tmpSpec.y + tmpSpec.height - 1) - ytext );
-#endif
+    const int pixelFontSize = int(fontSize * args.renderScale.y);
+    if ( text.empty() || (pixelFontSize <= 0) ) {
+        return;
     }
-    assert(tmpSpec.width == args.renderWindow.x2 - args.renderWindow.x1);
-    assert(tmpSpec.height == args.renderWindow.y2 - args.renderWindow.y1);
-    OIIO::ImageBuf tmpBuf("tmp", tmpSpec, tmpPixelData);
+    TextCoverage coverage;
+    string error;
+    if ( !_coverageCache.get(text, pixelFontSize, fontName, &coverage, &error) ) {
+        setPersistentMessage(Message::eMessageError, "", error);
+        //throwSuiteStatusException(kOfxStatFailed);
 
-    // do we have to flip the image?
-    if ( !srcImg.get() ) {
-        OIIO::ImageBufAlgo::zero(tmpBuf);
-    } else {
-        if (flipit) {
-            bool ok = OIIO::ImageBufAlgo::flip(tmpBuf, *srcBuf, srcRoi);
-            if (!ok) {
-                setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-                throwSuiteStatusException(kOfxStatFailed);
-            }
-        } else {
-            // copy the renderWindow from src to a temp buffer
-            tmpBuf.copy_pixels(*srcBuf);
-        }
+        return;
     }
 
-    // render text in the temp buffer
-    {
-        bool ok = OIIO::ImageBufAlgo::render_text(tmpBuf, int(x * args.renderScale.x), ytext, text, int(fontSize * args.renderScale.y), fontName, textColor);
-        if (!ok) {
-            setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-            //throwSuiteStatusException(kOfxStatFailed);
-        }
+    // the coverage is y-down from the baseline: pixel (cx,cy) of the coverage is pixel (xtext+cx, ytext-cy) of the image
+    const int xtext = int(x * args.renderScale.x);
+    const int ytext = int(y * args.renderScale.y);
+    OfxRectI textRect;
+    textRect.x1 = xtext + coverage.x1;
+    textRect.x2 = xtext + coverage.x2;
+    textRect.y1 = ytext - coverage.y2 + 1;
+    textRect.y2 = ytext - coverage.y1 + 1;
+    OfxRectI window;
+    if ( !Coords::rectIntersection(args.renderWindow, textRect, &window) ) {
+        return;
     }
-    OIIO::ImageSpec dstSpec = imageSpecFromOFXImage(dstRod, dstBounds, pixelComponents, bitDepth);
-    OIIO::ImageBuf dstBuf( "dst", dstSpec, dstImg->getPixelData() );
-
-    OIIO::ROI tmpRoi(tmpSpec.x, tmpSpec.x + tmpSpec.width, tmpSpec.y, tmpSpec.y + tmpSpec.height);
-    // do we have to flip the image?
-    if (flipit) {
-        bool ok = OIIO::ImageBufAlgo::flip(dstBuf, tmpBuf, tmpRoi);
-        if (!ok) {
-            setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-            throwSuiteStatusException(kOfxStatFailed);
-        }
-    } else {
-        // copy the temp buffer to dstImg
-        //dstBuf.copy_pixels(tmpBuf); // erases everything out of tmpBuf!
-        bool ok = OIIO::ImageBufAlgo::paste(dstBuf, args.renderWindow.x1, srcRod.y2 - args.renderWindow.y2, 0, 0, tmpBuf, tmpRoi);
-        if (!ok) {
-            setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-            throwSuiteStatusException(kOfxStatFailed);
+    const int coverageWidth = coverage.x2 - coverage.x1;
+    for (int dy = window.y1; dy < window.y2; ++dy) {
+        const float* cov = &coverage.pixels[(std::size_t)(ytext - dy - coverage.y1) * coverageWidth + (window.x1 - textRect.x1)];
+        float* dstPix = (float*)dstImg->getPixelAddress(window.x1, dy);
+        assert(dstPix);
+        for (int dx = window.x1; dx < window.x2; ++dx, ++cov, dstPix += dstPixelComponentCount) {
+            const float c = *cov;
+            if (c != 0.f) {
+                // same as render_text: the text color over the image, using the coverage as alpha
+                for (int i = 0; i < dstPixelComponentCount; ++i) {
+                    dstPix[i] = textColor[i] * c + dstPix[i] * (1.f - c);
+                }
+            }
         }
     }
-
-    // TODO: answer questions:
-    // - can we support tiling?
-    // - can we support multiresolution by just scaling the coordinates and the font size?
 } // OIIOTextPlugin::render
 
 bool
@@ -567,7 +629,7 @@ OIIOTextPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
-    desc.setSupportsTiles(kSupportsTiles); // may be switched to true later?
+    desc.setSupportsTiles(kSupportsTiles); // the text is composited over each tile
     desc.setSupportsMultiResolution(kSupportsMultiResolution); // may be switch to true later? don't forget to reduce font size too
     desc.setRenderThreadSafety(kRenderThreadSafety);
 
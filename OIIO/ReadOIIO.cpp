@@ -2917,6 +2917,7 @@ ReadOIIOPluginFactory::load()
 void
 ReadOIIOPluginFactory::unload()
 {
+    shutdownOCIOPrewarm();
     _extensions.clear();
 
 #  ifdef OFX_READ_OIIO_SHARED_CACHE
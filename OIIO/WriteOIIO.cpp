@@ -22,19 +22,29 @@
  */
 
 #include <cfloat> // DBL_MAX
+#include <cstddef> // ptrdiff_t
+#include <algorithm>
+#include <stdexcept>
 
 #include "ofxsMacros.h"
 
 #include "OIIOGlobal.h"
 GCC_DIAG_OFF(unused-parameter)
 #include <OpenImageIO/filesystem.h>
+// see the comment about OPENIMAGEIO_THREAD_H in OIIOResize.cpp
+#define OPENIMAGEIO_THREAD_H
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imagebufalgo.h>
+#include <OpenImageIO/filter.h>
 GCC_DIAG_ON(unused-parameter)
 
 #include "GenericOCIO.h"
 #include "GenericWriter.h"
+#include "WriteOIIOStrips.h"
 
 #include <ofxsMultiPlane.h>
 #include <ofxsCoords.h>
+#include "ofxsMultiThread.h"
 
 #ifdef _WIN32
 #include <IlmThreadPool.h>
@@ -203,6 +213,15 @@ enum EParamCompression
     eParamCompressionPACKBITS
 };
 
+#define kWriteOIIOStripHeight 64 // minimum number of scanlines interleaved and written at once by encodePartPlanes()
+#define kWriteOIIOBlocksPerThread 2 // number of compression blocks given to each thread by a single write call
+
+#define kParamThreads "compressionThreads"
+#define kParamThreadsLabel "Compression Threads"
+#define kParamThreadsHint "Number of threads used to compress TIFF files. " \
+    "The image is written by batches holding several blocks per thread, so that they can be compressed concurrently. " \
+    "0 means one thread per core."
+
 #define kParamTileSize "tileSize"
 #define kParamTileSizeLabel "Tile Size"
 #define kParamTileSizeHint "Size of a tile in the output file for formats that support tiles. If scan-line based, the whole image will have a single tile."
@@ -212,6 +231,19 @@ enum EParamCompression
 #define kParamTileSizeOption256 "256", "", "256"
 #define kParamTileSizeOption512 "512", "", "512"
 
+#define kParamMipMap "mipmap"
+#define kParamMipMapLabel "MIP-Map"
+#define kParamMipMapHint "When checked, the file is written as a tiled, MIP-mapped texture, as maketx would do (TIFF and EXR only). " \
+    "Each MIP level is half the size of the previous one, and is computed from it in memory using the MIP-Map Filter. " \
+    "If the Tile Size is Scan-Line Based, 64x64 tiles are used."
+
+#define kParamMipMapFilter "mipmapFilter"
+#define kParamMipMapFilterLabel "MIP-Map Filter"
+#define kParamMipMapFilterHint "The filter used to compute each MIP level from the previous one."
+#define kParamMipMapFilterDefault "box"
+
+#define kWriteOIIOMipMapTileSize 64 // tile size of MIP-mapped files written with Scan-Line Based tiles
+
 enum EParamTileSize
 {
     eParamTileSizeScanLineBased = 0,
@@ -292,44 +324,49 @@ private:
                         const int dstNComps,
                         const int rowBytes) OVERRIDE FINAL
     {
-        string rawComps(kFnOfxImagePlaneColour);
-
-        switch (dstNComps) {
-        case 1:
-            rawComps = kOfxImageComponentAlpha;
-            break;
-        case 3:
-            rawComps = kOfxImageComponentRGB;
-            break;
-        case 4:
-            rawComps = kOfxImageComponentRGBA;
-            break;
-        case 2:
-            rawComps = kFnOfxImageComponentMotionVectors;
-            break;
-        default:
-            throwSuiteStatusException(kOfxStatFailed);
+        EncodePlanesLocalData_RAII data(this);
 
+        if ( !prepareEncode(data.getData(), filename, time, viewName, bounds, pixelAspectRatio, pixelDataNComps, pixelDataNCompsStartIndex, dstNComps) ) {
             return;
         }
-
-        std::list<string> comps;
-        comps.push_back(rawComps);
-        EncodePlanesLocalData_RAII data(this);
-        map<int, string> viewsToRender;
-        viewsToRender[0] = viewName;
-
-        vector<int> packingMapping(dstNComps);
-        for (int i = 0; i < dstNComps; ++i) {
-            packingMapping[i] = pixelDataNCompsStartIndex + i;
+        try {
+            encodePrepared(data.getData(), pixelData, rowBytes);
+        } catch (const std::exception& e) {
+            setPersistentMessage( Message::eMessageError, "", e.what() );
+            throwSuiteStatusException(kOfxStatFailed);
         }
-
-        beginEncodeParts(data.getData(), filename, time, pixelAspectRatio, eLayerViewsSinglePart, viewsToRender, comps, false, packingMapping, bounds);
-        encodePart(data.getData(), filename, pixelData, pixelDataNComps, 0, rowBytes);
-        endEncodeParts( data.getData() );
     }
 
+    virtual bool prepareEncode(void* user_data,
+                               const string& filename,
+                               OfxTime time,
+                               const string& viewName,
+                               const OfxRectI& bounds,
+                               float pixelAspectRatio,
+                               int pixelDataNComps,
+                               int dstNCompsStartIndex,
+                               int dstNComps) OVERRIDE FINAL;
+    virtual void encodePrepared(void* user_data, const float* pixelData, int rowBytes) OVERRIDE FINAL;
+
     virtual void encodePart(void* user_data, const string& filename, const float *pixelData, int pixelDataNComps, int planeIndex, int rowBytes) OVERRIDE FINAL;
+    virtual void encodePartPlanes(void* user_data,
+                                  const string& filename,
+                                  const vector<EncodePartPlane>& planes,
+                                  const OfxRectI& bounds,
+                                  int partIndex) OVERRIDE FINAL;
+    // MIP levels are computed from the whole image
+    virtual bool supportsEncodeStrips(const string& /*filename*/) const OVERRIDE FINAL { return !_mipmap->getValue(); }
+    virtual int beginEncodeStrips(void* user_data,
+                                  const string& filename,
+                                  OfxTime time,
+                                  const string& viewName,
+                                  const OfxRectI& bounds,
+                                  float pixelAspectRatio,
+                                  int pixelDataNComps,
+                                  int dstNCompsStartIndex,
+                                  int dstNComps) OVERRIDE FINAL;
+    virtual void encodeStrip(void* user_data, const float *pixelData, const OfxRectI& stripBounds, int rowBytes) OVERRIDE FINAL;
+    virtual void endEncodeStrips(void* user_data) OVERRIDE FINAL;
     virtual void beginEncodeParts(void* user_data,
                                   const string& filename,
                                   OfxTime time,
@@ -341,17 +378,34 @@ private:
                                   const vector<int>& packingMapping,
                                   const OfxRectI& bounds) OVERRIDE FINAL;
 
+    // beginEncodeParts() without opening the file: only reads the parameters, and fills user_data
+    void prepareEncodeParts(void* user_data,
+                            const string& filename,
+                            OfxTime time,
+                            float pixelAspectRatio,
+                            LayerViewsPartsEnum partsSplitting,
+                            const map<int, string>& viewsToRender,
+                            const std::list<string>& planes,
+                            const bool packingRequired,
+                            const vector<int>& packingMapping,
+                            const OfxRectI& bounds);
+
     void endEncodeParts(void* user_data) OVERRIDE FINAL;
 
     virtual void* allocateEncodePlanesUserData() OVERRIDE FINAL;
     virtual void destroyEncodePlanesUserData(void* data) OVERRIDE FINAL;
     virtual bool isImageFile(const string& fileExtension) const OVERRIDE FINAL;
+    virtual void appendEncodeSettings(double time, stringstream& settings) const OVERRIDE FINAL;
     virtual PreMultiplicationEnum getExpectedInputPremultiplication() const OVERRIDE FINAL { return eImagePreMultiplied; }
 
     virtual bool displayWindowSupportedByFormat(const string& filename) const OVERRIDE FINAL;
 
     void refreshParamsVisibility(const string& filename);
 
+    // encodePart() and encodeMIPLevels() may be called from a write-behind thread: they throw std::exception on errors
+    void writePart(void* user_data, const string& filename, const float *pixelData, int pixelDataNComps, int planeIndex, int rowBytes);
+    void encodeMIPLevels(void* user_data, const string& filename, const float *pixelData, int pixelDataNComps, int planeIndex, int rowBytes);
+
     void refreshCheckboxesLabels();
 
 private:
@@ -361,6 +415,9 @@ private:
     ChoiceParam* _orientation;
     ChoiceParam* _compression;
     ChoiceParam* _tileSize;
+    IntParam* _threads;
+    BooleanParam* _mipmap;
+    ChoiceParam* _mipmapFilter;
     ChoiceParam* _outputLayers;
     ChoiceParam* _parts;
     ChoiceParam* _views;
@@ -377,6 +434,9 @@ WriteOIIOPlugin::WriteOIIOPlugin(OfxImageEffectHandle handle,
     , _orientation(NULL)
     , _compression(NULL)
     , _tileSize(NULL)
+    , _threads(NULL)
+    , _mipmap(NULL)
+    , _mipmapFilter(NULL)
     , _outputLayers(NULL)
     , _parts(NULL)
     , _views(NULL)
@@ -390,6 +450,9 @@ WriteOIIOPlugin::WriteOIIOPlugin(OfxImageEffectHandle handle,
     _orientation = fetchChoiceParam(kParamOutputOrientation);
     _compression = fetchChoiceParam(kParamOutputCompression);
     _tileSize = fetchChoiceParam(kParamTileSize);
+    _threads = fetchIntParam(kParamThreads);
+    _mipmap = fetchBooleanParam(kParamMipMap);
+    _mipmapFilter = fetchChoiceParam(kParamMipMapFilter);
     if (gIsMultiplanarV2) {
         _outputLayers = fetchChoiceParam(kParamOutputChannels);
 
@@ -490,7 +553,7 @@ WriteOIIOPlugin::changedParam(const InstanceChangedArgs &args,
         }
         string msg = oiio_versions() + "\nAll supported formats and extensions: " + extensions_pretty;
         sendMessage(Message::eMessageMessage, "", msg);
-    } else if ( (paramName == kParamOutputCompression) && (args.reason == eChangeUserEdit) ) {
+    } else if ( ( (paramName == kParamOutputCompression) || (paramName == kParamMipMap) ) && (args.reason == eChangeUserEdit) ) {
         string filename;
         _fileParam->getValue(filename);
         refreshParamsVisibility(filename);
@@ -781,6 +844,15 @@ WriteOIIOPlugin::refreshParamsVisibility(const string& filename)
     auto_ptr<ImageOutput> output( ImageOutput::create(filename) );
     if ( output.get() ) {
         _tileSize->setIsSecretAndDisabled( !output->supports("tiles") );
+#if OIIO_VERSION >= 10800
+        // OpenEXR compresses on its global thread pool, which uses all cores (see initOIIOThreads())
+        _threads->setIsSecretAndDisabled(strcmp(output->format_name(), "tiff") != 0);
+#else
+        // ImageOutput::threads() is not available
+        _threads->setIsSecretAndDisabled(true);
+#endif
+        _mipmap->setIsSecretAndDisabled( !output->supports("mipmap") );
+        _mipmapFilter->setIsSecretAndDisabled( !output->supports("mipmap") || !_mipmap->getValue() );
         //_outputLayers->setIsSecretAndDisabled(!output->supports("nchannels"));
         bool hasQuality = (strcmp(output->format_name(), "jpeg") == 0 ||
                            strcmp(output->format_name(), "webp") == 0);
@@ -807,6 +879,9 @@ WriteOIIOPlugin::refreshParamsVisibility(const string& filename)
         }
     } else {
         _tileSize->setIsSecretAndDisabled(true);
+        _threads->setIsSecretAndDisabled(true);
+        _mipmap->setIsSecretAndDisabled(true);
+        _mipmapFilter->setIsSecretAndDisabled(true);
         //_outputLayers->setIsSecretAndDisabled(true);
         _quality->setIsSecretAndDisabled(true);
         _dwaCompressionLevel->setIsSecretAndDisabled(true);
@@ -823,6 +898,12 @@ struct WriteOIIOEncodePlanesData
 {
     auto_ptr<ImageOutput> output;
     vector<ImageSpec> specs;
+    int nThreads; // compression threads
+    int mipmapFilter; // index of the Filter2D used to compute the MIP levels, or -1 if there are none
+    OfxRectI stripsBounds; // when writing by strips
+    int stripsPixelDataNComps;
+    string filename; // set by prepareEncode()
+    int pixelDataNComps; // set by prepareEncode()
 };
 
 void*
@@ -852,6 +933,30 @@ WriteOIIOPlugin::beginEncodeParts(void* user_data,
                                   const bool packingRequired,
                                   const vector<int>& packingMapping,
                                   const OfxRectI& bounds)
+{
+    prepareEncodeParts(user_data, filename, time, pixelAspectRatio, partsSplitting, viewsToRender, planes, packingRequired, packingMapping, bounds);
+
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    if ( !data->output->open( filename, data->specs.size(), &data->specs.front() ) ) {
+        setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+}
+
+void
+WriteOIIOPlugin::prepareEncodeParts(void* user_data,
+                                    const string& filename,
+                                    OfxTime time,
+                                    float pixelAspectRatio,
+                                    LayerViewsPartsEnum partsSplitting,
+                                    const map<int, string>& viewsToRender,
+                                    const std::list<string>& planes,
+                                    const bool packingRequired,
+                                    const vector<int>& packingMapping,
+                                    const OfxRectI& bounds)
 {
     assert( (packingRequired && planes.size() == 1) || !packingRequired );
 
@@ -1083,6 +1188,7 @@ WriteOIIOPlugin::beginEncodeParts(void* user_data,
         spec.attribute("PixelAspectRatio", pixelAspectRatio);
     }
 
+    data->mipmapFilter = -1;
     if ( data->output->supports("tiles") ) {
         spec.x = bounds.x1;
         spec.y = bounds.y1;
@@ -1132,6 +1238,17 @@ WriteOIIOPlugin::beginEncodeParts(void* user_data,
         default:
             break;
         }
+
+        if ( _mipmap->getValueAtTime(time) && data->output->supports("mipmap") ) {
+            // MIP-mapped files must be tiled
+            if (spec.tile_width == 0) {
+                spec.tile_width = std::min(kWriteOIIOMipMapTileSize, spec.full_width);
+                spec.tile_height = std::min(kWriteOIIOMipMapTileSize, spec.full_height);
+            }
+            // the TIFF and EXR writers expect MIP levels for textures
+            spec.attribute("textureformat", "Plain Texture");
+            data->mipmapFilter = _mipmapFilter->getValueAtTime(time);
+        }
     }
 
 
@@ -1326,13 +1443,134 @@ WriteOIIOPlugin::beginEncodeParts(void* user_data,
     } // switch
 
 
-    if ( !data->output->open( filename, data->specs.size(), &data->specs.front() ) ) {
-        setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
+    // the parameter only applies to TIFF: OpenEXR compresses on its global thread pool, which uses all cores
+    // (see initOIIOThreads())
+    data->nThreads = 0;
+#if OIIO_VERSION >= 10800
+    if (strcmp(data->output->format_name(), "tiff") == 0) {
+        data->nThreads = _threads->getValue();
+    }
+#endif
+    if (data->nThreads <= 0) {
+        data->nThreads = (int)MultiThread::getNumCPUs();
+    }
+#if OIIO_VERSION >= 10800
+    data->output->threads(data->nThreads);
+#endif
+} // WriteOIIOPlugin::prepareEncodeParts
+
+bool
+WriteOIIOPlugin::prepareEncode(void* user_data,
+                               const string& filename,
+                               OfxTime time,
+                               const string& viewName,
+                               const OfxRectI& bounds,
+                               float pixelAspectRatio,
+                               int pixelDataNComps,
+                               int dstNCompsStartIndex,
+                               int dstNComps)
+{
+    string rawComps(kFnOfxImagePlaneColour);
+
+    switch (dstNComps) {
+    case 1:
+        rawComps = kOfxImageComponentAlpha;
+        break;
+    case 3:
+        rawComps = kOfxImageComponentRGB;
+        break;
+    case 4:
+        rawComps = kOfxImageComponentRGBA;
+        break;
+    case 2:
+        rawComps = kFnOfxImageComponentMotionVectors;
+        break;
+    default:
         throwSuiteStatusException(kOfxStatFailed);
 
-        return;
+        return false;
+    }
+
+    std::list<string> comps;
+    comps.push_back(rawComps);
+    map<int, string> viewsToRender;
+    viewsToRender[0] = viewName;
+
+    vector<int> packingMapping(dstNComps);
+    for (int i = 0; i < dstNComps; ++i) {
+        packingMapping[i] = dstNCompsStartIndex + i;
     }
-} // WriteOIIOPlugin::beginEncodeParts
+
+    prepareEncodeParts(user_data, filename, time, pixelAspectRatio, eLayerViewsSinglePart, viewsToRender, comps, false, packingMapping, bounds);
+
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    data->filename = filename;
+    data->pixelDataNComps = pixelDataNComps;
+
+    return true;
+}
+
+void
+WriteOIIOPlugin::encodePrepared(void* user_data,
+                                const float* pixelData,
+                                int rowBytes)
+{
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    if ( !data->output->open( data->filename, data->specs.size(), &data->specs.front() ) ) {
+        throw std::runtime_error( data->output->geterror() );
+    }
+    writePart(user_data, data->filename, pixelData, data->pixelDataNComps, 0, rowBytes);
+    data->output->close();
+}
+
+// Number of scan-lines that the format compresses together, independently from the others
+static int
+getCompressionBlockHeight(ImageOutput* output,
+                          const ImageSpec& spec)
+{
+    if (spec.tile_width > 0) {
+        return spec.tile_height;
+    }
+    if (strcmp(output->format_name(), "openexr") == 0) {
+        string compression = spec.get_string_attribute("compression", "zip");
+        if ( (compression == "zip") || (compression == "pxr24") ) {
+            return 16;
+        } else if ( (compression == "piz") || (compression == "b44") || (compression == "b44a") || (compression.compare(0, 4, "dwaa") == 0) ) {
+            return 32;
+        } else if (compression.compare(0, 4, "dwab") == 0) {
+            return 256;
+        }
+
+        return 1; // none, rle, zips
+    }
+    if (strcmp(output->format_name(), "tiff") == 0) {
+        return std::max(1, spec.get_int_attribute("tiff:RowsPerStrip", 32) );
+    }
+
+    return 1;
+}
+
+// Number of rows given to each write call: enough blocks for all compression threads
+static int
+getWriteBatchHeight(ImageOutput* output,
+                    const ImageSpec& spec,
+                    int nThreads)
+{
+    const int blockHeight = getCompressionBlockHeight(output, spec);
+    int nBlockRows = std::max(1, nThreads * kWriteOIIOBlocksPerThread);
+
+    if (spec.tile_width > 0) {
+        // each row of tiles already holds several blocks
+        const int tilesPerRow = (spec.width + spec.tile_width - 1) / spec.tile_width;
+        nBlockRows = (nBlockRows + tilesPerRow - 1) / tilesPerRow;
+    } else {
+        nBlockRows = std::max(nBlockRows, (kWriteOIIOStripHeight + blockHeight - 1) / blockHeight);
+    }
+
+    return std::min(spec.height, nBlockRows * blockHeight);
+}
 
 void
 WriteOIIOPlugin::encodePart(void* user_data,
@@ -1341,11 +1579,165 @@ WriteOIIOPlugin::encodePart(void* user_data,
                             int pixelDataNComps,
                             int planeIndex,
                             int rowBytes)
+{
+    try {
+        writePart(user_data, filename, pixelData, pixelDataNComps, planeIndex, rowBytes);
+    } catch (const std::exception& e) {
+        setPersistentMessage( Message::eMessageError, "", e.what() );
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+}
+
+void
+WriteOIIOPlugin::writePart(void* user_data,
+                           const string& filename,
+                           const float *pixelData,
+                           int pixelDataNComps,
+                           int planeIndex,
+                           int rowBytes)
 {
     assert(user_data);
     WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
     if (planeIndex != 0) {
         if ( !data->output->open(filename, data->specs[planeIndex], ImageOutput::AppendSubimage) ) {
+            throw std::runtime_error( data->output->geterror() );
+        }
+    }
+
+    const ImageSpec& spec = data->specs[planeIndex];
+    //do not use auto-stride as the buffer may have more components that what we want to write
+    std::size_t xStride = sizeof(float) * pixelDataNComps;
+    // write by batches of blocks, which the format may compress concurrently
+    const int batchHeight = getWriteBatchHeight(data->output.get(), spec, data->nThreads);
+
+    for (int s0 = 0; s0 < spec.height; s0 += batchHeight) {
+        const int s1 = std::min(spec.height, s0 + batchHeight);
+        const char* topRow = (const char*)pixelData + (std::ptrdiff_t)(spec.height - 1 - s0) * rowBytes; //invert y
+        if ( !writeRows(data->output.get(), spec, s0, s1, topRow, xStride, -rowBytes) ) {
+            throw std::runtime_error( data->output->geterror() );
+        }
+    }
+
+    if (data->mipmapFilter >= 0) {
+        encodeMIPLevels(user_data, filename, pixelData, pixelDataNComps, planeIndex, rowBytes);
+    }
+}
+
+// the coordinate of a MIP level origin, from the one of the previous level (rounded down, as the level size)
+static inline int
+halveMIPCoordinate(int x)
+{
+    return (x >= 0) ? (x / 2) : -( (1 - x) / 2 );
+}
+
+/*
+ * Computes and writes the MIP levels of a part after its first level, as maketx does.
+ * Each level is resized from the previous one in memory, using the compression threads.
+ * The levels are kept from bottom to top, as OFX images (the filter is symmetric, so this gives the same result),
+ * and the first level is read in place unless it holds other channels.
+ */
+void
+WriteOIIOPlugin::encodeMIPLevels(void* user_data,
+                                 const string& filename,
+                                 const float *pixelData,
+                                 int pixelDataNComps,
+                                 int planeIndex,
+                                 int rowBytes)
+{
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    const ImageSpec& spec = data->specs[planeIndex];
+    const int nChannels = spec.nchannels;
+    FilterDesc fd;
+    Filter2D::get_filterdesc(data->mipmapFilter, &fd);
+    // the filter width is in destination pixels
+    auto_ptr<Filter2D> filter( Filter2D::create(fd.name, fd.width, fd.width) );
+
+    const float* srcPixels = pixelData;
+    vector<float> srcLevel;
+    const std::size_t packedRowSize = (std::size_t)spec.width * nChannels;
+    if ( (pixelDataNComps != nChannels) || ( (std::size_t)rowBytes != packedRowSize * sizeof(float) ) ) {
+        // the first level must be packed
+        srcLevel.resize(packedRowSize * spec.height);
+        for (int y = 0; y < spec.height; ++y) {
+            const float* srcPix = (const float*)( (const char*)pixelData + (std::ptrdiff_t)y * rowBytes );
+            float* dstPix = &srcLevel[(std::size_t)y * packedRowSize];
+            for (int x = 0; x < spec.width; ++x, srcPix += pixelDataNComps, dstPix += nChannels) {
+                for (int c = 0; c < nChannels; ++c) {
+                    dstPix[c] = srcPix[c];
+                }
+            }
+        }
+        srcPixels = &srcLevel.front();
+    }
+
+    ImageSpec srcSpec(spec.width, spec.height, nChannels, TypeDesc::FLOAT);
+    ImageSpec levelSpec = spec; // keeps the tile size
+    vector<float> dstLevel;
+    while ( (levelSpec.width > 1) || (levelSpec.height > 1) ) {
+        // the data and display windows are both scaled, so that their relative position is kept
+        levelSpec.x = halveMIPCoordinate(levelSpec.x);
+        levelSpec.y = halveMIPCoordinate(levelSpec.y);
+        levelSpec.width = std::max(1, levelSpec.width / 2);
+        levelSpec.height = std::max(1, levelSpec.height / 2);
+        levelSpec.full_x = halveMIPCoordinate(levelSpec.full_x);
+        levelSpec.full_y = halveMIPCoordinate(levelSpec.full_y);
+        levelSpec.full_width = std::max(1, levelSpec.full_width / 2);
+        levelSpec.full_height = std::max(1, levelSpec.full_height / 2);
+        ImageSpec dstSpec(levelSpec.width, levelSpec.height, nChannels, TypeDesc::FLOAT);
+        dstLevel.resize( (std::size_t)levelSpec.width * levelSpec.height * nChannels );
+
+        // the source is only read
+        const ImageBuf srcBuf( "src", srcSpec, const_cast<float*>(srcPixels) );
+        ImageBuf dstBuf( "dst", dstSpec, &dstLevel.front() );
+        if ( !ImageBufAlgo::resize( dstBuf, srcBuf, filter.get(), ROI::All(), data->nThreads ) ) {
+            throw std::runtime_error( dstBuf.geterror() );
+        }
+        // OIIO scan-lines go from top to bottom
+        const stride_t levelRowBytes = (stride_t)levelSpec.width * nChannels * sizeof(float);
+        const char* topRow = (const char*)&dstLevel.front() + (std::ptrdiff_t)(levelSpec.height - 1) * levelRowBytes;
+        if ( !data->output->open(filename, levelSpec, ImageOutput::AppendMIPLevel) ||
+             !writeRows(data->output.get(), levelSpec, 0, levelSpec.height, topRow, nChannels * sizeof(float), -levelRowBytes) ) {
+            throw std::runtime_error( data->output->geterror() );
+        }
+        srcLevel.swap(dstLevel);
+        srcPixels = &srcLevel.front();
+        srcSpec = dstSpec;
+    }
+} // WriteOIIOPlugin::encodeMIPLevels
+
+/*
+ * The planes are interleaved and written by batches of rows (see getWriteBatchHeight()), so that
+ * they never have to be interleaved into a full-frame buffer.
+ */
+void
+WriteOIIOPlugin::encodePartPlanes(void* user_data,
+                                  const string& filename,
+                                  const vector<EncodePartPlane>& planes,
+                                  const OfxRectI& bounds,
+                                  int partIndex)
+{
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    const ImageSpec& spec = data->specs[partIndex];
+
+    if ( (planes.size() == 1) &&
+         ( planes[0].bounds.x1 == bounds.x1) && ( planes[0].bounds.x2 == bounds.x2) &&
+         ( planes[0].bounds.y1 == bounds.y1) && ( planes[0].bounds.y2 == bounds.y2) ) {
+        // a single plane can be read directly from the source buffer
+        encodePart(user_data, filename, planes[0].pixelData + planes[0].srcNCompsStartIndex, planes[0].pixelDataNComps, partIndex, planes[0].rowBytes);
+
+        return;
+    }
+    if (data->mipmapFilter >= 0) {
+        // the MIP levels are computed from the whole interleaved image
+        GenericWriterPlugin::encodePartPlanes(user_data, filename, planes, bounds, partIndex);
+
+        return;
+    }
+
+    if (partIndex != 0) {
+        if ( !data->output->open(filename, spec, ImageOutput::AppendSubimage) ) {
             setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
             throwSuiteStatusException(kOfxStatFailed);
 
@@ -1353,16 +1745,128 @@ WriteOIIOPlugin::encodePart(void* user_data,
         }
     }
 
-    TypeDesc format = TypeDesc::FLOAT;
+    int nChannels = 0;
+    for (vector<EncodePartPlane>::const_iterator it = planes.begin(); it != planes.end(); ++it) {
+        nChannels += it->nComps;
+    }
+    assert(nChannels == spec.nchannels);
+    const int width = bounds.x2 - bounds.x1;
+    const int height = bounds.y2 - bounds.y1;
+    const int stripHeight = std::max( 1, getWriteBatchHeight(data->output.get(), spec, data->nThreads) );
+    vector<float> strip( (size_t)width * nChannels * stripHeight );
+
+    // OIIO scan-lines go from top to bottom
+    for (int s0 = 0; s0 < height; s0 += stripHeight) {
+        const int s1 = std::min(height, s0 + stripHeight);
+        std::fill(strip.begin(), strip.end(), 0.f); // the planes may not cover the whole part
+
+        int channelOffset = 0;
+        for (vector<EncodePartPlane>::const_iterator it = planes.begin(); it != planes.end(); ++it) {
+            const int x1 = std::max(bounds.x1, it->bounds.x1);
+            const int x2 = std::min(bounds.x2, it->bounds.x2);
+            for (int s = s0; s < s1 && x1 < x2; ++s) {
+                const int y = bounds.y2 - 1 - s;
+                if ( (y < it->bounds.y1) || (y >= it->bounds.y2) ) {
+                    continue;
+                }
+                const float* srcPix = (const float*)( (const char*)it->pixelData + (std::ptrdiff_t)(y - it->bounds.y1) * it->rowBytes ) +
+                                      (x1 - it->bounds.x1) * it->pixelDataNComps + it->srcNCompsStartIndex;
+                float* dstPix = &strip[( (size_t)(s - s0) * width + (x1 - bounds.x1) ) * nChannels + channelOffset];
+                for (int x = x1; x < x2; ++x, srcPix += it->pixelDataNComps, dstPix += nChannels) {
+                    for (int c = 0; c < it->nComps; ++c) {
+                        dstPix[c] = srcPix[c];
+                    }
+                }
+            }
+            channelOffset += it->nComps;
+        }
+
+        if ( !writeRows(data->output.get(), spec, s0, s1, &strip.front(), AutoStride, AutoStride) ) {
+            setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
+            throwSuiteStatusException(kOfxStatFailed);
 
-    //do not use auto-stride as the buffer may have more components that what we want to write
-    std::size_t xStride = format.size() * pixelDataNComps;
-    data->output->write_image(format,
-                              (char*)pixelData + (data->specs[planeIndex].height - 1) * rowBytes, //invert y
-                              xStride, //xstride
-                              -rowBytes, //ystride
-                              AutoStride //zstride
-                              );
+            return;
+        }
+    }
+} // WriteOIIOPlugin::encodePartPlanes
+
+/*
+ * Writing by strips: each strip is a batch of rows, as given by getWriteBatchHeight().
+ */
+int
+WriteOIIOPlugin::beginEncodeStrips(void* user_data,
+                                   const string& filename,
+                                   OfxTime time,
+                                   const string& viewName,
+                                   const OfxRectI& bounds,
+                                   float pixelAspectRatio,
+                                   int pixelDataNComps,
+                                   int dstNCompsStartIndex,
+                                   int dstNComps)
+{
+    string rawComps;
+
+    switch (dstNComps) {
+    case 1:
+        rawComps = kOfxImageComponentAlpha;
+        break;
+    case 3:
+        rawComps = kOfxImageComponentRGB;
+        break;
+    case 4:
+        rawComps = kOfxImageComponentRGBA;
+        break;
+    case 2:
+        rawComps = kFnOfxImageComponentMotionVectors;
+        break;
+    default:
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return 0;
+    }
+
+    std::list<string> comps;
+    comps.push_back(rawComps);
+    map<int, string> viewsToRender;
+    viewsToRender[0] = viewName;
+
+    vector<int> packingMapping(dstNComps);
+    for (int i = 0; i < dstNComps; ++i) {
+        packingMapping[i] = dstNCompsStartIndex + i;
+    }
+
+    beginEncodeParts(user_data, filename, time, pixelAspectRatio, eLayerViewsSinglePart, viewsToRender, comps, false, packingMapping, bounds);
+
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    data->stripsBounds = bounds;
+    data->stripsPixelDataNComps = pixelDataNComps;
+    const ImageSpec& spec = data->specs[0];
+
+    return getWriteBatchHeight(data->output.get(), spec, data->nThreads);
+}
+
+void
+WriteOIIOPlugin::encodeStrip(void* user_data,
+                             const float *pixelData,
+                             const OfxRectI& stripBounds,
+                             int rowBytes)
+{
+    assert(user_data);
+    WriteOIIOEncodePlanesData* data = (WriteOIIOEncodePlanesData*)user_data;
+    const ImageSpec& spec = data->specs[0];
+
+    // the components to write were packed at the start of each pixel by fetchPlaneConvertAndCopy()
+    if ( !writeStrip(data->output.get(), spec, data->stripsBounds.y2, stripBounds.y1, stripBounds.y2, pixelData, data->stripsPixelDataNComps, rowBytes) ) {
+        setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+}
+
+void
+WriteOIIOPlugin::endEncodeStrips(void* user_data)
+{
+    endEncodeParts(user_data);
 }
 
 void
@@ -1373,6 +1877,17 @@ WriteOIIOPlugin::endEncodeParts(void* user_data)
     data->output->close();
 }
 
+void
+WriteOIIOPlugin::appendEncodeSettings(double time,
+                                      stringstream& settings) const
+{
+    GenericWriterPlugin::appendEncodeSettings(time, settings);
+    settings << ' ' << _bitDepth->getValueAtTime(time) << ' ' << _quality->getValueAtTime(time)
+             << ' ' << _dwaCompressionLevel->getValueAtTime(time) << ' ' << _orientation->getValueAtTime(time)
+             << ' ' << _compression->getValueAtTime(time) << ' ' << _tileSize->getValueAtTime(time)
+             << ' ' << _mipmap->getValueAtTime(time) << ' ' << _mipmapFilter->getValueAtTime(time);
+}
+
 bool
 WriteOIIOPlugin::isImageFile(const string& /*fileExtension*/) const
 {
@@ -1383,6 +1898,7 @@ mDeclareWriterPluginFactory(WriteOIIOPluginFactory,; , false);
 void
 WriteOIIOPluginFactory::unload()
 {
+    shutdownOCIOPrewarm();
 #ifdef _WIN32
     //Kill all threads otherwise when the static global thread pool joins it threads there is a deadlock on Mingw
     IlmThread::ThreadPool::globalThreadPool().setNumThreads(0);
@@ -1509,6 +2025,49 @@ WriteOIIOPluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamMipMap);
+        param->setLabel(kParamMipMapLabel);
+        param->setHint(kParamMipMapHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamMipMapFilter);
+        param->setLabel(kParamMipMapFilterLabel);
+        param->setHint(kParamMipMapFilterHint);
+        param->setAnimates(false);
+        int nFilters = Filter2D::num_filters();
+        int defIndex = 0;
+        for (int i = 0; i < nFilters; ++i) {
+            FilterDesc f;
+            Filter2D::get_filterdesc(i, &f);
+            param->appendOption(f.name);
+            if ( !strcmp(f.name, kParamMipMapFilterDefault) ) {
+                defIndex = i;
+            }
+        }
+        param->setDefault(defIndex);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamThreads);
+        param->setLabel(kParamThreadsLabel);
+        param->setHint(kParamThreadsHint);
+        param->setRange(0, 256);
+        param->setDisplayRange(0, 16);
+        param->setDefault(0);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamBitDepth);
         param->setLabel(kParamBitDepthLabel);
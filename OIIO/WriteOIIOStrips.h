@@ -0,0 +1,76 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Writing OFX images to an OIIO ImageOutput by batches of rows, used by WriteOIIO.
+ * Does not depend on OpenFX, so that it can be checked by the tests (see Tests/).
+ */
+
+#ifndef IO_WriteOIIOStrips_h
+#define IO_WriteOIIOStrips_h
+
+#include <cstddef> // ptrdiff_t
+
+#include <OpenImageIO/imageio.h>
+
+namespace OFX {
+namespace IO {
+
+// Writes the rows [ybegin,yend) of the part, counted from the top. Batches must start on a block boundary.
+inline bool
+writeRows(OIIO_NAMESPACE::ImageOutput* output,
+          const OIIO_NAMESPACE::ImageSpec& spec,
+          int ybegin,
+          int yend,
+          const void* data,
+          OIIO_NAMESPACE::stride_t xStride,
+          OIIO_NAMESPACE::stride_t yStride)
+{
+    if (spec.tile_width > 0) {
+        return output->write_tiles(spec.x, spec.x + spec.width, spec.y + ybegin, spec.y + yend, 0, 1, OIIO_NAMESPACE::TypeDesc::FLOAT, data, xStride, yStride, OIIO_NAMESPACE::AutoStride);
+    }
+
+    return output->write_scanlines(spec.y + ybegin, spec.y + yend, 0, OIIO_NAMESPACE::TypeDesc::FLOAT, data, xStride, yStride);
+}
+
+// Writes the OFX rows [stripY1,stripY2) of an image whose top is boundsY2.
+// pixelData is the bottom row of the strip, as given to encodeStrip(): the components to write are already packed
+// at the start of each pixel, which has pixelDataNComps components.
+inline bool
+writeStrip(OIIO_NAMESPACE::ImageOutput* output,
+           const OIIO_NAMESPACE::ImageSpec& spec,
+           int boundsY2,
+           int stripY1,
+           int stripY2,
+           const float* pixelData,
+           int pixelDataNComps,
+           int rowBytes)
+{
+    // OIIO scan-lines go from top to bottom
+    const int ybegin = boundsY2 - stripY2;
+    const int yend = ybegin + (stripY2 - stripY1);
+    const char* topRow = (const char*)pixelData + (std::ptrdiff_t)(stripY2 - stripY1 - 1) * rowBytes;
+    //do not use auto-stride as the buffer may have more components that what we want to write
+    const std::size_t xStride = sizeof(float) * pixelDataNComps;
+
+    return writeRows(output, spec, ybegin, yend, topRow, xStride, -rowBytes);
+}
+} // namespace IO
+} // namespace OFX
+
+#endif // ifndef IO_WriteOIIOStrips_h
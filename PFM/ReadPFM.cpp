@@ -478,7 +478,7 @@ ReadPFMPlugin::guessParamsFromFilename(const string& /*newFile*/,
     return true;
 } // ReadPFMPlugin::guessParamsFromFilename
 
-mDeclareReaderPluginFactory(ReadPFMPluginFactory, {}, false);
+mDeclareReaderPluginFactory(ReadPFMPluginFactory, {shutdownOCIOPrewarm();}, false);
 void
 ReadPFMPluginFactory::load()
 {
@@ -24,12 +24,14 @@
 #include <cstdio> // fopen, fwrite, fprintf...
 #include <vector>
 #include <algorithm>
+#include <stdexcept>
 
 #include "GenericOCIO.h"
 
 #include "GenericWriter.h"
 #include "ofxsMacros.h"
 #include "ofxsFileOpen.h"
+#include "OutputFile.h"
 
 using namespace OFX;
 using namespace IO;
@@ -87,6 +89,18 @@ private:
                         const int dstNCompsStartIndex,
                         const int dstNComps,
                         const int rowBytes) OVERRIDE FINAL;
+    virtual bool prepareEncode(void* user_data,
+                               const string& filename,
+                               OfxTime time,
+                               const string& viewName,
+                               const OfxRectI& bounds,
+                               float pixelAspectRatio,
+                               int pixelDataNComps,
+                               int dstNCompsStartIndex,
+                               int dstNComps) OVERRIDE FINAL;
+    virtual void encodePrepared(void* user_data, const float* pixelData, int rowBytes) OVERRIDE FINAL;
+    virtual void* allocateEncodePlanesUserData() OVERRIDE FINAL;
+    virtual void destroyEncodePlanesUserData(void* data) OVERRIDE FINAL;
     virtual bool isImageFile(const string& fileExtension) const OVERRIDE FINAL;
     virtual PreMultiplicationEnum getExpectedInputPremultiplication() const OVERRIDE FINAL { return eImageUnPreMultiplied; }
 
@@ -137,31 +151,98 @@ copyLine(const PIX* pixelData,
     }
 }
 
+// what encodePrepared() needs, set by prepareEncode()
+struct WritePFMEncodeData
+{
+    string filename;
+    OfxRectI bounds;
+    int pixelDataNComps;
+    int dstNCompsStartIndex;
+    int dstNComps;
+};
+
+void*
+WritePFMPlugin::allocateEncodePlanesUserData()
+{
+    return new WritePFMEncodeData;
+}
+
+void
+WritePFMPlugin::destroyEncodePlanesUserData(void* data)
+{
+    assert(data);
+    delete (WritePFMEncodeData*)data;
+}
+
 void
 WritePFMPlugin::encode(const string& filename,
-                       const OfxTime /*time*/,
-                       const string& /*viewName*/,
+                       const OfxTime time,
+                       const string& viewName,
                        const float *pixelData,
                        const OfxRectI& bounds,
-                       const float /*pixelAspectRatio*/,
+                       const float pixelAspectRatio,
                        const int pixelDataNComps,
                        const int dstNCompsStartIndex,
                        const int dstNComps,
                        const int rowBytes)
+{
+    EncodePlanesLocalData_RAII data(this);
+
+    if ( !prepareEncode(data.getData(), filename, time, viewName, bounds, pixelAspectRatio, pixelDataNComps, dstNCompsStartIndex, dstNComps) ) {
+        return;
+    }
+    try {
+        encodePrepared(data.getData(), pixelData, rowBytes);
+    } catch (const std::exception& e) {
+        setPersistentMessage( Message::eMessageError, "", e.what() );
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+}
+
+bool
+WritePFMPlugin::prepareEncode(void* user_data,
+                              const string& filename,
+                              OfxTime /*time*/,
+                              const string& /*viewName*/,
+                              const OfxRectI& bounds,
+                              float /*pixelAspectRatio*/,
+                              int pixelDataNComps,
+                              int dstNCompsStartIndex,
+                              int dstNComps)
 {
     if ( (dstNComps != 4) && (dstNComps != 3) && (dstNComps != 1) ) {
         setPersistentMessage(Message::eMessageError, "", "PFM: can only write RGBA, RGB or Alpha components images");
         throwSuiteStatusException(kOfxStatErrFormat);
 
-        return;
+        return false;
     }
 
-    std::FILE *const nfile = fopen_utf8(filename.c_str(), "wb");
-    if (!nfile) {
-        setPersistentMessage(Message::eMessageError, "", "Cannot open file \"" + filename + "\"");
-        throwSuiteStatusException(kOfxStatFailed);
+    assert(user_data);
+    WritePFMEncodeData* data = (WritePFMEncodeData*)user_data;
+    data->filename = filename;
+    data->bounds = bounds;
+    data->pixelDataNComps = pixelDataNComps;
+    data->dstNCompsStartIndex = dstNCompsStartIndex;
+    data->dstNComps = dstNComps;
 
-        return;
+    return true;
+}
+
+void
+WritePFMPlugin::encodePrepared(void* user_data,
+                               const float* pixelData,
+                               int rowBytes)
+{
+    assert(user_data);
+    const WritePFMEncodeData* data = (const WritePFMEncodeData*)user_data;
+    const OfxRectI& bounds = data->bounds;
+    const int pixelDataNComps = data->pixelDataNComps;
+    const int dstNCompsStartIndex = data->dstNCompsStartIndex;
+    const int dstNComps = data->dstNComps;
+
+    std::FILE *const nfile = fopen_utf8(data->filename.c_str(), "wb");
+    if (!nfile) {
+        throw std::runtime_error("Cannot open file \"" + data->filename + "\"");
     }
     int width = (bounds.x2 - bounds.x1);
     int height = (bounds.y2 - bounds.y1);
@@ -170,7 +251,11 @@ WritePFMPlugin::encode(const string& filename,
     vector<float> buffer(buf_size);
     std::fill(buffer.begin(), buffer.end(), 0.);
 
-    std::fprintf(nfile, "P%c\n%u %u\n%d.0\n", (dstNComps == 1 ? 'f' : 'F'), width, height, endianness() ? 1 : -1);
+    char header[64];
+    const int headerSize = std::sprintf(header, "P%c\n%u %u\n%d.0\n", (dstNComps == 1 ? 'f' : 'F'), width, height, endianness() ? 1 : -1);
+    // the file size is known: reserve it (this is only a hint, and may fail)
+    preallocateFile( nfile, headerSize + (std::size_t)buf_size * height * sizeof(float) );
+    std::fwrite(header, 1, headerSize, nfile);
 
     for (int y = 0; y < height; ++y) {
         // now copy to the dstImg
@@ -209,7 +294,7 @@ WritePFMPlugin::onOutputFileChanged(const string & /*filename*/,
     }
 }
 
-mDeclareWriterPluginFactory(WritePFMPluginFactory, {}, false);
+mDeclareWriterPluginFactory(WritePFMPluginFactory, {shutdownOCIOPrewarm();}, false);
 void
 WritePFMPluginFactory::load()
 {
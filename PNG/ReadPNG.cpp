@@ -1470,7 +1470,7 @@ ReadPNGPlugin::guessParamsFromFilename(const string& filename,
 } // ReadPNGPlugin::guessParamsFromFilename
 
 
-mDeclareReaderPluginFactory(ReadPNGPluginFactory, {}, false);
+mDeclareReaderPluginFactory(ReadPNGPluginFactory, {shutdownOCIOPrewarm();}, false);
 void
 ReadPNGPluginFactory::load()
 {
@@ -23,8 +23,10 @@
 
 
 #include <cstdio> // fopen, fwrite...
+#include <cstddef> // ptrdiff_t
 #include <vector>
 #include <algorithm>
+#include <stdexcept>
 
 #include <png.h>
 #include <zlib.h>
@@ -61,6 +63,9 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kSupportsXY false
 #define kSupportsAlpha false
 
+#define kWritePNGStripHeight 64 // number of rows converted at once when writing by strips
+#define kWritePNGDitherSeed 2000
+
 #define kWritePNGParamCompression "compression"
 #define kWritePNGParamCompressionLabel "Compression"
 #define kWritePNGParamCompressionHint "Compression used by the internal zlib library when encoding the file. This parameter is used to tune the compression algorithm.\n" \
@@ -367,7 +372,37 @@ private:
                         const int dstNCompsStartIndex,
                         const int dstNComps,
                         const int rowBytes) OVERRIDE FINAL;
+    virtual bool prepareEncode(void* user_data,
+                               const string& filename,
+                               OfxTime time,
+                               const string& viewName,
+                               const OfxRectI& bounds,
+                               float pixelAspectRatio,
+                               int pixelDataNComps,
+                               int dstNCompsStartIndex,
+                               int dstNComps) OVERRIDE FINAL;
+    virtual void encodePrepared(void* user_data, const float* pixelData, int rowBytes) OVERRIDE FINAL;
+    virtual void* allocateEncodePlanesUserData() OVERRIDE FINAL;
+    virtual void destroyEncodePlanesUserData(void* data) OVERRIDE FINAL;
+    virtual bool supportsEncodeStrips(const string& /*filename*/) const OVERRIDE FINAL { return true; }
+    virtual int beginEncodeStrips(void* user_data,
+                                  const string& filename,
+                                  OfxTime time,
+                                  const string& viewName,
+                                  const OfxRectI& bounds,
+                                  float pixelAspectRatio,
+                                  int pixelDataNComps,
+                                  int dstNCompsStartIndex,
+                                  int dstNComps) OVERRIDE FINAL;
+    virtual void encodeStrip(void* user_data, const float *pixelData, const OfxRectI& stripBounds, int rowBytes) OVERRIDE FINAL;
+    virtual void endEncodeStrips(void* user_data) OVERRIDE FINAL;
+
+    // openEncode() and writeStrip() may be called from a write-behind thread: they throw std::exception on errors
+    void openEncode(void* user_data);
+    void writeStrip(void* user_data, const float *pixelData, const OfxRectI& stripBounds, int rowBytes);
+
     virtual bool isImageFile(const string& fileExtension) const OVERRIDE FINAL;
+    virtual void appendEncodeSettings(double time, std::stringstream& settings) const OVERRIDE FINAL;
     virtual PreMultiplicationEnum getExpectedInputPremultiplication() const OVERRIDE FINAL { return eImageUnPreMultiplied; }
 
     virtual void onOutputFileChanged(const string& newFile, bool setColorSpace) OVERRIDE FINAL;
@@ -392,8 +427,7 @@ private:
                      PNGBitDepthEnum bitdepth);
 
     template <int srcNComps, int dstNComps>
-    void add_dither_for_components(OfxTime time,
-                                   unsigned int seed,
+    void add_dither_for_components(unsigned int randHash,
                                    const float *src_pixels,
                                    const OfxRectI& bounds,
                                    unsigned char* dst_pixels,
@@ -401,8 +435,7 @@ private:
                                    int dstRowElements,
                                    int dstNCompsStartIndex);
 
-    void add_dither(OfxTime time,
-                    unsigned int seed,
+    void add_dither(unsigned int randHash,
                     const float *src_pixels,
                     const OfxRectI& bounds,
                     unsigned char* dst_pixels,
@@ -474,12 +507,12 @@ WritePNGPlugin::openFile(const string& filename,
 
     try {
         create_write_struct (*png, *info, nChannels, color_type);
-    } catch (const std::exception& e) {
+    } catch (...) {
         std::fclose(*file);
         if (*png != NULL) {
             destroy_write_struct(*png, *info);
         }
-        throw e;
+        throw;
     }
 }
 
@@ -601,10 +634,10 @@ WritePNGPlugin::write_info (png_structp& sp,
     png_set_packing (sp);   // Pack 1, 2, 4 bit into bytes
 }
 
+// randHash is the state of the pseudo-random generator before the first row of bounds
 template <int srcNComps, int dstNComps>
 void
-WritePNGPlugin::add_dither_for_components(OfxTime time,
-                                          unsigned int seed,
+WritePNGPlugin::add_dither_for_components(unsigned int randHash,
                                           const float *src_pixels,
                                           const OfxRectI& bounds,
                                           unsigned char* dst_pixels,
@@ -612,9 +645,6 @@ WritePNGPlugin::add_dither_for_components(OfxTime time,
                                           int dstRowElements,
                                           int dstNCompsStartIndex)
 {
-    unsigned int randHash = pseudoRandomHashSeed(time, seed);
-
-
     assert(srcNComps >= 3 && dstNComps >= 3);
 
     int width = bounds.x2 - bounds.x1;
@@ -661,8 +691,7 @@ WritePNGPlugin::add_dither_for_components(OfxTime time,
 }
 
 void
-WritePNGPlugin::add_dither(OfxTime time,
-                           unsigned int seed,
+WritePNGPlugin::add_dither(unsigned int randHash,
                            const float *src_pixels,
                            const OfxRectI& bounds,
                            unsigned char* dst_pixels,
@@ -674,23 +703,91 @@ WritePNGPlugin::add_dither(OfxTime time,
 {
     if (srcNComps == 3) {
         if (dstNComps == 3) {
-            add_dither_for_components<3, 3>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<3, 3>(randHash, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         } else if (dstNComps == 4) {
-            add_dither_for_components<3, 4>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<3, 4>(randHash, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         }
     } else if (srcNComps == 4) {
         if (dstNComps == 3) {
-            add_dither_for_components<4, 3>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<4, 3>(randHash, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         } else if (dstNComps == 4) {
-            add_dither_for_components<4, 4>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<4, 4>(randHash, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         }
     }
 }
 
+struct WritePNGEncodeData
+{
+    png_structp png;
+    png_infop info;
+    std::FILE* file;
+    // set by prepareEncode()
+    string filename;
+    OfxTime time;
+    OfxRectI bounds;
+    float pixelAspectRatio;
+    int pixelDataNComps;
+    int dstNCompsStartIndex;
+    int dstNComps;
+    int compressionLevel;
+    int compressionStrategy;
+    PNGBitDepthEnum pngDepth;
+    bool ditherEnabled;
+    string ocioColorspace;
+
+    WritePNGEncodeData()
+        : png(NULL)
+        , info(NULL)
+        , file(NULL)
+        , filename()
+        , time(0.)
+        , bounds()
+        , pixelAspectRatio(1.f)
+        , pixelDataNComps(0)
+        , dstNCompsStartIndex(0)
+        , dstNComps(0)
+        , compressionLevel(Z_DEFAULT_COMPRESSION)
+        , compressionStrategy(Z_DEFAULT_STRATEGY)
+        , pngDepth(ePNGBitDepthUByte)
+        , ditherEnabled(false)
+        , ocioColorspace()
+    {
+    }
+
+    ~WritePNGEncodeData()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if (png) {
+            destroy_write_struct(png, info);
+        }
+        if (file) {
+            std::fclose(file);
+            file = NULL;
+        }
+    }
+};
+
+void*
+WritePNGPlugin::allocateEncodePlanesUserData()
+{
+    return new WritePNGEncodeData;
+}
+
+void
+WritePNGPlugin::destroyEncodePlanesUserData(void* data)
+{
+    assert(data);
+    delete (WritePNGEncodeData*)data;
+}
+
 void
 WritePNGPlugin::encode(const string& filename,
                        const OfxTime time,
-                       const string& /*viewName*/,
+                       const string& viewName,
                        const float *pixelData,
                        const OfxRectI& bounds,
                        const float pixelAspectRatio,
@@ -699,138 +796,259 @@ WritePNGPlugin::encode(const string& filename,
                        const int dstNComps,
                        const int rowBytes)
 {
-    if ( (dstNComps != 4) && (dstNComps != 3) && (dstNComps != 2) && (dstNComps != 1) ) {
-        setPersistentMessage(Message::eMessageError, "", "PFM: can only write RGBA, RGB, IA or Alpha components images");
-        throwSuiteStatusException(kOfxStatErrFormat);
+    EncodePlanesLocalData_RAII data(this);
 
+    if ( !prepareEncode(data.getData(), filename, time, viewName, bounds, pixelAspectRatio, pixelDataNComps, dstNCompsStartIndex, dstNComps) ) {
         return;
     }
-
-    png_structp png = NULL;
-    png_infop info = NULL;
-    FILE* file = NULL;
-    int color_type = PNG_COLOR_TYPE_GRAY;
     try {
-        openFile(filename, dstNComps, &png, &info, &file, &color_type);
+        encodePrepared(data.getData(), pixelData, rowBytes);
     } catch (const std::exception& e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
     }
+}
 
+bool
+WritePNGPlugin::prepareEncode(void* user_data,
+                              const string& filename,
+                              OfxTime time,
+                              const string& /*viewName*/,
+                              const OfxRectI& bounds,
+                              float pixelAspectRatio,
+                              int pixelDataNComps,
+                              int dstNCompsStartIndex,
+                              int dstNComps)
+{
+    if ( (dstNComps != 4) && (dstNComps != 3) && (dstNComps != 2) && (dstNComps != 1) ) {
+        setPersistentMessage(Message::eMessageError, "", "PFM: can only write RGBA, RGB, IA or Alpha components images");
+        throwSuiteStatusException(kOfxStatErrFormat);
 
-    png_init_io (png, file);
+        return false;
+    }
+
+    assert(user_data);
+    WritePNGEncodeData* data = (WritePNGEncodeData*)user_data;
+    data->filename = filename;
+    data->time = time;
+    data->bounds = bounds;
+    data->pixelAspectRatio = pixelAspectRatio;
+    data->pixelDataNComps = pixelDataNComps;
+    data->dstNCompsStartIndex = dstNCompsStartIndex;
+    data->dstNComps = dstNComps;
 
     int compressionLevelParam;
     _compressionLevel->getValue(compressionLevelParam);
     assert(compressionLevelParam >= 0 && compressionLevelParam <= 9);
-    int compressionLevel = std::max(std::min(compressionLevelParam, Z_BEST_COMPRESSION), Z_NO_COMPRESSION);
-    png_set_compression_level(png, compressionLevel);
+    data->compressionLevel = std::max(std::min(compressionLevelParam, Z_BEST_COMPRESSION), Z_NO_COMPRESSION);
 
     int compression_i;
     _compression->getValue(compression_i);
     switch (compression_i) {
     case 1:
-        png_set_compression_strategy(png, Z_FILTERED);
+        data->compressionStrategy = Z_FILTERED;
         break;
     case 2:
-        png_set_compression_strategy(png, Z_HUFFMAN_ONLY);
+        data->compressionStrategy = Z_HUFFMAN_ONLY;
         break;
     case 3:
-        png_set_compression_strategy(png, Z_RLE);
+        data->compressionStrategy = Z_RLE;
         break;
     case 4:
-        png_set_compression_strategy(png, Z_FIXED);
+        data->compressionStrategy = Z_FIXED;
         break;
     case 0:
     default:
-        png_set_compression_strategy(png, Z_DEFAULT_STRATEGY);
+        data->compressionStrategy = Z_DEFAULT_STRATEGY;
         break;
     }
 
-    PNGBitDepthEnum pngDepth = (PNGBitDepthEnum)_bitdepth->getValueAtTime(time);
-    string ocioColorspace;
+    data->pngDepth = (PNGBitDepthEnum)_bitdepth->getValueAtTime(time);
+    data->ditherEnabled = (data->pngDepth == ePNGBitDepthUByte) && _ditherEnabled->getValue();
+    data->ocioColorspace.clear();
 #ifdef OFX_IO_USING_OCIO
-    _ocio->getOutputColorspace(ocioColorspace);
+    _ocio->getOutputColorspace(data->ocioColorspace);
 #endif
-    write_info(png, info, color_type, bounds.x1, bounds.y1, bounds.x2 - bounds.x1, bounds.y2 - bounds.y1, pixelAspectRatio, ocioColorspace, pngDepth);
 
-    int bitDepthSize = ( (pngDepth == ePNGBitDepthUShort) ? sizeof(unsigned short) : sizeof(unsigned char) );
+    return true;
+} // WritePNGPlugin::prepareEncode
+
+void
+WritePNGPlugin::encodePrepared(void* user_data,
+                               const float* pixelData,
+                               int rowBytes)
+{
+    assert(user_data);
+    WritePNGEncodeData* data = (WritePNGEncodeData*)user_data;
+
+    openEncode(user_data);
+    writeStrip(user_data, pixelData, data->bounds, rowBytes);
+    endEncodeStrips(user_data);
+}
+
+void
+WritePNGPlugin::openEncode(void* user_data)
+{
+    assert(user_data);
+    WritePNGEncodeData* data = (WritePNGEncodeData*)user_data;
+    int color_type = PNG_COLOR_TYPE_GRAY;
+    try {
+        openFile(data->filename, data->dstNComps, &data->png, &data->info, &data->file, &color_type);
+    } catch (...) {
+        // openFile() already closed everything
+        data->png = NULL;
+        data->info = NULL;
+        data->file = NULL;
+        throw;
+    }
+
+    png_structp png = data->png;
+    png_init_io (png, data->file);
+    png_set_compression_level(png, data->compressionLevel);
+    png_set_compression_strategy(png, data->compressionStrategy);
+
+    const OfxRectI& bounds = data->bounds;
+    write_info(png, data->info, color_type, bounds.x1, bounds.y1, bounds.x2 - bounds.x1, bounds.y2 - bounds.y1, data->pixelAspectRatio, data->ocioColorspace, data->pngDepth);
+}
+
+int
+WritePNGPlugin::beginEncodeStrips(void* user_data,
+                                  const string& filename,
+                                  OfxTime time,
+                                  const string& viewName,
+                                  const OfxRectI& bounds,
+                                  float pixelAspectRatio,
+                                  int pixelDataNComps,
+                                  int dstNCompsStartIndex,
+                                  int dstNComps)
+{
+    if ( !prepareEncode(user_data, filename, time, viewName, bounds, pixelAspectRatio, pixelDataNComps, dstNCompsStartIndex, dstNComps) ) {
+        return 0;
+    }
+    try {
+        openEncode(user_data);
+    } catch (const std::exception& e) {
+        setPersistentMessage( Message::eMessageError, "", e.what() );
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    // PNG rows are written one at a time, any strip height would do
+    return kWritePNGStripHeight;
+} // WritePNGPlugin::beginEncodeStrips
+
+void
+WritePNGPlugin::encodeStrip(void* user_data,
+                            const float *pixelData,
+                            const OfxRectI& stripBounds,
+                            int rowBytes)
+{
+    try {
+        writeStrip(user_data, pixelData, stripBounds, rowBytes);
+    } catch (const std::exception& e) {
+        setPersistentMessage( Message::eMessageError, "", e.what() );
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+}
+
+void
+WritePNGPlugin::writeStrip(void* user_data,
+                           const float *pixelData,
+                           const OfxRectI& stripBounds,
+                           int rowBytes)
+{
+    assert(user_data);
+    WritePNGEncodeData* data = (WritePNGEncodeData*)user_data;
+    const int pixelDataNComps = data->pixelDataNComps;
+    const int dstNCompsStartIndex = data->dstNCompsStartIndex;
+    const int dstNComps = data->dstNComps;
+    const int width = stripBounds.x2 - stripBounds.x1;
+    const int height = stripBounds.y2 - stripBounds.y1;
+    int bitDepthSize = ( (data->pngDepth == ePNGBitDepthUShort) ? sizeof(unsigned short) : sizeof(unsigned char) );
 
     // Convert the float buffer to the buffer used by PNG
-    int dstRowElements = (bounds.x2 - bounds.x1) * dstNComps;
+    int dstRowElements = width * dstNComps;
     std::size_t pngRowBytes =  dstRowElements * bitDepthSize;
-    std::size_t scratchBufBytes = (bounds.y2 - bounds.y1) * pngRowBytes;
+    std::size_t scratchBufBytes = height * pngRowBytes;
 
     RamBuffer scratchBuffer(scratchBufBytes);
     int nComps = std::min(dstNComps, pixelDataNComps);
     const int srcRowElements = rowBytes / sizeof(float);
-    const size_t numPixels = (size_t)(bounds.x2 - bounds.x1) * (size_t)(bounds.y2 - bounds.y1);
-
-    assert(srcRowElements == (bounds.x2 - bounds.x1) * pixelDataNComps);
-    assert(scratchBufBytes == numPixels * dstNComps * bitDepthSize);
-
-    const float* src_pixels = pixelData;
-
-    if (pngDepth == ePNGBitDepthUByte) {
-        bool ditherEnabled = _ditherEnabled->getValue();
 
+    if (data->pngDepth == ePNGBitDepthUByte) {
         unsigned char* dstPixelData = scratchBuffer.getData();
-        unsigned char* dst_pixels = dstPixelData;
 
         // no dither
-        if ( !ditherEnabled || (nComps < 3) ) {
-            for ( size_t i = 0; i < numPixels; ++i,
-                 dst_pixels += dstNComps,
-                 src_pixels += pixelDataNComps) {
-                assert(src_pixels == pixelData + i * pixelDataNComps);
-                assert(dst_pixels == dstPixelData + i * dstNComps);
-                for (int c = 0; c < nComps; ++c) {
-                    dst_pixels[c] = floatToInt<256>(src_pixels[dstNCompsStartIndex + c]);
+        if ( !data->ditherEnabled || (nComps < 3) ) {
+            for (int y = 0; y < height; ++y) {
+                const float* src_pixels = pixelData + (std::ptrdiff_t)y * srcRowElements;
+                unsigned char* dst_pixels = dstPixelData + (std::ptrdiff_t)y * dstRowElements;
+                for (int x = 0; x < width; ++x,
+                     dst_pixels += dstNComps,
+                     src_pixels += pixelDataNComps) {
+                    for (int c = 0; c < nComps; ++c) {
+                        dst_pixels[c] = floatToInt<256>(src_pixels[dstNCompsStartIndex + c]);
+                    }
                 }
-
             }
         } else {
             assert(nComps >= 3);
-            const unsigned int ditherSeed = 2000;
-            add_dither(time, ditherSeed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex, pixelDataNComps, dstNComps);
+            // the dither pattern only depends on the row, whatever the strip height
+            unsigned int randHash = pseudoRandomHashSeed(data->time, kWritePNGDitherSeed);
+            for (int y = data->bounds.y1; y < stripBounds.y1; ++y) {
+                randHash = generatePseudoRandomHash(randHash);
+            }
+            add_dither(randHash, pixelData, stripBounds, dstPixelData, srcRowElements, dstRowElements, dstNCompsStartIndex, pixelDataNComps, dstNComps);
         }
     } else {
-        assert(pngDepth == ePNGBitDepthUShort);
+        assert(data->pngDepth == ePNGBitDepthUShort);
 
         unsigned short* dstPixelData = reinterpret_cast<unsigned short*>( scratchBuffer.getData() );
-        unsigned short* dst_pixels = dstPixelData;
-
-        for ( size_t i = 0; i < numPixels; ++i,
-             dst_pixels += dstNComps,
-             src_pixels += pixelDataNComps) {
-            assert(src_pixels == pixelData + i * pixelDataNComps);
-            assert(dst_pixels == dstPixelData + i * dstNComps);
-            for (int c = 0; c < nComps; ++c) {
-                dst_pixels[c] = floatToInt<65536>(src_pixels[dstNCompsStartIndex + c]);
+
+        for (int y = 0; y < height; ++y) {
+            const float* src_pixels = pixelData + (std::ptrdiff_t)y * srcRowElements;
+            unsigned short* dst_pixels = dstPixelData + (std::ptrdiff_t)y * dstRowElements;
+            for (int x = 0; x < width; ++x,
+                 dst_pixels += dstNComps,
+                 src_pixels += pixelDataNComps) {
+                for (int c = 0; c < nComps; ++c) {
+                    dst_pixels[c] = floatToInt<65536>(src_pixels[dstNCompsStartIndex + c]);
+                }
             }
         }
         // PNG is always big endian
         if ( littleendian() ) {
-            swap_endian ( dstPixelData, numPixels * dstNComps );
+            swap_endian ( dstPixelData, (int)( (std::size_t)width * height * dstNComps ) );
         }
     }
 
 
     // Y is top down in PNG, so invert it now
-    for (int y = (bounds.y2 - bounds.y1 - 1); y >= 0; --y) {
-        if ( setjmp ( png_jmpbuf(png) ) ) {
-            destroy_write_struct(png, info);
-            std::fclose(file);
-            setPersistentMessage(Message::eMessageError, "", "PNG library error");
-            throwSuiteStatusException(kOfxStatFailed);
-        }
-        png_write_row (png, (png_byte*)scratchBuffer.getData() + y * pngRowBytes);
+    if ( setjmp ( png_jmpbuf(data->png) ) ) {
+        throw std::runtime_error("PNG library error");
     }
+    for (int y = height - 1; y >= 0; --y) {
+        png_write_row (data->png, (png_byte*)scratchBuffer.getData() + y * pngRowBytes);
+    }
+} // WritePNGPlugin::writeStrip
 
-    finish_image(png, info);
-    destroy_write_struct(png, info);
-    std::fclose(file);
-} // WritePNGPlugin::encode
+void
+WritePNGPlugin::endEncodeStrips(void* user_data)
+{
+    assert(user_data);
+    WritePNGEncodeData* data = (WritePNGEncodeData*)user_data;
+
+    finish_image(data->png, data->info);
+    data->close();
+}
+
+void
+WritePNGPlugin::appendEncodeSettings(double time,
+                                     std::stringstream& settings) const
+{
+    GenericWriterPlugin::appendEncodeSettings(time, settings);
+    settings << ' ' << _compression->getValueAtTime(time) << ' ' << _compressionLevel->getValueAtTime(time)
+             << ' ' << _bitdepth->getValueAtTime(time) << ' ' << _ditherEnabled->getValueAtTime(time);
+}
 
 bool
 WritePNGPlugin::isImageFile(const string& /*fileExtension*/) const
@@ -917,6 +1135,7 @@ WritePNGPluginFactory::load()
 void
 WritePNGPluginFactory::unload()
 {
+    shutdownOCIOPrewarm();
     delete gLutManager;
 }
 
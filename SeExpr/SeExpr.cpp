@@ -21,11 +21,13 @@
  * Execute a SeExpr script.
  */
 
+#include <cstring> // memcpy
 #include <cfloat> // DBL_MAX
 #include <vector>
 #include <algorithm>
 #include <limits>
 #include <set>
+#include <stdint.h> // uint64_t
 
 //#include <stdio.h> // for snprintf & _snprintf
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
@@ -144,6 +146,9 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
     "- `float apixel(int i, int f, float x, float y, int interp = 0)`: interpolates the " \
     "alpha from input i at the pixel position (x,y) in the image, at frame f.\n" \
     "\n" \
+    "`rand(min, max, seed)` does not return a sequence of numbers: its result is a hash of the seed, the pixel, the frame, and " \
+    "the number of calls already made for the pixel, so that renders are reproducible whatever the number of threads.\n" \
+    "\n" \
     "The pixel position of the center of the bottom-left pixel is (0., 0.).\n" \
     "\n" \
     "The first input has index i=1.\n" \
@@ -263,7 +268,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginIdentifier "fr.inria.openfx.SeExpr"
 #define kPluginIdentifierSimple "fr.inria.openfx.SeExprSimple"
 #define kPluginVersionMajor 2 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 // History:
 // version 1: initial version
 // version 2: $scale replaced with $scalex, $scaley; added $par, $cx, $cy; getPixel replaced by cpixel/apixel
@@ -278,6 +283,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 
 #define kSeExprCPixelFuncName "cpixel"
 #define kSeExprAPixelFuncName "apixel"
+#define kSeExprRandFuncName "rand"
 #define kSeExprCurrentTimeVarName "frame"
 #define kSeExprXCoordVarName "x"
 #define kSeExprYCoordVarName "y"
@@ -544,20 +550,42 @@ SeExprPlugin::getOutputComponents() const
 }
 
 class OFXSeExpression;
+class OFXSeExprThreadData;
+
+// The expressions evaluated by one thread. OFXSeExpression holds the variables of the current pixel, so that each
+// thread needs its own.
+struct OFXSeExpressions
+{
+    OFXSeExprThreadData* data; // shared by the expressions of the thread
+    OFXSeExpression* r;
+    OFXSeExpression* g;
+    OFXSeExpression* b;
+    OFXSeExpression* rgb;
+    OFXSeExpression* alpha;
+
+    OFXSeExpressions()
+        : data(NULL)
+        , r(NULL)
+        , g(NULL)
+        , b(NULL)
+        , rgb(NULL)
+        , alpha(NULL)
+    {
+    }
+};
 
-// Base class for processor, note that we do not use the multi-thread suite.
+// Base class for processor.
+// The render window is split between threads by hand rather than by ImageProcessor, because each thread
+// evaluates its own copy of the expressions.
 class SeExprProcessorBase
+    : public MultiThread::Processor
 {
 protected:
 
     OfxTime _renderTime;
     int _renderView;
     SeExprPlugin* _plugin;
-    OFXSeExpression* _rExpr;
-    OFXSeExpression* _gExpr;
-    OFXSeExpression* _bExpr;
-    OFXSeExpression* _rgbExpr;
-    OFXSeExpression* _alphaExpr;
+    vector<OFXSeExpressions> _exprs; // one set per thread, the first one is checked by isExprOk()
     const Image* _srcCurTime[kSourceClipCount];
     int _nSrcComponents[kSourceClipCount];
     Image* _dstImg;
@@ -565,11 +593,27 @@ protected:
     const Image* _maskImg;
     bool _doMasking;
     double _mix;
+    OfxRectI _renderWindow;
+
+    // what the expressions of each thread are created from
+    bool _simple;
+    string _rScript;
+    string _gScript;
+    string _bScript;
+    string _rgbScript;
+    string _alphaScript;
+    OfxRectI _dstPixelRod;
+    OfxPointI _inputSizes[kSourceClipCount];
+    OfxPointI _outputSize;
+    OfxPointD _renderScale;
+    double _par;
 
     // <clipIndex, <time, image> >
     typedef map<OfxTime, const Image*> FetchedImagesForClipMap;
     typedef map<int, FetchedImagesForClipMap> FetchedImagesMap;
     FetchedImagesMap _images;
+    //Using SeExpr lock is faster than calling the multi-thread suite to get a mutex
+    SeExprInternal::Mutex _imagesLock; // the expressions of all threads may fetch images
 
 public:
 
@@ -619,16 +663,21 @@ public:
 
     bool isExprOk(string* error);
 
-    void prefetchImage(int inputIndex,
-                       OfxTime time)
+    // Returns the image of the input at the given time, or NULL if there is none, and fetches it the first time.
+    // MT-safe, but the expressions should go through their OFXSeExprThreadData, which only calls it on a miss.
+    const Image* fetchImage(int inputIndex,
+                            OfxTime time)
     {
-        // find or create input
-        FetchedImagesForClipMap& foundInput = _images[inputIndex];
-
-        FetchedImagesForClipMap::iterator foundImage = foundInput.find(time);
-        if ( foundImage != foundInput.end() ) {
-            // image already fetched
-            return;
+        {
+            SeExprInternal::AutoLock<SeExprInternal::Mutex> locker(_imagesLock);
+            // find or create input
+            FetchedImagesForClipMap& foundInput = _images[inputIndex];
+
+            FetchedImagesForClipMap::iterator foundImage = foundInput.find(time);
+            if ( foundImage != foundInput.end() ) {
+                // image already fetched
+                return foundImage->second;
+            }
         }
 
         Clip* clip = _plugin->getClip(inputIndex);
@@ -636,55 +685,128 @@ public:
 
         if ( !clip->isConnected() ) {
             // clip is not connected, image is NULL
-            return;
+            return NULL;
         }
 
+        // the host call is made without holding the lock, so that it does not block the other threads
         Image *img = clip->fetchImage(time);
         if (!img) {
-            return;
+            return NULL;
+        }
+        SeExprInternal::AutoLock<SeExprInternal::Mutex> locker(_imagesLock);
+        pair<FetchedImagesForClipMap::iterator, bool> ret = _images[inputIndex].insert( make_pair(time, img) );
+        if (!ret.second) {
+            // another thread fetched it in the meantime
+            delete img;
         }
-        pair<FetchedImagesForClipMap::iterator, bool> ret = foundInput.insert( make_pair(time, img) );
-        assert(ret.second);
+
+        return ret.first->second;
+    }
+
+    // process the render window, split between threads
+    void process(const OfxRectI& renderWindow);
+
+private:
+    virtual void multiThreadFunction(unsigned int threadID, unsigned int nThreads) OVERRIDE FINAL;
+
+    // process the rows of procWindow, using the expressions of the calling thread
+    virtual void processRows(const OfxRectI& procWindow, const OFXSeExpressions& exprs) = 0;
+
+    void createExprs(OFXSeExpressions* exprs);
+
+    void initExprs(const OFXSeExpressions& exprs);
+
+    void setValuesOther(OfxTime time,
+                        int view,
+                        double mix,
+                        const OfxRectI& dstPixelRod,
+                        OfxPointI* inputSizes,
+                        const OfxPointI& outputSize,
+                        const OfxPointD& renderScale,
+                        double par);
+};
+
+// What the expressions of one thread keep between pixels: the images they sample, so that the lock of the
+// images shared by all threads is only taken on a miss, and the pixel being computed, for rand().
+class OFXSeExprThreadData
+{
+public:
+
+    OFXSeExprThreadData(SeExprProcessorBase* processor,
+                        OfxTime time)
+        : _processor(processor)
+        , _time(time)
+        , _images()
+        , _x(0)
+        , _y(0)
+        , _randCalls(0)
+    {
     }
 
+    // NOT MT-SAFE, this object is to be used PER-THREAD
     const Image* getImage(int inputIndex,
                           OfxTime time)
     {
-        // find or create input
-        FetchedImagesForClipMap& foundInput = _images[inputIndex];
+        const pair<int, OfxTime> key(inputIndex, time);
+        ImagesMap::const_iterator found = _images.find(key);
 
-        FetchedImagesForClipMap::iterator foundImage = foundInput.find(time);
-        if ( foundImage != foundInput.end() ) {
-            return foundImage->second;
+        if ( found != _images.end() ) {
+            return found->second;
         }
+        const Image* img = _processor->fetchImage(inputIndex, time);
+        _images[key] = img;
 
-        return NULL;
+        return img;
     }
 
-    virtual void process(OfxRectI procWindow) = 0;
+    // Must be called before the expressions are evaluated at a pixel
+    // NOT MT-SAFE, this object is to be used PER-THREAD
+    void setPixel(int x,
+                  int y)
+    {
+        _x = x;
+        _y = y;
+        _randCalls = 0;
+    }
+
+    // Returns a random number in [0,1), which only depends on the seed, the pixel, the frame, and the number of
+    // calls made since setPixel(): the result does not depend on which thread computes the pixel.
+    // NOT MT-SAFE, this object is to be used PER-THREAD
+    double random(int seed)
+    {
+        uint64_t timeBits;
+
+        std::memcpy( &timeBits, &_time, sizeof(timeBits) );
+        uint64_t h = mix( (uint64_t)(unsigned int)seed );
+        h = mix( h ^ (uint64_t)(unsigned int)_x );
+        h = mix( h ^ (uint64_t)(unsigned int)_y );
+        h = mix(h ^ timeBits);
+        h = mix( h ^ (uint64_t)_randCalls );
+        ++_randCalls;
+
+        // the 53 high bits, which a double holds exactly
+        return (double)(h >> 11) / (double)(1ULL << 53);
+    }
 
 private:
-    void setExprs(OfxTime time,
-                  const string& rgbExpr,
-                  const string& alphaExpr,
-                  const OfxRectI& dstPixelRod,
-                  const OfxPointD& renderScale,
-                  double par);
-
-    void setExprsSimple(OfxTime time,
-                        const string& rExpr,
-                        const string& gExpr,
-                        const string& bExpr,
-                        const string& aExpr,
-                        const OfxRectI& dstPixelRod,
-                        const OfxPointD& renderScale,
-                        double par);
+    typedef map<pair<int, OfxTime>, const Image*> ImagesMap;
 
-    void setValuesOther(OfxTime time,
-                        int view,
-                        double mix,
-                        OfxPointI* inputSizes,
-                        const OfxPointI& outputSize);
+    // the finalizer of SplitMix64
+    static uint64_t mix(uint64_t h)
+    {
+        h += 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30) ) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27) ) * 0x94D049BB133111EBULL;
+
+        return h ^ (h >> 31);
+    }
+
+    SeExprProcessorBase* _processor;
+    OfxTime _time;
+    ImagesMap _images; // NULL if the input has no image at that time
+    int _x;
+    int _y;
+    unsigned int _randCalls; // since setPixel()
 };
 
 
@@ -797,14 +919,14 @@ template<bool alpha>
 class PixelFuncX
     : public SeExprFuncX
 {
-    SeExprProcessorBase* _processor;
+    OFXSeExprThreadData* _data;
 
 public:
 
 
-    PixelFuncX(SeExprProcessorBase* processor)
+    PixelFuncX(OFXSeExprThreadData* data)
         : SeExprFuncX(true) // Thread Safe
-        , _processor(processor)
+        , _data(data)
     {}
 
     virtual ~PixelFuncX() {}
@@ -881,8 +1003,7 @@ private:
 
             return;
         }
-        _processor->prefetchImage(inputIndex, frame);
-        const Image* img = _processor->getImage(inputIndex, frame);
+        const Image* img = _data->getImage(inputIndex, frame);
         if (!img) {
             // be black and transparent
             result.setValue(0., 0., 0.);
@@ -906,6 +1027,75 @@ private:
     } // eval
 };
 
+// implementation of the "rand" function, with the arguments of the builtin one.
+// The builtin function keeps its state in global variables, which the threads would share: this one is a hash
+// of the seed and of the pixel (see OFXSeExprThreadData::random()).
+class RandFuncX
+    : public SeExprFuncX
+{
+    OFXSeExprThreadData* _data;
+
+public:
+
+
+    RandFuncX(OFXSeExprThreadData* data)
+        : SeExprFuncX(true) // Thread Safe
+        , _data(data)
+    {}
+
+    virtual ~RandFuncX() {}
+
+private:
+
+    virtual bool prep(SeExprFuncNode* node,
+                      bool /*wantVec*/)
+    {
+        // check number of arguments
+        int nargs = node->nargs();
+
+        if ( (nargs == 1) || (3 < nargs) ) {
+            node->addError("Wrong number of arguments, should be 0, 2 or 3");
+
+            return false;
+        }
+
+        for (int i = 0; i < nargs; ++i) {
+            if ( node->child(i)->isVec() ) {
+                node->addError("Wrong arguments, should be all scalars");
+
+                return false;
+            }
+            if ( !node->child(i)->prep(false) ) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    virtual void eval(const SeExprFuncNode* node,
+                      SeVec3d& result) const
+    {
+        double min = 0.;
+        double max = 1.;
+        int seed = 0;
+        SeVec3d v;
+
+        if (node->nargs() >= 2) {
+            node->child(0)->eval(v);
+            min = v[0];
+            node->child(1)->eval(v);
+            max = v[0];
+            if (node->nargs() == 3) {
+                node->child(2)->eval(v);
+                seed = (int)SeExpr::round(v[0]);
+            }
+        }
+        double r = min + (max - min) * _data->random(seed);
+        result.setValue(r, r, r);
+    }
+};
+
 
 class DoubleParamVarRef
     : public SeExprVarRef
@@ -1154,6 +1344,8 @@ class OFXSeExpression
     mutable SeExprFunc _cpixelFunction;
     mutable PixelFuncX<true> _apixel;
     mutable SeExprFunc _apixelFunction;
+    mutable RandFuncX _rand;
+    mutable SeExprFunc _randFunction;
     OfxRectI _dstPixelRod;
     typedef map<string, SeExprVarRef*> VariablesMap;
     VariablesMap _variables;
@@ -1184,6 +1376,7 @@ public:
 
 
     OFXSeExpression(SeExprProcessorBase* processor,
+                    OFXSeExprThreadData* data,
                     const string& expr,
                     bool wantVec,
                     bool simple,
@@ -1246,6 +1439,7 @@ public:
 };
 
 OFXSeExpression::OFXSeExpression(SeExprProcessorBase* processor,
+                                 OFXSeExprThreadData* data,
                                  const string& expr,
                                  bool wantVec,
                                  bool simple,
@@ -1255,10 +1449,12 @@ OFXSeExpression::OFXSeExpression(SeExprProcessorBase* processor,
                                  const OfxRectI& outputRod)
     : SeExpression(expr, wantVec)
     , _simple(simple)
-    , _cpixel(processor)
+    , _cpixel(data)
     , _cpixelFunction(_cpixel, 4, 5)
-    , _apixel(processor)
+    , _apixel(data)
     , _apixelFunction(_apixel, 4, 5)
+    , _rand(data)
+    , _randFunction(_rand, 0, 3)
     , _dstPixelRod(outputRod)
     , _variables()
     , _scalex()
@@ -1378,6 +1574,10 @@ OFXSeExpression::resolveVar(const string& varName) const
 SeExprFunc*
 OFXSeExpression::resolveFunc(const string& funcName) const
 {
+    // replaces the builtin, which is not MT-safe
+    if (funcName == kSeExprRandFuncName) {
+        return &_randFunction;
+    }
     // check if it is builtin so we get proper behavior
     if ( SeExprFunc::lookup(funcName) ) {
         return 0;
@@ -1492,32 +1692,39 @@ SeExprProcessorBase::SeExprProcessorBase(SeExprPlugin* instance)
     : _renderTime(0.)
     , _renderView(0)
     , _plugin(instance)
-    , _rExpr(NULL)
-    , _gExpr(NULL)
-    , _bExpr(NULL)
-    , _rgbExpr(NULL)
-    , _alphaExpr(NULL)
+    , _exprs()
     , _srcCurTime()
     , _dstImg(NULL)
     , _maskInvert(false)
     , _maskImg(NULL)
     , _doMasking(false)
     , _mix(0.)
+    , _simple(false)
+    , _par(1.)
     , _images()
+    , _imagesLock()
 {
     for (int i = 0; i < kSourceClipCount; ++i) {
         _srcCurTime[i] = 0;
         _nSrcComponents[i] = 0;
+        _inputSizes[i].x = _inputSizes[i].y = 0;
     }
+    _renderWindow.x1 = _renderWindow.y1 = _renderWindow.x2 = _renderWindow.y2 = 0;
+    _dstPixelRod = _renderWindow;
+    _outputSize.x = _outputSize.y = 0;
+    _renderScale.x = _renderScale.y = 1.;
 }
 
 SeExprProcessorBase::~SeExprProcessorBase()
 {
-    delete _rExpr;
-    delete _gExpr;
-    delete _bExpr;
-    delete _rgbExpr;
-    delete _alphaExpr;
+    for (std::size_t i = 0; i < _exprs.size(); ++i) {
+        delete _exprs[i].r;
+        delete _exprs[i].g;
+        delete _exprs[i].b;
+        delete _exprs[i].rgb;
+        delete _exprs[i].alpha;
+        delete _exprs[i].data;
+    }
     for (FetchedImagesMap::iterator it = _images.begin(); it != _images.end(); ++it) {
         for (FetchedImagesForClipMap::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
             delete it2->second;
@@ -1537,8 +1744,10 @@ SeExprProcessorBase::setValues(OfxTime time,
                                const OfxPointD& renderScale,
                                double par)
 {
-    setExprs(time, rgbExpr, alphaExpr, dstPixelRod, renderScale, par);
-    setValuesOther(time, view, mix, inputSizes, outputSize);
+    _simple = false;
+    _rgbScript = rgbExpr;
+    _alphaScript = alphaExpr;
+    setValuesOther(time, view, mix, dstPixelRod, inputSizes, outputSize, renderScale, par);
 }
 
 void
@@ -1555,153 +1764,156 @@ SeExprProcessorBase::setValuesSimple(OfxTime time,
                                      const OfxPointD& renderScale,
                                      double par)
 {
-    setExprsSimple(time, rExpr, gExpr, bExpr, aExpr, dstPixelRod, renderScale, par);
-    setValuesOther(time, view, mix, inputSizes, outputSize);
-}
-
-void
-SeExprProcessorBase::setExprs(OfxTime time,
-                              const string& rgbExpr,
-                              const string& alphaExpr,
-                              const OfxRectI& dstPixelRod,
-                              const OfxPointD& renderScale,
-                              double par)
-{
-    if ( !isSpaces(rgbExpr) ) {
-        _rgbExpr = new OFXSeExpression(this, rgbExpr, /*wantVec=*/ true, /*simple=*/ false, time, renderScale, par, dstPixelRod);
-    }
-    if ( !isSpaces(alphaExpr) ) {
-        _alphaExpr = new OFXSeExpression(this, alphaExpr, /*wantVec=*/ false, /*simple=*/ false, time, renderScale, par, dstPixelRod);
-    }
+    _simple = true;
+    _rScript = rExpr;
+    _gScript = gExpr;
+    _bScript = bExpr;
+    _alphaScript = aExpr;
+    setValuesOther(time, view, mix, dstPixelRod, inputSizes, outputSize, renderScale, par);
 }
 
 void
-SeExprProcessorBase::setExprsSimple(OfxTime time,
-                                    const string& rExpr,
-                                    const string& gExpr,
-                                    const string& bExpr,
-                                    const string& aExpr,
+SeExprProcessorBase::setValuesOther(OfxTime time,
+                                    int view,
+                                    double mix,
                                     const OfxRectI& dstPixelRod,
+                                    OfxPointI* inputSizes,
+                                    const OfxPointI& outputSize,
                                     const OfxPointD& renderScale,
                                     double par)
 {
-    if ( !isSpaces(rExpr) ) {
-        _rExpr = new OFXSeExpression(this, rExpr, /*wantVec=*/ false, /*simple=*/ true, time, renderScale, par, dstPixelRod);
-    }
-    if ( !isSpaces(gExpr) ) {
-        _gExpr = new OFXSeExpression(this, gExpr, /*wantVec=*/ false, /*simple=*/ true, time, renderScale, par, dstPixelRod);
-    }
-    if ( !isSpaces(bExpr) ) {
-        _bExpr = new OFXSeExpression(this, bExpr, /*wantVec=*/ false, /*simple=*/ true, time, renderScale, par, dstPixelRod);
-    }
-    if ( !isSpaces(aExpr) ) {
-        _alphaExpr = new OFXSeExpression(this, aExpr, /*wantVec=*/ false, /*simple=*/ true, time, renderScale, par, dstPixelRod);
+    _renderTime = time;
+    _renderView = view;
+    _dstPixelRod = dstPixelRod;
+    for (int i = 0; i < kSourceClipCount; ++i) {
+        _inputSizes[i] = inputSizes[i];
     }
+    _outputSize = outputSize;
+    _renderScale = renderScale;
+    _par = par;
+    //assert(exprs.alpha || exprs.rgb); // both may be empty!
+    _mix = mix;
+
+    // the expressions of the first thread
+    _exprs.resize(1);
+    createExprs(&_exprs[0]);
 }
 
 void
-SeExprProcessorBase::setValuesOther(OfxTime time,
-                                    int view,
-                                    double mix,
-                                    OfxPointI* inputSizes,
-                                    const OfxPointI& outputSize)
+SeExprProcessorBase::createExprs(OFXSeExpressions* exprs)
 {
-    _renderTime = time;
-    _renderView = view;
-
-    for (int i = 0; i < kSourceClipCount; ++i) {
-        if (_rExpr) {
-            _rExpr->setSize(i, inputSizes[i].x, inputSizes[i].y);
+    exprs->data = new OFXSeExprThreadData(this, _renderTime);
+    if (_simple) {
+        if ( !isSpaces(_rScript) ) {
+            exprs->r = new OFXSeExpression(this, exprs->data, _rScript, /*wantVec=*/ false, /*simple=*/ true, _renderTime, _renderScale, _par, _dstPixelRod);
         }
-        if (_gExpr) {
-            _gExpr->setSize(i, inputSizes[i].x, inputSizes[i].y);
+        if ( !isSpaces(_gScript) ) {
+            exprs->g = new OFXSeExpression(this, exprs->data, _gScript, /*wantVec=*/ false, /*simple=*/ true, _renderTime, _renderScale, _par, _dstPixelRod);
         }
-        if (_bExpr) {
-            _bExpr->setSize(i, inputSizes[i].x, inputSizes[i].y);
+        if ( !isSpaces(_bScript) ) {
+            exprs->b = new OFXSeExpression(this, exprs->data, _bScript, /*wantVec=*/ false, /*simple=*/ true, _renderTime, _renderScale, _par, _dstPixelRod);
         }
-        if (_rgbExpr) {
-            _rgbExpr->setSize(i, inputSizes[i].x, inputSizes[i].y);
+    } else {
+        if ( !isSpaces(_rgbScript) ) {
+            exprs->rgb = new OFXSeExpression(this, exprs->data, _rgbScript, /*wantVec=*/ true, /*simple=*/ false, _renderTime, _renderScale, _par, _dstPixelRod);
         }
-        if (_alphaExpr) {
-            _alphaExpr->setSize(i, inputSizes[i].x, inputSizes[i].y);
+    }
+    if ( !isSpaces(_alphaScript) ) {
+        exprs->alpha = new OFXSeExpression(this, exprs->data, _alphaScript, /*wantVec=*/ false, /*simple=*/ _simple, _renderTime, _renderScale, _par, _dstPixelRod);
+    }
+
+    OFXSeExpression* all[5] = { exprs->r, exprs->g, exprs->b, exprs->rgb, exprs->alpha };
+    for (int e = 0; e < 5; ++e) {
+        if (all[e]) {
+            for (int i = 0; i < kSourceClipCount; ++i) {
+                all[e]->setSize(i, _inputSizes[i].x, _inputSizes[i].y);
+            }
+            all[e]->setSize(-1, _outputSize.x, _outputSize.y);
         }
     }
-    if (_rExpr) {
-        _rExpr->setSize(-1, outputSize.x, outputSize.y);
+}
+
+// Run the expressions once, to parse them, to get the values of the parameters they use, and to fetch the images
+// they need at the first pixel, before multi-threading
+void
+SeExprProcessorBase::initExprs(const OFXSeExpressions& exprs)
+{
+    if (exprs.r) {
+        (void)exprs.r->evaluate();
     }
-    if (_gExpr) {
-        _gExpr->setSize(-1, outputSize.x, outputSize.y);
+    if (exprs.g) {
+        (void)exprs.g->evaluate();
     }
-    if (_bExpr) {
-        _bExpr->setSize(-1, outputSize.x, outputSize.y);
+    if (exprs.b) {
+        (void)exprs.b->evaluate();
     }
-    if (_rgbExpr) {
-        _rgbExpr->setSize(-1, outputSize.x, outputSize.y);
+    if (exprs.rgb) {
+        (void)exprs.rgb->evaluate();
     }
-    if (_alphaExpr) {
-        _alphaExpr->setSize(-1, outputSize.x, outputSize.y);
+    if (exprs.alpha) {
+        (void)exprs.alpha->evaluate();
     }
-    //assert(_alphaExpr || _rgbExpr); // both may be empty!
-    _mix = mix;
 }
 
 bool
 SeExprProcessorBase::isExprOk(string* error)
 {
-    if ( _rExpr && !_rExpr->isValid() ) {
-        *error = _rExpr->parseError();
-
-        return false;
-    }
-    if ( _gExpr && !_gExpr->isValid() ) {
-        *error = _gExpr->parseError();
+    assert( !_exprs.empty() );
+    const OFXSeExpressions& exprs = _exprs[0];
+    OFXSeExpression* all[5] = { exprs.r, exprs.g, exprs.b, exprs.rgb, exprs.alpha };
+    for (int e = 0; e < 5; ++e) {
+        if ( all[e] && !all[e]->isValid() ) {
+            *error = all[e]->parseError();
 
-        return false;
-    }
-    if ( _bExpr && !_bExpr->isValid() ) {
-        *error = _bExpr->parseError();
-
-        return false;
-    }
-    if ( _rgbExpr && !_rgbExpr->isValid() ) {
-        *error = _rgbExpr->parseError();
-
-        return false;
+            return false;
+        }
     }
-    if ( _alphaExpr && !_alphaExpr->isValid() ) {
-        *error = _alphaExpr->parseError();
 
-        return false;
-    }
-
-    //Run the expression once to initialize all the images fields before multi-threading
-    if (_rExpr) {
-        (void)_rExpr->evaluate();
-    }
-    if (_gExpr) {
-        (void)_gExpr->evaluate();
-    }
-    if (_bExpr) {
-        (void)_bExpr->evaluate();
-    }
-    if (_rgbExpr) {
-        (void)_rgbExpr->evaluate();
-    }
-    if (_alphaExpr) {
-        (void)_alphaExpr->evaluate();
-    }
+    initExprs(exprs);
 
     //Ensure the image of the input 0 at the current time exists for the mix
 
     for (int i = 0; i < kSourceClipCount; ++i) {
-        prefetchImage(i, _renderTime);
-        _srcCurTime[i] = getImage(i, _renderTime);
+        _srcCurTime[i] = fetchImage(i, _renderTime);
         _nSrcComponents[i] = _srcCurTime[i] ? _srcCurTime[i]->getPixelComponentCount() : 0;
     }
 
     return true;
 } // SeExprProcessorBase::isExprOk
 
+void
+SeExprProcessorBase::process(const OfxRectI& renderWindow)
+{
+    if ( (renderWindow.x2 <= renderWindow.x1) || (renderWindow.y2 <= renderWindow.y1) ) {
+        return;
+    }
+    _renderWindow = renderWindow;
+    // evaluating the expressions costs much more than the rest: one row per thread is enough
+    unsigned int nThreads = std::max( 1u, std::min( (unsigned int)(renderWindow.y2 - renderWindow.y1), MultiThread::getNumCPUs() ) );
+    // the other threads get their own copy of the expressions, initialized in this thread like the first one.
+    // rand() is a hash of the pixel, so each pixel gets the same result whichever thread computes it
+    while (_exprs.size() < nThreads) {
+        _exprs.push_back( OFXSeExpressions() );
+        createExprs( &_exprs.back() );
+        initExprs(_exprs.back());
+    }
+    multiThread(nThreads);
+}
+
+void
+SeExprProcessorBase::multiThreadFunction(unsigned int threadID,
+                                         unsigned int nThreads)
+{
+    const int rows = _renderWindow.y2 - _renderWindow.y1;
+    OfxRectI procWindow;
+
+    procWindow.x1 = _renderWindow.x1;
+    procWindow.x2 = _renderWindow.x2;
+    procWindow.y1 = _renderWindow.y1 + (int)( (double)rows * threadID / nThreads );
+    procWindow.y2 = _renderWindow.y1 + (int)( (double)rows * (threadID + 1) / nThreads );
+    processRows(procWindow, _exprs[threadID]);
+}
+
 // template to do the RGBA processing
 template <class PIX, int nComponents, int maxValue>
 class SeExprProcessor
@@ -1717,11 +1929,12 @@ public:
 
 private:
     // and do some processing
-    virtual void process(OfxRectI procWindow) OVERRIDE FINAL
+    virtual void processRows(const OfxRectI& procWindow,
+                             const OFXSeExpressions& exprs) OVERRIDE FINAL
     {
-        assert( (nComponents == 4 /*&& _rgbExpr && _alphaExpr*/) ||
-                (nComponents == 3 /*&& _rgbExpr && !_alphaExpr*/) ||
-                (nComponents == 1 /*&& !_rgbExpr && _alphaExpr*/) );
+        assert( (nComponents == 4 /*&& exprs.rgb && exprs.alpha*/) ||
+                (nComponents == 3 /*&& exprs.rgb && !exprs.alpha*/) ||
+                (nComponents == 1 /*&& !exprs.rgb && exprs.alpha*/) );
 
 
         float tmpPix[4];
@@ -1735,6 +1948,7 @@ private:
             PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
 
             for (int x = procWindow.x1; x < procWindow.x2; ++x) {
+                exprs.data->setPixel(x, y);
                 for (int i = kSourceClipCount - 1; i  >= 0; --i) {
                     const PIX* src_pixels  = _srcCurTime[i] ? (const PIX*) _srcCurTime[i]->getPixelAddress(x, y) : 0;
                     if (_nSrcComponents[i] == 4) {
@@ -1762,20 +1976,20 @@ private:
                     float g = srcPixels[i][1] / (float)maxValue;
                     float b = srcPixels[i][2] / (float)maxValue;
                     float a = srcPixels[i][3] / (float)maxValue;
-                    if (_rExpr) {
-                        _rExpr->setRGBA(i, r, g, b, a);
+                    if (exprs.r) {
+                        exprs.r->setRGBA(i, r, g, b, a);
                     }
-                    if (_gExpr) {
-                        _gExpr->setRGBA(i, r, g, b, a);
+                    if (exprs.g) {
+                        exprs.g->setRGBA(i, r, g, b, a);
                     }
-                    if (_bExpr) {
-                        _bExpr->setRGBA(i, r, g, b, a);
+                    if (exprs.b) {
+                        exprs.b->setRGBA(i, r, g, b, a);
                     }
-                    if (_rgbExpr) {
-                        _rgbExpr->setRGBA(i, r, g, b, a);
+                    if (exprs.rgb) {
+                        exprs.rgb->setRGBA(i, r, g, b, a);
                     }
-                    if (_alphaExpr) {
-                        _alphaExpr->setRGBA(i, r, g, b, a);
+                    if (exprs.alpha) {
+                        exprs.alpha->setRGBA(i, r, g, b, a);
                     }
                 }
 
@@ -1793,39 +2007,39 @@ private:
                 }
 
                 // execute the valid expressions
-                if (_rExpr) {
-                    _rExpr->setXY(x, y);
-                    SeVec3d result = _rExpr->evaluate();
+                if (exprs.r) {
+                    exprs.r->setXY(x, y);
+                    SeVec3d result = exprs.r->evaluate();
                     if (nComponents >= 3) {
                         tmpPix[0] = result[0] * maxValue;
                     }
                 }
-                if (_gExpr) {
-                    _gExpr->setXY(x, y);
-                    SeVec3d result = _gExpr->evaluate();
+                if (exprs.g) {
+                    exprs.g->setXY(x, y);
+                    SeVec3d result = exprs.g->evaluate();
                     if (nComponents >= 3) {
                         tmpPix[1] = result[0] * maxValue;
                     }
                 }
-                if (_bExpr) {
-                    _bExpr->setXY(x, y);
-                    SeVec3d result = _bExpr->evaluate();
+                if (exprs.b) {
+                    exprs.b->setXY(x, y);
+                    SeVec3d result = exprs.b->evaluate();
                     if (nComponents >= 3) {
                         tmpPix[2] = result[0] * maxValue;
                     }
                 }
-                if (_rgbExpr) {
-                    _rgbExpr->setXY(x, y);
-                    SeVec3d result = _rgbExpr->evaluate();
+                if (exprs.rgb) {
+                    exprs.rgb->setXY(x, y);
+                    SeVec3d result = exprs.rgb->evaluate();
                     if (nComponents >= 3) {
                         tmpPix[0] = result[0] * maxValue;
                         tmpPix[1] = result[1] * maxValue;
                         tmpPix[2] = result[2] * maxValue;
                     }
                 }
-                if (_alphaExpr) {
-                    _alphaExpr->setXY(x, y);
-                    SeVec3d result = _alphaExpr->evaluate();
+                if (exprs.alpha) {
+                    exprs.alpha->setXY(x, y);
+                    SeVec3d result = exprs.alpha->evaluate();
                     if (nComponents == 4) {
                         tmpPix[3] = result[0] * maxValue;
                     } else if (nComponents == 1) {
@@ -1839,7 +2053,7 @@ private:
                 dstPix += nComponents;
             }
         }
-    } // process
+    } // processRows
 };
 
 SeExprPlugin::SeExprPlugin(OfxImageEffectHandle handle,
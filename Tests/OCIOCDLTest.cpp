@@ -0,0 +1,143 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Checks that the native CDL of OCIOCDLTransform (see OCIOCDLBlockTransform.h) matches OpenColorIO::CDLTransform,
+ * forward and inverse, on RGB and RGBA pixels below 0, in [0,1] and above 1.
+ * The CDLs which cannot be inverted natively (null slope or power) must be reported as such, so that the plugin
+ * lets OpenColorIO handle them.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include <OpenColorIO/OpenColorIO.h>
+
+#include "OCIOCDLBlockTransform.h"
+
+namespace OCIO = OCIO_NAMESPACE;
+
+using namespace OFX::IO;
+
+#define kCDLTolerance 1e-5 // max difference with OCIO, relative above 1, absolute below
+#define kCDLProbeSize 4096 // number of pixels checked for each CDL
+
+struct CDLParams
+{
+    const char* name;
+    double slope[3];
+    double offset[3];
+    double power[3];
+    double saturation;
+    bool nativeInverse; // false if the inverse must be left to OCIO
+};
+
+// the max difference (relative above 1, absolute below) between the native CDL and OCIO, on pixels with numChannels
+static double
+getCDLMaxError(const CDLParams& params,
+               bool inverse,
+               int numChannels)
+{
+    const int n = kCDLProbeSize;
+    std::vector<float> pixels(n * numChannels);
+
+    for (int i = 0; i < n * numChannels; ++i) {
+        // a different value on each channel, from -0.5 to 2
+        pixels[i] = -0.5f + 2.5f * ( (i * 2654435761u) % 65536u ) / 65535.f;
+    }
+    std::vector<float> expected(pixels);
+    OCIO::CDLTransformRcPtr cdl = OCIO::CDLTransform::Create();
+    float sop[9];
+    for (int c = 0; c < 3; ++c) {
+        sop[c] = (float)params.slope[c];
+        sop[3 + c] = (float)params.offset[c];
+        sop[6 + c] = (float)params.power[c];
+    }
+    cdl->setSOP(sop);
+    cdl->setSat( (float)params.saturation );
+    cdl->setDirection(inverse ? OCIO::TRANSFORM_DIR_INVERSE : OCIO::TRANSFORM_DIR_FORWARD);
+    OCIO::ConstConfigRcPtr config = OCIO::Config::Create();
+    OCIO::ConstProcessorRcPtr proc = config->getProcessor(cdl);
+    OCIO::PackedImageDesc desc(&expected[0], n, 1, numChannels);
+    proc->apply(desc);
+
+    CDLBlockTransform(params.slope, params.offset, params.power, params.saturation, inverse).transformBlock(&pixels[0], n, numChannels);
+    double maxError = 0.;
+    for (int i = 0; i < n * numChannels; ++i) {
+        double e = std::fabs( (double)expected[i] - pixels[i] ) / std::max( 1., std::fabs( (double)expected[i] ) );
+        if ( !(e <= maxError) ) {
+            maxError = e;
+        }
+    }
+
+    return maxError;
+}
+
+int
+main(int /*argc*/,
+     char* /*argv*/[])
+{
+    const CDLParams cdls[] = {
+        { "identity", { 1., 1., 1. }, { 0., 0., 0. }, { 1., 1., 1. }, 1., true },
+        { "slope and offset", { 1.2, 0.9, 1.05 }, { 0.05, -0.02, 0.1 }, { 1., 1., 1. }, 1., true },
+        { "power", { 1., 1., 1. }, { 0., 0., 0. }, { 0.8, 1.25, 2.2 }, 1., true },
+        { "saturation", { 1., 1., 1. }, { 0., 0., 0. }, { 1., 1., 1. }, 1.4, true },
+        { "full grade", { 1.1, 0.95, 1.3 }, { -0.03, 0.02, 0.15 }, { 1.2, 0.9, 1.1 }, 0.7, true },
+        { "desaturated", { 0.8, 0.8, 0.8 }, { 0.1, 0.1, 0.1 }, { 1.5, 1.5, 1.5 }, 0., false },
+        { "zero slope", { 0., 1., 1. }, { 0.1, 0., 0. }, { 1., 1., 1. }, 1., false },
+        { "zero power", { 1., 1., 1. }, { 0., 0., 0. }, { 1., 0., 1. }, 1., false },
+    };
+    int failures = 0;
+
+    try {
+        for (std::size_t i = 0; i < sizeof(cdls) / sizeof(cdls[0]); ++i) {
+            const CDLParams& params = cdls[i];
+            for (int inverse = 0; inverse < 2; ++inverse) {
+                const char* direction = inverse ? "inverse" : "forward";
+                const CDLBlockTransform cdl(params.slope, params.offset, params.power, params.saturation, inverse != 0);
+                // the forward CDL is always evaluated natively
+                const bool expectedValid = !inverse || params.nativeInverse;
+                if (cdl.isValid() != expectedValid) {
+                    std::printf("FAILED: %s %s is %s natively\n", params.name, direction, cdl.isValid() ? "evaluated" : "not evaluated");
+                    ++failures;
+                    continue;
+                }
+                if ( !cdl.isValid() ) {
+                    std::printf("%s %s: left to OpenColorIO\n", params.name, direction);
+                    continue;
+                }
+                for (int numChannels = 3; numChannels <= 4; ++numChannels) {
+                    double maxError = getCDLMaxError(params, inverse != 0, numChannels);
+                    if ( !(maxError <= kCDLTolerance) ) {
+                        std::printf("FAILED: ");
+                        ++failures;
+                    }
+                    std::printf("%s %s %s: max error %g with OpenColorIO\n", params.name, direction, numChannels == 4 ? "RGBA" : "RGB", maxError);
+                }
+            }
+        }
+    } catch (const OCIO::Exception &e) {
+        std::printf( "FAILED: OpenColorIO error: %s\n", e.what() );
+
+        return 1;
+    }
+
+    return failures ? 1 : 0;
+} // main
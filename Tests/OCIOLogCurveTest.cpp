@@ -0,0 +1,185 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Checks that the analytic curves of OCIOLogConvert (see OCIOLogCurve.h) match OpenColorIO, and reports their
+ * throughput. Each curve is written to a 1D LUT file computed in double precision, as configs usually implement it,
+ * and the processors built from that LUT (forward for log to lin, inverse for lin to log) must be recognized by
+ * detectLogCurve().
+ * The native curves are also compared with the exact formulas, without the LUT.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "OCIOLogCurve.h"
+
+namespace OCIO = OCIO_NAMESPACE;
+
+using namespace OFX::IO;
+
+#define kLutSize 4096 // size of the LUT files, as in most configs
+#define kExactTolerance 1e-5 // max difference between the native curves and the exact formulas, on the log range [0,1]
+
+// the log to lin curves, from their specifications
+static double
+exactToLin(LogCurveEnum curve,
+           double x)
+{
+    const double acesLogMax = ( std::log(65504.) / std::log(2.) + 9.72 ) / 17.52;
+
+    switch (curve) {
+    case eLogCurveCineon: {
+        const double black = std::pow(10., (95. - 685.) / 300.);
+
+        return ( std::pow(10., (x * 1023. - 685.) / 300.) - black ) / (1. - black);
+    }
+    case eLogCurveACEScct:
+        if (x <= 0.155251141552511) {
+            return (x - 0.0729055341958355) / 10.5402377416545;
+        }
+
+        return (x < acesLogMax) ? std::pow(2., x * 17.52 - 9.72) : 65504.;
+    case eLogCurveACEScc:
+        if ( x < (9.72 - 15.) / 17.52 ) {
+            return ( std::pow(2., x * 17.52 - 9.72) - std::pow(2., -16.) ) * 2.;
+        }
+
+        return (x < acesLogMax) ? std::pow(2., x * 17.52 - 9.72) : 65504.;
+    case eLogCurveLogC:
+        if (x > 5.367655 * 0.010591 + 0.092809) {
+            return ( std::pow(10., (x - 0.385537) / 0.247190) - 0.052272 ) / 5.555556;
+        }
+
+        return (x - 0.092809) / 5.367655;
+    case eLogCurveNone:
+        break;
+    }
+
+    return x;
+}
+
+// the max difference (relative above 1, absolute below) between the native curve and the exact one on [0,1]
+static double
+getExactMaxError(LogCurveEnum curve,
+                 bool toLin)
+{
+    const int n = kLogCurveProbeSize;
+    std::vector<float> log(n), lin(n);
+
+    for (int i = 0; i < n; ++i) {
+        log[i] = (i + 0.5f) / n;
+        lin[i] = (float)exactToLin(curve, log[i]);
+    }
+    std::vector<float> values(toLin ? log : lin);
+    LogCurveBlockTransform(curve, toLin).transformBlock(&values[0], n, 1);
+    const std::vector<float>& exact = toLin ? lin : log;
+    double maxError = 0.;
+    for (int i = 0; i < n; ++i) {
+        double e = std::fabs( (double)exact[i] - values[i] ) / std::max( 1., std::fabs( (double)exact[i] ) );
+        if ( !(e <= maxError) ) {
+            maxError = e;
+        }
+    }
+
+    return maxError;
+}
+
+// writes the log to lin curve as a .spi1d LUT over [0,1]
+static bool
+writeLut(LogCurveEnum curve,
+         const std::string& filename)
+{
+    std::FILE* file = std::fopen(filename.c_str(), "w");
+
+    if (!file) {
+        return false;
+    }
+    std::fprintf(file, "Version 1\nFrom 0.0 1.0\nLength %d\nComponents 1\n{\n", kLutSize);
+    for (int i = 0; i < kLutSize; ++i) {
+        std::fprintf( file, "    %.9g\n", exactToLin( curve, (double)i / (kLutSize - 1) ) );
+    }
+    std::fprintf(file, "}\n");
+
+    return std::fclose(file) == 0;
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+    const LogCurveEnum curves[] = { eLogCurveCineon, eLogCurveACEScct, eLogCurveACEScc, eLogCurveLogC };
+    const std::string dir = (argc > 1) ? argv[1] : ".";
+    int failures = 0;
+
+    try {
+        OCIO::ConstConfigRcPtr config = OCIO::Config::Create();
+        for (std::size_t c = 0; c < sizeof(curves) / sizeof(curves[0]); ++c) {
+            // OCIO caches the files it read by name
+            char lutName[64];
+            std::sprintf(lutName, "/OCIOLogCurveTest%d.spi1d", (int)c);
+            const std::string lutFile = dir + lutName;
+            if ( !writeLut(curves[c], lutFile) ) {
+                std::printf("cannot write %s\n", lutFile.c_str());
+
+                return 1;
+            }
+            for (int toLin = 0; toLin < 2; ++toLin) {
+                const LogCurveBlockTransform expected(curves[c], toLin != 0);
+                const char* name = expected.getCurveName();
+                const char* direction = toLin ? "log2lin" : "lin2log";
+
+                double exactError = getExactMaxError(curves[c], toLin != 0);
+                if ( !(exactError <= kExactTolerance) ) {
+                    std::printf("FAILED: %s %s differs from the exact curve by %g\n", name, direction, exactError);
+                    ++failures;
+                }
+
+                OCIO::FileTransformRcPtr transform = OCIO::FileTransform::Create();
+                transform->setSrc( lutFile.c_str() );
+                transform->setInterpolation(OCIO::INTERP_LINEAR);
+                transform->setDirection(toLin ? OCIO::TRANSFORM_DIR_FORWARD : OCIO::TRANSFORM_DIR_INVERSE);
+                OCIO::ConstProcessorRcPtr proc = config->getProcessor(transform);
+                // the LUT clamps its input
+                const LogCurveBlockTransform curve = detectLogCurve(proc, toLin != 0);
+                if ( (curve.getCurve() != curves[c]) || !curve.isClamped() ) {
+                    std::printf( "FAILED: %s %s was detected as %s%s (max error %g with the clamped curve)\n", name, direction,
+                                 curve.getCurveName(), curve.isClamped() ? " (clamped)" : "",
+                                 getLogCurveMaxError( proc, LogCurveBlockTransform(curves[c], toLin != 0, true) ) );
+                    ++failures;
+                    continue;
+                }
+                double ocioThroughput;
+                double curveThroughput;
+                benchmarkLogCurve(proc, curve, &ocioThroughput, &curveThroughput);
+                std::printf("%s %s: max error %g with OpenColorIO, %g with the exact curve, %.1f Mpixel/s (OpenColorIO: %.1f Mpixel/s)\n",
+                            name, direction, getLogCurveMaxError(proc, curve), exactError, curveThroughput, ocioThroughput);
+            }
+            std::remove( lutFile.c_str() );
+        }
+    } catch (const OCIO::Exception &e) {
+        std::printf( "FAILED: OpenColorIO error: %s\n", e.what() );
+
+        return 1;
+    }
+
+    return failures ? 1 : 0;
+} // main
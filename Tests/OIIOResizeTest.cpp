@@ -0,0 +1,317 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Compares the separable resize of OIIOResize (see OIIOResizeSeparable.h) with ImageBufAlgo::resize, which it
+ * replaces for separable filters, and reports the time taken by each, on one thread.
+ * Every separable OIIO filter is checked on reductions, enlargements, a source image smaller than its format
+ * and a render window smaller than the destination format, with 8-bit and float RGBA images.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+   unfortunately, OpenImageIO/imagebuf.h includes OpenImageIO/thread.h,
+   which includes boost/thread.hpp,
+   which includes boost/system/error_code.hpp,
+   which requires the library boost_system to get the symbol boost::system::system_category().
+
+   the following define prevents including error_code.hpp, which is not used anyway.
+ */
+#define OPENIMAGEIO_THREAD_H
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imagebufalgo.h>
+#include <OpenImageIO/filter.h>
+#include <OpenImageIO/timer.h>
+
+#include "OIIOResizeSeparable.h"
+
+OIIO_NAMESPACE_USING
+
+using namespace OFX::IO;
+
+#define kFloatTolerance 1e-4 // max difference with OIIO for float images
+#define kByteTolerance 1 // max difference with OIIO for 8-bit images, which may be rounded differently
+
+struct Rect
+{
+    int x1, y1, x2, y2;
+
+    Rect(int x1_,
+         int y1_,
+         int x2_,
+         int y2_)
+        : x1(x1_), y1(y1_), x2(x2_), y2(y2_)
+    {
+    }
+
+    int width() const { return x2 - x1; }
+
+    int height() const { return y2 - y1; }
+};
+
+template <class PIX>
+TypeDesc pixelType();
+
+template <>
+TypeDesc
+pixelType<float>()
+{
+    return TypeDesc::FLOAT;
+}
+
+template <>
+TypeDesc
+pixelType<unsigned char>()
+{
+    return TypeDesc::UINT8;
+}
+
+template <class PIX>
+PIX randomValue(unsigned int* seed);
+
+template <>
+float
+randomValue<float>(unsigned int* seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+
+    return (*seed >> 8) / 16777216.f;
+}
+
+template <>
+unsigned char
+randomValue<unsigned char>(unsigned int* seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+
+    return (unsigned char)(*seed >> 24);
+}
+
+// the first pass, as ResizeHorizontalProcessor does it, on one thread
+template <class PIX, int nComps>
+class HorizontalPass
+{
+public:
+    HorizontalPass(const PIX* src,
+                   const Rect& srcBounds,
+                   const Rect& srcFormat,
+                   const ResizeAxisWeights& xWeights,
+                   float* tmp,
+                   int tmpX1,
+                   int tmpX2,
+                   int tmpY1,
+                   int tmpY2)
+        : _src(src), _srcBounds(srcBounds), _srcFormat(srcFormat), _xWeights(xWeights)
+        , _tmp(tmp), _tmpX1(tmpX1), _tmpX2(tmpX2), _tmpY1(tmpY1), _tmpY2(tmpY2)
+    {
+    }
+
+    template <int TAPS>
+    void run() const
+    {
+        const std::size_t tmpRowSize = (std::size_t)(_tmpX2 - _tmpX1) * nComps;
+
+        for (int y = _tmpY1; y < _tmpY2; ++y) {
+            float* tmpPix = _tmp + (y - _tmpY1) * tmpRowSize;
+            if ( (y < _srcBounds.y1) || (_srcBounds.y2 <= y) ) {
+                std::fill(tmpPix, tmpPix + tmpRowSize, 0.f);
+                continue;
+            }
+            const PIX* srcRow = _src + (std::size_t)(y - _srcBounds.y1) * _srcBounds.width() * nComps;
+            resizeRowHorizontal<PIX, nComps, TAPS>(srcRow, _srcBounds.x1, _srcBounds.x2, _srcFormat.x1, _srcFormat.x2, _xWeights, _tmpX1, _tmpX2, tmpPix);
+        }
+    }
+
+private:
+    const PIX* _src;
+    const Rect _srcBounds;
+    const Rect _srcFormat;
+    const ResizeAxisWeights& _xWeights;
+    float* _tmp;
+    const int _tmpX1;
+    const int _tmpX2;
+    const int _tmpY1;
+    const int _tmpY2;
+};
+
+// the second pass, as ResizeVerticalProcessor does it, on one thread
+template <class PIX, int nComps>
+class VerticalPass
+{
+public:
+    VerticalPass(PIX* dst,
+                 const Rect& window,
+                 const Rect& srcFormat,
+                 const ResizeAxisWeights& yWeights,
+                 const float* tmp,
+                 int tmpY1,
+                 int tmpY2)
+        : _dst(dst), _window(window), _srcFormat(srcFormat), _yWeights(yWeights), _tmp(tmp), _tmpY1(tmpY1), _tmpY2(tmpY2)
+    {
+    }
+
+    template <int TAPS>
+    void run() const
+    {
+        const std::size_t tmpRowSize = (std::size_t)_window.width() * nComps;
+        std::vector<float> acc(tmpRowSize);
+
+        for (int y = _window.y1; y < _window.y2; ++y) {
+            PIX* dstPix = _dst + (y - _window.y1) * tmpRowSize;
+            resizeRowVertical<PIX, nComps, TAPS>(_yWeights, y, _tmp, tmpRowSize, _tmpY1, _tmpY2, _srcFormat.y1, _srcFormat.y2, &acc[0], dstPix);
+        }
+    }
+
+private:
+    PIX* _dst;
+    const Rect _window;
+    const Rect _srcFormat;
+    const ResizeAxisWeights& _yWeights;
+    const float* _tmp;
+    const int _tmpY1;
+    const int _tmpY2;
+};
+
+// Resizes srcFormat to dstFormat over window, with the source image covering srcBounds, and compares with OIIO.
+// Returns false if the difference is above the tolerance.
+template <class PIX, int nComps>
+static bool
+compareResize(const FilterDesc& fd,
+              const Rect& srcFormat,
+              const Rect& srcBounds,
+              const Rect& dstFormat,
+              const Rect& window,
+              double tolerance)
+{
+    std::vector<PIX> src( (std::size_t)srcBounds.width() * srcBounds.height() * nComps );
+    unsigned int seed = 1;
+
+    for (std::size_t i = 0; i < src.size(); ++i) {
+        src[i] = randomValue<PIX>(&seed);
+    }
+
+    // the filter width, as OIIOResizePlugin::getResizeFilter() computes it
+    const float wratio = float( dstFormat.width() ) / float( srcFormat.width() );
+    const float hratio = float( dstFormat.height() ) / float( srcFormat.height() );
+    const float fw = fd.width * std::max(1.0f, wratio);
+    const float fh = fd.width * std::max(1.0f, hratio);
+
+    Filter1D* xFilter = Filter1D::create(fd.name, fw);
+    Filter1D* yFilter = Filter1D::create(fd.name, fh);
+    if (!xFilter || !yFilter) {
+        // not separable: OIIOResize uses OIIO
+        Filter1D::destroy(xFilter);
+        Filter1D::destroy(yFilter);
+
+        return true;
+    }
+    Timer separableTimer;
+    ResizeAxisWeights xWeights, yWeights;
+    computeResizeAxisWeights(*xFilter, srcFormat.x1, srcFormat.width(), dstFormat.x1, dstFormat.width(), &xWeights);
+    computeResizeAxisWeights(*yFilter, srcFormat.y1, srcFormat.height(), dstFormat.y1, dstFormat.height(), &yWeights);
+    Filter1D::destroy(xFilter);
+    Filter1D::destroy(yFilter);
+    int tmpY1, tmpY2;
+    getResizeSourceRows(yWeights, window.y1, window.y2, srcFormat.y1, srcFormat.y2, srcBounds.y1, srcBounds.y2, &tmpY1, &tmpY2);
+    std::vector<float> tmp( (std::size_t)window.width() * (tmpY2 - tmpY1) * nComps + 1 );
+    std::vector<PIX> dst( (std::size_t)window.width() * window.height() * nComps );
+    dispatchResizeTaps( xWeights, HorizontalPass<PIX, nComps>(&src[0], srcBounds, srcFormat, xWeights, &tmp[0], window.x1, window.x2, tmpY1, tmpY2) );
+    dispatchResizeTaps( yWeights, VerticalPass<PIX, nComps>(&dst[0], window, srcFormat, yWeights, &tmp[0], tmpY1, tmpY2) );
+    const double separableTime = separableTimer();
+
+    // the same ImageBufs as OIIOResizePlugin::renderInternal()
+    ImageSpec srcSpec(srcBounds.width(), srcBounds.height(), nComps, pixelType<PIX>());
+    srcSpec.x = srcBounds.x1;
+    srcSpec.y = srcBounds.y1;
+    srcSpec.full_x = srcFormat.x1;
+    srcSpec.full_y = srcFormat.y1;
+    srcSpec.full_width = srcFormat.width();
+    srcSpec.full_height = srcFormat.height();
+    const ImageBuf srcBuf( "src", srcSpec, &src[0] );
+    ImageSpec refSpec(window.width(), window.height(), nComps, pixelType<PIX>());
+    refSpec.x = window.x1;
+    refSpec.y = window.y1;
+    refSpec.full_x = dstFormat.x1;
+    refSpec.full_y = dstFormat.y1;
+    refSpec.full_width = dstFormat.width();
+    refSpec.full_height = dstFormat.height();
+    ImageBuf refBuf(refSpec);
+    ROI roi(window.x1, window.x2, window.y1, window.y2, 0, 1, 0, nComps);
+    Filter2D* filter = Filter2D::create(fd.name, fw, fh);
+    Timer oiioTimer;
+    const bool ok = ImageBufAlgo::resize(refBuf, srcBuf, filter, roi, 1);
+    const double oiioTime = oiioTimer();
+    Filter2D::destroy(filter);
+    if (!ok) {
+        std::printf( "FAILED: %s: %s\n", fd.name, refBuf.geterror().c_str() );
+
+        return false;
+    }
+
+    double maxDiff = 0.;
+    for (int y = window.y1; y < window.y2; ++y) {
+        const PIX* dstPix = &dst[(std::size_t)(y - window.y1) * window.width() * nComps];
+        for (int x = window.x1; x < window.x2; ++x, dstPix += nComps) {
+            const PIX* refPix = (const PIX*)refBuf.pixeladdr(x, y);
+            for (int c = 0; c < nComps; ++c) {
+                maxDiff = std::max( maxDiff, std::fabs( (double)dstPix[c] - (double)refPix[c] ) );
+            }
+        }
+    }
+    const bool passed = (maxDiff <= tolerance);
+    std::printf("%s%s %s %dx%d (image %dx%d) -> %dx%d (window %dx%d): max difference %g, separable %.2f ms, OIIO %.2f ms\n",
+                passed ? "" : "FAILED: ", fd.name, pixelType<PIX>().c_str(), srcFormat.width(), srcFormat.height(), srcBounds.width(), srcBounds.height(),
+                dstFormat.width(), dstFormat.height(), window.width(), window.height(), maxDiff, separableTime * 1000., oiioTime * 1000.);
+
+    return passed;
+} // compareResize
+
+int
+main(int /*argc*/,
+     char* /*argv*/[])
+{
+    const Rect hd(0, 0, 1920, 1080);
+    // reductions, an enlargement, a source image which only covers part of its format (as the region of interest
+    // of a tile) and a render window which is a tile of the destination
+    const Rect srcFormats[] = { hd, hd, hd, Rect(0, 0, 960, 540), hd, hd };
+    const Rect srcBounds[] = { hd, hd, hd, Rect(0, 0, 960, 540), Rect(100, 50, 1000, 700), hd };
+    const Rect dstFormats[] = { Rect(0, 0, 960, 540), Rect(0, 0, 480, 270), Rect(0, 0, 1280, 720), hd, Rect(0, 0, 960, 540), Rect(0, 0, 1280, 720) };
+    const Rect windows[] = { Rect(0, 0, 960, 540), Rect(0, 0, 480, 270), Rect(0, 0, 1280, 720), hd, Rect(0, 0, 960, 540), Rect(256, 128, 512, 384) };
+    const int nCases = (int)( sizeof(srcFormats) / sizeof(srcFormats[0]) );
+    int failures = 0;
+
+    for (int f = 0; f < Filter2D::num_filters(); ++f) {
+        FilterDesc fd;
+        Filter2D::get_filterdesc(f, &fd);
+        for (int i = 0; i < nCases; ++i) {
+            if ( !compareResize<unsigned char, 4>(fd, srcFormats[i], srcBounds[i], dstFormats[i], windows[i], kByteTolerance) ) {
+                ++failures;
+            }
+            if ( !compareResize<float, 4>(fd, srcFormats[i], srcBounds[i], dstFormats[i], windows[i], kFloatTolerance) ) {
+                ++failures;
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/MrKepzie/openfx-io>,
+ * Copyright (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Checks the writing by strips of WriteOIIO (see WriteOIIOStrips.h) when only some channels of the input are written:
+ * GenericWriter packs them at the start of each pixel before giving each strip to the writer.
+ * Each strip is written from top to bottom, as GenericWriter does, to scan-line and tiled EXR files, which are read back.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <OpenImageIO/imageio.h>
+
+#include "WriteOIIOStrips.h"
+
+OIIO_NAMESPACE_USING
+
+using namespace OFX::IO;
+
+#define kSrcNComps 4 // RGBA input
+#define kImageWidth 77
+#define kImageHeight 100 // not a multiple of the strip height: the last strip is smaller
+#define kStripHeight 32 // a multiple of the EXR zip block height and of the tile height
+
+// the value of channel c of the input pixel (x,y), in OFX coordinates
+static float
+srcValue(int x,
+         int y,
+         int c)
+{
+    return c * 1000.f + y * 10.f + x * 0.01f;
+}
+
+// writes the channels [startIndex,startIndex+nComps) of the input by strips, and checks the file
+static bool
+checkStripWrite(int startIndex,
+                int nComps,
+                int tileSize,
+                const std::string& filename)
+{
+    const int y1 = 20; // OFX bounds, bottom to top
+    const int y2 = y1 + kImageHeight;
+    ImageSpec spec(kImageWidth, kImageHeight, nComps, TypeDesc::FLOAT);
+
+    spec.attribute("compression", "zip");
+    if (tileSize > 0) {
+        spec.tile_width = tileSize;
+        spec.tile_height = tileSize;
+    }
+    ImageOutput* output = ImageOutput::create(filename);
+    if (!output) {
+        std::printf( "FAILED: cannot create a writer for %s\n", filename.c_str() );
+
+        return false;
+    }
+    bool ok = output->open(filename, spec);
+    for (int s2 = y2; ok && s2 > y1; s2 -= kStripHeight) {
+        const int s1 = std::max(y1, s2 - kStripHeight);
+        // the strip, packed as fetchPlaneConvertAndCopy() gives it
+        std::vector<float> strip( (std::size_t)(s2 - s1) * kImageWidth * nComps );
+        for (int y = s1; y < s2; ++y) {
+            float* pix = &strip[(std::size_t)(y - s1) * kImageWidth * nComps];
+            for (int x = 0; x < kImageWidth; ++x, pix += nComps) {
+                for (int c = 0; c < nComps; ++c) {
+                    pix[c] = srcValue(x, y, startIndex + c);
+                }
+            }
+        }
+        ok = writeStrip(output, spec, y2, s1, s2, &strip[0], nComps, (int)(kImageWidth * nComps * sizeof(float) ) );
+    }
+    if (!ok) {
+        std::printf( "FAILED: cannot write %s: %s\n", filename.c_str(), output->geterror().c_str() );
+    }
+    output->close();
+    ImageOutput::destroy(output);
+    if (!ok) {
+        return false;
+    }
+
+    ImageInput* input = ImageInput::open(filename);
+    if (!input) {
+        std::printf( "FAILED: cannot read %s\n", filename.c_str() );
+
+        return false;
+    }
+    std::vector<float> pixels( (std::size_t)kImageWidth * kImageHeight * nComps );
+    ok = input->read_image(TypeDesc::FLOAT, &pixels[0]);
+    input->close();
+    ImageInput::destroy(input);
+    std::remove( filename.c_str() );
+    if (!ok) {
+        std::printf( "FAILED: cannot read %s\n", filename.c_str() );
+
+        return false;
+    }
+    int errors = 0;
+    for (int row = 0; row < kImageHeight; ++row) {
+        // the file rows go from top to bottom
+        const int y = y2 - 1 - row;
+        for (int x = 0; x < kImageWidth; ++x) {
+            for (int c = 0; c < nComps; ++c) {
+                const float expected = srcValue(x, y, startIndex + c);
+                const float value = pixels[( (std::size_t)row * kImageWidth + x ) * nComps + c];
+                if ( (value != expected) && (errors++ == 0) ) {
+                    std::printf("FAILED: channels [%d,%d) %s: pixel (%d,%d) channel %d is %g instead of %g\n", startIndex, startIndex + nComps,
+                                tileSize > 0 ? "tiled" : "scan-lines", x, y, c, value, expected);
+                }
+            }
+        }
+    }
+    if (errors == 0) {
+        std::printf("channels [%d,%d) %s: ok\n", startIndex, startIndex + nComps, tileSize > 0 ? "tiled" : "scan-lines");
+    }
+
+    return errors == 0;
+} // checkStripWrite
+
+int
+main(int argc,
+     char* argv[])
+{
+    const std::string dir = (argc > 1) ? argv[1] : ".";
+    // all channels, a leading subset and non-leading subsets
+    const int startIndices[] = { 0, 0, 1, 3, 2 };
+    const int nComps[] = { kSrcNComps, 3, 3, 1, 2 };
+    int failures = 0;
+
+    for (std::size_t i = 0; i < sizeof(startIndices) / sizeof(startIndices[0]); ++i) {
+        for (int tiled = 0; tiled < 2; ++tiled) {
+            if ( !checkStripWrite(startIndices[i], nComps[i], tiled ? kStripHeight : 0, dir + "/WriteOIIOStripTest.exr") ) {
+                ++failures;
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}